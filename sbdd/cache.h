@@ -0,0 +1,105 @@
+#ifndef _SBDD_CACHE_H_
+#define _SBDD_CACHE_H_
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
+#include <linux/spinlock_types.h>
+
+#include <io.h>
+
+#define SBDD_CACHE_FMODE            (FMODE_READ | FMODE_WRITE)
+/* Cache blocks are pages, the array logical block is a page too with a cache */
+#define SBDD_CACHE_BLOCK_SHIFT      (PAGE_SHIFT - SECTOR_SHIFT)
+/* Data blocks of a log record, one header block is written in front of them */
+#define SBDD_CACHE_REC_BLOCKS       64
+/* Blocks destaged to the array at once */
+#define SBDD_CACHE_DESTAGE_BLOCKS   256
+/* Cache block 0 is the superblock, the log follows */
+#define SBDD_CACHE_LOG_START        1
+
+struct sbdd_cache_rec;
+
+/* Array block held in the cache, entries of a record are its data blocks in order */
+struct sbdd_cache_entry {
+    struct rb_node          node;
+    u64                     block;
+    struct sbdd_cache_rec*  rec;
+};
+
+/* Log record in memory, freed once it is at the log tail with no live entries */
+struct sbdd_cache_rec {
+    struct list_head        list;
+    /* cache block of the header */
+    u64                     pos;
+    u64                     seq;
+    u32                     count;
+    /* entries in the index, under the cache lock */
+    u32                     live;
+    /* readers and destage of its blocks, the record write itself */
+    atomic_t                pins;
+    /* header and data writes in flight */
+    atomic_t                pending;
+    blk_status_t            status;
+    struct sbdd_cache_entry entries[];
+};
+
+struct sbdd_cache {
+    void*                   ctx;
+    char*                   path;
+    struct block_device*    bdev;
+    /* target the cache is in front of */
+    process_bio_t           process_bio;
+    struct bio_set          bio_set;
+    sector_t                capacity;
+    u64                     nr_blocks;
+    u64                     epoch;
+    u64                     next_seq;
+    /* index, records list, head and tail */
+    spinlock_t              lock;
+    struct rb_root          index;
+    u64                     cached;
+    /* records oldest first */
+    struct list_head        recs;
+    /* next record goes at head, tail is the one in the superblock */
+    u64                     head;
+    u64                     tail;
+    /* record reservation, held by flushes to drain the log */
+    struct mutex            log_lock;
+    wait_queue_head_t       space_wait;
+    atomic_t                writing;
+    atomic_t                unflushed;
+    /* writes past the cache completed on the array since its last flush */
+    atomic_t                array_unflushed;
+    unsigned long           last_write;
+    /* destage batch, invalidations of ranges wait for it */
+    struct mutex            destage_lock;
+    u64                     sweep;
+    struct sbdd_cache_entry** batch;
+    struct page**           pages;
+    struct task_struct*     destager;
+    wait_queue_head_t       destage_wait;
+};
+
+/* Takes wb_cache=PATH out of the raid config, *path is NULL without it */
+int sbdd_cache_parse_config(char* cfg, char** path);
+
+/* The cache owns path from here on */
+int sbdd_cache_create(struct sbdd_cache* cache, char* path, process_bio_t process_bio, sector_t capacity, void* ctx);
+/* Destaging needs the array disk, it is started once the disk is added */
+int sbdd_cache_start(struct sbdd_cache* cache);
+void sbdd_cache_destroy(struct sbdd_cache* cache);
+
+static inline bool sbdd_cache_is_enabled(struct sbdd_cache* cache)
+{
+	return cache->bdev != NULL;
+}
+
+blk_qc_t sbdd_cache_process_bio(struct bio* bio);
+bool sbdd_cache_bio_may_block(struct bio* bio);
+
+#endif
@@ -1,6 +1,6 @@
 #include <sbdd.h>
 
 
-int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops);
+int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops, unsigned int nr_hw_queues, unsigned int queue_depth);
 
 void sbdd_free_disk(struct sbdd* device);
\ No newline at end of file
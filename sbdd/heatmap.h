@@ -0,0 +1,73 @@
+#ifndef _SBDD_HEATMAP_H_
+#define _SBDD_HEATMAP_H_
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+
+/* Upper bound of regions, keeps the map at 4 MiB whatever the array size is */
+#define SBDD_HEATMAP_MAX_REGIONS    (1 << 18)
+/* Score halves every decay period */
+#define SBDD_HEATMAP_DECAY_SECS     10
+/* One of this many data bios is recorded */
+#define SBDD_HEATMAP_SAMPLE_DEFAULT 64
+
+#define SBDD_HEATMAP_MAGIC          0x4d484253 /* "SBHM" */
+#define SBDD_HEATMAP_VERSION        1
+
+struct sbdd_heatmap_region {
+	u32 reads;
+	u32 writes;
+	u32 score;
+	/* decay period the score was last brought up to date in */
+	u32 epoch;
+};
+
+/* Header of the binary snapshot, followed by regions_count regions */
+struct sbdd_heatmap_header {
+	u32 magic;
+	u32 version;
+	u64 region_sectors;
+	u32 regions_count;
+	u32 sample_rate;
+};
+
+struct sbdd_heatmap {
+	struct sbdd_heatmap_region*     regions;
+	u32                             regions_count;
+	u32                             region_shift;
+	/* one of (sample_mask + 1) bios is recorded */
+	u32                             sample_mask;
+	unsigned int __percpu*          sample_cnt;
+	unsigned long                   start;
+	struct dentry*                  dir;
+};
+
+int sbdd_heatmap_init(void);
+void sbdd_heatmap_exit(void);
+
+/* region_mb of 0 leaves the heatmap disabled */
+int sbdd_heatmap_create(struct sbdd_heatmap* heatmap, sector_t capacity, u32 region_mb, u32 sample_rate);
+void sbdd_heatmap_destroy(struct sbdd_heatmap* heatmap);
+
+int sbdd_heatmap_register(struct sbdd_heatmap* heatmap, const char* name);
+void sbdd_heatmap_unregister(struct sbdd_heatmap* heatmap);
+
+void __sbdd_heatmap_record(struct sbdd_heatmap* heatmap, struct bio* bio, sector_t sector);
+
+/* Called by the targets as they remap a bio, sector is its array sector */
+static inline void sbdd_heatmap_record(struct sbdd_heatmap* heatmap, struct bio* bio, sector_t sector)
+{
+	/* Flushes and other dataless bios carry no location */
+	if (!heatmap->regions || !bio_has_data(bio))
+		return;
+
+	if (this_cpu_inc_return(*heatmap->sample_cnt) & READ_ONCE(heatmap->sample_mask))
+		return;
+
+	__sbdd_heatmap_record(heatmap, bio, sector);
+}
+
+#endif
@@ -10,21 +10,85 @@
 #include <linux/list.h>
 #include <linux/spinlock_types.h>
 #include <linux/blk-mq.h>
+#include <linux/cpuhotplug.h>
+#include <linux/jump_label.h>
 
 typedef blk_qc_t (*process_bio_t) (struct bio *bio);
+/* Tells whether processing of the bio may sleep, such bios are never dispatched inline */
+typedef bool (*bio_may_block_t) (struct bio *bio);
+
+enum sbdd_io_workers_mode {
+	SBDD_IO_WORKERS_PER_CPU		= 0,
+	SBDD_IO_WORKERS_PER_NODE	= 1,
+	SBDD_IO_WORKERS_MODE_LAST
+};
+
+enum sbdd_io_dispatch_mode {
+	/* bios are queued to the io workers */
+	SBDD_IO_DISPATCH_DEFERRED	= 0,
+	/* bios are remapped and submitted in the submit_bio context */
+	SBDD_IO_DISPATCH_INLINE		= 1,
+	SBDD_IO_DISPATCH_LAST
+};
+
+struct sbdd_io;
+
+/* Front pad of every bio cloned from the io clone_bio_set */
+struct sbdd_io_bio {
+	/* time the bio was queued to a worker, 0 - queued while not tracked */
+	u64                     queued_ns;
+	struct bio              bio;
+};
+
+/* blk-mq request pdu: the request completes when the last member clone does */
+struct sbdd_io_rq {
+	atomic_t                pending;
+	blk_status_t            status;
+};
+
+struct sbdd_io_worker {
+	struct sbdd_io*         io;
+	/* cpu or numa node the worker serves */
+	int                     id;
+	wait_queue_head_t       events;
+	struct task_struct*     thread;
+	/* lock-free LIFO of pending bios chained through bi_next */
+	struct bio*             bio_stack;
+} ____cacheline_aligned_in_smp;
 
 struct sbdd_io {
     void*                   ctx;
-	wait_queue_head_t       events;	
 	process_bio_t           process_bio;
-	struct task_struct*     io_thread;
+	bio_may_block_t         bio_may_block;
+	int                     dispatch_mode;
+	int                     workers_mode;
+	int                     workers_count;
+	struct sbdd_io_worker*  workers;
+	/* first started worker, serves cpus whose worker is not up yet */
+	struct sbdd_io_worker*  default_worker;
+	struct hlist_node       cpuhp_node;
+	/* blk-mq request bios and tracked queued bios are cloned from here */
+	struct bio_set          clone_bio_set;
     atomic_t 				is_io_thread_active;
 	atomic_t 				is_io_active;
-	spinlock_t              bio_list_lock;
-	struct bio_list 		bio_list;
 };
 
-int sbdd_io_create(struct sbdd_io* io, process_bio_t process_bio, void* ctx);
+/* Enabled while anybody needs per member completion tracking */
+DECLARE_STATIC_KEY_FALSE(sbdd_io_track_key);
+
+static inline bool sbdd_io_is_tracked(void)
+{
+	return static_branch_unlikely(&sbdd_io_track_key);
+}
+
+int sbdd_io_track_get(void);
+void sbdd_io_track_put(void);
+
+int sbdd_io_init(void);
+void sbdd_io_exit(void);
+
+int sbdd_io_create(struct sbdd_io* io, process_bio_t process_bio, bio_may_block_t bio_may_block, void* ctx,
+                   int workers_mode, int dispatch_mode);
 void sbdd_io_destroy(struct sbdd_io* io);
 
 int sbdd_io_start(struct sbdd_io* io);
@@ -32,6 +96,8 @@ void sbdd_io_stop(struct sbdd_io* io);
 
 int sbdd_io_is_active(struct sbdd_io* io);
 int sbdd_io_is_empty(struct sbdd_io* io);
+/* Targets may block in the io workers, not in the submit_bio or queue_rq context */
+bool sbdd_io_in_worker(struct sbdd_io* io);
 
 blk_qc_t sbdd_io_submit_bio(struct bio *bio);
 
@@ -6,33 +6,161 @@
 #include <linux/blkdev.h>
 #include <linux/wait.h>
 #include <linux/types.h>
-#include <linux/spinlock_types.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu-refcount.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
 #include <linux/blk-mq.h>
 
 #include <raid_0_cfg.h>
 
 #define SBDD_RAID_0_FMODE (FMODE_READ | FMODE_WRITE)
 
+/* sbdd_raid_0_disk flags bits */
+#define SBDD_RAID_0_DISK_DIRTY  0
+
 struct sbdd_raid_0_disk {
     struct block_device* bdev_raw;
     __u64 capacity;
     __u32 max_sectors;
+    /* a coalesced child is closed before it has more segments than the member takes */
+    __u32 max_segments;
+    __u32 max_segment_size;
     char name[DISK_NAME_LEN];
+    /* member ios in flight, raid10 reads go to the least busy copy */
+    atomic_t inflight;
+    /* SBDD_RAID_0_DISK_DIRTY: a write was sent or completed since its last flush was sent */
+    unsigned long flags;
+    /* flushes sent and not completed yet */
+    atomic_t flushing;
 };
 typedef struct sbdd_raid_0_disk sbdd_raid_0_disk_t;
 
+struct sbdd_raid_0_map;
+struct sbdd_raid_0_tier;
+struct sbdd_raid_0_reshape;
+
+/* Chunk of a weighted striping pattern period */
+struct sbdd_raid_0_slot {
+    __u32 disk;
+    /* chunks of the disk before this one in the period */
+    __u32 rank;
+    /* chunks of the disk in the period */
+    __u32 weight;
+};
+
+/* Maps array sector to member index and sector on that member */
+typedef __u32 (*sbdd_raid_0_map_t)(const struct sbdd_raid_0_map* map, sector_t source_sector, sector_t* mapped_sector);
+
+/* Sector mapper specialized for the array geometry at create time */
+struct sbdd_raid_0_map {
+    sbdd_raid_0_map_t       map_sector;
+    const char*             name;
+    __u32                   chunk_sectors;
+    __u32                   disks_count;
+    /* chunk_sectors - 1 for power of two chunks, 0 otherwise */
+    __u32                   chunk_mask;
+    /* power of two geometry */
+    __u32                   chunk_shift;
+    __u32                   disks_shift;
+    /* ceil(2^64 / divisor) for the reciprocal-multiply division */
+    __u64                   chunk_recip;
+    __u64                   disks_recip;
+    /* raid10: copies of every chunk and their placement */
+    __u32                   copies;
+    __u32                   layout;
+    /* far layout: distance between copies on a member */
+    sector_t                far_offset;
+    /* weighted striping: chunk slots of one period, NULL for round-robin */
+    struct sbdd_raid_0_slot* pattern;
+    __u32                   pattern_len;
+};
+
+/*
+Part of a raid0 array striped across the members that still have space
+there. Members of different sizes give a zone per distinct size.
+*/
+struct sbdd_raid_0_zone {
+    /* array sectors [start, end) */
+    sector_t                start;
+    sector_t                end;
+    /* member sector the zone rows start at */
+    sector_t                disk_start;
+    struct sbdd_raid_0_map  map;
+    /* zone column to member index, map.disks_count of them */
+    __u32*                  disks;
+};
+
+/*
+Geometry of an array: members, mapper and zones. It is never changed once
+published, a member change publishes a new one. Bios hold the geometry they
+are mapped by from the lookup to the completion of their member ios, the old
+geometry is freed once the last of them is done.
+*/
+struct sbdd_raid_0_geo {
+    struct sbdd_raid_0*     raid_0;
+    /* geometry of the first zone, the whole array when members are the same size */
+    struct sbdd_raid_0_map  map;
+    struct sbdd_raid_0_zone* zones;
+    __u32                   zones_count;
+    /* member being copied to a new disk, NULL for none */
+    struct sbdd_raid_0_reshape* replace;
+    /* killed when the geometry is replaced or grown */
+    struct percpu_ref       users;
+    __u32                   disks_count;
+    sbdd_raid_0_disk_t*     disks[];
+};
+
 struct sbdd_raid_0 {
     void*                   ctx;
     struct bio_set			bio_set;
     sbdd_raid_0_config_t    config;
-    spinlock_t              disks_lock;
-    sbdd_raid_0_disk_t**    disks;
+    struct sbdd_raid_0_geo __rcu* geo;
+    /* extent remapping between fast and slow members, NULL for a striped array */
+    struct sbdd_raid_0_tier* tier;
+    /* A striped array of same size members can grow by a member */
+    bool                    reshapable;
+    /* serializes the geometry changes */
+    struct mutex            reshape_lock;
+    struct sbdd_raid_0_reshape* reshape;
+    /* writes that may wait for a member copy, came in a context that can't */
+    spinlock_t              defer_lock;
+    struct bio_list         deferred;
+    struct work_struct      defer_work;
 };
 
+/* Geometry of the control paths, they run with no geometry change in progress or are the change */
+static inline struct sbdd_raid_0_geo* sbdd_raid_0_geo(struct sbdd_raid_0* raid_0)
+{
+    return rcu_dereference_protected(raid_0->geo, true);
+}
+
+/* Opens a member by path, shared with the other targets built on raid0 members */
+struct sbdd_raid_0_disk* sbdd_raid_0_create_disk(const char* name);
+int sbdd_raid_0_destroy_disk(struct sbdd_raid_0_disk* disk);
+
 int sbdd_raid_0_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx);
+/* Striped mirrors on top of the raid0 striping, copies=2 unless configured */
+int sbdd_raid_10_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx);
 void sbdd_raid_0_destroy(struct sbdd_raid_0* raid_0);
+/* Opens a new member and restripes the array onto it in the background, the capacity grows at the end */
+int sbdd_raid_0_add_disk(struct sbdd_raid_0* raid_0, const char* name);
+/* Opens a new disk and copies a member to it in the background, the member is swapped at the end */
+int sbdd_raid_0_replace_disk(struct sbdd_raid_0* raid_0, __u32 slot, const char* name);
+/* Runs a growth found on the members at create, once the array is up */
+void sbdd_raid_0_resume(struct sbdd_raid_0* raid_0);
+/* Geometry with every member, the new one of a growth in progress */
+struct sbdd_raid_0_geo* sbdd_raid_0_members_geo(struct sbdd_raid_0* raid_0);
+/* Publishes a geometry and frees the old one once its bios are done, members are closed by the caller */
+void sbdd_raid_0_switch_geo(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo);
+/* Copy of the geometry with its own zones and pattern, live users */
+struct sbdd_raid_0_geo* sbdd_raid_0_dup_geo(const struct sbdd_raid_0_geo* geo);
+void sbdd_raid_0_free_geo(struct sbdd_raid_0_geo* geo);
 blk_qc_t sbdd_raid_0_process_bio(struct bio* bio);
-__u32 sbdd_raid_0_get_capacity(struct sbdd_raid_0* raid_0);
+bool sbdd_raid_0_bio_may_block(struct bio* bio);
+sector_t sbdd_raid_0_get_capacity(struct sbdd_raid_0* raid_0);
 __u64 sbdd_raid_0_get_max_sectors(struct sbdd_raid_0* raid_0);
+void sbdd_raid_0_get_io_hints(struct sbdd_raid_0* raid_0, unsigned int* io_min, unsigned int* io_opt);
 
 #endif
\ No newline at end of file
@@ -1,16 +1,48 @@
 #ifndef _SBDD_RAID_0_CFG_H_
 #define _SBDD_RAID_0_CFG_H_
 
-#define SDBB_RAID_0_MAX_DISKS_COUNT 32
+/* Members are in tables sized at create, the limit only bounds a config */
+#define SDBB_RAID_0_MAX_DISKS_COUNT 1024
+/* KiB, a chunk is read through a buffer of its size by a reshape */
+#define SBDD_RAID_0_MAX_STRIPE      (64 << 10)
+#define SBDD_RAID_0_MAX_COPIES      4
+#define SBDD_RAID_0_MAX_WEIGHT      16
+/* KiB */
+#define SBDD_RAID_0_TIER_EXTENT_DEFAULT 4096
+/* MiB/s */
+#define SBDD_RAID_0_TIER_RATE_DEFAULT   32
 
 #include <linux/types.h>
 
+/* Placement of chunk copies, raid10 only */
+enum sbdd_raid_0_layout {
+    /* copies of a chunk are on adjacent disks in the same row */
+    SBDD_RAID_0_LAYOUT_NEAR = 0,
+    /* copy c is in the c-th part of every disk, rotated by c disks */
+    SBDD_RAID_0_LAYOUT_FAR  = 1,
+};
+
 struct sbdd_raid_0_config
 {
+    /* KiB */
     int strip_size;
+    int copies;
+    int layout;
+    /* raid5/6: stripe cache entries, 0 - default */
+    int cache_stripes;
+    /* tiering: the first tier_disks disks are the fast tier, 0 - no tiering */
+    int tier_disks;
+    /* tiering: extent size in 1024-bytes-units and migration rate in MiB/s, 0 - default */
+    int extent_size;
+    int tier_rate;
     int disks_count;
+    /* disks point into disks_str, both are the config the array was created with */
     char* disks_str;
-    char* disks[SDBB_RAID_0_MAX_DISKS_COUNT];
+    char** disks;
+    /* chunks a disk gets per pattern period, disks=path:weight, 1 by default */
+    __u32* weights;
+    /* some disk has a weight other than 1 */
+    bool weighted;
 };
 typedef struct sbdd_raid_0_config sbdd_raid_0_config_t;
 
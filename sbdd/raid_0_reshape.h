@@ -0,0 +1,147 @@
+#ifndef _SBDD_RAID_0_RESHAPE_H_
+#define _SBDD_RAID_0_RESHAPE_H_
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/wait_bit.h>
+#include <linux/completion.h>
+
+#include <raid_0.h>
+
+/* Copy buffer, chunks of a window are moved through it at once */
+#define SBDD_RAID_0_RESHAPE_BUFFER  (4 << 20)
+
+#define SBDD_RAID_0_RESHAPE_MAGIC   0x73626772
+/* The growth record takes the last page of the new member */
+#define SBDD_RAID_0_RESHAPE_SB_SECTORS  (PAGE_SIZE >> SECTOR_SHIFT)
+
+/*
+Position of a growth, kept past the sectors the array uses of the new
+member. Chunks below done are in the layout with the new member, the
+growth goes on from there when the array is created again.
+*/
+struct sbdd_raid_0_reshape_sb {
+    __le32  magic;
+    /* of the record with crc 0 */
+    __le32  crc;
+    /* members before the growth */
+    __le32  disks_count;
+    __le32  chunk_sectors;
+    /* sectors used of every member */
+    __le64  disk_sectors;
+    __le64  chunks;
+    __le64  done;
+};
+
+/*
+Watermark of a copy in progress, in chunks of a growth or sectors of a
+replacement. Units below done are copied, [done, window) are being copied
+and their ios wait. Member ios are counted in active by the parity of gen
+they were mapped in, a window is copied once the ios mapped before it are done.
+*/
+struct sbdd_raid_0_watermark {
+    __u64                   done;
+    __u64                   window;
+    unsigned long           gen;
+    atomic_t                active[2];
+};
+
+/*
+Background copy of an array geometry change, one at a time.
+
+Growth of a striped raid0 by one member: chunks are moved to the geometry
+with the new member in array order, the ones below the watermark are there
+already. The new place of a chunk is the old place of a chunk not after it,
+so the chunks of a window are all read before any of them is written. A
+window only overwrites chunks below the watermark and the watermark is
+recorded on the new member after every window, so a growth cut short goes
+on from the record.
+
+Replacement of a member: the member is copied to the new disk in sector
+order, writes below the watermark go to both of them. The geometry being
+copied points to the replacement, the new disk takes the member slot at the end.
+*/
+struct sbdd_raid_0_reshape {
+    struct sbdd_raid_0*     raid_0;
+    /* growth: geometry the data is moved from and the one with the new member */
+    struct sbdd_raid_0_geo* from;
+    struct sbdd_raid_0_geo* geo;
+    /* growth: copies of their maps, bios of the reshape are mapped by them */
+    struct sbdd_raid_0_map  map;
+    struct sbdd_raid_0_map  old_map;
+    /* growth: chunks of the old geometry, the record of the position on the new member */
+    __u64                   chunks;
+    sector_t                sb_sector;
+    /* replacement: member slot, its new disk and the sectors copied */
+    bool                    replace;
+    __u32                   slot;
+    struct sbdd_raid_0_disk* disk;
+    __u64                   sectors;
+    /* replacement: geometry published while the member is copied, geo is the one with the new disk */
+    struct sbdd_raid_0_geo* copying;
+    struct sbdd_raid_0_watermark mark;
+    __u32                   window_chunks;
+    /* bios being mapped, kept until the next reshape may change the geometries */
+    atomic_t                entered;
+    struct page**           pages;
+    __u32                   pages_count;
+    /* copy ios of a window */
+    atomic_t                pending;
+    int                     io_error;
+    struct completion       io_done;
+    struct task_struct*     thread;
+    bool                    running;
+    int                     error;
+};
+
+/*
+Prepares a growth to the geometry with the new member from chunk done and
+records it on the new member, the restriper is not running before sbdd_raid_0_reshape_run
+*/
+int sbdd_raid_0_reshape_start(struct sbdd_raid_0_reshape* reshape, struct sbdd_raid_0* raid_0,
+                              struct sbdd_raid_0_geo* geo, __u64 chunks, __u64 done);
+/* Sector of the growth record, the new member is used below it */
+sector_t sbdd_raid_0_reshape_sb_sector(struct sbdd_raid_0_disk* disk);
+/* Reads the growth record of a member, -ENOENT if it has none */
+int sbdd_raid_0_reshape_read_sb(struct sbdd_raid_0_disk* disk, struct sbdd_raid_0_reshape_sb* sb);
+/* Prepares a copy of the member in slot to disk, the copier is not running before sbdd_raid_0_reshape_run */
+int sbdd_raid_0_replace_start(struct sbdd_raid_0_reshape* reshape, struct sbdd_raid_0* raid_0, __u32 slot,
+                              struct sbdd_raid_0_disk* disk, struct sbdd_raid_0_geo* copying, struct sbdd_raid_0_geo* geo);
+void sbdd_raid_0_reshape_run(struct sbdd_raid_0_reshape* reshape);
+/* Stops a reshape in progress: a growth is resumed at the next create, a replacement is rolled back */
+void sbdd_raid_0_reshape_destroy(struct sbdd_raid_0_reshape* reshape);
+
+static inline bool sbdd_raid_0_reshape_running(struct sbdd_raid_0_reshape* reshape)
+{
+    return reshape && READ_ONCE(reshape->running);
+}
+
+/* A bio is mapped by the growth, entered under rcu once the old geometry is killed */
+static inline void sbdd_raid_0_reshape_enter(struct sbdd_raid_0_reshape* reshape)
+{
+    atomic_inc(&reshape->entered);
+}
+
+static inline void sbdd_raid_0_reshape_exit(struct sbdd_raid_0_reshape* reshape)
+{
+    if(atomic_dec_and_test(&reshape->entered))
+        wake_up_var(&reshape->entered);
+}
+
+/*
+Holds units [first, end) of the watermark until sbdd_raid_0_reshape_put of
+active. Waits while some of them are copied, returns the watermark seen.
+*/
+__u64 sbdd_raid_0_watermark_get(struct sbdd_raid_0_watermark* mark, __u64 first, __u64 end, atomic_t** active);
+
+/* Maps the sector by the geometry its chunk is in and holds the chunk */
+__u32 sbdd_raid_0_reshape_get(struct sbdd_raid_0_reshape* reshape, sector_t sector, sector_t* mapped_sector, atomic_t** active);
+
+static inline void sbdd_raid_0_reshape_put(atomic_t* active)
+{
+    if(atomic_dec_and_test(active))
+        wake_up_var(active);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _SBDD_RAID_0_TIER_H_
+#define _SBDD_RAID_0_TIER_H_
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/wait_bit.h>
+
+#include <raid_0.h>
+
+/* sbdd_raid_0_extent flags bits */
+#define SBDD_RAID_0_EXTENT_MIGRATING    0
+
+/* Logical extent of a tiered array */
+struct sbdd_raid_0_extent {
+    /* physical extent, changed only by a migration with no io in flight */
+    __u32       phys;
+    /* accesses, halved every migration pass */
+    __u32       hits;
+    /* member ios in flight */
+    atomic_t    inflight;
+    unsigned long flags;
+};
+
+/* Physical extents of a member */
+struct sbdd_raid_0_tier_disk {
+    __u32       first;
+    __u32       count;
+    /* member sector of its first extent */
+    sector_t    start;
+};
+
+/*
+Tiered raid0: members are cut into physical extents, fast members first,
+and every logical extent is remapped to one of them. One physical extent is
+always spare, a migration copies an extent into it and the old place
+becomes the spare. The remap table is kept at the start of the first member.
+*/
+struct sbdd_raid_0_tier {
+    struct sbdd_raid_0*             raid_0;
+    /* members, the geometry of a tiered array never changes */
+    struct sbdd_raid_0_geo*         geo;
+    __u32                           extent_shift;
+    /* physical extents [0, fast_extents) are on the fast members */
+    __u32                           fast_extents;
+    __u32                           phys_count;
+    /* logical extents, one less than the physical ones */
+    __u32                           count;
+    __u32                           spare;
+    /* extents moved per migration pass */
+    __u32                           budget;
+    struct sbdd_raid_0_extent*      extents;
+    /* geo->disks_count of them */
+    struct sbdd_raid_0_tier_disk*   disks;
+    /* extent copy buffer and a remap table block */
+    struct page**                   pages;
+    struct page*                    table_page;
+    struct task_struct*             migrator;
+    __u64                           promoted;
+    __u64                           demoted;
+};
+
+int sbdd_raid_0_tier_create(struct sbdd_raid_0_tier* tier, struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo);
+void sbdd_raid_0_tier_destroy(struct sbdd_raid_0_tier* tier);
+
+static inline struct sbdd_raid_0_extent* sbdd_raid_0_tier_extent(struct sbdd_raid_0_tier* tier, sector_t sector)
+{
+    return &tier->extents[sector >> tier->extent_shift];
+}
+
+/*
+Holds the extent of sector until sbdd_raid_0_tier_put and maps the sector.
+Waits while the extent is migrated. Lookups take no lock.
+*/
+__u32 sbdd_raid_0_tier_get(struct sbdd_raid_0_tier* tier, sector_t sector, sector_t* mapped_sector);
+
+static inline void sbdd_raid_0_tier_put(struct sbdd_raid_0_extent* extent)
+{
+    if(atomic_dec_and_test(&extent->inflight) && test_bit(SBDD_RAID_0_EXTENT_MIGRATING, &extent->flags))
+        wake_up_var(&extent->inflight);
+}
+
+static inline sector_t sbdd_raid_0_tier_capacity(struct sbdd_raid_0_tier* tier)
+{
+    return (sector_t)tier->count << tier->extent_shift;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _SBDD_RAID_1_H_
+#define _SBDD_RAID_1_H_
+
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/spinlock_types.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
+
+#include <raid_1_cfg.h>
+#include <stats.h>
+
+#define SBDD_RAID_1_FMODE (FMODE_READ | FMODE_WRITE)
+
+struct sbdd_raid_1_disk {
+    struct block_device* bdev_raw;
+    __u64 capacity;
+    __u32 max_sectors;
+    char name[DISK_NAME_LEN];
+    /* ios submitted and not completed yet */
+    atomic_t inflight;
+    /* sector the last io submitted to the member ended at */
+    sector_t head;
+} ____cacheline_aligned_in_smp;
+typedef struct sbdd_raid_1_disk sbdd_raid_1_disk_t;
+
+/* Read service time histogram the hedge delay is derived from */
+struct sbdd_raid_1_lat {
+    u64 hist[SBDD_STATS_HIST_BUCKETS];
+    u32 count;
+};
+
+struct sbdd_raid_1 {
+    void*                           ctx;
+    struct bio_set                  bio_set;
+    sbdd_raid_1_config_t            config;
+    sbdd_raid_1_disk_t**            disks;
+    /* 0 - hedge delay not known yet, reads are not hedged */
+    u64                             hedge_ns;
+    __u32                           hedge_sectors;
+    struct sbdd_raid_1_lat __percpu* lat;
+    /* hedged reads not released yet */
+    atomic_t                        hedges;
+    /* histogram at the previous hedge delay update */
+    spinlock_t                      lat_lock;
+    u64                             lat_prev[SBDD_STATS_HIST_BUCKETS];
+    /* failed reads waiting to be sent to another mirror */
+    spinlock_t                      retry_lock;
+    struct bio_list                 retry;
+    struct work_struct              retry_work;
+};
+
+int sbdd_raid_1_create(struct sbdd_raid_1* raid_1, char* cfg, void* ctx);
+void sbdd_raid_1_destroy(struct sbdd_raid_1* raid_1);
+blk_qc_t sbdd_raid_1_process_bio(struct bio* bio);
+bool sbdd_raid_1_bio_may_block(struct bio* bio);
+sector_t sbdd_raid_1_get_capacity(struct sbdd_raid_1* raid_1);
+__u64 sbdd_raid_1_get_max_sectors(struct sbdd_raid_1* raid_1);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _SBDD_RAID_1_CFG_H_
+#define _SBDD_RAID_1_CFG_H_
+
+#define SBDD_RAID_1_MAX_DISKS_COUNT 8
+
+#include <linux/types.h>
+
+enum sbdd_raid_1_read_balance {
+    /* member with the fewest reads in flight */
+    SBDD_RAID_1_READ_INFLIGHT   = 0,
+    /* member whose last io ended nearest to the read */
+    SBDD_RAID_1_READ_NEAREST    = 1,
+    SBDD_RAID_1_READ_LAST
+};
+
+struct sbdd_raid_1_config
+{
+    int read_balance;
+    /* read latency percentile a hedged read is issued at, 0 - no hedging */
+    int hedge_pct;
+    /* largest read that is hedged, KiB */
+    int hedge_kb;
+    int disks_count;
+    char* disks_str;
+    char* disks[SBDD_RAID_1_MAX_DISKS_COUNT];
+};
+typedef struct sbdd_raid_1_config sbdd_raid_1_config_t;
+
+int sbdd_raid_1_create_config(char* cfg, sbdd_raid_1_config_t* _cfg);
+void sbdd_raid_1_destroy_config(sbdd_raid_1_config_t* cfg);
+
+#endif
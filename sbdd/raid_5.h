@@ -0,0 +1,70 @@
+#ifndef _SBDD_RAID_5_H_
+#define _SBDD_RAID_5_H_
+
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+
+#include <raid_0.h>
+
+#define SBDD_RAID_5_CACHE_DEFAULT   256
+#define SBDD_RAID_5_PAGE_SECTORS    (PAGE_SIZE >> SECTOR_SHIFT)
+/* Columns of a head are bits of its uptodate and dirty masks */
+#define SBDD_RAID_5_MAX_DISKS_COUNT 32
+
+/*
+Stripe cache entry: one page of every member at the same member offset.
+Pages are kept by column, data columns first, then P and Q.
+*/
+struct sbdd_raid_5_head {
+    struct hlist_node       hash;
+    struct list_head        lru;
+    struct mutex            lock;
+    /* member page index, SBDD_RAID_5_NO_INDEX while unused */
+    sector_t                index;
+    /* holders, under the cache lock. Held heads are off the lru */
+    int                     refs;
+    /* member writes in flight, pages are not touched until they are done */
+    atomic_t                io;
+    __u32                   uptodate;
+    __u32                   dirty;
+    struct page*            pages[];
+};
+
+struct sbdd_raid_5 {
+    void*                       ctx;
+    struct bio_set              bio_set;
+    sbdd_raid_0_config_t        config;
+    sbdd_raid_0_disk_t**        disks;
+    /* 1 - raid5, 2 - raid6 */
+    __u32                       parity;
+    __u32                       data_disks;
+    __u32                       chunk_sectors;
+    /* stripe cache */
+    struct mutex                cache_lock;
+    wait_queue_head_t           cache_wait;
+    struct hlist_head*          cache_hash;
+    __u32                       cache_hash_bits;
+    /* heads nobody holds, least recently used first */
+    struct list_head            cache_lru;
+    __u32                       cache_count;
+    struct sbdd_raid_5_head**   heads;
+    /* member writes of all heads in flight */
+    atomic_t                    writing;
+    /* write-back error, reported by the next flush */
+    blk_status_t                write_error;
+};
+
+int sbdd_raid_5_create(struct sbdd_raid_5* raid_5, char* cfg, void* ctx, __u32 parity);
+void sbdd_raid_5_destroy(struct sbdd_raid_5* raid_5);
+blk_qc_t sbdd_raid_5_process_bio(struct bio* bio);
+bool sbdd_raid_5_bio_may_block(struct bio* bio);
+sector_t sbdd_raid_5_get_capacity(struct sbdd_raid_5* raid_5);
+__u64 sbdd_raid_5_get_max_sectors(struct sbdd_raid_5* raid_5);
+void sbdd_raid_5_get_io_hints(struct sbdd_raid_5* raid_5, unsigned int* io_min, unsigned int* io_opt);
+
+#endif
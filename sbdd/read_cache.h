@@ -0,0 +1,76 @@
+#ifndef _SBDD_READ_CACHE_H_
+#define _SBDD_READ_CACHE_H_
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/xarray.h>
+#include <linux/refcount.h>
+#include <linux/rcupdate.h>
+
+#include <io.h>
+
+/* Cached blocks are pages */
+#define SBDD_READ_CACHE_BLOCK_SHIFT     (PAGE_SHIFT - SECTOR_SHIFT)
+/* Larger reads are taken for scans and are not cached */
+#define SBDD_READ_CACHE_MAX_BLOCKS      32
+/* Generations of array regions of SBDD_READ_CACHE_MAX_BLOCKS, a read spans at most two */
+#define SBDD_READ_CACHE_GENS            256
+
+/* Set on a hit, an Am block with it gets a second chance instead of being evicted */
+#define SBDD_READ_CACHE_REFERENCED      0
+/* The block is on the Am list, on the A1in list otherwise */
+#define SBDD_READ_CACHE_AM              1
+
+struct sbdd_read_cache_block {
+    struct list_head        list;
+    struct rcu_head         rcu;
+    u64                     block;
+    /* the index holds one, every hit in progress one more */
+    refcount_t              refs;
+    unsigned long           flags;
+    struct page*            page;
+};
+
+/*
+2Q cache: blocks read once go to the A1in fifo, blocks read again after they
+left it, while their number is still in the A1out ghost fifo, go to Am, a
+clock of the hot set. A scan passes through A1in and does not touch Am.
+*/
+struct sbdd_read_cache {
+    void*                   ctx;
+    /* layer the cache is in front of */
+    process_bio_t           process_bio;
+    bio_may_block_t         bio_may_block;
+    struct bio_set          bio_set;
+    /* blocks, ghosts are value entries. Lookups are under rcu only, its lock guards the rest */
+    struct xarray           index;
+    struct list_head        a1in;
+    struct list_head        am;
+    u64                     a1in_count;
+    u64                     count;
+    u64                     max_count;
+    u64                     a1in_max;
+    /* A1out ring of block numbers */
+    u64*                    ghosts;
+    u64                     ghosts_max;
+    u64                     ghosts_head;
+    u64                     ghosts_count;
+    /* bumped by writes, a read whose regions changed meanwhile is not cached */
+    atomic_t                gens[SBDD_READ_CACHE_GENS];
+};
+
+int sbdd_read_cache_create(struct sbdd_read_cache* cache, unsigned int size_mb, process_bio_t process_bio,
+                           bio_may_block_t bio_may_block, void* ctx);
+void sbdd_read_cache_destroy(struct sbdd_read_cache* cache);
+
+static inline bool sbdd_read_cache_is_enabled(struct sbdd_read_cache* cache)
+{
+	return cache->max_count != 0;
+}
+
+blk_qc_t sbdd_read_cache_process_bio(struct bio* bio);
+bool sbdd_read_cache_bio_may_block(struct bio* bio);
+
+#endif
@@ -10,19 +10,50 @@
 #include <linux/blk-mq.h>
 
 #include <raid_0.h>
+#include <raid_1.h>
+#include <raid_5.h>
+#include <cache.h>
+#include <read_cache.h>
 #include <io.h>
+#include <stats.h>
+#include <heatmap.h>
+#include <sbdd_ctl.h>
 
 #define SBDD_SECTOR_SHIFT      9
 #define SBDD_SECTOR_SIZE       (1 << SBDD_SECTOR_SHIFT)
 #define SBDD_MIB_SECTORS       (1 << (20 - SBDD_SECTOR_SHIFT))
 #define SBDD_NAME              "sbdd"
+/* blk_mq build only */
+#define SBDD_HW_QUEUE_DEPTH_DEFAULT 128
+
+enum sbdd_raid_type {
+	SBDD_RAID_TYPE_0		= 0,
+	SBDD_RAID_TYPE_1		= 1,
+	/* distributed parity, one or two parity chunks per row */
+	SBDD_RAID_TYPE_5		= 5,
+	SBDD_RAID_TYPE_6		= 6,
+	/* striped mirrors, built on the raid0 striping */
+	SBDD_RAID_TYPE_10		= 10,
+};
 
 struct sbdd {
 	struct sbdd_raid_0		raid_0;
+	struct sbdd_raid_1		raid_1;
+	struct sbdd_raid_5		raid_5;
+	struct sbdd_cache		cache;
+	struct sbdd_read_cache	read_cache;
 	struct sbdd_io 			io;
+	struct sbdd_stats		stats;
+	struct sbdd_heatmap		heatmap;
 	struct gendisk          *gd;
     struct blk_mq_tag_set   *tag_set;
-
+	/* N of sbddN, the parameters hold the config the raid parsed in place */
+	int						id;
+	struct sbdd_ctl_create	params;
+	bool					reshape_attrs;
+	/* opens of the disk, an array is destroyed while it has none */
+	atomic_t				openers;
+	bool					dying;
 };
 
 #endif
\ No newline at end of file
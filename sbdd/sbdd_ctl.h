@@ -0,0 +1,35 @@
+#ifndef _SBDD_CTL_H_
+#define _SBDD_CTL_H_
+
+/* Shared with user space, arrays are created and destroyed through /dev/sbdd-control */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define SBDD_CTL_NAME           "sbdd-control"
+#define SBDD_CTL_CONFIG_LEN     1024
+
+/* Array parameters, the same as the module parameters, 0 - the default */
+struct sbdd_ctl_create {
+	/* 0 - raid0, 1 - raid1, 5 - raid5, 6 - raid6, 10 - raid10 */
+	__u32	raid_type;
+	__u32	io_workers;
+	__u32	io_dispatch;
+	__u32	heatmap_region_mb;
+	__u32	heatmap_sample;
+	__u32	read_cache_mb;
+	/* blk_mq build only */
+	__u32	hw_queues;
+	__u32	hw_queue_depth;
+	/* out: N of the created sbddN */
+	__u32	id;
+	char	raid_config[SBDD_CTL_CONFIG_LEN];
+};
+
+#define SBDD_CTL_MAGIC          0x5B
+
+/* Creates an array and returns its id */
+#define SBDD_CTL_CREATE         _IOWR(SBDD_CTL_MAGIC, 0, struct sbdd_ctl_create)
+/* Destroys the array with the id in arg, -EBUSY while it is open */
+#define SBDD_CTL_DESTROY        _IO(SBDD_CTL_MAGIC, 1)
+
+#endif
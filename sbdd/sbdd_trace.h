@@ -0,0 +1,181 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sbdd
+
+#if !defined(_SBDD_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _SBDD_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/blkdev.h>
+#include <linux/blktrace_api.h>
+
+#include <io.h>
+
+#define SBDD_TRACE_RWBS_LEN 8
+
+/* Bio is queued to an io worker */
+TRACE_EVENT(sbdd_enqueue,
+
+	TP_PROTO(struct bio* bio, int worker),
+
+	TP_ARGS(bio, worker),
+
+	TP_STRUCT__entry(
+		__field(dev_t,			dev)
+		__field(sector_t,		sector)
+		__field(unsigned int,	nr_sector)
+		__field(int,			worker)
+		__array(char,			rwbs, SBDD_TRACE_RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= bio_dev(bio);
+		__entry->sector		= bio->bi_iter.bi_sector;
+		__entry->nr_sector	= bio_sectors(bio);
+		__entry->worker		= worker;
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u worker %d",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		(unsigned long long)__entry->sector, __entry->nr_sector, __entry->worker)
+);
+
+/*
+Bio is taken by an io worker, wait is the time it was queued for.
+Enabling the event turns on the stamping of queued bios.
+*/
+TRACE_EVENT_FN(sbdd_dequeue,
+
+	TP_PROTO(struct bio* bio, int worker, u64 wait_ns),
+
+	TP_ARGS(bio, worker, wait_ns),
+
+	TP_STRUCT__entry(
+		__field(dev_t,			dev)
+		__field(sector_t,		sector)
+		__field(unsigned int,	nr_sector)
+		__field(int,			worker)
+		__field(u64,			wait_ns)
+		__array(char,			rwbs, SBDD_TRACE_RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= bio_dev(bio);
+		__entry->sector		= bio->bi_iter.bi_sector;
+		__entry->nr_sector	= bio_sectors(bio);
+		__entry->worker		= worker;
+		__entry->wait_ns	= wait_ns;
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u worker %d wait %llu ns",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		(unsigned long long)__entry->sector, __entry->nr_sector, __entry->worker,
+		__entry->wait_ns),
+
+	sbdd_io_track_get, sbdd_io_track_put
+);
+
+/* Bio is mapped onto a member disk */
+TRACE_EVENT(sbdd_remap,
+
+	TP_PROTO(struct bio* bio, sector_t source_sector, u32 disk),
+
+	TP_ARGS(bio, source_sector, disk),
+
+	TP_STRUCT__entry(
+		__field(dev_t,			dev)
+		__field(sector_t,		sector)
+		__field(sector_t,		source_sector)
+		__field(unsigned int,	nr_sector)
+		__field(u32,			disk)
+		__array(char,			rwbs, SBDD_TRACE_RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev			= bio_dev(bio);
+		__entry->sector			= bio->bi_iter.bi_sector;
+		__entry->source_sector	= source_sector;
+		__entry->nr_sector		= bio_sectors(bio);
+		__entry->disk			= disk;
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u <- %llu disk %u",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		(unsigned long long)__entry->sector, __entry->nr_sector,
+		(unsigned long long)__entry->source_sector, __entry->disk)
+);
+
+/* Read is hedged: the primary mirror is late, a second read goes to another one */
+TRACE_EVENT(sbdd_hedge,
+
+	TP_PROTO(struct bio* bio, u32 primary, u32 disk),
+
+	TP_ARGS(bio, primary, disk),
+
+	TP_STRUCT__entry(
+		__field(sector_t,		sector)
+		__field(unsigned int,	nr_sector)
+		__field(u32,			primary)
+		__field(u32,			disk)
+	),
+
+	TP_fast_assign(
+		__entry->sector		= bio->bi_iter.bi_sector;
+		__entry->nr_sector	= bio_sectors(bio);
+		__entry->primary	= primary;
+		__entry->disk		= disk;
+	),
+
+	TP_printk("%llu + %u disk %u -> disk %u",
+		(unsigned long long)__entry->sector, __entry->nr_sector,
+		__entry->primary, __entry->disk)
+);
+
+/*
+Member io is completed. Enabling the event turns on completion tracking
+in the remap path, it costs nothing while disabled.
+*/
+TRACE_EVENT_FN(sbdd_complete,
+
+	TP_PROTO(struct bio* bio, sector_t sector, unsigned int nr_sector, u32 disk, u64 latency_ns),
+
+	TP_ARGS(bio, sector, nr_sector, disk, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(dev_t,			dev)
+		__field(sector_t,		sector)
+		__field(unsigned int,	nr_sector)
+		__field(u32,			disk)
+		__field(int,			error)
+		__field(u64,			latency_ns)
+		__array(char,			rwbs, SBDD_TRACE_RWBS_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= bio_dev(bio);
+		__entry->sector		= sector;
+		__entry->nr_sector	= nr_sector;
+		__entry->disk		= disk;
+		__entry->error		= blk_status_to_errno(bio->bi_status);
+		__entry->latency_ns	= latency_ns;
+		blk_fill_rwbs(__entry->rwbs, bio->bi_opf);
+	),
+
+	TP_printk("%d,%d %s %llu + %u disk %u [%d] %llu ns",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->rwbs,
+		(unsigned long long)__entry->sector, __entry->nr_sector,
+		__entry->disk, __entry->error, __entry->latency_ns),
+
+	sbdd_io_track_get, sbdd_io_track_put
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sbdd_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,1402 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/highmem.h>
+#include <linux/crc32c.h>
+#include <linux/completion.h>
+#include <linux/wait_bit.h>
+#include <sbdd.h>
+#include <cache.h>
+
+#define SBDD_CACHE_MAGIC            0x43574253 /* "SBWC" */
+#define SBDD_CACHE_REC_MAGIC        0x52574253 /* "SBWR" */
+#define SBDD_CACHE_VERSION          1
+#define SBDD_CACHE_CONFIG_KEY       "wb_cache="
+/* Record flags: a trim has no data, blocks[0] and blocks[1] are the range it drops */
+#define SBDD_CACHE_REC_TRIM         0x1
+
+/* seq is the load epoch and a record counter within it */
+#define SBDD_CACHE_SEQ_EPOCH_SHIFT  40
+#define SBDD_CACHE_SEQ_EPOCH(seq)   ((seq) >> SBDD_CACHE_SEQ_EPOCH_SHIFT)
+#define SBDD_CACHE_SEQ_COUNT(seq)   ((seq) & ((1ull << SBDD_CACHE_SEQ_EPOCH_SHIFT) - 1))
+
+/* Cache block 0 */
+struct sbdd_cache_sb {
+    __le32 magic;
+    __le32 version;
+    __le32 crc;
+    __le32 block_size;
+    __le64 capacity;
+    __le64 nr_blocks;
+    __le64 epoch;
+    /* oldest record still needed and its seq, the next seq with no records */
+    __le64 tail;
+    __le64 tail_seq;
+};
+
+/* First block of a record, the record data blocks follow it */
+struct sbdd_cache_rec_hdr {
+    __le32 magic;
+    /* of the header with crc 0 and of the data blocks */
+    __le32 crc;
+    __le64 seq;
+    __le32 count;
+    __le32 flags;
+    __le64 blocks[];
+};
+
+/* Ios a caller waits for together */
+struct sbdd_cache_batch {
+    atomic_t            pending;
+    blk_status_t        status;
+    struct completion   done;
+};
+
+/* Front pad of every bio allocated from the cache bio_set */
+struct sbdd_cache_io {
+    struct sbdd_cache*          cache;
+    struct sbdd_cache_rec*      rec;
+    /* header or data of a record write, a read of cached blocks otherwise */
+    bool                        logged;
+    /* record header page, freed with the bio */
+    struct page*                page;
+    struct sbdd_cache_batch*    batch;
+    struct bio                  bio;
+};
+
+int sbdd_cache_parse_config(char* cfg, char** path)
+{
+    char*   _key = cfg;
+    char*   _end = NULL;
+    size_t  _len = strlen(SBDD_CACHE_CONFIG_KEY);
+
+    *path = NULL;
+
+    /* The key starts the config or follows a ';' */
+    while(_key && (_key = strstr(_key, SBDD_CACHE_CONFIG_KEY)) != NULL)
+    {
+        if(_key == cfg || _key[-1] == ';')
+            break;
+
+        _key += _len;
+    }
+
+    if(!_key)
+        return 0;
+
+    _end = strchrnul(_key, ';');
+
+    *path = kstrndup(_key + _len, _end - _key - _len, GFP_KERNEL);
+    if(!*path)
+        return -ENOMEM;
+
+    /* The target config parsers see the rest only */
+    if(*_end)
+        ++_end;
+    memmove(_key, _end, strlen(_end) + 1);
+
+    return 0;
+}
+
+static u64 __sbdd_cache_loc(const struct sbdd_cache_entry* entry)
+{
+    return entry->rec->pos + 1 + (entry - entry->rec->entries);
+}
+
+/* First entry of block or after it, under the cache lock */
+static struct sbdd_cache_entry* __sbdd_cache_lower_bound(struct sbdd_cache* cache, u64 block)
+{
+    struct rb_node*             _node = cache->index.rb_node;
+    struct sbdd_cache_entry*    _entry = NULL;
+    struct sbdd_cache_entry*    _best = NULL;
+
+    while(_node)
+    {
+        _entry = rb_entry(_node, struct sbdd_cache_entry, node);
+
+        if(_entry->block >= block)
+        {
+            _best = _entry;
+            _node = _node->rb_left;
+        }
+        else
+        {
+            _node = _node->rb_right;
+        }
+    }
+
+    return _best;
+}
+
+/* Under the cache lock. An entry of a newer record wins, whatever completes first */
+static void __sbdd_cache_insert(struct sbdd_cache* cache, struct sbdd_cache_entry* entry)
+{
+    struct rb_node**            _link = &cache->index.rb_node;
+    struct rb_node*             _parent = NULL;
+    struct sbdd_cache_entry*    _entry = NULL;
+
+    while(*_link)
+    {
+        _parent = *_link;
+        _entry = rb_entry(_parent, struct sbdd_cache_entry, node);
+
+        if(entry->block < _entry->block)
+        {
+            _link = &_parent->rb_left;
+        }
+        else if(entry->block > _entry->block)
+        {
+            _link = &_parent->rb_right;
+        }
+        else
+        {
+            if(_entry->rec->seq > entry->rec->seq)
+                return;
+
+            rb_replace_node(&_entry->node, &entry->node, &cache->index);
+            RB_CLEAR_NODE(&_entry->node);
+            --_entry->rec->live;
+            ++entry->rec->live;
+            return;
+        }
+    }
+
+    rb_link_node(&entry->node, _parent, _link);
+    rb_insert_color(&entry->node, &cache->index);
+    ++entry->rec->live;
+    ++cache->cached;
+}
+
+/* Under the cache lock */
+static void __sbdd_cache_remove(struct sbdd_cache* cache, struct sbdd_cache_entry* entry)
+{
+    rb_erase(&entry->node, &cache->index);
+    RB_CLEAR_NODE(&entry->node);
+    --entry->rec->live;
+    --cache->cached;
+}
+
+static struct sbdd_cache_rec* __sbdd_cache_alloc_rec(u64 block, u32 count, gfp_t gfp)
+{
+    struct sbdd_cache_rec*  _rec = NULL;
+    u32                     _idx = 0;
+
+    _rec = kzalloc(struct_size(_rec, entries, count), gfp);
+    if(!_rec)
+        return NULL;
+
+    INIT_LIST_HEAD(&_rec->list);
+    _rec->count = count;
+    atomic_set(&_rec->pins, 0);
+
+    for(_idx = 0; _idx < count; ++_idx)
+    {
+        RB_CLEAR_NODE(&_rec->entries[_idx].node);
+        _rec->entries[_idx].block = block + _idx;
+        _rec->entries[_idx].rec = _rec;
+    }
+
+    return _rec;
+}
+
+static void __sbdd_cache_set_array(struct sbdd_cache* cache, struct bio* bio)
+{
+    struct sbdd* _dev = cache->ctx;
+
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+    bio_set_dev(bio, _dev->gd->part0);
+#else
+    bio->bi_disk = _dev->gd;
+    bio->bi_partno = 0;
+#endif
+}
+
+/* bdev NULL is the array, its bios go to the target */
+static struct bio* __sbdd_cache_alloc_bio(struct sbdd_cache* cache, struct block_device* bdev, unsigned short nr_vecs, unsigned int opf)
+{
+    struct sbdd_cache_io*   _io = NULL;
+    struct bio*             _bio = NULL;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _bio = bio_alloc_bioset(GFP_NOIO, nr_vecs, &cache->bio_set);
+    _bio->bi_opf = opf;
+#else
+    _bio = bio_alloc_bioset(bdev, nr_vecs, opf, GFP_NOIO, &cache->bio_set);
+#endif
+
+    if(bdev)
+        bio_set_dev(_bio, bdev);
+    else
+        __sbdd_cache_set_array(cache, _bio);
+
+    _io = container_of(_bio, struct sbdd_cache_io, bio);
+    _io->cache = cache;
+    _io->rec = NULL;
+    _io->logged = false;
+    _io->page = NULL;
+    _io->batch = NULL;
+
+    return _bio;
+}
+
+static struct bio* __sbdd_cache_clone(struct sbdd_cache* cache, struct bio* bio)
+{
+    struct sbdd_cache_io*   _io = NULL;
+    struct bio*             _clone = NULL;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _clone = bio_clone_fast(bio, GFP_NOIO, &cache->bio_set);
+#else
+    _clone = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &cache->bio_set);
+#endif
+
+    _io = container_of(_clone, struct sbdd_cache_io, bio);
+    _io->cache = cache;
+    _io->rec = NULL;
+    _io->logged = false;
+    _io->page = NULL;
+    _io->batch = NULL;
+
+    return _clone;
+}
+
+/* Next piece of bio up to sectors, the last one is a clone of what is left */
+static struct bio* __sbdd_cache_next_piece(struct sbdd_cache* cache, struct bio* bio, u32 sectors)
+{
+    struct sbdd_cache_io*   _io = NULL;
+    struct bio*             _piece = NULL;
+
+    if(sectors >= bio_sectors(bio))
+        return __sbdd_cache_clone(cache, bio);
+
+    _piece = bio_split(bio, sectors, GFP_NOIO, &cache->bio_set);
+
+    _io = container_of(_piece, struct sbdd_cache_io, bio);
+    _io->cache = cache;
+    _io->rec = NULL;
+    _io->logged = false;
+    _io->page = NULL;
+    _io->batch = NULL;
+
+    return _piece;
+}
+
+static void __sbdd_cache_batch_init(struct sbdd_cache_batch* batch)
+{
+    /* The submitter holds one until everything is sent */
+    atomic_set(&batch->pending, 1);
+    batch->status = BLK_STS_OK;
+    init_completion(&batch->done);
+}
+
+static blk_status_t __sbdd_cache_batch_wait(struct sbdd_cache_batch* batch)
+{
+    if(!atomic_dec_and_test(&batch->pending))
+        wait_for_completion_io(&batch->done);
+
+    return READ_ONCE(batch->status);
+}
+
+static void __sbdd_cache_batch_endio(struct bio* bio)
+{
+    struct sbdd_cache_io* _io = container_of(bio, struct sbdd_cache_io, bio);
+
+    if(bio->bi_status)
+        WRITE_ONCE(_io->batch->status, bio->bi_status);
+
+    if(atomic_dec_and_test(&_io->batch->pending))
+        complete(&_io->batch->done);
+
+    bio_put(bio);
+}
+
+static void __sbdd_cache_batch_submit(struct sbdd_cache* cache, struct bio* bio, struct sbdd_cache_batch* batch, bool to_array)
+{
+    struct sbdd_cache_io* _io = container_of(bio, struct sbdd_cache_io, bio);
+
+    _io->batch = batch;
+    bio->bi_end_io = __sbdd_cache_batch_endio;
+    atomic_inc(&batch->pending);
+
+    if(to_array)
+    {
+        cache->process_bio(bio);
+        return;
+    }
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(bio);
+#else
+    submit_bio_noacct(bio);
+#endif
+}
+
+static int __sbdd_cache_sync_io(struct sbdd_cache* cache, u64 block, struct page** pages, u32 count, unsigned int opf)
+{
+    struct bio* _bio = NULL;
+    u32         _idx = 0;
+    int         _ret = 0;
+
+    _bio = __sbdd_cache_alloc_bio(cache, cache->bdev, count, opf);
+    _bio->bi_iter.bi_sector = block << SBDD_CACHE_BLOCK_SHIFT;
+
+    for(_idx = 0; _idx < count; ++_idx)
+        bio_add_page(_bio, pages[_idx], PAGE_SIZE, 0);
+
+    _ret = submit_bio_wait(_bio);
+    bio_put(_bio);
+
+    return _ret;
+}
+
+static int __sbdd_cache_write_sb(struct sbdd_cache* cache, u64 tail, u64 tail_seq)
+{
+    struct page*            _page = NULL;
+    struct sbdd_cache_sb*   _sb = NULL;
+    int                     _ret = 0;
+
+    _page = alloc_page(GFP_NOIO | __GFP_ZERO);
+    if(!_page)
+        return -ENOMEM;
+
+    _sb = page_address(_page);
+    _sb->magic = cpu_to_le32(SBDD_CACHE_MAGIC);
+    _sb->version = cpu_to_le32(SBDD_CACHE_VERSION);
+    _sb->block_size = cpu_to_le32(PAGE_SIZE);
+    _sb->capacity = cpu_to_le64(cache->capacity);
+    _sb->nr_blocks = cpu_to_le64(cache->nr_blocks);
+    _sb->epoch = cpu_to_le64(cache->epoch);
+    _sb->tail = cpu_to_le64(tail);
+    _sb->tail_seq = cpu_to_le64(tail_seq);
+    _sb->crc = cpu_to_le32(crc32c(~0, _sb, sizeof(struct sbdd_cache_sb)));
+
+    _ret = __sbdd_cache_sync_io(cache, 0, &_page, 1, REQ_OP_WRITE | REQ_SYNC | REQ_FUA);
+    if(_ret)
+        pr_err("cache:: superblock write error: %d \n", _ret);
+
+    __free_page(_page);
+
+    return _ret;
+}
+
+/* Used log blocks, under the cache lock */
+static u64 __sbdd_cache_used(struct sbdd_cache* cache)
+{
+    if(cache->head >= cache->tail)
+        return cache->head - cache->tail;
+
+    return cache->nr_blocks - cache->tail + cache->head - SBDD_CACHE_LOG_START;
+}
+
+/*
+Where a record of blocks goes, U64_MAX if there is no room. A record never
+wraps, it goes to the log start if it does not fit before the device end.
+head never catches up with the tail, head == tail is an empty log.
+*/
+static u64 __sbdd_cache_fit(struct sbdd_cache* cache, u64 blocks)
+{
+    if(cache->head < cache->tail)
+        return cache->head + blocks < cache->tail ? cache->head : U64_MAX;
+
+    if(cache->head + blocks <= cache->nr_blocks)
+        return cache->head;
+
+    if(SBDD_CACHE_LOG_START + blocks < cache->tail)
+        return SBDD_CACHE_LOG_START;
+
+    return U64_MAX;
+}
+
+static bool __sbdd_cache_has_space(struct sbdd_cache* cache, u64 blocks)
+{
+    u64 _pos = 0;
+
+    spin_lock_irq(&cache->lock);
+    _pos = __sbdd_cache_fit(cache, blocks);
+    spin_unlock_irq(&cache->lock);
+
+    return _pos != U64_MAX;
+}
+
+/* Log position and seq of a record, waits for the destage to free room */
+static void __sbdd_cache_reserve(struct sbdd_cache* cache, struct sbdd_cache_rec* rec)
+{
+    u64 _blocks = rec->count + 1;
+    u64 _pos = 0;
+
+    mutex_lock(&cache->log_lock);
+    spin_lock_irq(&cache->lock);
+
+    while((_pos = __sbdd_cache_fit(cache, _blocks)) == U64_MAX)
+    {
+        spin_unlock_irq(&cache->lock);
+
+        wake_up(&cache->destage_wait);
+        wait_event(cache->space_wait, __sbdd_cache_has_space(cache, _blocks));
+
+        spin_lock_irq(&cache->lock);
+    }
+
+    rec->pos = _pos;
+    rec->seq = cache->next_seq++;
+    cache->head = _pos + _blocks;
+
+    /* Pinned until written, the log tail does not pass it before that */
+    atomic_set(&rec->pins, 1);
+    list_add_tail(&rec->list, &cache->recs);
+    atomic_inc(&cache->writing);
+
+    spin_unlock_irq(&cache->lock);
+    mutex_unlock(&cache->log_lock);
+
+    WRITE_ONCE(cache->last_write, jiffies);
+}
+
+/*
+Makes every completed write stable. Records reserved before are waited for
+first: a completed record after a torn one would not be found on recovery.
+*/
+static blk_status_t __sbdd_cache_flush(struct sbdd_cache* cache)
+{
+    int _ret = 0;
+
+    mutex_lock(&cache->log_lock);
+
+    wait_var_event(&cache->writing, !atomic_read(&cache->writing));
+
+    if(atomic_xchg(&cache->unflushed, 0))
+    {
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 12, 0))
+        _ret = blkdev_issue_flush(cache->bdev, GFP_NOIO, NULL);
+#elif (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 17, 0))
+        _ret = blkdev_issue_flush(cache->bdev, GFP_NOIO);
+#else
+        _ret = blkdev_issue_flush(cache->bdev);
+#endif
+        if(_ret)
+            atomic_set(&cache->unflushed, 1);
+    }
+
+    mutex_unlock(&cache->log_lock);
+
+    return errno_to_blk_status(_ret);
+}
+
+/* The array gets a flush only when writes went to it past the cache since the last one */
+static blk_status_t __sbdd_cache_flush_array(struct sbdd_cache* cache)
+{
+    struct sbdd_cache_batch _wait;
+    struct bio*             _bio = NULL;
+    blk_status_t            _status = BLK_STS_OK;
+
+    if(!atomic_xchg(&cache->array_unflushed, 0))
+        return BLK_STS_OK;
+
+    __sbdd_cache_batch_init(&_wait);
+    _bio = __sbdd_cache_alloc_bio(cache, NULL, 0, REQ_OP_WRITE | REQ_PREFLUSH | REQ_SYNC);
+    __sbdd_cache_batch_submit(cache, _bio, &_wait, true);
+    _status = __sbdd_cache_batch_wait(&_wait);
+
+    if(_status)
+        atomic_set(&cache->array_unflushed, 1);
+
+    return _status;
+}
+
+static void __sbdd_cache_rec_done(struct sbdd_cache* cache, struct sbdd_cache_rec* rec)
+{
+    unsigned long   _flags = 0;
+    u32             _idx = 0;
+
+    if(rec->status)
+    {
+        /* Not in the index, the space is reclaimed. The log can't be replayed past it */
+        pr_err("cache:: record %llu write error: %d \n", rec->seq, blk_status_to_errno(rec->status));
+    }
+    else
+    {
+        spin_lock_irqsave(&cache->lock, _flags);
+
+        for(_idx = 0; _idx < rec->count; ++_idx)
+            __sbdd_cache_insert(cache, &rec->entries[_idx]);
+
+        spin_unlock_irqrestore(&cache->lock, _flags);
+
+        atomic_set(&cache->unflushed, 1);
+    }
+
+    atomic_dec(&rec->pins);
+
+    if(atomic_dec_and_test(&cache->writing))
+        wake_up_var(&cache->writing);
+}
+
+static void __sbdd_cache_child_endio(struct bio* bio)
+{
+    struct sbdd_cache_io*   _io = container_of(bio, struct sbdd_cache_io, bio);
+    struct sbdd_cache_rec*  _rec = _io->rec;
+    struct bio*             _parent = bio->bi_private;
+
+    if(bio->bi_status && !_parent->bi_status)
+        _parent->bi_status = bio->bi_status;
+
+    if(_io->page)
+        __free_page(_io->page);
+
+    if(_io->logged)
+    {
+        if(bio->bi_status)
+            _rec->status = bio->bi_status;
+
+        if(atomic_dec_and_test(&_rec->pending))
+            __sbdd_cache_rec_done(_io->cache, _rec);
+    }
+    else if(_rec)
+    {
+        /* Read of cached blocks */
+        atomic_dec(&_rec->pins);
+    }
+    else if(op_is_write(bio_op(bio)) && !bio->bi_status)
+    {
+        /* Discard or write zeroes past the cache, the array has to be flushed for it */
+        atomic_set(&_io->cache->array_unflushed, 1);
+    }
+
+    bio_put(bio);
+    bio_endio(_parent);
+}
+
+static void __sbdd_cache_chain(struct bio* child, struct bio* parent)
+{
+    child->bi_private = parent;
+    child->bi_end_io = __sbdd_cache_child_endio;
+    bio_inc_remaining(parent);
+}
+
+/* A record is its header and the piece data written side by side, both chained to parent */
+static void __sbdd_cache_write_rec(struct sbdd_cache* cache, struct bio* parent, struct bio* piece)
+{
+    struct sbdd_cache_rec_hdr*  _hdr = NULL;
+    struct sbdd_cache_rec*      _rec = NULL;
+    struct sbdd_cache_io*       _io = NULL;
+    struct page*                _page = NULL;
+    struct bio*                 _bio = NULL;
+    struct bio_vec              _bv;
+    struct bvec_iter            _iter;
+    unsigned int                _opf = REQ_OP_WRITE | (parent->bi_opf & (REQ_SYNC | REQ_FUA));
+    u32                         _count = bio_sectors(piece) >> SBDD_CACHE_BLOCK_SHIFT;
+    u32                         _crc = 0;
+    u32                         _idx = 0;
+    char*                       _ptr = NULL;
+
+    _rec = __sbdd_cache_alloc_rec(piece->bi_iter.bi_sector >> SBDD_CACHE_BLOCK_SHIFT, _count, GFP_NOIO);
+    _page = alloc_page(GFP_NOIO | __GFP_ZERO);
+    if(!_rec || !_page)
+    {
+        kfree(_rec);
+        if(_page)
+            __free_page(_page);
+
+        __sbdd_cache_chain(piece, parent);
+        bio_io_error(piece);
+        return;
+    }
+
+    __sbdd_cache_reserve(cache, _rec);
+
+    _hdr = page_address(_page);
+    _hdr->magic = cpu_to_le32(SBDD_CACHE_REC_MAGIC);
+    _hdr->seq = cpu_to_le64(_rec->seq);
+    _hdr->count = cpu_to_le32(_count);
+    for(_idx = 0; _idx < _count; ++_idx)
+        _hdr->blocks[_idx] = cpu_to_le64(_rec->entries[_idx].block);
+
+    /* The queue has stable writes, the pages do not change while they are written */
+    _crc = crc32c(~0, _hdr, PAGE_SIZE);
+    bio_for_each_segment(_bv, piece, _iter)
+    {
+        _ptr = kmap_atomic(_bv.bv_page);
+        _crc = crc32c(_crc, _ptr + _bv.bv_offset, _bv.bv_len);
+        kunmap_atomic(_ptr);
+    }
+    _hdr->crc = cpu_to_le32(_crc);
+
+    atomic_set(&_rec->pending, 2);
+
+    _bio = __sbdd_cache_alloc_bio(cache, cache->bdev, 1, _opf);
+    _bio->bi_iter.bi_sector = _rec->pos << SBDD_CACHE_BLOCK_SHIFT;
+    bio_add_page(_bio, _page, PAGE_SIZE, 0);
+
+    _io = container_of(_bio, struct sbdd_cache_io, bio);
+    _io->rec = _rec;
+    _io->logged = true;
+    _io->page = _page;
+    __sbdd_cache_chain(_bio, parent);
+
+    _io = container_of(piece, struct sbdd_cache_io, bio);
+    _io->rec = _rec;
+    _io->logged = true;
+    __sbdd_cache_chain(piece, parent);
+
+    bio_set_dev(piece, cache->bdev);
+    piece->bi_opf = _opf;
+    piece->bi_iter.bi_sector = (_rec->pos + 1) << SBDD_CACHE_BLOCK_SHIFT;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(_bio);
+    generic_make_request(piece);
+#else
+    submit_bio_noacct(_bio);
+    submit_bio_noacct(piece);
+#endif
+}
+
+static void __sbdd_cache_write(struct sbdd_cache* cache, struct bio* bio)
+{
+    struct bio* _piece = NULL;
+    bool        _last = false;
+
+    while(!_last)
+    {
+        _last = bio_sectors(bio) <= (SBDD_CACHE_REC_BLOCKS << SBDD_CACHE_BLOCK_SHIFT);
+        _piece = __sbdd_cache_next_piece(cache, bio, SBDD_CACHE_REC_BLOCKS << SBDD_CACHE_BLOCK_SHIFT);
+
+        __sbdd_cache_write_rec(cache, bio, _piece);
+    }
+
+    /* Drop the parent own reference, it completes with the last record */
+    bio_endio(bio);
+}
+
+/*
+Reads are cut into runs of blocks that are all cached in consecutive log
+blocks of one record, read from the cache, and runs that are not cached,
+sent to the array. The record of a run read from the cache is pinned, so
+its log blocks are not reused before the read is done.
+*/
+static void __sbdd_cache_read(struct sbdd_cache* cache, struct bio* bio)
+{
+    struct sbdd_cache_entry*    _entry = NULL;
+    struct sbdd_cache_entry*    _next = NULL;
+    struct sbdd_cache_rec*      _rec = NULL;
+    struct sbdd_cache_io*       _io = NULL;
+    struct bio*                 _piece = NULL;
+    struct rb_node*             _node = NULL;
+    u64                         _block = 0;
+    u64                         _left = 0;
+    u64                         _loc = 0;
+    u64                         _run = 0;
+    bool                        _first = true;
+
+    while(true)
+    {
+        _block = bio->bi_iter.bi_sector >> SBDD_CACHE_BLOCK_SHIFT;
+        _left = bio_sectors(bio) >> SBDD_CACHE_BLOCK_SHIFT;
+        _rec = NULL;
+
+        spin_lock_irq(&cache->lock);
+
+        _entry = __sbdd_cache_lower_bound(cache, _block);
+        if(_entry && _entry->block == _block)
+        {
+            _rec = _entry->rec;
+            _loc = __sbdd_cache_loc(_entry);
+            atomic_inc(&_rec->pins);
+
+            for(_run = 1, _node = rb_next(&_entry->node); _run < _left && _node; ++_run, _node = rb_next(_node))
+            {
+                _next = rb_entry(_node, struct sbdd_cache_entry, node);
+                if(_next->block != _block + _run || _next->rec != _rec || __sbdd_cache_loc(_next) != _loc + _run)
+                    break;
+            }
+        }
+        else
+        {
+            _run = _entry ? min(_left, _entry->block - _block) : _left;
+        }
+
+        spin_unlock_irq(&cache->lock);
+
+        /* Nothing cached */
+        if(_first && !_rec && _run == _left)
+        {
+            cache->process_bio(bio);
+            return;
+        }
+
+        _first = false;
+
+        _piece = __sbdd_cache_next_piece(cache, bio, _run << SBDD_CACHE_BLOCK_SHIFT);
+        __sbdd_cache_chain(_piece, bio);
+
+        if(_rec)
+        {
+            _io = container_of(_piece, struct sbdd_cache_io, bio);
+            _io->rec = _rec;
+
+            bio_set_dev(_piece, cache->bdev);
+            _piece->bi_iter.bi_sector = _loc << SBDD_CACHE_BLOCK_SHIFT;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+            generic_make_request(_piece);
+#else
+            submit_bio_noacct(_piece);
+#endif
+        }
+        else
+        {
+            cache->process_bio(_piece);
+        }
+
+        if(_run == _left)
+            break;
+    }
+
+    bio_endio(bio);
+}
+
+/* Drops the cached blocks [first, last), under the cache lock */
+static void __sbdd_cache_drop(struct sbdd_cache* cache, u64 first, u64 last)
+{
+    struct sbdd_cache_entry*    _entry = NULL;
+    struct rb_node*             _node = NULL;
+
+    _entry = __sbdd_cache_lower_bound(cache, first);
+    while(_entry && _entry->block < last)
+    {
+        _node = rb_next(&_entry->node);
+        __sbdd_cache_remove(cache, _entry);
+        _entry = _node ? rb_entry(_node, struct sbdd_cache_entry, node) : NULL;
+    }
+}
+
+/*
+Discards, write zeroes and unaligned writes go to the array past the cache.
+Their blocks are dropped from the index and a trim record is logged along
+with the array io, so a replay of the log does not bring the old data back.
+*/
+static void __sbdd_cache_pass(struct sbdd_cache* cache, struct bio* bio)
+{
+    struct sbdd_cache_rec_hdr*  _hdr = NULL;
+    struct sbdd_cache_rec*      _rec = NULL;
+    struct sbdd_cache_io*       _io = NULL;
+    struct page*                _page = NULL;
+    struct bio*                 _bio = NULL;
+    u64                         _first = bio->bi_iter.bi_sector >> SBDD_CACHE_BLOCK_SHIFT;
+    u64                         _last = DIV_ROUND_UP(bio_end_sector(bio), 1 << SBDD_CACHE_BLOCK_SHIFT);
+
+    _rec = __sbdd_cache_alloc_rec(_first, 0, GFP_NOIO);
+    _page = alloc_page(GFP_NOIO | __GFP_ZERO);
+    if(!_rec || !_page)
+    {
+        kfree(_rec);
+        if(_page)
+            __free_page(_page);
+
+        bio_io_error(bio);
+        return;
+    }
+
+    /* A destage batch in progress could write the old data back after it */
+    mutex_lock(&cache->destage_lock);
+    spin_lock_irq(&cache->lock);
+    __sbdd_cache_drop(cache, _first, _last);
+    spin_unlock_irq(&cache->lock);
+    mutex_unlock(&cache->destage_lock);
+
+    __sbdd_cache_reserve(cache, _rec);
+
+    _hdr = page_address(_page);
+    _hdr->magic = cpu_to_le32(SBDD_CACHE_REC_MAGIC);
+    _hdr->seq = cpu_to_le64(_rec->seq);
+    _hdr->flags = cpu_to_le32(SBDD_CACHE_REC_TRIM);
+    _hdr->blocks[0] = cpu_to_le64(_first);
+    _hdr->blocks[1] = cpu_to_le64(_last);
+    _hdr->crc = cpu_to_le32(crc32c(~0, _hdr, PAGE_SIZE));
+
+    atomic_set(&_rec->pending, 1);
+
+    _bio = __sbdd_cache_alloc_bio(cache, cache->bdev, 1, REQ_OP_WRITE | (bio->bi_opf & REQ_SYNC));
+    _bio->bi_iter.bi_sector = _rec->pos << SBDD_CACHE_BLOCK_SHIFT;
+    bio_add_page(_bio, _page, PAGE_SIZE, 0);
+
+    _io = container_of(_bio, struct sbdd_cache_io, bio);
+    _io->rec = _rec;
+    _io->logged = true;
+    _io->page = _page;
+    __sbdd_cache_chain(_bio, bio);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(_bio);
+#else
+    submit_bio_noacct(_bio);
+#endif
+
+    /* The array io is a child too, the bio completes once both are done and its completion marks the array unflushed */
+    _bio = __sbdd_cache_clone(cache, bio);
+    __sbdd_cache_chain(_bio, bio);
+    cache->process_bio(_bio);
+
+    bio_endio(bio);
+}
+
+static blk_qc_t __sbdd_cache_process_bio(struct sbdd_cache* cache, struct bio* bio)
+{
+    blk_status_t _status = BLK_STS_OK;
+
+    if(bio->bi_opf & (REQ_PREFLUSH | REQ_FUA))
+    {
+        /* A FUA record is only found on recovery if the ones before it are stable too */
+        _status = __sbdd_cache_flush(cache);
+        if(!_status && (bio->bi_opf & REQ_PREFLUSH))
+            _status = __sbdd_cache_flush_array(cache);
+        if(_status || !bio_sectors(bio))
+        {
+            bio->bi_status = _status;
+            bio_endio(bio);
+            return BLK_STS_OK;
+        }
+    }
+
+    if(!IS_ALIGNED(bio->bi_iter.bi_sector | bio_sectors(bio), 1 << SBDD_CACHE_BLOCK_SHIFT))
+    {
+        /* The array logical block is a cache block, this is not expected */
+        WARN_ON_ONCE(bio_has_data(bio));
+        __sbdd_cache_pass(cache, bio);
+        return BLK_STS_OK;
+    }
+
+    switch(bio_op(bio))
+    {
+    case REQ_OP_READ:
+        __sbdd_cache_read(cache, bio);
+        break;
+    case REQ_OP_WRITE:
+        __sbdd_cache_write(cache, bio);
+        break;
+    default:
+        /* Discard and write zeroes go to the array, the blocks are not cached any more */
+        __sbdd_cache_pass(cache, bio);
+        break;
+    }
+
+    return BLK_STS_OK;
+}
+
+/*
+Frees the records at the log tail that have no live entries and moves the
+tail in the superblock past them, once the array is flushed. The log space
+is reused only after that.
+*/
+static void __sbdd_cache_reclaim(struct sbdd_cache* cache)
+{
+    struct sbdd_cache_rec*  _rec = NULL;
+    struct sbdd_cache_rec*  _tmp = NULL;
+    LIST_HEAD(_free);
+    u64                     _tail = 0;
+    u64                     _tail_seq = 0;
+
+    spin_lock_irq(&cache->lock);
+
+    while(!list_empty(&cache->recs))
+    {
+        _rec = list_first_entry(&cache->recs, struct sbdd_cache_rec, list);
+        if(_rec->live || atomic_read(&_rec->pins))
+            break;
+
+        list_move_tail(&_rec->list, &_free);
+    }
+
+    if(list_empty(&cache->recs))
+    {
+        _tail = cache->head;
+        _tail_seq = cache->next_seq;
+    }
+    else
+    {
+        _rec = list_first_entry(&cache->recs, struct sbdd_cache_rec, list);
+        _tail = _rec->pos;
+        _tail_seq = _rec->seq;
+    }
+
+    spin_unlock_irq(&cache->lock);
+
+    if(list_empty(&_free))
+        return;
+
+    /* A trim record past the tail can't be replayed, the array ios it went with have to be stable first */
+    if(!__sbdd_cache_flush_array(cache) && !__sbdd_cache_write_sb(cache, _tail, _tail_seq))
+    {
+        spin_lock_irq(&cache->lock);
+        cache->tail = _tail;
+        spin_unlock_irq(&cache->lock);
+
+        wake_up_all(&cache->space_wait);
+    }
+
+    list_for_each_entry_safe(_rec, _tmp, &_free, list)
+        kfree(_rec);
+}
+
+/*
+Writes a batch of cached blocks back to the array. The batch is taken in
+block order from where the previous one ended, read from the cache, written
+to the array in runs of adjacent blocks and the array is flushed before the
+blocks are dropped from the index. Blocks written again meanwhile stay.
+*/
+static void __sbdd_cache_destage(struct sbdd_cache* cache)
+{
+    struct sbdd*                _dev = cache->ctx;
+    struct sbdd_cache_entry**   _batch = cache->batch;
+    struct sbdd_cache_entry*    _entry = NULL;
+    struct sbdd_cache_batch     _wait;
+    struct rb_node*             _node = NULL;
+    struct bio*                 _bio = NULL;
+    blk_status_t                _status = BLK_STS_OK;
+    u32                         _max_blocks = max_t(u32, queue_max_hw_sectors(_dev->gd->queue) >> SBDD_CACHE_BLOCK_SHIFT, 1);
+    u32                         _count = 0;
+    u32                         _idx = 0;
+    u32                         _run = 0;
+    u32                         _page = 0;
+
+    mutex_lock(&cache->destage_lock);
+    spin_lock_irq(&cache->lock);
+
+    _entry = __sbdd_cache_lower_bound(cache, cache->sweep);
+    _node = _entry ? &_entry->node : rb_first(&cache->index);
+
+    for(; _node && _count < SBDD_CACHE_DESTAGE_BLOCKS; _node = rb_next(_node))
+    {
+        _entry = rb_entry(_node, struct sbdd_cache_entry, node);
+        atomic_inc(&_entry->rec->pins);
+        _batch[_count++] = _entry;
+    }
+
+    cache->sweep = _node ? _batch[_count - 1]->block + 1 : 0;
+
+    spin_unlock_irq(&cache->lock);
+
+    if(!_count)
+    {
+        mutex_unlock(&cache->destage_lock);
+        return;
+    }
+
+    /* Runs of consecutive log blocks are read at once */
+    __sbdd_cache_batch_init(&_wait);
+    for(_idx = 0; _idx < _count; _idx += _run)
+    {
+        for(_run = 1; _idx + _run < _count &&
+            __sbdd_cache_loc(_batch[_idx + _run]) == __sbdd_cache_loc(_batch[_idx]) + _run; ++_run);
+
+        _bio = __sbdd_cache_alloc_bio(cache, cache->bdev, _run, REQ_OP_READ);
+        _bio->bi_iter.bi_sector = __sbdd_cache_loc(_batch[_idx]) << SBDD_CACHE_BLOCK_SHIFT;
+        for(_page = 0; _page < _run; ++_page)
+            bio_add_page(_bio, cache->pages[_idx + _page], PAGE_SIZE, 0);
+
+        __sbdd_cache_batch_submit(cache, _bio, &_wait, false);
+    }
+    _status = __sbdd_cache_batch_wait(&_wait);
+
+    /* Runs of adjacent array blocks are written at once */
+    __sbdd_cache_batch_init(&_wait);
+    for(_idx = 0; !_status && _idx < _count; _idx += _run)
+    {
+        for(_run = 1; _idx + _run < _count && _run < _max_blocks &&
+            _batch[_idx + _run]->block == _batch[_idx]->block + _run; ++_run);
+
+        _bio = __sbdd_cache_alloc_bio(cache, NULL, _run, REQ_OP_WRITE);
+        _bio->bi_iter.bi_sector = _batch[_idx]->block << SBDD_CACHE_BLOCK_SHIFT;
+        for(_page = 0; _page < _run; ++_page)
+            bio_add_page(_bio, cache->pages[_idx + _page], PAGE_SIZE, 0);
+
+        __sbdd_cache_batch_submit(cache, _bio, &_wait, true);
+    }
+    if(!_status)
+        _status = __sbdd_cache_batch_wait(&_wait);
+
+    /* The log is reused after this, the array has to have the data stable */
+    if(!_status)
+    {
+        __sbdd_cache_batch_init(&_wait);
+        _bio = __sbdd_cache_alloc_bio(cache, NULL, 0, REQ_OP_WRITE | REQ_PREFLUSH | REQ_SYNC);
+        __sbdd_cache_batch_submit(cache, _bio, &_wait, true);
+        _status = __sbdd_cache_batch_wait(&_wait);
+    }
+
+    if(_status)
+        pr_err("cache:: destage error: %d, blocks stay cached \n", blk_status_to_errno(_status));
+
+    spin_lock_irq(&cache->lock);
+
+    for(_idx = 0; _idx < _count; ++_idx)
+    {
+        if(!_status && !RB_EMPTY_NODE(&_batch[_idx]->node))
+            __sbdd_cache_remove(cache, _batch[_idx]);
+
+        atomic_dec(&_batch[_idx]->rec->pins);
+    }
+
+    spin_unlock_irq(&cache->lock);
+    mutex_unlock(&cache->destage_lock);
+}
+
+/* Half of the log is used, writers wait for room or the array is idle for a second */
+static bool __sbdd_cache_need_destage(struct sbdd_cache* cache)
+{
+    bool _need = false;
+
+    spin_lock_irq(&cache->lock);
+
+    if(cache->cached)
+    {
+        _need = __sbdd_cache_used(cache) * 2 >= cache->nr_blocks ||
+                waitqueue_active(&cache->space_wait) ||
+                time_after(jiffies, READ_ONCE(cache->last_write) + HZ);
+    }
+
+    spin_unlock_irq(&cache->lock);
+
+    return _need;
+}
+
+static int __sbdd_cache_destager(void* data)
+{
+    struct sbdd_cache* _cache = data;
+
+    while(!kthread_should_stop())
+    {
+        wait_event_interruptible_timeout(_cache->destage_wait,
+                                         kthread_should_stop() || __sbdd_cache_need_destage(_cache), HZ);
+
+        if(kthread_should_stop())
+            break;
+
+        if(__sbdd_cache_need_destage(_cache))
+            __sbdd_cache_destage(_cache);
+
+        __sbdd_cache_reclaim(_cache);
+    }
+
+    return 0;
+}
+
+/* Record seqs go up by one within a load epoch, a later epoch starts from 0 */
+static bool __sbdd_cache_seq_follows(struct sbdd_cache* cache, u64 prev, u64 seq, bool first)
+{
+    if(seq == (first ? prev : prev + 1))
+        return true;
+
+    return SBDD_CACHE_SEQ_EPOCH(seq) > SBDD_CACHE_SEQ_EPOCH(prev) &&
+           SBDD_CACHE_SEQ_EPOCH(seq) < cache->epoch && !SBDD_CACHE_SEQ_COUNT(seq);
+}
+
+/* Valid record at pos following prev, its header is left in the header page */
+static struct sbdd_cache_rec* __sbdd_cache_load_rec(struct sbdd_cache* cache, struct page* page, u64 pos, u64 prev, bool first)
+{
+    struct sbdd_cache_rec_hdr*  _hdr = page_address(page);
+    struct sbdd_cache_rec*      _rec = NULL;
+    u32                         _count = 0;
+    u32                         _crc = 0;
+    u32                         _expected = 0;
+    u32                         _idx = 0;
+    bool                        _trim = false;
+
+    if(pos + 1 >= cache->nr_blocks || __sbdd_cache_sync_io(cache, pos, &page, 1, REQ_OP_READ))
+        return NULL;
+
+    _count = le32_to_cpu(_hdr->count);
+    _trim = le32_to_cpu(_hdr->flags) & SBDD_CACHE_REC_TRIM;
+
+    if(le32_to_cpu(_hdr->magic) != SBDD_CACHE_REC_MAGIC || (_trim ? _count : !_count || _count > SBDD_CACHE_REC_BLOCKS) ||
+        pos + 1 + _count > cache->nr_blocks || !__sbdd_cache_seq_follows(cache, prev, le64_to_cpu(_hdr->seq), first))
+        return NULL;
+
+    if(_count && __sbdd_cache_sync_io(cache, pos + 1, cache->pages, _count, REQ_OP_READ))
+        return NULL;
+
+    _crc = le32_to_cpu(_hdr->crc);
+    _hdr->crc = 0;
+
+    /* Data pages are separate allocations, the crc runs over them one by one */
+    _expected = crc32c(~0, _hdr, PAGE_SIZE);
+    for(_idx = 0; _idx < _count; ++_idx)
+        _expected = crc32c(_expected, page_address(cache->pages[_idx]), PAGE_SIZE);
+
+    if(_crc != _expected)
+        return NULL;
+
+    if(_trim && (le64_to_cpu(_hdr->blocks[0]) >= le64_to_cpu(_hdr->blocks[1]) ||
+        le64_to_cpu(_hdr->blocks[1]) > DIV_ROUND_UP(cache->capacity, 1 << SBDD_CACHE_BLOCK_SHIFT)))
+        return NULL;
+
+    _rec = __sbdd_cache_alloc_rec(0, _count, GFP_KERNEL);
+    if(!_rec)
+        return NULL;
+
+    _rec->pos = pos;
+    _rec->seq = le64_to_cpu(_hdr->seq);
+    for(_idx = 0; _idx < _count; ++_idx)
+    {
+        _rec->entries[_idx].block = le64_to_cpu(_hdr->blocks[_idx]);
+
+        if(_rec->entries[_idx].block >= cache->capacity >> SBDD_CACHE_BLOCK_SHIFT)
+        {
+            kfree(_rec);
+            return NULL;
+        }
+    }
+
+    return _rec;
+}
+
+/*
+Reads the superblock and replays the log from its tail, so the index is
+back as it was. The chain of records ends at the first block that is not
+the next record, a record that does not fit before the device end is at
+the log start. A trim record drops the blocks of the records before it.
+A new device is formatted.
+*/
+static int __sbdd_cache_load(struct sbdd_cache* cache)
+{
+    struct sbdd_cache_rec_hdr*  _hdr = NULL;
+    struct sbdd_cache_sb*       _sb = NULL;
+    struct sbdd_cache_rec*      _rec = NULL;
+    struct page*                _page = NULL;
+    u64                         _pos = 0;
+    u64                         _head = 0;
+    u64                         _prev = 0;
+    u64                         _records = 0;
+    u32                         _crc = 0;
+    u32                         _idx = 0;
+    bool                        _wrapped = false;
+    int                         _ret = 0;
+
+    _page = alloc_page(GFP_KERNEL);
+    if(!_page)
+        return -ENOMEM;
+
+    _ret = __sbdd_cache_sync_io(cache, 0, &_page, 1, REQ_OP_READ);
+    if(_ret)
+        goto out;
+
+    _sb = page_address(_page);
+    _crc = le32_to_cpu(_sb->crc);
+    _sb->crc = 0;
+
+    if(le32_to_cpu(_sb->magic) != SBDD_CACHE_MAGIC || _crc != crc32c(~0, _sb, sizeof(struct sbdd_cache_sb)))
+    {
+        pr_info("cache:: no superblock on %s, formatting \n", cache->path);
+
+        cache->epoch = 1;
+        cache->head = cache->tail = SBDD_CACHE_LOG_START;
+        cache->next_seq = cache->epoch << SBDD_CACHE_SEQ_EPOCH_SHIFT;
+
+        _ret = __sbdd_cache_write_sb(cache, cache->tail, cache->next_seq);
+        goto out;
+    }
+
+    if(le32_to_cpu(_sb->version) != SBDD_CACHE_VERSION || le32_to_cpu(_sb->block_size) != PAGE_SIZE ||
+        le64_to_cpu(_sb->capacity) != cache->capacity || le64_to_cpu(_sb->nr_blocks) > cache->nr_blocks)
+    {
+        pr_err("cache:: %s belongs to another array: capacity %llu, block size %u \n", cache->path,
+               le64_to_cpu(_sb->capacity), le32_to_cpu(_sb->block_size));
+        _ret = -EINVAL;
+        goto out;
+    }
+
+    /* Records of this load get a new epoch, stale records of earlier loads never follow them */
+    cache->nr_blocks = le64_to_cpu(_sb->nr_blocks);
+    cache->epoch = le64_to_cpu(_sb->epoch) + 1;
+    cache->tail = le64_to_cpu(_sb->tail);
+    _prev = le64_to_cpu(_sb->tail_seq);
+    _pos = _head = cache->tail;
+
+    while(_records < cache->nr_blocks)
+    {
+        _rec = __sbdd_cache_load_rec(cache, _page, _pos, _prev, !_records);
+        if(!_rec && !_wrapped && _pos != SBDD_CACHE_LOG_START)
+        {
+            _wrapped = true;
+            _pos = SBDD_CACHE_LOG_START;
+            continue;
+        }
+
+        if(!_rec)
+            break;
+
+        for(_idx = 0; _idx < _rec->count; ++_idx)
+            __sbdd_cache_insert(cache, &_rec->entries[_idx]);
+
+        _hdr = page_address(_page);
+        if(le32_to_cpu(_hdr->flags) & SBDD_CACHE_REC_TRIM)
+            __sbdd_cache_drop(cache, le64_to_cpu(_hdr->blocks[0]), le64_to_cpu(_hdr->blocks[1]));
+
+        list_add_tail(&_rec->list, &cache->recs);
+
+        _prev = _rec->seq;
+        _pos = _head = _pos + 1 + _rec->count;
+        _wrapped = false;
+        ++_records;
+    }
+
+    cache->head = _head;
+    cache->next_seq = cache->epoch << SBDD_CACHE_SEQ_EPOCH_SHIFT;
+
+    pr_info("cache:: replayed %llu records, %llu blocks cached \n", _records, cache->cached);
+
+    /* The tail seq stays the one of the first record, a new epoch follows any */
+    _ret = __sbdd_cache_write_sb(cache, cache->tail, list_empty(&cache->recs) ? cache->next_seq :
+                                 list_first_entry(&cache->recs, struct sbdd_cache_rec, list)->seq);
+
+out:
+    __free_page(_page);
+
+    return _ret;
+}
+
+int sbdd_cache_create(struct sbdd_cache* cache, char* path, process_bio_t process_bio, sector_t capacity, void* ctx)
+{
+    int _ret = 0;
+    u32 _idx = 0;
+
+    cache->path = path;
+    cache->ctx = ctx;
+    cache->process_bio = process_bio;
+    cache->capacity = capacity;
+    cache->index = RB_ROOT;
+
+    spin_lock_init(&cache->lock);
+    mutex_init(&cache->log_lock);
+    mutex_init(&cache->destage_lock);
+    init_waitqueue_head(&cache->space_wait);
+    init_waitqueue_head(&cache->destage_wait);
+    INIT_LIST_HEAD(&cache->recs);
+    atomic_set(&cache->writing, 0);
+    atomic_set(&cache->unflushed, 0);
+    atomic_set(&cache->array_unflushed, 0);
+    cache->last_write = jiffies;
+
+    _ret = bioset_init(&cache->bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_cache_io, bio),
+                       BIOSET_NEED_BVECS | BIOSET_NEED_RESCUER);
+    if(_ret)
+    {
+        pr_err("cache:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    cache->batch = kcalloc(SBDD_CACHE_DESTAGE_BLOCKS, sizeof(struct sbdd_cache_entry*), GFP_KERNEL);
+    cache->pages = kcalloc(SBDD_CACHE_DESTAGE_BLOCKS, sizeof(struct page*), GFP_KERNEL);
+    if(!cache->batch || !cache->pages)
+        return -ENOMEM;
+
+    for(_idx = 0; _idx < SBDD_CACHE_DESTAGE_BLOCKS; ++_idx)
+    {
+        cache->pages[_idx] = alloc_page(GFP_KERNEL);
+        if(!cache->pages[_idx])
+            return -ENOMEM;
+    }
+
+    cache->bdev = blkdev_get_by_path(path, SBDD_CACHE_FMODE, NULL);
+    if(IS_ERR(cache->bdev))
+    {
+        pr_err("cache:: cannot open cache device '%s' \n", path);
+        _ret = PTR_ERR(cache->bdev);
+        cache->bdev = NULL;
+        return _ret;
+    }
+
+    cache->nr_blocks = bdev_nr_sectors(cache->bdev) >> SBDD_CACHE_BLOCK_SHIFT;
+    if(cache->nr_blocks < SBDD_CACHE_LOG_START + 4 * (SBDD_CACHE_REC_BLOCKS + 1))
+    {
+        pr_err("cache:: cache device '%s' is too small \n", path);
+        return -EINVAL;
+    }
+
+    _ret = __sbdd_cache_load(cache);
+    if(_ret)
+        return _ret;
+
+    pr_info("cache:: device: %s, blocks: %llu, epoch: %llu \n", path, cache->nr_blocks, cache->epoch);
+
+    return 0;
+}
+
+int sbdd_cache_start(struct sbdd_cache* cache)
+{
+    if(!sbdd_cache_is_enabled(cache))
+        return 0;
+
+    cache->destager = kthread_run(__sbdd_cache_destager, cache, "sbdd_destage");
+    if(IS_ERR(cache->destager))
+    {
+        pr_err("cache:: can't start destage thread \n");
+        cache->destager = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Cached blocks stay in the log and are found on the next load */
+void sbdd_cache_destroy(struct sbdd_cache* cache)
+{
+    struct sbdd_cache_rec*  _rec = NULL;
+    struct sbdd_cache_rec*  _tmp = NULL;
+    u32                     _idx = 0;
+
+    if(cache->destager)
+        kthread_stop(cache->destager);
+    cache->destager = NULL;
+
+    if(cache->bdev)
+    {
+        __sbdd_cache_flush(cache);
+        __sbdd_cache_reclaim(cache);
+
+        blkdev_put(cache->bdev, SBDD_CACHE_FMODE);
+        cache->bdev = NULL;
+    }
+
+    list_for_each_entry_safe(_rec, _tmp, &cache->recs, list)
+        kfree(_rec);
+    INIT_LIST_HEAD(&cache->recs);
+    cache->index = RB_ROOT;
+    cache->cached = 0;
+
+    for(_idx = 0; cache->pages && _idx < SBDD_CACHE_DESTAGE_BLOCKS; ++_idx)
+    {
+        if(cache->pages[_idx])
+            __free_page(cache->pages[_idx]);
+    }
+
+    kfree(cache->pages);
+    kfree(cache->batch);
+    cache->pages = NULL;
+    cache->batch = NULL;
+
+    bioset_exit(&cache->bio_set);
+
+    kfree(cache->path);
+    cache->path = NULL;
+}
+
+blk_qc_t sbdd_cache_process_bio(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+    return __sbdd_cache_process_bio(&_dev->cache, bio);
+}
+
+bool sbdd_cache_bio_may_block(struct bio* bio)
+{
+    /* Log space reservation and flushes sleep, bios are processed by the io workers only */
+    return true;
+}
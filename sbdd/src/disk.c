@@ -3,7 +3,7 @@
 #include <kernel_version.h>
 #include <disk.h>
 
-int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops)
+int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops, unsigned int nr_hw_queues, unsigned int queue_depth)
 {
   	int _ret = 0;
 
@@ -18,11 +18,17 @@ int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops)
         }
 
         /* Number of hardware dispatch queues */
-        device->tag_set->nr_hw_queues = 1;
+        device->tag_set->nr_hw_queues = nr_hw_queues ? nr_hw_queues : num_online_cpus();
         /* Depth of hardware dispatch queues */
-        device->tag_set->queue_depth = 128;
+        device->tag_set->queue_depth = queue_depth;
         device->tag_set->numa_node = NUMA_NO_NODE;
         device->tag_set->ops = mqops;
+        /* Per request completion state of the member clones */
+        device->tag_set->cmd_size = sizeof(struct sbdd_io_rq);
+        /* Clones are submitted to members right from queue_rq, that may sleep */
+        device->tag_set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+
+        pr_info("tag_set hw queues: %u, depth: %u\n", device->tag_set->nr_hw_queues, device->tag_set->queue_depth);
 
         _ret = blk_mq_alloc_tag_set(device->tag_set);
         if (_ret) {
@@ -46,9 +52,11 @@ int sbdd_alloc_disk(struct sbdd* device, const struct blk_mq_ops* mqops)
 #if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
         pr_info("allocating mq disk\n"); 
         device->gd = blk_mq_alloc_disk(device->tag_set, NULL);
-        if (!device->gd) {
-            pr_err("call alloc_disk() failed\n");
-            return -EINVAL;
+        if (IS_ERR(device->gd)) {
+            _ret = (int)PTR_ERR(device->gd);
+            pr_err("call blk_mq_alloc_disk() failed with %d\n", _ret);
+            device->gd = NULL;
+            return _ret;
         }
 #endif
     }
@@ -94,7 +102,7 @@ void sbdd_free_disk(struct sbdd* device)
 		del_gendisk(device->gd);
 	}
 
-	if (device->gd->queue) {
+	if (device->gd && device->gd->queue) {
 		pr_info("cleaning up queue\n");
 		blk_cleanup_queue(device->gd->queue);
 	}
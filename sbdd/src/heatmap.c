@@ -0,0 +1,287 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/jiffies.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <heatmap.h>
+
+static struct dentry* __sbdd_heatmap_root = NULL;
+
+struct sbdd_heatmap_snapshot {
+    size_t  size;
+    char    data[];
+};
+
+static u32 __sbdd_heatmap_epoch(struct sbdd_heatmap* heatmap)
+{
+    return (jiffies - heatmap->start) / (SBDD_HEATMAP_DECAY_SECS * HZ);
+}
+
+static u32 __sbdd_heatmap_score(struct sbdd_heatmap_region* region, u32 epoch)
+{
+    u32 _periods = epoch - READ_ONCE(region->epoch);
+
+    return _periods >= 32 ? 0 : READ_ONCE(region->score) >> _periods;
+}
+
+/* Updates are racy on purpose, a lost update only drops a sample */
+void __sbdd_heatmap_record(struct sbdd_heatmap* heatmap, struct bio* bio, sector_t sector)
+{
+    struct sbdd_heatmap_region* _region = NULL;
+    u64                         _idx = sector >> heatmap->region_shift;
+    u32                         _epoch = 0;
+
+    if(_idx >= heatmap->regions_count)
+        return;
+
+    _region = &heatmap->regions[_idx];
+    _epoch = __sbdd_heatmap_epoch(heatmap);
+
+    if(op_is_write(bio_op(bio)))
+        WRITE_ONCE(_region->writes, _region->writes + 1);
+    else
+        WRITE_ONCE(_region->reads, _region->reads + 1);
+
+    WRITE_ONCE(_region->score, __sbdd_heatmap_score(_region, _epoch) + 1);
+    WRITE_ONCE(_region->epoch, _epoch);
+}
+
+static void* __sbdd_heatmap_seq_start(struct seq_file* m, loff_t* pos)
+{
+    struct sbdd_heatmap* _heatmap = m->private;
+
+    if(*pos == 0)
+        return SEQ_START_TOKEN;
+
+    return *pos <= _heatmap->regions_count ? &_heatmap->regions[*pos - 1] : NULL;
+}
+
+static void* __sbdd_heatmap_seq_next(struct seq_file* m, void* v, loff_t* pos)
+{
+    ++*pos;
+
+    return __sbdd_heatmap_seq_start(m, pos);
+}
+
+static void __sbdd_heatmap_seq_stop(struct seq_file* m, void* v)
+{
+}
+
+static int __sbdd_heatmap_seq_show(struct seq_file* m, void* v)
+{
+    struct sbdd_heatmap*        _heatmap = m->private;
+    struct sbdd_heatmap_region* _region = v;
+    u64                         _idx = 0;
+
+    if(v == SEQ_START_TOKEN)
+    {
+        seq_puts(m, "region,start_sector,reads,writes,score\n");
+        return 0;
+    }
+
+    /* Untouched regions are left out to keep the dump small */
+    if(!READ_ONCE(_region->reads) && !READ_ONCE(_region->writes))
+        return 0;
+
+    _idx = _region - _heatmap->regions;
+
+    seq_printf(m, "%llu,%llu,%u,%u,%u\n", _idx, _idx << _heatmap->region_shift,
+               READ_ONCE(_region->reads), READ_ONCE(_region->writes),
+               __sbdd_heatmap_score(_region, __sbdd_heatmap_epoch(_heatmap)));
+
+    return 0;
+}
+
+static const struct seq_operations __sbdd_heatmap_seq_ops = {
+    .start  = __sbdd_heatmap_seq_start,
+    .next   = __sbdd_heatmap_seq_next,
+    .stop   = __sbdd_heatmap_seq_stop,
+    .show   = __sbdd_heatmap_seq_show,
+};
+
+static int __sbdd_heatmap_csv_open(struct inode* inode, struct file* file)
+{
+    int _ret = seq_open(file, &__sbdd_heatmap_seq_ops);
+
+    if(!_ret)
+        ((struct seq_file*)file->private_data)->private = inode->i_private;
+
+    return _ret;
+}
+
+static const struct file_operations __sbdd_heatmap_csv_fops = {
+    .owner      = THIS_MODULE,
+    .open       = __sbdd_heatmap_csv_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = seq_release,
+};
+
+/* The binary dump is a snapshot taken at open */
+static int __sbdd_heatmap_bin_open(struct inode* inode, struct file* file)
+{
+    struct sbdd_heatmap*            _heatmap = inode->i_private;
+    struct sbdd_heatmap_snapshot*   _snapshot = NULL;
+    struct sbdd_heatmap_header*     _header = NULL;
+    struct sbdd_heatmap_region*     _regions = NULL;
+    size_t                          _size = 0;
+    u32                             _epoch = __sbdd_heatmap_epoch(_heatmap);
+    u32                             _idx = 0;
+
+    _size = sizeof(struct sbdd_heatmap_header) + sizeof(struct sbdd_heatmap_region) * _heatmap->regions_count;
+
+    _snapshot = kvmalloc(sizeof(struct sbdd_heatmap_snapshot) + _size, GFP_KERNEL);
+    if(!_snapshot)
+        return -ENOMEM;
+
+    _snapshot->size = _size;
+
+    _header = (struct sbdd_heatmap_header*)_snapshot->data;
+    _header->magic = SBDD_HEATMAP_MAGIC;
+    _header->version = SBDD_HEATMAP_VERSION;
+    _header->region_sectors = 1ull << _heatmap->region_shift;
+    _header->regions_count = _heatmap->regions_count;
+    _header->sample_rate = _heatmap->sample_mask + 1;
+
+    _regions = (struct sbdd_heatmap_region*)(_header + 1);
+
+    for(_idx = 0; _idx < _heatmap->regions_count; ++_idx)
+    {
+        _regions[_idx].reads = READ_ONCE(_heatmap->regions[_idx].reads);
+        _regions[_idx].writes = READ_ONCE(_heatmap->regions[_idx].writes);
+        _regions[_idx].score = __sbdd_heatmap_score(&_heatmap->regions[_idx], _epoch);
+        _regions[_idx].epoch = _epoch;
+    }
+
+    file->private_data = _snapshot;
+
+    return 0;
+}
+
+static ssize_t __sbdd_heatmap_bin_read(struct file* file, char __user* buf, size_t count, loff_t* pos)
+{
+    struct sbdd_heatmap_snapshot* _snapshot = file->private_data;
+
+    return simple_read_from_buffer(buf, count, pos, _snapshot->data, _snapshot->size);
+}
+
+static int __sbdd_heatmap_bin_release(struct inode* inode, struct file* file)
+{
+    kvfree(file->private_data);
+
+    return 0;
+}
+
+static const struct file_operations __sbdd_heatmap_bin_fops = {
+    .owner      = THIS_MODULE,
+    .open       = __sbdd_heatmap_bin_open,
+    .read       = __sbdd_heatmap_bin_read,
+    .llseek     = default_llseek,
+    .release    = __sbdd_heatmap_bin_release,
+};
+
+static int __sbdd_heatmap_sample_mask_get(void* data, u64* val)
+{
+    *val = READ_ONCE(((struct sbdd_heatmap*)data)->sample_mask);
+
+    return 0;
+}
+
+/* Only low bits, a mask with a hole would sample in bursts and 0 records every bio */
+static int __sbdd_heatmap_sample_mask_set(void* data, u64 val)
+{
+    if(val > U32_MAX || !is_power_of_2(val + 1))
+        return -EINVAL;
+
+    WRITE_ONCE(((struct sbdd_heatmap*)data)->sample_mask, (u32)val);
+
+    return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(__sbdd_heatmap_sample_mask_fops, __sbdd_heatmap_sample_mask_get, __sbdd_heatmap_sample_mask_set, "%llu\n");
+
+int sbdd_heatmap_init(void)
+{
+    __sbdd_heatmap_root = debugfs_create_dir("sbdd", NULL);
+
+    return 0;
+}
+
+void sbdd_heatmap_exit(void)
+{
+    debugfs_remove_recursive(__sbdd_heatmap_root);
+    __sbdd_heatmap_root = NULL;
+}
+
+int sbdd_heatmap_create(struct sbdd_heatmap* heatmap, sector_t capacity, u32 region_mb, u32 sample_rate)
+{
+    u32 _shift = 0;
+
+    memset(heatmap, 0, sizeof(struct sbdd_heatmap));
+
+    if(!region_mb || !capacity)
+        return 0;
+
+    /* Regions grow until the whole array fits into the bounded map */
+    _shift = ilog2(roundup_pow_of_two(region_mb)) + 20 - SECTOR_SHIFT;
+    while(((capacity - 1) >> _shift) + 1 > SBDD_HEATMAP_MAX_REGIONS)
+        ++_shift;
+
+    heatmap->region_shift = _shift;
+    heatmap->regions_count = ((capacity - 1) >> _shift) + 1;
+    heatmap->sample_mask = roundup_pow_of_two(max(sample_rate, 1u)) - 1;
+    heatmap->start = jiffies;
+
+    heatmap->sample_cnt = alloc_percpu(unsigned int);
+    if(!heatmap->sample_cnt)
+        return -ENOMEM;
+
+    heatmap->regions = kvcalloc(heatmap->regions_count, sizeof(struct sbdd_heatmap_region), GFP_KERNEL);
+    if(!heatmap->regions)
+    {
+        pr_err("heatmap:: can't alloc %u regions \n", heatmap->regions_count);
+        free_percpu(heatmap->sample_cnt);
+        heatmap->sample_cnt = NULL;
+        return -ENOMEM;
+    }
+
+    pr_info("heatmap:: regions: %u, region sectors: %llu, sample rate: %u \n",
+            heatmap->regions_count, 1ull << heatmap->region_shift, heatmap->sample_mask + 1);
+
+    return 0;
+}
+
+void sbdd_heatmap_destroy(struct sbdd_heatmap* heatmap)
+{
+    kvfree(heatmap->regions);
+    free_percpu(heatmap->sample_cnt);
+
+    heatmap->regions = NULL;
+    heatmap->sample_cnt = NULL;
+    heatmap->regions_count = 0;
+}
+
+int sbdd_heatmap_register(struct sbdd_heatmap* heatmap, const char* name)
+{
+    if(!heatmap->regions)
+        return 0;
+
+    heatmap->dir = debugfs_create_dir(name, __sbdd_heatmap_root);
+
+    debugfs_create_file("heatmap.csv", 0444, heatmap->dir, heatmap, &__sbdd_heatmap_csv_fops);
+    debugfs_create_file("heatmap.bin", 0444, heatmap->dir, heatmap, &__sbdd_heatmap_bin_fops);
+    debugfs_create_u32("region_shift", 0444, heatmap->dir, &heatmap->region_shift);
+    debugfs_create_file_unsafe("sample_mask", 0644, heatmap->dir, heatmap, &__sbdd_heatmap_sample_mask_fops);
+
+    return 0;
+}
+
+void sbdd_heatmap_unregister(struct sbdd_heatmap* heatmap)
+{
+    debugfs_remove_recursive(heatmap->dir);
+    heatmap->dir = NULL;
+}
@@ -5,44 +5,264 @@
 #include <sbdd.h>
 #include <io.h>
 
+#define CREATE_TRACE_POINTS
+#include <sbdd_trace.h>
+
+DEFINE_STATIC_KEY_FALSE(sbdd_io_track_key);
+
+static enum cpuhp_state __sbdd_io_cpuhp_state = CPUHP_INVALID;
+
+int sbdd_io_track_get(void)
+{
+    static_branch_inc(&sbdd_io_track_key);
+    return 0;
+}
+
+void sbdd_io_track_put(void)
+{
+    static_branch_dec(&sbdd_io_track_key);
+}
+
+/* Time the bio spent in the worker queue, 0 if it was queued while nobody tracked */
+static u64 __sbdd_io_bio_wait_ns(struct sbdd_io* io, struct bio* bio)
+{
+    u64 _queued = 0;
+
+    if(bio->bi_pool != &io->clone_bio_set)
+        return 0;
+
+    _queued = container_of(bio, struct sbdd_io_bio, bio)->queued_ns;
+
+    return _queued ? ktime_get_ns() - _queued : 0;
+}
+
+static void __sbdd_io_clone_endio(struct bio* clone)
+{
+    struct bio* _bio = clone->bi_private;
+
+    if(clone->bi_status)
+        _bio->bi_status = clone->bi_status;
+
+    bio_put(clone);
+    bio_endio(_bio);
+}
+
+/*
+A bio from submit_bio has no room for the time it is queued at, while
+tracked it is queued as a clone that has. blk-mq clones have it already.
+*/
+static struct bio* __sbdd_io_stamp_bio(struct sbdd_io* io, struct bio* bio)
+{
+    struct bio* _clone = bio;
+    bool        _tracked = sbdd_io_is_tracked();
+
+    if(bio->bi_pool != &io->clone_bio_set)
+    {
+        if(!_tracked)
+            return bio;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+        _clone = bio_clone_fast(bio, GFP_NOIO, &io->clone_bio_set);
+#else
+        _clone = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &io->clone_bio_set);
+#endif
+        _clone->bi_end_io = __sbdd_io_clone_endio;
+        _clone->bi_private = bio;
+    }
+
+    container_of(_clone, struct sbdd_io_bio, bio)->queued_ns = _tracked ? ktime_get_ns() : 0;
+
+    return _clone;
+}
+
+/*
+Pushes bio on the lock-free stack. Returns true if the stack was empty,
+i.e. the io thread may be sleeping and has to be woken up.
+*/
+static bool __sbdd_io_push_bio(struct sbdd_io_worker* worker, struct bio* bio)
+{
+    struct bio* _first = READ_ONCE(worker->bio_stack);
+    struct bio* _prev = NULL;
+
+    do
+    {
+        _prev = _first;
+        bio->bi_next = _prev;
+        _first = cmpxchg(&worker->bio_stack, _prev, bio);
+    } while (_first != _prev);
+
+    return _prev == NULL;
+}
+
+/*
+Takes the whole pending batch with one atomic swap and returns it
+in submission order (the stack keeps it in reverse order).
+*/
+static struct bio* __sbdd_io_pop_all(struct sbdd_io_worker* worker)
+{
+    struct bio* _bio = xchg(&worker->bio_stack, NULL);
+    struct bio* _next = NULL;
+    struct bio* _batch = NULL;
+
+    while (_bio)
+    {
+        _next = _bio->bi_next;
+        _bio->bi_next = _batch;
+        _batch = _bio;
+        _bio = _next;
+    }
+
+    return _batch;
+}
+
 static int __io_io_routine(void* data)
 {
-    struct bio* _bio = NULL;
+    struct bio*         _bio = NULL;
+    struct bio*         _next = NULL;
+    struct blk_plug     _plug;
+    u64                 _wait = 0;
 
-    struct sbdd_io* _io = data;
+    struct sbdd_io_worker* _worker = data;
 
     set_user_nice(current, -20);
 
-    pr_info("sbdd_io:: io thread entry \n");
+    pr_info("sbdd_io:: io thread %d entry \n", _worker->id);
 
-    while (!kthread_should_stop())
+    /* Bios queued before the stop are still processed */
+    while (!kthread_should_stop() || READ_ONCE(_worker->bio_stack))
     {
-        wait_event_interruptible(_io->events, kthread_should_stop() || !bio_list_empty(&_io->bio_list));
+        wait_event_interruptible(_worker->events, kthread_should_stop() || READ_ONCE(_worker->bio_stack));
+
+        _bio = __sbdd_io_pop_all(_worker);
+        if (!_bio)
+            continue;
 
-        spin_lock_irq(&_io->bio_list_lock);
+        /* Let member queues see the whole batch before dispatching */
+        blk_start_plug(&_plug);
 
-        if (bio_list_empty(&_io->bio_list))
+        while (_bio)
         {
-            spin_unlock_irq(&_io->bio_list_lock);
-            continue;
+            _next = _bio->bi_next;
+            _bio->bi_next = NULL;
+
+            _wait = __sbdd_io_bio_wait_ns(_worker->io, _bio);
+
+            trace_sbdd_dequeue(_bio, _worker->id, _wait);
+
+            if(_wait)
+                sbdd_stats_queue_wait(&((struct sbdd*)_worker->io->ctx)->stats, _wait);
+
+            _worker->io->process_bio(_bio);
+
+            _bio = _next;
         }
 
-        _bio = bio_list_pop(&_io->bio_list);
+        blk_finish_plug(&_plug);
+    }
+
+    pr_info("sbdd_io:: io thread %d exit \n", _worker->id);
+
+    return 0;
+}
+
+static struct sbdd_io_worker* __sbdd_io_cpu_worker(struct sbdd_io* io, unsigned int cpu)
+{
+    if(io->workers_mode == SBDD_IO_WORKERS_PER_NODE)
+        return &io->workers[cpu_to_node(cpu)];
 
-        spin_unlock_irq(&_io->bio_list_lock);
+    return &io->workers[cpu];
+}
+
+static const struct cpumask* __sbdd_io_worker_cpumask(struct sbdd_io_worker* worker)
+{
+    if(worker->io->workers_mode == SBDD_IO_WORKERS_PER_NODE)
+        return cpumask_of_node(worker->id);
+
+    return cpumask_of(worker->id);
+}
+
+/* Under rcu, workers are stopped only after the submitters that saw the io active are done with them */
+static struct sbdd_io_worker* __sbdd_io_select_worker(struct sbdd_io* io)
+{
+    struct sbdd_io_worker* _worker = __sbdd_io_cpu_worker(io, raw_smp_processor_id());
 
-        _io->process_bio(_bio);
+    /* The cpu may be online before its hotplug callback started the worker */
+    if(unlikely(!READ_ONCE(_worker->thread)))
+        _worker = READ_ONCE(io->default_worker);
+
+    return _worker;
+}
+
+static int __sbdd_io_cpu_online(unsigned int cpu, struct hlist_node* node)
+{
+    struct sbdd_io*         _io = hlist_entry_safe(node, struct sbdd_io, cpuhp_node);
+    struct sbdd_io_worker*  _worker = __sbdd_io_cpu_worker(_io, cpu);
+    struct task_struct*     _thread = NULL;
+
+    if(_worker->thread)
+    {
+        /* Worker survived a previous offline, bring it back home */
+        set_cpus_allowed_ptr(_worker->thread, __sbdd_io_worker_cpumask(_worker));
+        return 0;
     }
 
-    pr_info("sbdd_io:: io thread exit \n");
+    if(_io->workers_mode == SBDD_IO_WORKERS_PER_NODE)
+        _thread = kthread_create_on_node(__io_io_routine, _worker, _worker->id, "sbdd_io_n/%d", _worker->id);
+    else
+        _thread = kthread_create_on_node(__io_io_routine, _worker, cpu_to_node(cpu), "sbdd_io/%d", _worker->id);
+
+    if (IS_ERR(_thread))
+    {
+        pr_err("sbdd_io_cpu_online:: cannot create io thread for cpu %u: %ld \n", cpu, PTR_ERR(_thread));
+        return PTR_ERR(_thread);
+    }
+
+    set_cpus_allowed_ptr(_thread, __sbdd_io_worker_cpumask(_worker));
+
+    WRITE_ONCE(_worker->thread, _thread);
+
+    if(!_io->default_worker)
+        WRITE_ONCE(_io->default_worker, _worker);
+
+    wake_up_process(_thread);
+
+    return 0;
+}
+
+static int __sbdd_io_cpu_offline(unsigned int cpu, struct hlist_node* node)
+{
+    struct sbdd_io*         _io = hlist_entry_safe(node, struct sbdd_io, cpuhp_node);
+    struct sbdd_io_worker*  _worker = __sbdd_io_cpu_worker(_io, cpu);
+
+    if(!_worker->thread)
+        return 0;
+
+    /*
+    Workers are never stopped on offline: the thread keeps draining bios
+    already queued on it, only its affinity is widened to the cpus left.
+    */
+    if(set_cpus_allowed_ptr(_worker->thread, cpumask_of_node(cpu_to_node(cpu))))
+        set_cpus_allowed_ptr(_worker->thread, cpu_possible_mask);
 
     return 0;
 }
 
 static int __sbdd_io_add_bio(struct sbdd_io* io, struct bio* bio)
 {
-    if(!sbdd_io_is_active(io))
+    struct sbdd_io_worker* _worker = NULL;
+
+    /* May sleep on the clone mempool, done before the rcu section */
+    bio = __sbdd_io_stamp_bio(io, bio);
+
+    rcu_read_lock();
+
+    if(sbdd_io_is_active(io))
+        _worker = __sbdd_io_select_worker(io);
+
+    if(!_worker)
     {
+        rcu_read_unlock();
+
         pr_err("sbdd_io_add_bio:: io is not active \n");
 
         bio_io_error(bio);
@@ -50,15 +270,13 @@ static int __sbdd_io_add_bio(struct sbdd_io* io, struct bio* bio)
         return -EINVAL;
     }
 
-    pr_info("sbdd_io_add_bio:: io is added \n");
-
-    spin_lock_irq(&io->bio_list_lock);
+    trace_sbdd_enqueue(bio, _worker->id);
 
-    bio_list_add(&io->bio_list, bio);
+    /* Only the empty to non-empty transition needs a wakeup */
+    if(__sbdd_io_push_bio(_worker, bio))
+        wake_up(&_worker->events);
 
-    wake_up(&io->events);
-    
-    spin_unlock_irq(&io->bio_list_lock);
+    rcu_read_unlock();
 
     return 0;
 }
@@ -68,19 +286,109 @@ static int __sbdd_xfer_bio(struct sbdd* dev, struct bio *bio)
 	return __sbdd_io_add_bio(&dev->io, bio);
 }
 
-static int __sbdd_xfer_rq(struct sbdd* dev, struct request *req)
+static void __sbdd_io_rq_put(struct request* rq)
 {
-    int         _ret = 0;
-    struct bio* _bio = NULL;
-    
+    struct sbdd_io_rq* _io_rq = blk_mq_rq_to_pdu(rq);
+
+    if(atomic_dec_and_test(&_io_rq->pending))
+        blk_mq_end_request(rq, READ_ONCE(_io_rq->status));
+}
+
+static void __sbdd_io_rq_clone_endio(struct bio* clone)
+{
+    struct request*     _rq = clone->bi_private;
+    struct sbdd_io_rq*  _io_rq = blk_mq_rq_to_pdu(_rq);
+
+    if(clone->bi_status)
+        WRITE_ONCE(_io_rq->status, clone->bi_status);
+
+    bio_put(clone);
+
+    __sbdd_io_rq_put(_rq);
+}
+
+/* A flush request carries no bio, the targets get it as an empty preflush to the array */
+static struct bio* __sbdd_io_rq_flush_bio(struct sbdd* dev)
+{
+    struct bio* _flush = NULL;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _flush = bio_alloc_bioset(GFP_NOIO, 0, &dev->io.clone_bio_set);
+    _flush->bi_opf = REQ_OP_WRITE | REQ_PREFLUSH;
+#else
+    _flush = bio_alloc_bioset(dev->gd->part0, 0, REQ_OP_WRITE | REQ_PREFLUSH, GFP_NOIO, &dev->io.clone_bio_set);
+#endif
+
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+    bio_set_dev(_flush, dev->gd->part0);
+#else
+    _flush->bi_disk = dev->gd;
+    _flush->bi_partno = 0;
+#endif
+
+    return _flush;
+}
+
+static void __sbdd_xfer_rq_bio(struct sbdd* dev, struct request *req, struct bio* clone)
+{
+    struct sbdd_io_rq*  _io_rq = blk_mq_rq_to_pdu(req);
+
+    clone->bi_end_io = __sbdd_io_rq_clone_endio;
+    clone->bi_private = req;
+
+    atomic_inc(&_io_rq->pending);
+
+    /* Same as the bio path, a clone the target may block on is remapped by a worker */
+    if(dev->io.bio_may_block && dev->io.bio_may_block(clone))
+    {
+        __sbdd_io_add_bio(&dev->io, clone);
+        return;
+    }
+
+    /* Maps the clone onto the member disks */
+    dev->io.process_bio(clone);
+}
+
+static blk_status_t __sbdd_xfer_rq(struct sbdd* dev, struct request *req)
+{
+    struct sbdd_io_rq*  _io_rq = blk_mq_rq_to_pdu(req);
+    struct bio*         _bio = NULL;
+    struct bio*         _clone = NULL;
+
+    /* Hold the request until every clone is submitted */
+    atomic_set(&_io_rq->pending, 1);
+    _io_rq->status = BLK_STS_OK;
+
+    if(!req->bio)
+    {
+        if(req_op(req) == REQ_OP_FLUSH || (req->cmd_flags & REQ_PREFLUSH))
+            __sbdd_xfer_rq_bio(dev, req, __sbdd_io_rq_flush_bio(dev));
+
+        __sbdd_io_rq_put(req);
+
+        return BLK_STS_OK;
+    }
+
 	__rq_for_each_bio(_bio, req)
     {
-		_ret = __sbdd_xfer_bio(dev, _bio);
-        if(_ret)
-            return _ret;
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+        _clone = bio_clone_fast(_bio, GFP_NOIO, &dev->io.clone_bio_set);
+#else
+        _clone = bio_alloc_clone(_bio->bi_bdev, _bio, GFP_NOIO, &dev->io.clone_bio_set);
+#endif
+        if(!_clone)
+        {
+            pr_err("sbdd_xfer_rq:: cannot clone bio \n");
+            WRITE_ONCE(_io_rq->status, BLK_STS_RESOURCE);
+            break;
+        }
+
+        __sbdd_xfer_rq_bio(dev, req, _clone);
 	}
 
-    return 0;
+    __sbdd_io_rq_put(req);
+
+    return BLK_STS_OK;
 }
 
 blk_qc_t sbdd_io_submit_bio(struct bio *bio)
@@ -96,16 +404,23 @@ blk_qc_t sbdd_io_submit_bio(struct bio *bio)
     {
         pr_err("sbdd_io_submit_bio:: io is not active \n");
         bio_io_error(bio);
-        bio_endio(bio);
         return BLK_STS_IOERR;
     }
 
+    sbdd_stats_account(&_dev->stats, sbdd_stats_dir(bio), bio_sectors(bio));
+
+    /* Remap and submit right in the caller context unless the target may block on it */
+    if(_dev->io.dispatch_mode == SBDD_IO_DISPATCH_INLINE &&
+        !(_dev->io.bio_may_block && _dev->io.bio_may_block(bio)))
+    {
+        return _dev->io.process_bio(bio);
+    }
+
 	_ret = __sbdd_xfer_bio(_dev, bio);
     if(_ret)
     {
+        /* bio is already completed with error */
         pr_err("sbdd_io_submit_bio:: xfer_bio error:%d \n", _ret);
-        bio_io_error(bio);
-        bio_endio(bio);
 		return BLK_STS_IOERR;
     }
 
@@ -126,11 +441,10 @@ blk_status_t sbdd_io_queue_rq(struct blk_mq_hw_ctx *hctx, struct blk_mq_queue_da
 
 	blk_mq_start_request(_req);
 
-	__sbdd_xfer_rq(_dev, _req);
-
-	blk_mq_end_request(_req, BLK_STS_OK);
+    sbdd_stats_account(&_dev->stats, op_is_write(req_op(_req)) ? SBDD_STATS_WRITE : SBDD_STATS_READ, blk_rq_sectors(_req));
 
-	return BLK_STS_OK;
+	/* The request is completed from the clones end_io with their status */
+	return __sbdd_xfer_rq(_dev, _req);
 }
 
 blk_qc_t sbdd_io_make_request(struct request_queue *q, struct bio *bio)
@@ -138,15 +452,79 @@ blk_qc_t sbdd_io_make_request(struct request_queue *q, struct bio *bio)
 	return sbdd_io_submit_bio(bio);
 }
 
-int sbdd_io_create(struct sbdd_io* io, process_bio_t process_bio, void* ctx)
+int sbdd_io_init(void)
 {
-    bio_list_init(&io->bio_list);
+    int _ret = 0;
 
-    spin_lock_init(&io->bio_list_lock);
+    _ret = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN, "block/sbdd:online", __sbdd_io_cpu_online, __sbdd_io_cpu_offline);
+    if(_ret < 0)
+    {
+        pr_err("sbdd_io_init:: cpuhp setup error:%d \n", _ret);
+        return _ret;
+    }
 
-    init_waitqueue_head(&io->events);
+    __sbdd_io_cpuhp_state = _ret;
 
+    return 0;
+}
+
+void sbdd_io_exit(void)
+{
+    if(__sbdd_io_cpuhp_state != CPUHP_INVALID)
+    {
+        cpuhp_remove_multi_state(__sbdd_io_cpuhp_state);
+        __sbdd_io_cpuhp_state = CPUHP_INVALID;
+    }
+}
+
+int sbdd_io_create(struct sbdd_io* io, process_bio_t process_bio, bio_may_block_t bio_may_block, void* ctx,
+                   int workers_mode, int dispatch_mode)
+{
+    int _ret = 0;
+    int _idx = 0;
+
+    if(dispatch_mode < 0 || dispatch_mode >= SBDD_IO_DISPATCH_LAST)
+    {
+        pr_err("sbdd_io_create:: wrong dispatch mode: %d \n", dispatch_mode);
+        return -EINVAL;
+    }
+
+    if(workers_mode < 0 || workers_mode >= SBDD_IO_WORKERS_MODE_LAST)
+    {
+        pr_err("sbdd_io_create:: wrong workers mode: %d \n", workers_mode);
+        return -EINVAL;
+    }
+
+    io->workers_mode = workers_mode;
+    io->workers_count = (workers_mode == SBDD_IO_WORKERS_PER_NODE) ? nr_node_ids : nr_cpu_ids;
+
+    _ret = bioset_init(&io->clone_bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_io_bio, bio), 0);
+    if(_ret)
+    {
+        pr_err("sbdd_io_create:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    io->workers = kcalloc(io->workers_count, sizeof(struct sbdd_io_worker), GFP_KERNEL);
+    if(!io->workers)
+    {
+        pr_err("sbdd_io_create:: can't alloc workers with count: %d \n", io->workers_count);
+        bioset_exit(&io->clone_bio_set);
+        return -ENOMEM;
+    }
+
+    for(_idx = 0; _idx < io->workers_count; ++_idx)
+    {
+        io->workers[_idx].io = io;
+        io->workers[_idx].id = _idx;
+        io->workers[_idx].bio_stack = NULL;
+        init_waitqueue_head(&io->workers[_idx].events);
+    }
+
+    io->default_worker = NULL;
+    io->dispatch_mode = dispatch_mode;
     io->process_bio = process_bio;
+    io->bio_may_block = bio_may_block;
     io->ctx = ctx;
 
     atomic_set(&io->is_io_active, 1);
@@ -158,57 +536,93 @@ int sbdd_io_create(struct sbdd_io* io, process_bio_t process_bio, void* ctx)
 void sbdd_io_destroy(struct sbdd_io* io)
 {
     struct bio* _bio = NULL;
+    struct bio* _next = NULL;
+    int         _count = 0;
+    int         _idx = 0;
 
-    if(atomic_dec_if_positive(&io->is_io_active) > 0)
+    if(atomic_dec_if_positive(&io->is_io_active) >= 0)
     {
         pr_info("sbdd_io_destroy:: destroing io\n");
 
-        /* clearing bio list */
-        spin_lock_irq(&io->bio_list_lock);
+        /* clearing bio stacks */
+        for(_idx = 0; _idx < io->workers_count; ++_idx)
+        {
+            _bio = __sbdd_io_pop_all(&io->workers[_idx]);
+
+            while(_bio)
+            {
+                _next = _bio->bi_next;
+                _bio->bi_next = NULL;
+                bio_io_error(_bio);
+                _bio = _next;
+                ++_count;
+            }
+        }
+
+        pr_info("sbdd_io_destroy:: bio list size= %d \n", _count);
+
+        kfree(io->workers);
+        io->workers = NULL;
+        io->workers_count = 0;
 
-        pr_info("sbdd_io_destroy:: bio list size= %d \n", bio_list_size(&io->bio_list));
+        bioset_exit(&io->clone_bio_set);
+    }
+}
 
-        while(!bio_list_empty(&io->bio_list))
+static void __sbdd_io_stop_workers(struct sbdd_io* io)
+{
+    int _ret = 0;
+    int _idx = 0;
+
+    for(_idx = 0; _idx < io->workers_count; ++_idx)
+    {
+        if(!io->workers[_idx].thread)
+            continue;
+
+        _ret = kthread_stop(io->workers[_idx].thread);
+        if(_ret)
         {
-            _bio = bio_list_pop(&io->bio_list);
-            bio_io_error(_bio);
+            pr_err("sbdd_io_destroy:: stopping thread %d error:%d\n", _idx, _ret);
         }
 
-        spin_unlock_irq(&io->bio_list_lock);
+        WRITE_ONCE(io->workers[_idx].thread, NULL);
     }
+
+    WRITE_ONCE(io->default_worker, NULL);
 }
 
 int sbdd_io_start(struct sbdd_io* io)
 {
-    io->io_thread = kthread_create(__io_io_routine, io, "io_bio_thread");
-    if (IS_ERR(io->io_thread))
+    int _ret = 0;
+
+    /* Runs the online callback, i.e. starts a worker, for every online cpu */
+    _ret = cpuhp_state_add_instance(__sbdd_io_cpuhp_state, &io->cpuhp_node);
+    if (_ret)
     {
-        pr_err("sbdd_io_start:: cannot create io thread: %ld \n", PTR_ERR(io->io_thread));
-        return PTR_ERR(io->io_thread);
+        pr_err("sbdd_io_start:: cannot start io threads: %d \n", _ret);
+        __sbdd_io_stop_workers(io);
+        return _ret;
     }
 
-    pr_info("sbdd_io_start:: io thread is ready \n");
+    pr_info("sbdd_io_start:: io threads are ready, mode: %d, dispatch: %d \n", io->workers_mode, io->dispatch_mode);
 
     atomic_set(&io->is_io_thread_active, 1);
 
-    wake_up_process(io->io_thread);
-
     return 0;
 }
 
 void sbdd_io_stop(struct sbdd_io* io)
 {
-    int _ret = 0;
-
-    if(atomic_dec_if_positive(&io->is_io_thread_active) > 0)
+    if(atomic_dec_if_positive(&io->is_io_thread_active) >= 0)
     {
-        pr_info("sbdd_io_destroy:: stopping thread \n");
+        pr_info("sbdd_io_destroy:: stopping threads \n");
 
-        _ret = kthread_stop(io->io_thread);
-        if(_ret)
-        {
-            pr_err("sbdd_io_destroy:: stopping thread error:%d\n", _ret);
-        }
+        /* Submitters that saw the io active have queued their bios once the grace period is over */
+        synchronize_rcu();
+
+        cpuhp_state_remove_instance_nocalls(__sbdd_io_cpuhp_state, &io->cpuhp_node);
+
+        __sbdd_io_stop_workers(io);
     }
 }
 
@@ -219,13 +633,30 @@ int sbdd_io_is_active(struct sbdd_io* io)
 
 int sbdd_io_is_empty(struct sbdd_io* io)
 {
-    int _is_empty = 1;
+    int _idx = 0;
 
-    spin_lock_irq(&io->bio_list_lock);
+    for(_idx = 0; _idx < io->workers_count; ++_idx)
+    {
+        if(READ_ONCE(io->workers[_idx].bio_stack))
+            return 0;
+    }
 
-    _is_empty = bio_list_empty(&io->bio_list);
+    return 1;
+}
 
-    spin_unlock_irq(&io->bio_list_lock);
+bool sbdd_io_in_worker(struct sbdd_io* io)
+{
+    int _idx = 0;
+
+    if(READ_ONCE(__sbdd_io_cpu_worker(io, raw_smp_processor_id())->thread) == current)
+        return true;
+
+    /* The worker of an offline cpu runs on the others */
+    for(_idx = 0; _idx < io->workers_count; ++_idx)
+    {
+        if(READ_ONCE(io->workers[_idx].thread) == current)
+            return true;
+    }
 
-    return _is_empty;
-}
\ No newline at end of file
+    return false;
+}
@@ -4,11 +4,33 @@
 #include <kernel_version.h>
 #include <linux/string.h>
 #include <linux/parser.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/indirect_call_wrapper.h>
 #include <trace/events/block.h>
 #include <sbdd.h>
 #include <raid_0.h>
+#include <raid_0_tier.h>
+#include <raid_0_reshape.h>
+#include <sbdd_trace.h>
 
-static struct sbdd_raid_0_disk* __sbdd_raid_0_create_disk(const char* name)
+/* Front pad of every bio allocated from the raid bio_set */
+struct sbdd_raid_0_io {
+    /* geometry the io is mapped by, held until it completes */
+    struct sbdd_raid_0_geo* geo;
+    __u64       start_ns;
+    sector_t    sector;
+    __u32       sectors;
+    __u32       disk;
+    bool        flush;
+    /* tiered array: extent held until the child completes */
+    struct sbdd_raid_0_extent* extent;
+    /* watermark of a reshape or a member copy held until the child completes */
+    atomic_t*   active;
+    struct bio  bio;
+};
+
+struct sbdd_raid_0_disk* sbdd_raid_0_create_disk(const char* name)
 {
     struct sbdd_raid_0_disk* _disk = NULL;
 
@@ -31,13 +53,17 @@ static struct sbdd_raid_0_disk* __sbdd_raid_0_create_disk(const char* name)
 
     _disk->capacity = bdev_nr_sectors(_disk->bdev_raw);
     _disk->max_sectors = queue_max_hw_sectors(bdev_get_queue(_disk->bdev_raw));
+    _disk->max_segments = queue_max_segments(bdev_get_queue(_disk->bdev_raw));
+    _disk->max_segment_size = queue_max_segment_size(bdev_get_queue(_disk->bdev_raw));
+    atomic_set(&_disk->inflight, 0);
+    atomic_set(&_disk->flushing, 0);
 
     pr_info("raid_0:: allocate disk name: %s, capacity: %llu, max_sectors: %u \n", _disk->name, _disk->capacity, _disk->max_sectors);
 
     return _disk;
 }
 
-static int __sbdd_raid_0_destroy_disk(struct sbdd_raid_0_disk* disk)
+int sbdd_raid_0_destroy_disk(struct sbdd_raid_0_disk* disk)
 {
     if(disk)
     {
@@ -50,222 +76,2180 @@ static int __sbdd_raid_0_destroy_disk(struct sbdd_raid_0_disk* disk)
     return -EINVAL;
 }
 
-static struct sbdd_raid_0_disk* __sbdd_raid_0_map_sector_to_disk(struct sbdd_raid_0* raid_0, sector_t source_sector, sector_t* mapped_sector)
+/* Generic geometry: two 64-bit divisions */
+static __u32 __sbdd_raid_0_map_div(const struct sbdd_raid_0_map* map, sector_t source_sector, sector_t* mapped_sector)
 {
-    struct sbdd_raid_0_disk* _disk = NULL;
+    __u64 _chunk_index = 0;
+    __u64 _row = 0;
+    __u32 _offset = 0;
+    __u32 _target_disk = 0;
 
-    __u64 _chunks_in_sectors = 0;
-	__u64 _chunk_index = 0;
-	__u64 _target_sectors = 0;
-	__u32 _target_disk = 0;
+    _chunk_index = div_u64_rem(source_sector, map->chunk_sectors, &_offset);
+    _row = div_u64_rem(_chunk_index, map->disks_count, &_target_disk);
 
-    _chunks_in_sectors = raid_0->config.strip_size << 1;
+    *mapped_sector = _row * map->chunk_sectors + _offset;
 
-	_chunk_index = source_sector / _chunks_in_sectors;
+    return _target_disk;
+}
 
-    _target_disk = (source_sector % (_chunks_in_sectors * raid_0->config.disks_count)) / _chunks_in_sectors;
+/* Power of two stripe and disks count: shifts and masks only */
+static __u32 __sbdd_raid_0_map_pow2(const struct sbdd_raid_0_map* map, sector_t source_sector, sector_t* mapped_sector)
+{
+    __u64 _chunk_index = source_sector >> map->chunk_shift;
 
-    _target_sectors = source_sector;
-	_target_sectors /= _chunks_in_sectors * raid_0->config.disks_count;
-	_target_sectors *= _chunks_in_sectors;
-	_target_sectors += source_sector % _chunks_in_sectors;
+    *mapped_sector = ((_chunk_index >> map->disks_shift) << map->chunk_shift) | (source_sector & (map->chunk_sectors - 1));
 
-    *mapped_sector = _target_sectors;
+    return _chunk_index & (map->disks_count - 1);
+}
 
-    _disk = raid_0->disks[_target_disk];
+/*
+Other geometries: divisions replaced by multiplication with precomputed
+ceil(2^64 / d). The quotient is exact while dividend * d < 2^64, which is
+checked against the array capacity before the mapper is chosen.
+*/
+static __u32 __sbdd_raid_0_map_recip(const struct sbdd_raid_0_map* map, sector_t source_sector, sector_t* mapped_sector)
+{
+    __u64 _chunk_index = mul_u64_u64_shr(source_sector, map->chunk_recip, 64);
+    __u64 _row = mul_u64_u64_shr(_chunk_index, map->disks_recip, 64);
+    __u64 _offset = source_sector - _chunk_index * map->chunk_sectors;
 
-    pr_info("raid_0:: chunks_in_sectors:%llu, chunk_index:%llu, source_sector:%llu, target_sectors:%llu, disk:%s \n",
-    _chunks_in_sectors, _chunk_index, source_sector, _target_sectors, _disk->name);
+    *mapped_sector = _row * map->chunk_sectors + _offset;
 
-    return _disk;
+    return _chunk_index - _row * map->disks_count;
 }
 
-static blk_qc_t __sbdd_raid_0_process_bio(struct sbdd_raid_0* raid_0, struct bio* bio)
+/*
+Weighted striping: chunks go to the disks by a pattern of weights sum slots
+repeated along the array, a disk gets as many chunks per period as its weight.
+*/
+static __u32 __sbdd_raid_0_map_weighted(const struct sbdd_raid_0_map* map, sector_t source_sector, sector_t* mapped_sector)
 {
-    struct sbdd_raid_0_disk*    _target_disk = NULL;
-    struct sbdd*                _dev = raid_0->ctx;
-    struct bio*                 _split_bio = NULL;
-    int                         _chunks_in_sectors = raid_0->config.strip_size << 1;
-    sector_t                    _source_sector = bio->bi_iter.bi_sector;
-    sector_t                    _target_sector = 0;
+    const struct sbdd_raid_0_slot*  _slot = NULL;
+    __u64                           _chunk_index = 0;
+    __u64                           _period = 0;
+    __u32                           _offset = 0;
+    __u32                           _pos = 0;
+
+    _chunk_index = div_u64_rem(source_sector, map->chunk_sectors, &_offset);
+    _period = div_u64_rem(_chunk_index, map->pattern_len, &_pos);
+    _slot = &map->pattern[_pos];
+
+    *mapped_sector = (_period * _slot->weight + _slot->rank) * map->chunk_sectors + _offset;
+
+    return _slot->disk;
+}
+
+static __u64 __sbdd_raid_0_recip(__u32 divisor)
+{
+    return div64_u64(U64_MAX, divisor) + 1;
+}
+
+static void __sbdd_raid_0_init_map(struct sbdd_raid_0_map* map, __u32 chunk_sectors, __u32 disks_count,
+                                   __u32 copies, __u32 layout, sector_t disk_capacity)
+{
+    /* Near copies are mapped through a virtual array copies times larger than the logical one */
+    sector_t _capacity = disk_capacity * disks_count;
+
+    memset(map, 0, sizeof(struct sbdd_raid_0_map));
+
+    map->chunk_sectors = chunk_sectors;
+    map->disks_count = disks_count;
+    map->chunk_mask = is_power_of_2(chunk_sectors) ? chunk_sectors - 1 : 0;
+    map->copies = copies;
+    map->layout = layout;
+
+    if(copies > 1 && layout == SBDD_RAID_0_LAYOUT_FAR)
+        map->far_offset = div_u64(div_u64(disk_capacity, copies), chunk_sectors) * chunk_sectors;
+
+    if(is_power_of_2(chunk_sectors) && is_power_of_2(disks_count))
+    {
+        map->chunk_shift = ilog2(chunk_sectors);
+        map->disks_shift = ilog2(disks_count);
+        map->map_sector = __sbdd_raid_0_map_pow2;
+        map->name = "pow2";
+    }
+    else if(chunk_sectors > 1 && disks_count > 1 &&
+            _capacity < div64_u64(U64_MAX, max(chunk_sectors, disks_count)))
+    {
+        map->chunk_recip = __sbdd_raid_0_recip(chunk_sectors);
+        map->disks_recip = __sbdd_raid_0_recip(disks_count);
+        map->map_sector = __sbdd_raid_0_map_recip;
+        map->name = "recip";
+    }
+    else
+    {
+        map->map_sector = __sbdd_raid_0_map_div;
+        map->name = "div";
+    }
+}
 
-    pr_info("raid_0_process_bio:: bi_sector=%llu, bio_sectors=%u, chunks_in_sector=%d \n", 
-                bio->bi_iter.bi_sector, bio_sectors(bio), _chunks_in_sectors);
+#ifdef SBDD_RAID_0_MAP_BENCH
+#define SBDD_RAID_0_MAP_BENCH_LOOPS (1 << 22)
 
-    if(bio_sectors(bio) > _chunks_in_sectors)
+static void __sbdd_raid_0_bench_map(const struct sbdd_raid_0_map* map, sbdd_raid_0_map_t map_sector, const char* name, sector_t capacity)
+{
+    __u64   _idx = 0;
+    __u64   _sink = 0;
+    __u64   _start = 0;
+    __u64   _elapsed = 0;
+    __u64   _mask = rounddown_pow_of_two(capacity) - 1;
+    __u32   _disk = 0;
+    __u32   _ref_disk = 0;
+    sector_t _sector = 0;
+    sector_t _mapped = 0;
+    sector_t _ref_mapped = 0;
+
+    /* Check the variant against the generic mapper first */
+    for(_idx = 0; _idx < 4096; ++_idx)
     {
-        _split_bio = bio_split(bio, _chunks_in_sectors, GFP_NOIO, &raid_0->bio_set);
-		bio_chain(_split_bio, bio);
-		submit_bio_noacct(bio);
-		bio = _split_bio;
+        _sector = (_idx * 0x9E3779B97F4A7C15ull) & _mask;
+
+        _disk = map_sector(map, _sector, &_mapped);
+        _ref_disk = __sbdd_raid_0_map_div(map, _sector, &_ref_mapped);
+        if(_disk != _ref_disk || _mapped != _ref_mapped)
+        {
+            pr_err("raid_0:: map bench '%s' mismatch at sector %llu \n", name, (__u64)_sector);
+            return;
+        }
     }
 
-    _target_disk = __sbdd_raid_0_map_sector_to_disk(raid_0, _source_sector, &_target_sector);
-    if(_target_disk == NULL)
+    _start = ktime_get_ns();
+
+    for(_idx = 0; _idx < SBDD_RAID_0_MAP_BENCH_LOOPS; ++_idx)
     {
-        pr_err("raid_0:: can't map disk \n");
-        return BLK_STS_TARGET;
+        _sector = (_idx * 0x9E3779B97F4A7C15ull) & _mask;
+        _sink += map_sector(map, _sector, &_mapped) + _mapped;
     }
 
-    pr_info("raid_0_process_bio:: dir=%d, source_sector=%llu, target_sector=%llu, disk=%s", 
-                bio_data_dir(bio), _source_sector, _target_sector, _target_disk->name);
+    _elapsed = ktime_get_ns() - _start;
 
-    bio_set_dev(bio, _target_disk->bdev_raw);
-	bio->bi_iter.bi_sector = _target_sector;
+    pr_info("raid_0:: map bench '%s': %llu.%03llu ns/map (sink %llu) \n", name,
+            div_u64(_elapsed, SBDD_RAID_0_MAP_BENCH_LOOPS),
+            div_u64((_elapsed % SBDD_RAID_0_MAP_BENCH_LOOPS) * 1000, SBDD_RAID_0_MAP_BENCH_LOOPS), _sink);
+}
 
-#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
-	trace_block_bio_remap(bio, disk_devt(_dev->gd), _source_sector);
-#else
-    trace_block_bio_remap(bdev_get_queue(_target_disk->bdev_raw), bio, bio->bi_bdev->bd_dev, bio->bi_sector);
-#endif
+static void __sbdd_raid_0_bench_maps(const struct sbdd_raid_0_map* map, sector_t capacity)
+{
+    struct sbdd_raid_0_map _map = *map;
 
-#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
-    generic_make_request(bio);
-#else
-	return submit_bio_noacct(bio);
-#endif
+    if(capacity == 0)
+        return;
+
+    __sbdd_raid_0_bench_map(&_map, __sbdd_raid_0_map_div, "div", capacity);
+
+    if(is_power_of_2(_map.chunk_sectors) && is_power_of_2(_map.disks_count))
+    {
+        _map.chunk_shift = ilog2(_map.chunk_sectors);
+        _map.disks_shift = ilog2(_map.disks_count);
+        __sbdd_raid_0_bench_map(&_map, __sbdd_raid_0_map_pow2, "pow2", capacity);
+    }
 
+    if(_map.chunk_sectors > 1 && _map.disks_count > 1)
+    {
+        _map.chunk_recip = __sbdd_raid_0_recip(_map.chunk_sectors);
+        _map.disks_recip = __sbdd_raid_0_recip(_map.disks_count);
+        __sbdd_raid_0_bench_map(&_map, __sbdd_raid_0_map_recip, "recip", capacity);
+    }
 }
+#endif
 
-int sbdd_raid_0_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx)
+/* Binary search of the zone the array sector is in */
+static const struct sbdd_raid_0_zone* __sbdd_raid_0_find_zone(struct sbdd_raid_0_geo* geo, sector_t source_sector)
 {
-    int     _ret = 0;
-    __u32   _idx = 0;
+    __u32 _lo = 0;
+    __u32 _hi = geo->zones_count - 1;
+    __u32 _mid = 0;
 
-    _ret = bioset_init(&raid_0->bio_set, BIO_POOL_SIZE, 0, 0);
-	if (_ret)
+    while(_lo < _hi)
     {
-        pr_err("raid_0:: bioset_init error: %d \n", _ret);
-        return _ret;
+        _mid = (_lo + _hi) >> 1;
+
+        if(source_sector < geo->zones[_mid].end)
+            _hi = _mid;
+        else
+            _lo = _mid + 1;
     }
 
-    _ret = sbdd_raid_0_create_config(cfg, &raid_0->config);
-    if(_ret)
+    return &geo->zones[_lo];
+}
+
+static __u32 __sbdd_raid_0_map_sector(struct sbdd_raid_0_geo* geo, sector_t source_sector, sector_t* mapped_sector)
+{
+    const struct sbdd_raid_0_zone*  _zone = NULL;
+    __u32                           _column = 0;
+
+    /* Same size members are a single zone mapped by the array map */
+    if(likely(geo->zones_count <= 1))
     {
-        pr_err("raid_0:: parsing config error: %d \n", _ret);
-        sbdd_raid_0_destroy_config(&raid_0->config);
-        return _ret;
+        return INDIRECT_CALL_2(geo->map.map_sector, __sbdd_raid_0_map_pow2, __sbdd_raid_0_map_recip,
+                               &geo->map, source_sector, mapped_sector);
     }
 
-    spin_lock_init(&raid_0->disks_lock);
+    _zone = __sbdd_raid_0_find_zone(geo, source_sector);
+
+    _column = INDIRECT_CALL_2(_zone->map.map_sector, __sbdd_raid_0_map_pow2, __sbdd_raid_0_map_recip,
+                              &_zone->map, source_sector - _zone->start, mapped_sector);
+    *mapped_sector += _zone->disk_start;
+
+    return _zone->disks[_column];
+}
+
+static __u32 __sbdd_raid_0_sectors_to_boundary(const struct sbdd_raid_0_map* map, sector_t sector)
+{
+    __u32 _offset = 0;
+
+    if(map->chunk_mask)
+        _offset = sector & map->chunk_mask;
+    else
+        div_u64_rem(sector, map->chunk_sectors, &_offset);
+
+    return map->chunk_sectors - _offset;
+}
 
-    /* create raid disks*/
+/*
+Maps array sector to every copy of it. Near: chunk k is virtual chunk
+k * copies of a plain stripe and its copies are the next virtual chunks,
+i.e. the next disks, wrapping to the next row. Far: copy 0 is a plain
+stripe and copy c is far_offset further on the disk c disks to the right.
+*/
+static void __sbdd_raid_10_map_copies(struct sbdd_raid_0_geo* geo, sector_t source_sector, __u32* disks, sector_t* sectors)
+{
+    struct sbdd_raid_0_map* _map = &geo->map;
+    sector_t                _mapped = 0;
+    __u32                   _offset = 0;
+    __u32                   _disk = 0;
+    __u32                   _copy = 0;
 
-    raid_0->disks = kzalloc(sizeof(struct sbdd_raid_0_disk*) * raid_0->config.disks_count, GFP_KERNEL);
-    if(!raid_0->disks)
+    if(_map->layout == SBDD_RAID_0_LAYOUT_NEAR)
     {
-        pr_err("raid_0:: can't alloc disks with count: %d \n", raid_0->config.disks_count);
-        return -ENOMEM;
+        _offset = _map->chunk_sectors - __sbdd_raid_0_sectors_to_boundary(_map, source_sector);
+        _disk = __sbdd_raid_0_map_sector(geo, (source_sector - _offset) * _map->copies + _offset, &_mapped);
+    }
+    else
+    {
+        _disk = __sbdd_raid_0_map_sector(geo, source_sector, &_mapped);
     }
 
-    for(_idx = 0; _idx < raid_0->config.disks_count; ++ _idx)
+    /* Copies never exceed disks, so a copy wraps at most once */
+    for(_copy = 0; _copy < _map->copies; ++_copy)
     {
-        raid_0->disks[_idx] = __sbdd_raid_0_create_disk(raid_0->config.disks[_idx]);
-        if (!raid_0->disks[_idx]) 
+        disks[_copy] = _disk + _copy;
+        sectors[_copy] = _mapped;
+
+        if(_map->layout == SBDD_RAID_0_LAYOUT_FAR)
+            sectors[_copy] += _copy * _map->far_offset;
+
+        if(disks[_copy] >= _map->disks_count)
         {
-            return -ENOMEM;
+            disks[_copy] -= _map->disks_count;
+            if(_map->layout == SBDD_RAID_0_LAYOUT_NEAR)
+                sectors[_copy] += _map->chunk_sectors;
         }
     }
+}
 
-    raid_0->ctx = ctx;
+static void __sbdd_raid_0_child_endio(struct bio* bio)
+{
+    struct sbdd_raid_0_io*  _io = container_of(bio, struct sbdd_raid_0_io, bio);
+    struct sbdd_raid_0_geo* _geo = _io->geo;
+    struct bio*             _parent = bio->bi_private;
+    __u64                   _latency = 0;
 
-    pr_info("raid_0:: disks count: %d, stripe size: %d \n", raid_0->config.disks_count, raid_0->config.strip_size);
+    if(_geo->map.copies > 1)
+        atomic_dec(&_geo->disks[_io->disk]->inflight);
 
-    return 0;
+    if(_io->flush)
+    {
+        /* The writes it was to cover are not known to be stable */
+        if(bio->bi_status)
+            set_bit(SBDD_RAID_0_DISK_DIRTY, &_geo->disks[_io->disk]->flags);
+
+        atomic_dec(&_geo->disks[_io->disk]->flushing);
+    }
+    /* A write in flight when a flush was sent is not covered by it, the next flush has to go out */
+    else if(op_is_write(bio_op(bio)) && !bio->bi_status)
+        set_bit(SBDD_RAID_0_DISK_DIRTY, &_geo->disks[_io->disk]->flags);
+
+    if(_io->extent)
+        sbdd_raid_0_tier_put(_io->extent);
+
+    if(_io->active)
+        sbdd_raid_0_reshape_put(_io->active);
+
+    if(unlikely(bio->bi_status))
+        sbdd_stats_disk_error(&((struct sbdd*)_geo->raid_0->ctx)->stats, _io->disk, sbdd_stats_dir(bio));
+
+    if(_io->start_ns)
+    {
+        _latency = ktime_get_ns() - _io->start_ns;
+
+        trace_sbdd_complete(bio, _io->sector, _io->sectors, _io->disk, _latency);
+
+        sbdd_stats_disk_complete(&((struct sbdd*)_geo->raid_0->ctx)->stats, _io->disk,
+                                 sbdd_stats_dir(bio), _latency);
+    }
+
+    if(bio->bi_status && !_parent->bi_status)
+        _parent->bi_status = bio->bi_status;
+
+    bio_put(bio);
+    bio_endio(_parent);
+
+    /* Last, the members of the geometry may be closed once it is released */
+    percpu_ref_put(&_geo->users);
 }
 
-void sbdd_raid_0_destroy(struct sbdd_raid_0* raid_0)
+/* Same as bio_chain() but completes through sbdd so member io can be observed */
+static void __sbdd_raid_0_chain(struct bio* child, struct bio* parent)
 {
-    int                         _ret = 0;
-    __u32                       _disk_idx = 0;
-    struct sbdd_raid_0_disk*    _disk = NULL;
+    child->bi_private = parent;
+    child->bi_end_io = __sbdd_raid_0_child_endio;
+    bio_inc_remaining(parent);
+}
+
+static void __sbdd_raid_0_issue(struct sbdd_raid_0_geo* geo, struct bio* bio, sector_t source_sector, __u32 disk)
+{
+    struct sbdd*    _dev = geo->raid_0->ctx;
+
+    /* Tested first, the flag line is shared by all submitters of the member */
+    if(op_is_write(bio_op(bio)) && bio_sectors(bio) && !test_bit(SBDD_RAID_0_DISK_DIRTY, &geo->disks[disk]->flags))
+        set_bit(SBDD_RAID_0_DISK_DIRTY, &geo->disks[disk]->flags);
+
+    trace_sbdd_remap(bio, source_sector, disk);
+
+    sbdd_stats_disk_submit(&_dev->stats, disk, sbdd_stats_dir(bio), bio_sectors(bio));
+
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	trace_block_bio_remap(bio, disk_devt(_dev->gd), source_sector);
+#else
+    trace_block_bio_remap(bdev_get_queue(bio->bi_bdev), bio, bio->bi_bdev->bd_dev, source_sector);
+#endif
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(bio);
+#else
+	submit_bio_noacct(bio);
+#endif
+}
+
+/*
+Member io of a member being copied to a new disk. Reads are served by the
+member. A write waits while its sectors are in the copy window and goes to
+the new disk as well when they are copied already, so the copy and the
+writes never race. Flushes go to both.
+*/
+static void __sbdd_raid_0_replace_io(struct sbdd_raid_0_geo* geo, struct bio* bio, sector_t source_sector)
+{
+    struct sbdd_raid_0_reshape* _replace = geo->replace;
+    struct sbdd_raid_0_io*      _io = container_of(bio, struct sbdd_raid_0_io, bio);
+    struct sbdd_raid_0_io*      _mirror_io = NULL;
+    struct bio*                 _mirror = NULL;
+    __u64                       _done = 0;
+
+    if(!op_is_write(bio_op(bio)))
+        return;
 
-    for (; _disk_idx < raid_0->config.disks_count; ++_disk_idx) 
+    if(bio_sectors(bio))
     {
-		_disk = raid_0->disks[_disk_idx];
-        if(_disk)
-        {
-            _ret = __sbdd_raid_0_destroy_disk(_disk);
-            if(_ret)
-            {
-                pr_err("raid_0:: delete disk '%s' error:%d \n", _disk->name, _ret);
-            }
-        }
+        _done = sbdd_raid_0_watermark_get(&_replace->mark, bio->bi_iter.bi_sector, bio_end_sector(bio), &_io->active);
+        if(bio->bi_iter.bi_sector >= _done)
+            return;
     }
 
-    if(raid_0->disks)
+    /* Taken before the bio is sent, it may be gone right after */
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _mirror = bio_clone_fast(bio, GFP_NOIO, &geo->raid_0->bio_set);
+    bio_set_dev(_mirror, _replace->disk->bdev_raw);
+#else
+    _mirror = bio_alloc_clone(_replace->disk->bdev_raw, bio, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+    __sbdd_raid_0_chain(_mirror, bio->bi_private);
+
+    /* Completes as an io of the member, so it is counted and released the same way */
+    _mirror_io = container_of(_mirror, struct sbdd_raid_0_io, bio);
+    *_mirror_io = (struct sbdd_raid_0_io) {
+        .geo = geo, .start_ns = _io->start_ns, .sector = _io->sector, .sectors = _io->sectors,
+        .disk = _io->disk, .flush = _io->flush, .active = _io->active,
+    };
+
+    percpu_ref_get(&geo->users);
+    if(_io->active)
+        atomic_inc(_io->active);
+    if(_io->flush)
+        atomic_inc(&geo->disks[_io->disk]->flushing);
+    if(geo->map.copies > 1)
+        atomic_inc(&geo->disks[_io->disk]->inflight);
+
+    __sbdd_raid_0_issue(geo, _mirror, source_sector, _io->disk);
+}
+
+/* Sends a child to a member, it holds the geometry until it completes */
+static void __sbdd_raid_0_submit_io(struct sbdd_raid_0_geo* geo, struct bio* bio, sector_t source_sector, __u32 disk,
+                                    atomic_t* active)
+{
+    struct sbdd*            _dev = geo->raid_0->ctx;
+    struct sbdd_raid_0_io*  _io = container_of(bio, struct sbdd_raid_0_io, bio);
+
+    _io->geo = geo;
+    _io->disk = disk;
+    _io->start_ns = 0;
+    /* Only __sbdd_raid_0_flush sends empty flushes to members */
+    _io->flush = (bio->bi_opf & REQ_PREFLUSH) && !bio_sectors(bio);
+    /* In a tiered array every child with data is sent by __sbdd_raid_0_tier_bio, which holds its extent */
+    _io->extent = geo->raid_0->tier && bio_sectors(bio) ? sbdd_raid_0_tier_extent(geo->raid_0->tier, source_sector) : NULL;
+    /* Children of a bio mapped by a growth hold its watermark */
+    _io->active = active;
+
+    percpu_ref_get(&geo->users);
+
+    if(geo->map.copies > 1)
+        atomic_inc(&geo->disks[disk]->inflight);
+
+    if(sbdd_io_is_tracked())
     {
-        kfree(raid_0->disks);
+        _io->sector = bio->bi_iter.bi_sector;
+        _io->sectors = bio_sectors(bio);
+        _io->start_ns = ktime_get_ns();
     }
 
-    bioset_exit(&raid_0->bio_set);
+    /* A mirror write to a member being copied is not sampled again */
+    sbdd_heatmap_record(&_dev->heatmap, bio, source_sector);
 
-    sbdd_raid_0_destroy_config(&raid_0->config);
+    if(unlikely(geo->replace) && disk == geo->replace->slot)
+        __sbdd_raid_0_replace_io(geo, bio, source_sector);
+
+    __sbdd_raid_0_issue(geo, bio, source_sector, disk);
+}
+
+static void __sbdd_raid_0_submit(struct sbdd_raid_0_geo* geo, struct bio* bio, sector_t source_sector, __u32 disk)
+{
+    __sbdd_raid_0_submit_io(geo, bio, source_sector, disk, NULL);
 }
 
-__u32 sbdd_raid_0_get_capacity(struct sbdd_raid_0* raid_0)
+static void __sbdd_raid_0_submit_mapped(struct sbdd_raid_0_geo* geo, struct bio* bio)
 {
-    __u32                       _capacity = 0;
+    struct sbdd_raid_0_disk*    _target_disk = NULL;
+    sector_t                    _source_sector = bio->bi_iter.bi_sector;
+    sector_t                    _target_sector = 0;
     __u32                       _disk_idx = 0;
-    struct sbdd_raid_0_disk*    _disk = NULL;
 
-    for (; _disk_idx < raid_0->config.disks_count; ++_disk_idx) 
+    _disk_idx = __sbdd_raid_0_map_sector(geo, _source_sector, &_target_sector);
+    _target_disk = geo->disks[_disk_idx];
+
+    pr_debug("raid_0_process_bio:: dir=%d, source_sector=%llu, target_sector=%llu, disk=%s", 
+                bio_data_dir(bio), _source_sector, _target_sector, _target_disk->name);
+
+    bio_set_dev(bio, _target_disk->bdev_raw);
+	bio->bi_iter.bi_sector = _target_sector;
+
+    __sbdd_raid_0_submit(geo, bio, _source_sector, _disk_idx);
+}
+
+static void __sbdd_raid_0_split_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct bio*                 _child = NULL;
+    __u32                       _sectors = 0;
+
+    /*
+    Cut the bio at every chunk boundary in one pass. Children are chained to
+    the bio, so its remaining counter completes it once the last part is done.
+    Each child goes straight to its member instead of back through sbdd.
+    */
+    while((_sectors = __sbdd_raid_0_sectors_to_boundary(&geo->map, bio->bi_iter.bi_sector)) < bio_sectors(bio))
     {
-        _disk = raid_0->disks[_disk_idx];
+        _child = bio_split(bio, _sectors, GFP_NOIO, &geo->raid_0->bio_set);
+        __sbdd_raid_0_chain(_child, bio);
 
-        if (_disk_idx == 0) 
-        {
-			_capacity = _disk->capacity;
-		} 
-        else 
-        {
-			if (_disk->capacity < _capacity) 
-            {
-				_capacity = _disk->capacity;
-			}
-		}
+        sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(bio));
+
+        __sbdd_raid_0_submit_mapped(geo, _child);
     }
 
-    return _capacity * raid_0->config.disks_count;
+    /*
+    The last part gets a bio of its own too, a member io remapped in place
+    would complete past the geometry hold and its member could be closed.
+    */
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _child = bio_clone_fast(bio, GFP_NOIO, &geo->raid_0->bio_set);
+#else
+    _child = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+    __sbdd_raid_0_chain(_child, bio);
+
+    __sbdd_raid_0_submit_mapped(geo, _child);
+
+    bio_endio(bio);
 }
 
-__u64 sbdd_raid_0_get_max_sectors(struct sbdd_raid_0* raid_0)
+/* Per member scratch of coalesce and discard is on the stack up to this many members */
+#define SBDD_RAID_0_STACK_DISKS 8
+
+/* Per member child being gathered from a large bio */
+struct sbdd_raid_0_gather {
+    struct bio*     bio;
+    sector_t        source_sector;
+    /* member byte offset the next piece has to start at to be appended */
+    __u64           next_pos;
+    /* most segments the child can take up on its member */
+    __u32           segments;
+};
+
+static void __sbdd_raid_0_submit_gathered(struct sbdd_raid_0_geo* geo, struct sbdd_raid_0_gather* gather, __u32 disk)
 {
-    __u64                       _max_sectors = 0;
-    __u32                       _disk_idx = 0;
-    struct sbdd_raid_0_disk*    _disk = NULL;
+    if(!gather->bio)
+        return;
+
+    __sbdd_raid_0_submit(geo, gather->bio, gather->source_sector, disk);
+
+    gather->bio = NULL;
+}
+
+static struct bio* __sbdd_raid_0_alloc_gathered(struct sbdd_raid_0_geo* geo, struct sbdd_raid_0_gather* gathers,
+                                                struct bio* parent, struct sbdd_raid_0_disk* disk, unsigned short nr_vecs)
+{
+    struct bio* _child = NULL;
+    __u32       _idx = 0;
 
-    for (; _disk_idx < raid_0->config.disks_count; ++_disk_idx) 
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _child = bio_alloc_bioset(GFP_NOWAIT, nr_vecs, &geo->raid_0->bio_set);
+#else
+    _child = bio_alloc_bioset(disk->bdev_raw, nr_vecs, parent->bi_opf, GFP_NOWAIT, &geo->raid_0->bio_set);
+#endif
+    if(!_child)
     {
-        _disk = raid_0->disks[_disk_idx];
+        /*
+        Do not sleep on the mempool while holding unsubmitted children,
+        send them out first so they can be returned to the pool.
+        */
+        for(_idx = 0; _idx < geo->disks_count; ++_idx)
+            __sbdd_raid_0_submit_gathered(geo, &gathers[_idx], _idx);
 
-        if (_disk_idx == 0) 
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+        _child = bio_alloc_bioset(GFP_NOIO, nr_vecs, &geo->raid_0->bio_set);
+#else
+        _child = bio_alloc_bioset(disk->bdev_raw, nr_vecs, parent->bi_opf, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+    }
+
+    bio_set_dev(_child, disk->bdev_raw);
+    _child->bi_opf = parent->bi_opf;
+    _child->bi_ioprio = parent->bi_ioprio;
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(6, 5, 0))
+    _child->bi_write_hint = parent->bi_write_hint;
+#endif
+    bio_clone_blkg_association(_child, parent);
+    __sbdd_raid_0_chain(_child, parent);
+
+    sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(parent));
+
+    return _child;
+}
+
+/*
+Chunks k and k + disks_count are adjacent on their member, so a large bio is
+turned into one multi-segment child per member by gathering the parent bvec
+ranges of every chunk the member holds. A child is closed early when it
+reaches the member max_sectors or max_segments or the next piece is not
+contiguous with it.
+The gathers are on the stack for the usual members count, a larger array
+allocates them and the bio is split by chunks without them.
+*/
+static void __sbdd_raid_0_coalesce_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct sbdd_raid_0_gather   _stack_gathers[SBDD_RAID_0_STACK_DISKS] = {};
+    struct sbdd_raid_0_gather*  _gathers = _stack_gathers;
+    struct sbdd_raid_0_gather*  _gather = NULL;
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    struct bio_vec              _bv;
+    struct bvec_iter            _iter;
+    sector_t                    _sector = 0;
+    sector_t                    _target_sector = 0;
+    __u64                       _target_pos = 0;
+    __u64                       _consumed = 0;
+    __u32                       _chunk_left = 0;
+    __u32                       _disk_idx = 0;
+    __u32                       _len = 0;
+    __u32                       _segments = 0;
+    unsigned short              _nr_vecs = min_t(unsigned int, bio_segments(bio), BIO_MAX_VECS);
+
+    if(geo->disks_count > SBDD_RAID_0_STACK_DISKS)
+    {
+        _gathers = kcalloc(geo->disks_count, sizeof(struct sbdd_raid_0_gather), GFP_NOIO | __GFP_NOWARN);
+        if(!_gathers)
         {
-			_max_sectors = _disk->max_sectors;
-		} 
-        else 
+            __sbdd_raid_0_split_bio(geo, bio);
+            return;
+        }
+    }
+
+    bio_for_each_segment(_bv, bio, _iter)
+    {
+        while(_bv.bv_len)
         {
-			if (_disk->max_sectors > _max_sectors) 
+            if(!_chunk_left)
             {
-				_max_sectors = _disk->max_sectors;
-			}
-		}
+                /* Chunk boundaries are sector aligned */
+                _sector = bio->bi_iter.bi_sector + (_consumed >> SECTOR_SHIFT);
+                _disk_idx = __sbdd_raid_0_map_sector(geo, _sector, &_target_sector);
+                _disk = geo->disks[_disk_idx];
+                _gather = &_gathers[_disk_idx];
+                _target_pos = (__u64)_target_sector << SECTOR_SHIFT;
+                _chunk_left = __sbdd_raid_0_sectors_to_boundary(&geo->map, _sector) << SECTOR_SHIFT;
+            }
+
+            _len = min(_bv.bv_len, _chunk_left);
+            /* A piece merged into the last bvec never takes more segments than on its own */
+            _segments = DIV_ROUND_UP(_len, _disk->max_segment_size);
+
+            if(_gather->bio &&
+                (_gather->next_pos != _target_pos ||
+                    (IS_ALIGNED(_gather->bio->bi_iter.bi_size, SECTOR_SIZE) &&
+                     (_gather->bio->bi_iter.bi_size + _len > ((__u64)_disk->max_sectors << SECTOR_SHIFT) ||
+                      _gather->segments + _segments > _disk->max_segments))))
+            {
+                __sbdd_raid_0_submit_gathered(geo, _gather, _disk_idx);
+            }
+
+            if(!_gather->bio || bio_add_page(_gather->bio, _bv.bv_page, _len, _bv.bv_offset) != _len)
+            {
+                __sbdd_raid_0_submit_gathered(geo, _gather, _disk_idx);
+
+                _gather->bio = __sbdd_raid_0_alloc_gathered(geo, _gathers, bio, _disk, _nr_vecs);
+                _gather->bio->bi_iter.bi_sector = _target_pos >> SECTOR_SHIFT;
+                _gather->source_sector = _sector;
+                _gather->segments = 0;
+
+                bio_add_page(_gather->bio, _bv.bv_page, _len, _bv.bv_offset);
+            }
+
+            _gather->segments += _segments;
+
+            _target_pos += _len;
+            _gather->next_pos = _target_pos;
+            _consumed += _len;
+
+            /* Single page segment, the rest of it stays in the same page */
+            _bv.bv_offset += _len;
+            _bv.bv_len -= _len;
+            _chunk_left -= _len;
+        }
     }
 
-    return _max_sectors;
+    for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        __sbdd_raid_0_submit_gathered(geo, &_gathers[_disk_idx], _disk_idx);
 
+    if(_gathers != _stack_gathers)
+        kfree(_gathers);
+
+    /* Drop the parent own reference, it completes with the last child */
+    bio_endio(bio);
 }
 
-blk_qc_t sbdd_raid_0_process_bio(struct bio* bio)
+/* Clone sharing the bio pages, it is chained to the parent the bio came from */
+static struct bio* __sbdd_raid_10_clone(struct sbdd_raid_0_geo* geo, struct bio* bio, struct bio* parent)
 {
-    blk_qc_t _ret = BLK_STS_OK;
+    struct bio* _clone = NULL;
 
-#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
-	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _clone = bio_clone_fast(bio, GFP_NOIO, &geo->raid_0->bio_set);
 #else
-	struct sbdd* _dev = bio->bi_disk->private_data;
+    _clone = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &geo->raid_0->bio_set);
 #endif
+    __sbdd_raid_0_chain(_clone, parent);
 
-   return __sbdd_raid_0_process_bio(&_dev->raid_0, bio);
+    return _clone;
+}
+
+static void __sbdd_raid_10_submit_copy(struct sbdd_raid_0_geo* geo, struct bio* bio, __u32 disk, sector_t sector, sector_t source_sector)
+{
+    bio_set_dev(bio, geo->disks[disk]->bdev_raw);
+    bio->bi_iter.bi_sector = sector;
+
+    __sbdd_raid_0_submit(geo, bio, source_sector, disk);
+}
+
+/* A piece within one chunk is read from its least busy copy and written to all of them */
+static void __sbdd_raid_10_submit_piece(struct sbdd_raid_0_geo* geo, struct bio* piece, struct bio* parent)
+{
+    __u32       _disks[SBDD_RAID_0_MAX_COPIES];
+    sector_t    _sectors[SBDD_RAID_0_MAX_COPIES];
+    sector_t    _source_sector = piece->bi_iter.bi_sector;
+    struct bio* _clone = NULL;
+    __u32       _copy = 0;
+    __u32       _best = 0;
 
-}
\ No newline at end of file
+    __sbdd_raid_10_map_copies(geo, _source_sector, _disks, _sectors);
+
+    if(bio_data_dir(piece) == READ)
+    {
+        for(_copy = 1; _copy < geo->map.copies; ++_copy)
+        {
+            if(atomic_read(&geo->disks[_disks[_copy]]->inflight) < atomic_read(&geo->disks[_disks[_best]]->inflight))
+                _best = _copy;
+        }
+
+        __sbdd_raid_10_submit_copy(geo, piece, _disks[_best], _sectors[_best], _source_sector);
+        return;
+    }
+
+    /* Clones are taken before the piece is sent, it may be gone right after */
+    for(_copy = 1; _copy < geo->map.copies; ++_copy)
+    {
+        _clone = __sbdd_raid_10_clone(geo, piece, parent);
+        __sbdd_raid_10_submit_copy(geo, _clone, _disks[_copy], _sectors[_copy], _source_sector);
+    }
+
+    __sbdd_raid_10_submit_copy(geo, piece, _disks[0], _sectors[0], _source_sector);
+}
+
+static void __sbdd_raid_10_split_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct bio* _child = NULL;
+    __u32       _sectors = 0;
+
+    /* Same single pass split as raid0, each piece then goes to its copies */
+    while((_sectors = __sbdd_raid_0_sectors_to_boundary(&geo->map, bio->bi_iter.bi_sector)) < bio_sectors(bio))
+    {
+        _child = bio_split(bio, _sectors, GFP_NOIO, &geo->raid_0->bio_set);
+        __sbdd_raid_0_chain(_child, bio);
+
+        sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(bio));
+
+        __sbdd_raid_10_submit_piece(geo, _child, bio);
+    }
+
+    /* The last part can't be remapped in place, it may be written to several copies */
+    _child = __sbdd_raid_10_clone(geo, bio, bio);
+    __sbdd_raid_10_submit_piece(geo, _child, bio);
+
+    bio_endio(bio);
+}
+
+/*
+Empty flushes to the members written since their last flush was sent, chained
+to parent. The dirty flag is cleared when the flush is sent, a write that is
+sent after it or completes after it marks the member again. A member with a flush still in flight
+gets another one, the caller has to wait for a flush of its own.
+*/
+static void __sbdd_raid_0_flush(struct sbdd_raid_0_geo* geo, struct bio* parent)
+{
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    struct bio*                 _child = NULL;
+    __u32                       _idx = 0;
+
+    for(_idx = 0; _idx < geo->disks_count; ++_idx)
+    {
+        _disk = geo->disks[_idx];
+
+        if(!test_and_clear_bit(SBDD_RAID_0_DISK_DIRTY, &_disk->flags) && !atomic_read(&_disk->flushing))
+            continue;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+        _child = bio_alloc_bioset(GFP_NOIO, 0, &geo->raid_0->bio_set);
+        bio_set_dev(_child, _disk->bdev_raw);
+        _child->bi_opf = REQ_OP_WRITE | REQ_PREFLUSH | REQ_SYNC;
+#else
+        _child = bio_alloc_bioset(_disk->bdev_raw, 0, REQ_OP_WRITE | REQ_PREFLUSH | REQ_SYNC, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+        bio_clone_blkg_association(_child, parent);
+        __sbdd_raid_0_chain(_child, parent);
+
+        atomic_inc(&_disk->flushing);
+
+        __sbdd_raid_0_submit(geo, _child, parent->bi_iter.bi_sector, _idx);
+    }
+}
+
+static void __sbdd_raid_0_flush_done(struct bio* bio)
+{
+    complete(bio->bi_private);
+}
+
+/*
+Flush before the data of a REQ_PREFLUSH write: the data may go to other
+members than the flushes, so they are waited for. Worker context only.
+*/
+static blk_status_t __sbdd_raid_0_preflush(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    DECLARE_COMPLETION_ONSTACK(_done);
+    struct bio*     _flush = NULL;
+    blk_status_t    _status = BLK_STS_OK;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _flush = bio_alloc_bioset(GFP_NOIO, 0, &geo->raid_0->bio_set);
+#else
+    _flush = bio_alloc_bioset(NULL, 0, REQ_OP_WRITE | REQ_PREFLUSH, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+    _flush->bi_iter.bi_sector = bio->bi_iter.bi_sector;
+    _flush->bi_private = &_done;
+    _flush->bi_end_io = __sbdd_raid_0_flush_done;
+
+    __sbdd_raid_0_flush(geo, _flush);
+
+    /* Drop the own reference, it completes with the last member flush */
+    bio_endio(_flush);
+    wait_for_completion_io(&_done);
+
+    _status = _flush->bi_status;
+    bio_put(_flush);
+
+    return _status;
+}
+
+/*
+Member sector a zone column has reached when the zone is consumed up to
+the zone sector: whole chunks of the column in the periods before, those
+in the period before the sector slot and the offset if the slot is its own.
+*/
+static sector_t __sbdd_raid_0_column_sector(const struct sbdd_raid_0_map* map, __u32 column, sector_t sector)
+{
+    __u64   _chunk_index = 0;
+    __u64   _period = 0;
+    __u32   _offset = 0;
+    __u32   _pos = 0;
+    __u32   _idx = 0;
+    __u32   _before = 0;
+    __u32   _weight = 1;
+    __u32   _slot_disk = 0;
+
+    _chunk_index = div_u64_rem(sector, map->chunk_sectors, &_offset);
+
+    if(!map->pattern)
+    {
+        _period = div_u64_rem(_chunk_index, map->disks_count, &_pos);
+        _before = column < _pos;
+        _slot_disk = _pos;
+    }
+    else
+    {
+        _period = div_u64_rem(_chunk_index, map->pattern_len, &_pos);
+        _weight = 0;
+
+        for(_idx = 0; _idx < map->pattern_len; ++_idx)
+        {
+            if(map->pattern[_idx].disk != column)
+                continue;
+
+            ++_weight;
+            if(_idx < _pos)
+                ++_before;
+        }
+
+        _slot_disk = map->pattern[_pos].disk;
+    }
+
+    return (_period * _weight + _before) * map->chunk_sectors + (_slot_disk == column ? _offset : 0);
+}
+
+/* Member range of a discard being gathered */
+struct sbdd_raid_0_range {
+    sector_t start;
+    sector_t end;
+};
+
+static void __sbdd_raid_0_submit_range(struct sbdd_raid_0_geo* geo, struct bio* parent, struct sbdd_raid_0_range* range, __u32 disk)
+{
+    struct sbdd_raid_0_disk*    _disk = geo->disks[disk];
+    struct bio*                 _child = NULL;
+
+    if(range->start == range->end)
+        return;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _child = bio_alloc_bioset(GFP_NOIO, 0, &geo->raid_0->bio_set);
+    bio_set_dev(_child, _disk->bdev_raw);
+    _child->bi_opf = parent->bi_opf;
+#else
+    _child = bio_alloc_bioset(_disk->bdev_raw, 0, parent->bi_opf, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+    _child->bi_ioprio = parent->bi_ioprio;
+    bio_clone_blkg_association(_child, parent);
+    __sbdd_raid_0_chain(_child, parent);
+
+    _child->bi_iter.bi_sector = range->start;
+    _child->bi_iter.bi_size = (range->end - range->start) << SECTOR_SHIFT;
+
+    sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(parent));
+
+    __sbdd_raid_0_submit(geo, _child, parent->bi_iter.bi_sector, disk);
+
+    range->start = range->end = 0;
+}
+
+/*
+Discard and write zeroes of a range are a single contiguous range on every
+member, so each member gets at most one bio instead of one per chunk. The
+ranges of a member in adjacent zones are adjacent too and are merged. The
+members split them further to their own discard limits and granularity.
+*/
+static void __sbdd_raid_0_discard_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct sbdd_raid_0_range        _stack_ranges[SBDD_RAID_0_STACK_DISKS] = {};
+    struct sbdd_raid_0_range*       _ranges = _stack_ranges;
+    struct sbdd_raid_0_range*       _range = NULL;
+    const struct sbdd_raid_0_zone*  _zone = NULL;
+    sector_t                        _start = bio->bi_iter.bi_sector;
+    sector_t                        _end = bio_end_sector(bio);
+    sector_t                        _zone_start = 0;
+    sector_t                        _zone_end = 0;
+    sector_t                        _disk_start = 0;
+    sector_t                        _disk_end = 0;
+    __u32                           _column = 0;
+    __u32                           _disk = 0;
+
+    /* Without the ranges the members get a discard per chunk */
+    if(geo->disks_count > SBDD_RAID_0_STACK_DISKS)
+    {
+        _ranges = kcalloc(geo->disks_count, sizeof(struct sbdd_raid_0_range), GFP_NOIO | __GFP_NOWARN);
+        if(!_ranges)
+        {
+            __sbdd_raid_0_split_bio(geo, bio);
+            return;
+        }
+    }
+
+    for(_zone = __sbdd_raid_0_find_zone(geo, _start);
+        _zone < geo->zones + geo->zones_count && _zone->start < _end; ++_zone)
+    {
+        _zone_start = max(_start, _zone->start) - _zone->start;
+        _zone_end = min(_end, _zone->end) - _zone->start;
+
+        for(_column = 0; _column < _zone->map.disks_count; ++_column)
+        {
+            _disk_start = _zone->disk_start + __sbdd_raid_0_column_sector(&_zone->map, _column, _zone_start);
+            _disk_end = _zone->disk_start + __sbdd_raid_0_column_sector(&_zone->map, _column, _zone_end);
+            if(_disk_start >= _disk_end)
+                continue;
+
+            _disk = _zone->disks[_column];
+            _range = &_ranges[_disk];
+
+            if(_range->start != _range->end && _range->end != _disk_start)
+                __sbdd_raid_0_submit_range(geo, bio, _range, _disk);
+
+            if(_range->start == _range->end)
+                _range->start = _disk_start;
+
+            _range->end = _disk_end;
+        }
+    }
+
+    for(_disk = 0; _disk < geo->disks_count; ++_disk)
+        __sbdd_raid_0_submit_range(geo, bio, &_ranges[_disk], _disk);
+
+    if(_ranges != _stack_ranges)
+        kfree(_ranges);
+
+    bio_endio(bio);
+}
+
+/*
+Cuts the bio at extent boundaries. Every piece holds its extent while it is
+in flight, so a migration waits for it, and counts as an access of it.
+*/
+static void __sbdd_raid_0_tier_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct bio*                 _child = NULL;
+    sector_t                    _source_sector = 0;
+    sector_t                    _target_sector = 0;
+    __u32                       _sectors = 0;
+    __u32                       _disk_idx = 0;
+    bool                        _last = false;
+
+    while(!_last)
+    {
+        _sectors = __sbdd_raid_0_sectors_to_boundary(&geo->map, bio->bi_iter.bi_sector);
+        _last = _sectors >= bio_sectors(bio);
+
+        if(_last)
+        {
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+            _child = bio_clone_fast(bio, GFP_NOIO, &geo->raid_0->bio_set);
+#else
+            _child = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+        }
+        else
+        {
+            _child = bio_split(bio, _sectors, GFP_NOIO, &geo->raid_0->bio_set);
+            sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(bio));
+        }
+
+        __sbdd_raid_0_chain(_child, bio);
+
+        _source_sector = _child->bi_iter.bi_sector;
+        _disk_idx = sbdd_raid_0_tier_get(geo->raid_0->tier, _source_sector, &_target_sector);
+
+        bio_set_dev(_child, geo->disks[_disk_idx]->bdev_raw);
+        _child->bi_iter.bi_sector = _target_sector;
+
+        __sbdd_raid_0_submit(geo, _child, _source_sector, _disk_idx);
+    }
+
+    bio_endio(bio);
+}
+
+/*
+A bio of an array being reshaped is cut at chunk boundaries and every chunk
+is mapped by the geometry its data is in, the new one below the watermark.
+Pieces hold the reshape while in flight, a window of chunks is moved once
+the pieces in it are done. geo is the new geometry, it has every member.
+*/
+static void __sbdd_raid_0_reshape_bio(struct sbdd_raid_0_geo* geo, struct bio* bio)
+{
+    struct sbdd_raid_0_reshape* _reshape = geo->raid_0->reshape;
+    struct bio*                 _child = NULL;
+    atomic_t*                   _active = NULL;
+    sector_t                    _source_sector = 0;
+    sector_t                    _target_sector = 0;
+    __u32                       _sectors = 0;
+    __u32                       _disk_idx = 0;
+    bool                        _last = false;
+
+    while(!_last)
+    {
+        /* Both geometries have the same chunks */
+        _sectors = __sbdd_raid_0_sectors_to_boundary(&_reshape->map, bio->bi_iter.bi_sector);
+        _last = _sectors >= bio_sectors(bio);
+
+        if(_last)
+        {
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+            _child = bio_clone_fast(bio, GFP_NOIO, &geo->raid_0->bio_set);
+#else
+            _child = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &geo->raid_0->bio_set);
+#endif
+        }
+        else
+        {
+            _child = bio_split(bio, _sectors, GFP_NOIO, &geo->raid_0->bio_set);
+            sbdd_stats_split(&((struct sbdd*)geo->raid_0->ctx)->stats, sbdd_stats_dir(bio));
+        }
+
+        __sbdd_raid_0_chain(_child, bio);
+
+        _source_sector = _child->bi_iter.bi_sector;
+        _disk_idx = sbdd_raid_0_reshape_get(_reshape, _source_sector, &_target_sector, &_active);
+
+        bio_set_dev(_child, geo->disks[_disk_idx]->bdev_raw);
+        _child->bi_iter.bi_sector = _target_sector;
+
+        __sbdd_raid_0_submit_io(geo, _child, _source_sector, _disk_idx, _active);
+    }
+
+    bio_endio(bio);
+}
+
+/*
+Geometry a bio is mapped by, held until its children are sent. A geometry
+is killed once the next one is published, a bio that finds it dead looks
+again. A growth kills the old geometry while it is still published, its
+bios are mapped by the watermark into the new one instead, reshape is set then.
+*/
+static struct sbdd_raid_0_geo* __sbdd_raid_0_get_geo(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_reshape** reshape)
+{
+    struct sbdd_raid_0_reshape* _reshape = NULL;
+    struct sbdd_raid_0_geo*     _geo = NULL;
+
+    rcu_read_lock();
+
+    while(true)
+    {
+        _geo = rcu_dereference(raid_0->geo);
+        if(likely(percpu_ref_tryget_live(&_geo->users)))
+            break;
+
+        _reshape = READ_ONCE(raid_0->reshape);
+        if(_reshape && READ_ONCE(_reshape->from) == _geo && percpu_ref_tryget_live(&_reshape->geo->users))
+        {
+            sbdd_raid_0_reshape_enter(_reshape);
+            *reshape = _reshape;
+            _geo = _reshape->geo;
+            break;
+        }
+
+        /* The next geometry is published before the old one is killed */
+        rcu_read_unlock();
+        cpu_relax();
+        rcu_read_lock();
+    }
+
+    rcu_read_unlock();
+
+    return _geo;
+}
+
+/*
+Maps a bio by the geometry taken for it, the geometry is put here. A bio
+of an array being grown is mapped by the watermark, reshape is set then.
+*/
+static void __sbdd_raid_0_map_bio(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo,
+                                  struct sbdd_raid_0_reshape* reshape, struct bio* bio)
+{
+    struct blk_plug         _plug;
+    __u32                   _chunk_sectors = geo->map.chunk_sectors;
+
+    pr_debug("raid_0_process_bio:: bi_sector=%llu, bio_sectors=%u, chunks_in_sector=%u \n", 
+                bio->bi_iter.bi_sector, bio_sectors(bio), _chunk_sectors);
+
+    /* Flushes have no sector to map, the dirty members get one */
+    if(bio->bi_opf & REQ_PREFLUSH)
+    {
+        if(!bio_sectors(bio))
+        {
+            __sbdd_raid_0_flush(geo, bio);
+            bio_endio(bio);
+            goto out;
+        }
+
+        bio->bi_status = __sbdd_raid_0_preflush(geo, bio);
+        if(bio->bi_status)
+        {
+            bio_endio(bio);
+            goto out;
+        }
+
+        /* FUA is left to the members, the ones without it emulate it themselves */
+        bio->bi_opf &= ~REQ_PREFLUSH;
+    }
+
+    blk_start_plug(&_plug);
+
+    if(reshape)
+    {
+        __sbdd_raid_0_reshape_bio(geo, bio);
+    }
+    else if(raid_0->tier)
+    {
+        __sbdd_raid_0_tier_bio(geo, bio);
+    }
+    else if(geo->map.copies > 1)
+    {
+        __sbdd_raid_10_split_bio(geo, bio);
+    }
+    else if((bio_op(bio) == REQ_OP_DISCARD || bio_op(bio) == REQ_OP_WRITE_ZEROES) && geo->zones_count)
+    {
+        __sbdd_raid_0_discard_bio(geo, bio);
+    }
+    /* Coalescing pays off only when some member gets more than one chunk */
+    else if(bio_has_data(bio) && (bio_op(bio) == REQ_OP_READ || bio_op(bio) == REQ_OP_WRITE) &&
+        bio_sectors(bio) > _chunk_sectors * geo->disks_count)
+    {
+        __sbdd_raid_0_coalesce_bio(geo, bio);
+    }
+    else
+    {
+        __sbdd_raid_0_split_bio(geo, bio);
+    }
+
+    blk_finish_plug(&_plug);
+
+out:
+    percpu_ref_put(&geo->users);
+
+    if(reshape)
+        sbdd_raid_0_reshape_exit(reshape);
+}
+
+static void __sbdd_raid_0_defer_work(struct work_struct* work)
+{
+    struct sbdd_raid_0*         _raid_0 = container_of(work, struct sbdd_raid_0, defer_work);
+    struct sbdd_raid_0_reshape* _reshape = NULL;
+    struct sbdd_raid_0_geo*     _geo = NULL;
+    struct bio_list             _deferred;
+    struct bio*                 _bio = NULL;
+
+    spin_lock(&_raid_0->defer_lock);
+    bio_list_init(&_deferred);
+    bio_list_merge(&_deferred, &_raid_0->deferred);
+    bio_list_init(&_raid_0->deferred);
+    spin_unlock(&_raid_0->defer_lock);
+
+    while((_bio = bio_list_pop(&_deferred)))
+    {
+        _reshape = NULL;
+        _geo = __sbdd_raid_0_get_geo(_raid_0, &_reshape);
+
+        __sbdd_raid_0_map_bio(_raid_0, _geo, _reshape, _bio);
+    }
+}
+
+static blk_qc_t __sbdd_raid_0_process_bio(struct sbdd_raid_0* raid_0, struct bio* bio)
+{
+    struct sbdd_raid_0_reshape* _reshape = NULL;
+    struct sbdd_raid_0_geo*     _geo = __sbdd_raid_0_get_geo(raid_0, &_reshape);
+    bool                        _may_wait = false;
+
+    /* The chunks of a bio may be moved by a growth, the sectors written of a member copied */
+    if(unlikely(_reshape))
+        _may_wait = bio_sectors(bio);
+    else if(unlikely(_geo->replace))
+        _may_wait = op_is_write(bio_op(bio)) && bio_sectors(bio);
+
+    /*
+    A growth or a replacement may start after sbdd_raid_0_bio_may_block let
+    the bio be processed in the caller context. It would wait for the copy
+    window there, it is handed to the defer work instead.
+    */
+    if(_may_wait && !sbdd_io_in_worker(&((struct sbdd*)raid_0->ctx)->io))
+    {
+        percpu_ref_put(&_geo->users);
+        if(_reshape)
+            sbdd_raid_0_reshape_exit(_reshape);
+
+        spin_lock(&raid_0->defer_lock);
+        bio_list_add(&raid_0->deferred, bio);
+        spin_unlock(&raid_0->defer_lock);
+
+        queue_work(system_highpri_wq, &raid_0->defer_work);
+
+        return BLK_STS_OK;
+    }
+
+    __sbdd_raid_0_map_bio(raid_0, _geo, _reshape, bio);
+
+    return BLK_STS_OK;
+}
+
+/* Every member is used up to the size of the smallest one */
+static sector_t __sbdd_raid_0_disk_capacity(struct sbdd_raid_0_geo* geo)
+{
+    sector_t                    _capacity = 0;
+    __u32                       _disk_idx = 0;
+    struct sbdd_raid_0_disk*    _disk = NULL;
+
+    for (; _disk_idx < geo->disks_count; ++_disk_idx) 
+    {
+        _disk = geo->disks[_disk_idx];
+
+        if (_disk_idx == 0) 
+        {
+			_capacity = _disk->capacity;
+		} 
+        else 
+        {
+			if (_disk->capacity < _capacity) 
+            {
+				_capacity = _disk->capacity;
+			}
+		}
+    }
+
+    return _capacity;
+}
+
+static sector_t __sbdd_raid_0_disk_chunks(struct sbdd_raid_0_geo* geo, __u32 disk_idx)
+{
+    return div_u64(geo->disks[disk_idx]->capacity, geo->map.chunk_sectors) * geo->map.chunk_sectors;
+}
+
+/*
+Pattern of the weighted striping. Slots are spread with the smooth weighted
+round-robin, so a heavy disk does not get its chunks of a period in a row.
+Every pattern period is a single zone over the whole array.
+*/
+static int __sbdd_raid_0_create_pattern(struct sbdd_raid_0_geo* geo)
+{
+    struct sbdd_raid_0_map*     _map = &geo->map;
+    struct sbdd_raid_0_zone*    _zone = NULL;
+    int*                        _current = NULL;
+    __u32*                      _ranks = NULL;
+    __u32*                      _weights = geo->raid_0->config.weights;
+    __u64                       _periods = U64_MAX;
+    __u32                       _disk_idx = 0;
+    __u32                       _best = 0;
+    __u32                       _pos = 0;
+
+    for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+    {
+        _map->pattern_len += _weights[_disk_idx];
+        _periods = min_t(__u64, _periods,
+                         div_u64(div_u64(geo->disks[_disk_idx]->capacity, _map->chunk_sectors), _weights[_disk_idx]));
+    }
+
+    _map->pattern = kcalloc(_map->pattern_len, sizeof(struct sbdd_raid_0_slot), GFP_KERNEL);
+    geo->zones = kcalloc(1, sizeof(struct sbdd_raid_0_zone), GFP_KERNEL);
+    if(!_map->pattern || !geo->zones)
+        return -ENOMEM;
+
+    geo->zones[0].disks = kcalloc(geo->disks_count, sizeof(__u32), GFP_KERNEL);
+    if(!geo->zones[0].disks)
+        return -ENOMEM;
+
+    geo->zones_count = 1;
+
+    _current = kcalloc(geo->disks_count, sizeof(int), GFP_KERNEL);
+    _ranks = kcalloc(geo->disks_count, sizeof(__u32), GFP_KERNEL);
+    if(!_current || !_ranks)
+    {
+        kfree(_current);
+        kfree(_ranks);
+        return -ENOMEM;
+    }
+
+    for(_pos = 0; _pos < _map->pattern_len; ++_pos)
+    {
+        _best = 0;
+        for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        {
+            _current[_disk_idx] += _weights[_disk_idx];
+            if(_current[_disk_idx] > _current[_best])
+                _best = _disk_idx;
+        }
+
+        _current[_best] -= _map->pattern_len;
+
+        _map->pattern[_pos].disk = _best;
+        _map->pattern[_pos].rank = _ranks[_best]++;
+        _map->pattern[_pos].weight = _weights[_best];
+    }
+
+    kfree(_current);
+    kfree(_ranks);
+
+    _map->map_sector = __sbdd_raid_0_map_weighted;
+    _map->name = "weighted";
+
+    _zone = &geo->zones[0];
+    _zone->map = *_map;
+    _zone->end = _periods * _map->pattern_len * _map->chunk_sectors;
+    for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        _zone->disks[_disk_idx] = _disk_idx;
+
+    pr_info("raid_0:: weighted pattern of %u chunks, periods: %llu \n", _map->pattern_len, _periods);
+
+    return 0;
+}
+
+/*
+md style strip zones: zone z stripes the members larger than the z-th
+smallest member size over the part of them above that size, so every
+member is used to its last whole chunk. Zones never split a chunk, array
+chunk boundaries stay the same as for a single zone.
+*/
+static int __sbdd_raid_0_create_zones(struct sbdd_raid_0_geo* geo)
+{
+    struct sbdd_raid_0_zone*    _zone = NULL;
+    sector_t                    _prev = 0;
+    sector_t                    _next = 0;
+    sector_t                    _start = 0;
+    sector_t                    _capacity = 0;
+    __u32                       _disk_idx = 0;
+    __u32                       _count = 0;
+
+    geo->zones = kcalloc(geo->disks_count, sizeof(struct sbdd_raid_0_zone), GFP_KERNEL);
+    if(!geo->zones)
+        return -ENOMEM;
+
+    while(true)
+    {
+        /* Next distinct member size */
+        _next = 0;
+        for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        {
+            _capacity = __sbdd_raid_0_disk_chunks(geo, _disk_idx);
+            if(_capacity > _prev && (!_next || _capacity < _next))
+                _next = _capacity;
+        }
+
+        if(!_next)
+            break;
+
+        _zone = &geo->zones[geo->zones_count];
+        _count = 0;
+
+        for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        {
+            if(__sbdd_raid_0_disk_chunks(geo, _disk_idx) > _prev)
+                ++_count;
+        }
+
+        _zone->disks = kcalloc(_count, sizeof(__u32), GFP_KERNEL);
+        if(!_zone->disks)
+            return -ENOMEM;
+
+        /* Counted once it has columns, sbdd_raid_0_free_geo frees them if a later zone fails */
+        ++geo->zones_count;
+
+        _count = 0;
+        for(_disk_idx = 0; _disk_idx < geo->disks_count; ++_disk_idx)
+        {
+            if(__sbdd_raid_0_disk_chunks(geo, _disk_idx) > _prev)
+                _zone->disks[_count++] = _disk_idx;
+        }
+
+        __sbdd_raid_0_init_map(&_zone->map, geo->map.chunk_sectors, _count, 1, SBDD_RAID_0_LAYOUT_NEAR, _next - _prev);
+
+        _zone->start = _start;
+        _zone->end = _start + (_next - _prev) * _count;
+        _zone->disk_start = _prev;
+
+        pr_info("raid_0:: zone %u: sectors %llu-%llu, disks: %u, disk start: %llu, mapper: %s \n",
+                geo->zones_count - 1, (__u64)_zone->start, (__u64)_zone->end, _count, (__u64)_zone->disk_start, _zone->map.name);
+
+        _start = _zone->end;
+        _prev = _next;
+    }
+
+    return 0;
+}
+
+static void __sbdd_raid_0_users_release(struct percpu_ref* ref)
+{
+    wake_up_var(ref);
+}
+
+static struct sbdd_raid_0_geo* __sbdd_raid_0_alloc_geo(struct sbdd_raid_0* raid_0, __u32 disks_count)
+{
+    struct sbdd_raid_0_geo* _geo = NULL;
+
+    _geo = kzalloc(struct_size(_geo, disks, disks_count), GFP_KERNEL);
+    if(!_geo)
+        return NULL;
+
+    if(percpu_ref_init(&_geo->users, __sbdd_raid_0_users_release, 0, GFP_KERNEL))
+    {
+        kfree(_geo);
+        return NULL;
+    }
+
+    _geo->raid_0 = raid_0;
+    _geo->disks_count = disks_count;
+
+    return _geo;
+}
+
+void sbdd_raid_0_free_geo(struct sbdd_raid_0_geo* geo)
+{
+    __u32 _idx = 0;
+
+    if(!geo)
+        return;
+
+    for(_idx = 0; geo->zones && _idx < geo->zones_count; ++_idx)
+        kfree(geo->zones[_idx].disks);
+
+    kfree(geo->map.pattern);
+    kfree(geo->zones);
+    percpu_ref_exit(&geo->users);
+    kfree(geo);
+}
+
+struct sbdd_raid_0_geo* sbdd_raid_0_dup_geo(const struct sbdd_raid_0_geo* geo)
+{
+    struct sbdd_raid_0_geo* _geo = NULL;
+    __u32                   _idx = 0;
+
+    _geo = __sbdd_raid_0_alloc_geo(geo->raid_0, geo->disks_count);
+    if(!_geo)
+        return NULL;
+
+    _geo->map = geo->map;
+    _geo->map.pattern = NULL;
+    memcpy(_geo->disks, geo->disks, geo->disks_count * sizeof(sbdd_raid_0_disk_t*));
+
+    if(geo->map.pattern)
+    {
+        _geo->map.pattern = kmemdup(geo->map.pattern, geo->map.pattern_len * sizeof(struct sbdd_raid_0_slot), GFP_KERNEL);
+        if(!_geo->map.pattern)
+            goto fail;
+    }
+
+    if(geo->zones)
+    {
+        _geo->zones = kmemdup(geo->zones, geo->zones_count * sizeof(struct sbdd_raid_0_zone), GFP_KERNEL);
+        if(!_geo->zones)
+            goto fail;
+
+        /* Every zone gets its own columns or none, so a failed copy frees only its own */
+        _geo->zones_count = geo->zones_count;
+        for(_idx = 0; _idx < _geo->zones_count; ++_idx)
+            _geo->zones[_idx].disks = kmemdup(geo->zones[_idx].disks, geo->zones[_idx].map.disks_count * sizeof(__u32), GFP_KERNEL);
+
+        for(_idx = 0; _idx < _geo->zones_count; ++_idx)
+        {
+            if(!_geo->zones[_idx].disks)
+                goto fail;
+
+            /* The weighted zone maps by the array pattern */
+            if(_geo->zones[_idx].map.pattern)
+                _geo->zones[_idx].map.pattern = _geo->map.pattern;
+        }
+    }
+
+    return _geo;
+
+fail:
+    sbdd_raid_0_free_geo(_geo);
+
+    return NULL;
+}
+
+/*
+The new geometry is published first, so a bio that finds the old one dead
+finds the new one on its next look. The old one is freed once the member
+ios holding it are done and no bio can see it any more.
+*/
+void sbdd_raid_0_switch_geo(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo)
+{
+    struct sbdd_raid_0_geo* _old = sbdd_raid_0_geo(raid_0);
+
+    rcu_assign_pointer(raid_0->geo, geo);
+
+    /* A growth has killed its old geometry already */
+    if(!percpu_ref_is_dying(&_old->users))
+        percpu_ref_kill(&_old->users);
+
+    wait_var_event(&_old->users, percpu_ref_is_zero(&_old->users));
+    synchronize_rcu();
+
+    sbdd_raid_0_free_geo(_old);
+}
+
+/*
+No geometry change is in progress or left half way, the reshape is allocated.
+A failed replacement is rolled back, another one may start. A stopped growth
+goes on at the next create. Under reshape_lock.
+*/
+static int __sbdd_raid_0_reshape_idle(struct sbdd_raid_0* raid_0)
+{
+    if(sbdd_raid_0_reshape_running(raid_0->reshape) || (raid_0->reshape && raid_0->reshape->from))
+    {
+        pr_err("raid_0:: the last reshape is %s \n", raid_0->reshape->error ? "stopped" : "in progress");
+        return -EBUSY;
+    }
+
+    if(!raid_0->reshape)
+    {
+        raid_0->reshape = kzalloc(sizeof(struct sbdd_raid_0_reshape), GFP_KERNEL);
+        if(!raid_0->reshape)
+            return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+Growth record on the last member, 1 if it is there and matches the members,
+their sizes are checked against it before the last one is cut to its size.
+*/
+static int __sbdd_raid_0_find_growth(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo, struct sbdd_raid_0_reshape_sb* sb)
+{
+    struct sbdd_raid_0_disk*    _last = geo->disks[geo->disks_count - 1];
+    __u32                       _chunk_sectors = raid_0->config.strip_size << 1;
+    sector_t                    _disk_sectors = 0;
+    __u32                       _idx = 0;
+    int                         _ret = 0;
+
+    _ret = sbdd_raid_0_reshape_read_sb(_last, sb);
+    if(_ret == -ENOENT)
+        return 0;
+    if(_ret)
+    {
+        pr_err("raid_0:: can't read the growth record of %s, error: %d \n", _last->name, _ret);
+        return _ret;
+    }
+
+    _disk_sectors = le64_to_cpu(sb->disk_sectors);
+
+    if(le32_to_cpu(sb->disks_count) != geo->disks_count - 1 || le32_to_cpu(sb->chunk_sectors) != _chunk_sectors ||
+        !_disk_sectors || _disk_sectors % _chunk_sectors ||
+        le64_to_cpu(sb->chunks) != div_u64(_disk_sectors, _chunk_sectors) * (geo->disks_count - 1) ||
+        le64_to_cpu(sb->done) > le64_to_cpu(sb->chunks) || sbdd_raid_0_reshape_sb_sector(_last) < _disk_sectors)
+    {
+        pr_err("raid_0:: the growth record of %s does not match the array \n", _last->name);
+        return -EINVAL;
+    }
+
+    for(_idx = 0; _idx + 1 < geo->disks_count; ++_idx)
+    {
+        if(div_u64(geo->disks[_idx]->capacity, _chunk_sectors) * _chunk_sectors != _disk_sectors)
+        {
+            pr_err("raid_0:: member %s is not of the size the array grew from \n", geo->disks[_idx]->name);
+            return -EINVAL;
+        }
+    }
+
+    _last->capacity = _disk_sectors;
+
+    return 1;
+}
+
+/*
+Publishes the geometry of the old members and sets a growth onto all of them
+from the recorded watermark. Bios are mapped by the watermark from the first
+one, the copy is run by sbdd_raid_0_resume once the array is up.
+*/
+static int __sbdd_raid_0_resume_growth(struct sbdd_raid_0* raid_0, struct sbdd_raid_0_reshape_sb* sb)
+{
+    struct sbdd_raid_0_geo* _geo = sbdd_raid_0_geo(raid_0);
+    struct sbdd_raid_0_geo* _from = NULL;
+    __u32                   _count = le32_to_cpu(sb->disks_count);
+    sector_t                _disk_sectors = le64_to_cpu(sb->disk_sectors);
+    __u64                   _chunks = le64_to_cpu(sb->chunks);
+    int                     _ret = 0;
+
+    if(_geo->zones_count != 1 || _geo->zones[0].end != _disk_sectors * (_count + 1))
+    {
+        pr_err("raid_0:: the members do not fit the growth, zones: %u \n", _geo->zones_count);
+        return -EINVAL;
+    }
+
+    _from = __sbdd_raid_0_alloc_geo(raid_0, _count);
+    if(!_from)
+        return -ENOMEM;
+
+    memcpy(_from->disks, _geo->disks, _count * sizeof(sbdd_raid_0_disk_t*));
+
+    __sbdd_raid_0_init_map(&_from->map, _geo->map.chunk_sectors, _count, 1, SBDD_RAID_0_LAYOUT_NEAR, _disk_sectors);
+
+    _ret = __sbdd_raid_0_create_zones(_from);
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_idle(raid_0);
+    if(_ret)
+        goto fail;
+
+    rcu_assign_pointer(raid_0->geo, _from);
+
+    _ret = sbdd_raid_0_reshape_start(raid_0->reshape, raid_0, _geo, _chunks, le64_to_cpu(sb->done));
+    if(_ret)
+    {
+        rcu_assign_pointer(raid_0->geo, _geo);
+        goto fail;
+    }
+
+    percpu_ref_kill(&_from->users);
+
+    pr_info("raid_0:: resuming the growth to %u disks at chunk %llu of %llu \n", _count + 1, le64_to_cpu(sb->done), _chunks);
+
+    return 0;
+
+fail:
+    sbdd_raid_0_free_geo(_from);
+
+    return _ret;
+}
+
+static int __sbdd_raid_0_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx, int copies)
+{
+    struct sbdd_raid_0_reshape_sb   _sb;
+    struct sbdd_raid_0_geo*         _geo = NULL;
+    int                             _growth = 0;
+    int                             _ret = 0;
+    __u32                           _idx = 0;
+
+    /* Splits are allocated in a loop from submit_bio context, rescuer avoids mempool deadlock */
+    _ret = bioset_init(&raid_0->bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_raid_0_io, bio),
+                       BIOSET_NEED_BVECS | BIOSET_NEED_RESCUER);
+	if (_ret)
+    {
+        pr_err("raid_0:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    raid_0->config.copies = copies;
+
+    _ret = sbdd_raid_0_create_config(cfg, &raid_0->config);
+    if(_ret)
+    {
+        pr_err("raid_0:: parsing config error: %d \n", _ret);
+        sbdd_raid_0_destroy_config(&raid_0->config);
+        return _ret;
+    }
+
+    if((copies == 1) != (raid_0->config.copies == 1))
+    {
+        pr_err("raid_0:: %d copies need raid type %s \n", raid_0->config.copies, copies == 1 ? "raid10" : "raid0");
+        return -EINVAL;
+    }
+
+    if(raid_0->config.weighted && raid_0->config.copies > 1)
+    {
+        pr_err("raid_0:: disk weights are not supported by raid10 \n");
+        return -EINVAL;
+    }
+
+    mutex_init(&raid_0->reshape_lock);
+    spin_lock_init(&raid_0->defer_lock);
+    bio_list_init(&raid_0->deferred);
+    INIT_WORK(&raid_0->defer_work, __sbdd_raid_0_defer_work);
+
+    raid_0->ctx = ctx;
+
+    /* Published before the members are open, so destroy finds every one of them */
+    _geo = __sbdd_raid_0_alloc_geo(raid_0, raid_0->config.disks_count);
+    if(!_geo)
+    {
+        pr_err("raid_0:: can't alloc geometry \n");
+        return -ENOMEM;
+    }
+
+    rcu_assign_pointer(raid_0->geo, _geo);
+
+    /* create raid disks */
+
+    for(_idx = 0; _idx < _geo->disks_count; ++ _idx)
+    {
+        _geo->disks[_idx] = sbdd_raid_0_create_disk(raid_0->config.disks[_idx]);
+        if (!_geo->disks[_idx]) 
+        {
+            return -ENOMEM;
+        }
+    }
+
+    if(raid_0->config.tier_disks)
+    {
+        if(raid_0->config.copies > 1 || raid_0->config.weighted)
+        {
+            pr_err("raid_0:: tiering is not supported with copies or disk weights \n");
+            return -EINVAL;
+        }
+
+        /* Not striped, the map only gives the extent boundaries */
+        __sbdd_raid_0_init_map(&_geo->map, raid_0->config.extent_size << 1, 1, 1, 0, __sbdd_raid_0_disk_capacity(_geo));
+
+        raid_0->tier = kzalloc(sizeof(struct sbdd_raid_0_tier), GFP_KERNEL);
+        if(!raid_0->tier)
+            return -ENOMEM;
+
+        return sbdd_raid_0_tier_create(raid_0->tier, raid_0, _geo);
+    }
+
+    /* A growth cut short is on the last member, the array is made of the old members until it is done */
+    if(raid_0->config.copies == 1 && !raid_0->config.weighted && _geo->disks_count > 1)
+    {
+        _growth = __sbdd_raid_0_find_growth(raid_0, _geo, &_sb);
+        if(_growth < 0)
+            return _growth;
+    }
+
+    __sbdd_raid_0_init_map(&_geo->map, raid_0->config.strip_size << 1, _geo->disks_count,
+                           raid_0->config.copies, raid_0->config.layout, __sbdd_raid_0_disk_capacity(_geo));
+
+    /* raid10 copies are placed on the common part of the members only */
+    if(raid_0->config.weighted)
+        _ret = __sbdd_raid_0_create_pattern(_geo);
+    else if(raid_0->config.copies == 1)
+        _ret = __sbdd_raid_0_create_zones(_geo);
+    if(_ret)
+    {
+        pr_err("raid_0:: can't alloc zones \n");
+        return _ret;
+    }
+
+    /* The restriper moves whole rows of the same size members */
+    raid_0->reshapable = raid_0->config.copies == 1 && !raid_0->config.weighted && _geo->zones_count == 1;
+
+    pr_info("raid_0:: disks count: %d, stripe size: %d, copies: %d, mapper: %s \n",
+            _geo->disks_count, raid_0->config.strip_size, raid_0->config.copies, _geo->map.name);
+
+    if(_growth)
+    {
+        _ret = __sbdd_raid_0_resume_growth(raid_0, &_sb);
+        if(_ret)
+            return _ret;
+    }
+
+#ifdef SBDD_RAID_0_MAP_BENCH
+    __sbdd_raid_0_bench_maps(&_geo->map, sbdd_raid_0_get_capacity(raid_0));
+#endif
+
+    return 0;
+}
+
+/* Opens a disk that is to hold sectors of a member, it has to fit the array queue limits */
+static int __sbdd_raid_0_open_member(struct sbdd_raid_0* raid_0, const char* name, sector_t sectors, struct sbdd_raid_0_disk** disk)
+{
+    struct sbdd*                _dev = raid_0->ctx;
+    struct sbdd_raid_0_disk*    _disk = NULL;
+
+    _disk = sbdd_raid_0_create_disk(name);
+    if(!_disk)
+        return -ENODEV;
+
+    if(_disk->capacity < sectors ||
+        bdev_logical_block_size(_disk->bdev_raw) > queue_logical_block_size(_dev->gd->queue) ||
+        (queue_max_discard_sectors(_dev->gd->queue) && !bdev_get_queue(_disk->bdev_raw)->limits.max_discard_sectors))
+    {
+        pr_err("raid_0:: '%s' is smaller than the members or does not fit the array limits \n", name);
+        sbdd_raid_0_destroy_disk(_disk);
+        return -EINVAL;
+    }
+
+    *disk = _disk;
+
+    return 0;
+}
+
+/*
+Online growth of a striped raid0 by one member. The member is used up to
+the size of the others, every row of chunks gets one more chunk. The
+watermark is recorded past that on the new member, the array has to be
+loaded with the new disks list from then on and a growth cut short goes on
+at the next create.
+*/
+int sbdd_raid_0_add_disk(struct sbdd_raid_0* raid_0, const char* name)
+{
+    struct sbdd_raid_0_geo*     _geo = NULL;
+    struct sbdd_raid_0_geo*     _new = NULL;
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    __u32                       _count = 0;
+    sector_t                    _disk_sectors = 0;
+    int                         _ret = 0;
+
+    if(!raid_0->reshapable)
+    {
+        pr_err("raid_0:: only a raid0 of same size members without weights and tiers can grow \n");
+        return -EOPNOTSUPP;
+    }
+
+    mutex_lock(&raid_0->reshape_lock);
+
+    _ret = __sbdd_raid_0_reshape_idle(raid_0);
+    if(_ret)
+        goto out;
+
+    _geo = sbdd_raid_0_geo(raid_0);
+    _count = _geo->disks_count;
+
+    if(_count >= SDBB_RAID_0_MAX_DISKS_COUNT || _geo->zones_count != 1)
+    {
+        pr_err("raid_0:: the array can't grow, disks: %u, zones: %u \n", _count, _geo->zones_count);
+        _ret = -EINVAL;
+        goto out;
+    }
+
+    _disk_sectors = div_u64(_geo->zones[0].end - _geo->zones[0].start, _count);
+
+    _ret = __sbdd_raid_0_open_member(raid_0, name, _disk_sectors, &_disk);
+    if(_ret)
+        goto out;
+
+    if(sbdd_raid_0_reshape_sb_sector(_disk) < _disk_sectors)
+    {
+        pr_err("raid_0:: '%s' has no room for the growth record past the size of the members \n", name);
+        _ret = -EINVAL;
+        goto fail;
+    }
+
+    /* The record is out of the array, the rest of the member is used once the array is created again */
+    _disk->capacity = _disk_sectors;
+
+    _new = __sbdd_raid_0_alloc_geo(raid_0, _count + 1);
+    if(!_new)
+    {
+        _ret = -ENOMEM;
+        goto fail;
+    }
+
+    memcpy(_new->disks, _geo->disks, _count * sizeof(sbdd_raid_0_disk_t*));
+    _new->disks[_count] = _disk;
+
+    __sbdd_raid_0_init_map(&_new->map, _geo->map.chunk_sectors, _count + 1, 1, SBDD_RAID_0_LAYOUT_NEAR, _disk_sectors);
+
+    _ret = __sbdd_raid_0_create_zones(_new);
+    if(_ret)
+    {
+        pr_err("raid_0:: can't alloc zones of the new geometry \n");
+        goto fail;
+    }
+
+    _ret = sbdd_raid_0_reshape_start(raid_0->reshape, raid_0, _new, div_u64(_disk_sectors, _geo->map.chunk_sectors) * _count, 0);
+    if(_ret)
+        goto fail;
+
+    sbdd_raid_0_reshape_run(raid_0->reshape);
+
+    pr_info("raid_0:: adding disk %s as member %u, mapper: %s \n", _disk->name, _count, _new->map.name);
+
+    goto out;
+
+fail:
+    sbdd_raid_0_free_geo(_new);
+    sbdd_raid_0_destroy_disk(_disk);
+
+out:
+    mutex_unlock(&raid_0->reshape_lock);
+
+    return _ret;
+}
+
+/*
+Live replacement of a member, e.g. by a faster disk. The new disk is used up
+to the size of the member, the geometry stays the same. The member is copied
+in the background while the array is in use, the new disk takes its slot at
+the end and the member is closed once the ios that may use it are done.
+*/
+int sbdd_raid_0_replace_disk(struct sbdd_raid_0* raid_0, __u32 slot, const char* name)
+{
+    struct sbdd_raid_0_geo*     _geo = NULL;
+    struct sbdd_raid_0_geo*     _copying = NULL;
+    struct sbdd_raid_0_geo*     _target = NULL;
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    int                         _ret = 0;
+
+    /* The migrator moves extents between the members by itself */
+    if(raid_0->tier)
+    {
+        pr_err("raid_0:: members of a tiered array can't be replaced \n");
+        return -EOPNOTSUPP;
+    }
+
+    mutex_lock(&raid_0->reshape_lock);
+
+    _ret = __sbdd_raid_0_reshape_idle(raid_0);
+    if(_ret)
+        goto out;
+
+    _geo = sbdd_raid_0_geo(raid_0);
+    if(slot >= _geo->disks_count)
+    {
+        pr_err("raid_0:: no member %u to replace \n", slot);
+        _ret = -EINVAL;
+        goto out;
+    }
+
+    _ret = __sbdd_raid_0_open_member(raid_0, name, _geo->disks[slot]->capacity, &_disk);
+    if(_ret)
+        goto out;
+
+    _disk->capacity = _geo->disks[slot]->capacity;
+
+    _copying = sbdd_raid_0_dup_geo(_geo);
+    _target = sbdd_raid_0_dup_geo(_geo);
+    if(!_copying || !_target)
+    {
+        _ret = -ENOMEM;
+        goto fail;
+    }
+
+    _copying->replace = raid_0->reshape;
+    _target->disks[slot] = _disk;
+
+    _ret = sbdd_raid_0_replace_start(raid_0->reshape, raid_0, slot, _disk, _copying, _target);
+    if(_ret)
+        goto fail;
+
+    sbdd_raid_0_reshape_run(raid_0->reshape);
+
+    pr_info("raid_0:: replacing member %u %s by %s \n", slot, _geo->disks[slot]->name, _disk->name);
+
+    goto out;
+
+fail:
+    sbdd_raid_0_free_geo(_copying);
+    sbdd_raid_0_free_geo(_target);
+    sbdd_raid_0_destroy_disk(_disk);
+
+out:
+    mutex_unlock(&raid_0->reshape_lock);
+
+    return _ret;
+}
+
+void sbdd_raid_0_resume(struct sbdd_raid_0* raid_0)
+{
+    mutex_lock(&raid_0->reshape_lock);
+
+    if(raid_0->reshape && raid_0->reshape->from && raid_0->reshape->thread && !raid_0->reshape->error)
+        sbdd_raid_0_reshape_run(raid_0->reshape);
+
+    mutex_unlock(&raid_0->reshape_lock);
+}
+
+struct sbdd_raid_0_geo* sbdd_raid_0_members_geo(struct sbdd_raid_0* raid_0)
+{
+    if(raid_0->reshape && raid_0->reshape->from)
+        return raid_0->reshape->geo;
+
+    return sbdd_raid_0_geo(raid_0);
+}
+
+int sbdd_raid_0_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx)
+{
+    return __sbdd_raid_0_create(raid_0, cfg, ctx, 1);
+}
+
+int sbdd_raid_10_create(struct sbdd_raid_0* raid_0, char* cfg, void* ctx)
+{
+    return __sbdd_raid_0_create(raid_0, cfg, ctx, 2);
+}
+
+void sbdd_raid_0_destroy(struct sbdd_raid_0* raid_0)
+{
+    struct sbdd_raid_0_reshape* _reshape = raid_0->reshape;
+    struct sbdd_raid_0_geo*     _geo = sbdd_raid_0_geo(raid_0);
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    __u32                       _disk_idx = 0;
+    int                         _ret = 0;
+
+    /* Deferred writes hold the geometry until they are mapped */
+    flush_work(&raid_0->defer_work);
+
+    /* Migrations use the members */
+    if(raid_0->tier)
+    {
+        sbdd_raid_0_tier_destroy(raid_0->tier);
+        kfree(raid_0->tier);
+        raid_0->tier = NULL;
+    }
+
+    /* A growth stopped half way goes on at the next create, a replacement is rolled back */
+    if(_reshape)
+    {
+        sbdd_raid_0_reshape_destroy(_reshape);
+
+        /* Bios of a stopped growth are mapped into its new geometry to the end, it has every member */
+        if(_reshape->from)
+        {
+            sbdd_raid_0_free_geo(_geo);
+            _geo = _reshape->geo;
+        }
+        /* The geometry with the disk of a replacement that did not finish is not published */
+        else if(_reshape->replace && _geo != _reshape->geo)
+        {
+            if(_reshape->copying != _geo)
+                sbdd_raid_0_free_geo(_reshape->copying);
+
+            sbdd_raid_0_free_geo(_reshape->geo);
+            sbdd_raid_0_destroy_disk(_reshape->disk);
+        }
+
+        kfree(_reshape);
+        raid_0->reshape = NULL;
+    }
+
+    raid_0->reshapable = false;
+
+    for (; _geo && _disk_idx < _geo->disks_count; ++_disk_idx) 
+    {
+		_disk = _geo->disks[_disk_idx];
+        if(_disk)
+        {
+            _ret = sbdd_raid_0_destroy_disk(_disk);
+            if(_ret)
+            {
+                pr_err("raid_0:: delete disk '%s' error:%d \n", _disk->name, _ret);
+            }
+        }
+    }
+
+    sbdd_raid_0_free_geo(_geo);
+    RCU_INIT_POINTER(raid_0->geo, NULL);
+
+    bioset_exit(&raid_0->bio_set);
+
+    sbdd_raid_0_destroy_config(&raid_0->config);
+}
+
+sector_t sbdd_raid_0_get_capacity(struct sbdd_raid_0* raid_0)
+{
+    struct sbdd_raid_0_geo*         _geo = sbdd_raid_0_geo(raid_0);
+    const struct sbdd_raid_0_map*   _map = &_geo->map;
+    __u64                           _rows = 0;
+
+    if(raid_0->tier)
+        return sbdd_raid_0_tier_capacity(raid_0->tier);
+
+    /* Sum of the members, each to its last whole chunk */
+    if(_map->copies <= 1)
+        return _geo->zones_count ? _geo->zones[_geo->zones_count - 1].end : 0;
+
+    /* raid10 keeps whole rows of chunks only */
+    if(_map->layout == SBDD_RAID_0_LAYOUT_FAR)
+        return div_u64(_map->far_offset, _map->chunk_sectors) * _map->disks_count * _map->chunk_sectors;
+
+    _rows = div_u64(__sbdd_raid_0_disk_capacity(_geo), _map->chunk_sectors);
+
+    return div_u64(_rows * _map->disks_count, _map->copies) * _map->chunk_sectors;
+}
+
+/* Chunk pieces are sent to the members as they are, so the smallest member limit applies */
+__u64 sbdd_raid_0_get_max_sectors(struct sbdd_raid_0* raid_0)
+{
+    struct sbdd_raid_0_geo* _geo = sbdd_raid_0_members_geo(raid_0);
+    __u64                   _max_sectors = 0;
+    __u32                   _disk_idx = 0;
+
+    for (; _disk_idx < _geo->disks_count; ++_disk_idx)
+    {
+        if (_disk_idx == 0 || _geo->disks[_disk_idx]->max_sectors < _max_sectors)
+            _max_sectors = _geo->disks[_disk_idx]->max_sectors;
+    }
+
+    return _max_sectors;
+}
+
+/* io_min is a chunk and io_opt a row of distinct data chunks, in bytes */
+void sbdd_raid_0_get_io_hints(struct sbdd_raid_0* raid_0, unsigned int* io_min, unsigned int* io_opt)
+{
+    const struct sbdd_raid_0_map*   _map = &sbdd_raid_0_geo(raid_0)->map;
+    __u32                           _width = _map->disks_count;
+
+    /* A tiered array has no stripe */
+    if(raid_0->tier)
+    {
+        *io_min = 0;
+        *io_opt = 0;
+        return;
+    }
+
+    if(_map->pattern)
+        _width = _map->pattern_len;
+    else if(_map->copies > 1 && _map->layout == SBDD_RAID_0_LAYOUT_NEAR)
+        _width = max_t(__u32, _map->disks_count / _map->copies, 1);
+
+    *io_min = _map->chunk_sectors << SECTOR_SHIFT;
+    /* A row of many large chunks is more than the limit holds, it is then the most whole chunks that fit */
+    *io_opt = *io_min * min_t(__u32, _width, UINT_MAX / *io_min);
+}
+
+blk_qc_t sbdd_raid_0_process_bio(struct bio* bio)
+{
+    blk_qc_t _ret = BLK_STS_OK;
+
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+   return __sbdd_raid_0_process_bio(&_dev->raid_0, bio);
+
+}
+
+bool sbdd_raid_0_bio_may_block(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+    bool _copying = false;
+
+    /* The data of a flush write waits for the member flushes */
+    if((bio->bi_opf & REQ_PREFLUSH) && bio_sectors(bio))
+        return true;
+
+    /* A bio waits for the migrations of its extents */
+    if(_dev->raid_0.tier && bio_sectors(bio))
+        return true;
+
+    /* A bio waits for the reshape windows of its chunks */
+    if(sbdd_raid_0_reshape_running(_dev->raid_0.reshape) && !_dev->raid_0.reshape->replace && bio_sectors(bio))
+        return true;
+
+    /* A write waits for the copy window of a member being replaced */
+    rcu_read_lock();
+    _copying = rcu_dereference(_dev->raid_0.geo)->replace != NULL;
+    rcu_read_unlock();
+
+    if(_copying && op_is_write(bio_op(bio)) && bio_sectors(bio))
+        return true;
+
+    /*
+    Every member io is a bio of its own, allocated from the bio_set mempool
+    which may sleep, that is not allowed for REQ_NOWAIT submitters.
+    */
+    return bio->bi_opf & REQ_NOWAIT;
+}
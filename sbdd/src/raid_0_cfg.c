@@ -1,29 +1,63 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/genhd.h>
 #include <linux/string.h>
 #include <linux/parser.h>
+#include <linux/ctype.h>
 #include <raid_0_cfg.h>
 
 enum {
-	opt_stripe,
+	opt_copies,
+	opt_cache,
+	opt_tier,
+	opt_tier_rate,
     opt_last_int,
+	opt_stripe,
+	opt_extent,
 	opt_disks,
+	opt_layout,
     opt_last_str,
 	opt_err
 };
 
 static match_table_t __sbdd_raid_0_config_opts_tokens = {
-	{opt_stripe, "stripe=%d"},
+	{opt_stripe, "stripe=%s"},
+	{opt_copies, "copies=%d"},
+	{opt_cache, "cache=%d"},
+	{opt_tier, "tier=%d"},
+	{opt_extent, "extent=%s"},
+	{opt_tier_rate, "tier_rate=%d"},
 	{opt_disks, "disks=%s"},
+	{opt_layout, "layout=%s"},
 	{opt_err, NULL}
 };
 
+/* Size in KiB: a plain number is KiB, a K or M suffix gives the unit, 64 MiB at most */
+static int __sbdd_raid_0_parse_kb(const char* str, int* kb)
+{
+    char*   _end = NULL;
+    __u64   _bytes = memparse(str, &_end);
+
+    if(_end == str || *_end)
+        return -EINVAL;
+
+    if(isdigit(_end[-1]))
+        _bytes <<= 10;
+
+    if(!IS_ALIGNED(_bytes, 1024) || (_bytes >> 10) > SBDD_RAID_0_MAX_STRIPE)
+        return -EINVAL;
+
+    *kb = _bytes >> 10;
+
+    return 0;
+}
 
 int sbdd_raid_0_create_config(char* cfg, sbdd_raid_0_config_t* _cfg)
 {
     char *_symbol = NULL;
+    char *_disks = NULL;
 
     int _idx = 0;
 
@@ -53,7 +87,36 @@ int sbdd_raid_0_create_config(char* cfg, sbdd_raid_0_config_t* _cfg)
         switch (_token) 
         {
         case opt_stripe:
-            _cfg->strip_size = _intval;
+        case opt_extent:
+            if(__sbdd_raid_0_parse_kb(_argstr[0].from, _token == opt_stripe ? &_cfg->strip_size : &_cfg->extent_size))
+            {
+                pr_err("raid_0_config:: bad size '%s', KiB or K/M suffixed up to %d KiB \n", _argstr[0].from, SBDD_RAID_0_MAX_STRIPE);
+                return -EINVAL;
+            }
+            break;
+        case opt_copies:
+            _cfg->copies = _intval;
+            break;
+        case opt_cache:
+            _cfg->cache_stripes = _intval;
+            break;
+        case opt_tier:
+            _cfg->tier_disks = _intval;
+            break;
+        case opt_tier_rate:
+            _cfg->tier_rate = _intval;
+            break;
+        case opt_layout:
+            /* The option is the rest of its ';' terminated token */
+            if(!strcmp(_argstr[0].from, "near"))
+                _cfg->layout = SBDD_RAID_0_LAYOUT_NEAR;
+            else if(!strcmp(_argstr[0].from, "far"))
+                _cfg->layout = SBDD_RAID_0_LAYOUT_FAR;
+            else
+            {
+                pr_err("raid_0_config:: unknown layout '%s' \n", _argstr[0].from);
+                return -EINVAL;
+            }
             break;
         case opt_disks:
             _cfg->disks_str = kstrndup(_argstr[0].from, _argstr[0].to - _argstr[0].from, GFP_KERNEL);
@@ -76,6 +139,16 @@ int sbdd_raid_0_create_config(char* cfg, sbdd_raid_0_config_t* _cfg)
         }
     }
 
+    /* A tiered array is not striped, the extent is its only unit */
+    if(_cfg->tier_disks)
+    {
+        if(_cfg->extent_size == 0)
+            _cfg->extent_size = SBDD_RAID_0_TIER_EXTENT_DEFAULT;
+        if(_cfg->tier_rate == 0)
+            _cfg->tier_rate = SBDD_RAID_0_TIER_RATE_DEFAULT;
+        _cfg->strip_size = _cfg->extent_size;
+    }
+
     if(_cfg->strip_size == 0)
     {
         pr_err("raid_0_config:: zero strip size! \n");
@@ -94,17 +167,50 @@ int sbdd_raid_0_create_config(char* cfg, sbdd_raid_0_config_t* _cfg)
         return -EINVAL;
     }
 
+    if(_cfg->copies < 1 || _cfg->copies > SBDD_RAID_0_MAX_COPIES || _cfg->copies > _cfg->disks_count)
+    {
+        pr_err("raid_0_config:: wrong copies count: %d, disks: %d, max: %d \n", _cfg->copies, _cfg->disks_count, SBDD_RAID_0_MAX_COPIES);
+        return -EINVAL;
+    }
+
+    _cfg->disks = kcalloc(_cfg->disks_count, sizeof(char*), GFP_KERNEL);
+    _cfg->weights = kcalloc(_cfg->disks_count, sizeof(__u32), GFP_KERNEL);
+    if(!_cfg->disks || !_cfg->weights)
+        return -ENOMEM;
+
     _idx = 0;
-    while ((_symbol = strsep(&_cfg->disks_str, ",")) != NULL)
+    _disks = _cfg->disks_str;
+    while ((_symbol = strsep(&_disks, ",")) != NULL)
     {
-        pr_info("raid_0_config:: add disk '%s' \n", _symbol);
+        char* _weight = strrchr(_symbol, ':');
+
+        _cfg->weights[_idx] = 1;
+
+        /* A path may have a ':' of its own, only digits after the last one are a weight */
+        if(_weight && _weight[1] && strspn(_weight + 1, "0123456789") == strlen(_weight + 1))
+        {
+            *_weight++ = '\0';
+
+            if(kstrtou32(_weight, 10, &_cfg->weights[_idx]) ||
+                _cfg->weights[_idx] < 1 || _cfg->weights[_idx] > SBDD_RAID_0_MAX_WEIGHT)
+            {
+                pr_err("raid_0_config:: wrong weight of disk '%s', max: %d \n", _symbol, SBDD_RAID_0_MAX_WEIGHT);
+                return -EINVAL;
+            }
+
+            if(_cfg->weights[_idx] != 1)
+                _cfg->weighted = true;
+        }
+
+        pr_info("raid_0_config:: add disk '%s', weight: %u \n", _symbol, _cfg->weights[_idx]);
 
         _cfg->disks[_idx] = _symbol;
 
         ++_idx;
     }
 
-    pr_info("raid_0_config:: disks count: %d, stripe size: %d \n", _cfg->disks_count, _cfg->strip_size);
+    pr_info("raid_0_config:: disks count: %d, stripe size: %d, copies: %d, layout: %s \n", _cfg->disks_count, _cfg->strip_size,
+            _cfg->copies, _cfg->layout == SBDD_RAID_0_LAYOUT_FAR ? "far" : "near");
 
     return 0;
 }
@@ -113,8 +219,14 @@ void sbdd_raid_0_destroy_config(sbdd_raid_0_config_t* cfg)
 {
     if(cfg->disks_str)
         kfree(cfg->disks_str);
+
+    kfree(cfg->disks);
+    kfree(cfg->weights);
         
     cfg->disks_str = NULL;
+    cfg->disks = NULL;
+    cfg->weights = NULL;
     cfg->disks_count = 0;
     cfg->strip_size = 0;
+    cfg->weighted = false;
 }
\ No newline at end of file
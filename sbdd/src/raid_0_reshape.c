@@ -0,0 +1,653 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/percpu-refcount.h>
+#include <linux/crc32c.h>
+#include <sbdd.h>
+#include <raid_0_reshape.h>
+
+__u64 sbdd_raid_0_watermark_get(struct sbdd_raid_0_watermark* mark, __u64 first, __u64 end, atomic_t** active)
+{
+    __u64   _done = 0;
+    __u64   _window = 0;
+    __u32   _idx = 0;
+
+    while(true)
+    {
+        _idx = smp_load_acquire(&mark->gen) & 1;
+        atomic_inc(&mark->active[_idx]);
+        /* Pairs with the barrier of __sbdd_raid_0_reshape_sync between the window and the active check */
+        smp_mb__after_atomic();
+
+        _done = smp_load_acquire(&mark->done);
+        _window = READ_ONCE(mark->window);
+        if(likely(end <= _done || first >= _window))
+            break;
+
+        sbdd_raid_0_reshape_put(&mark->active[_idx]);
+        wait_var_event(&mark->done, end <= smp_load_acquire(&mark->done) || first >= READ_ONCE(mark->window));
+    }
+
+    *active = &mark->active[_idx];
+
+    return _done;
+}
+
+__u32 sbdd_raid_0_reshape_get(struct sbdd_raid_0_reshape* reshape, sector_t sector, sector_t* mapped_sector, atomic_t** active)
+{
+    const struct sbdd_raid_0_map*   _map = NULL;
+    __u64                           _chunk = div_u64(sector, reshape->map.chunk_sectors);
+    __u64                           _done = 0;
+
+    _done = sbdd_raid_0_watermark_get(&reshape->mark, _chunk, _chunk + 1, active);
+
+    /* Chunks past the old geometry are new space */
+    _map = _chunk < _done || _chunk >= reshape->chunks ? &reshape->map : &reshape->old_map;
+
+    return _map->map_sector(_map, sector, mapped_sector);
+}
+
+/*
+Waits for the member ios mapped before the window was set. The parity is
+flipped twice, like srcu does: an io counted in the old parity after the
+first wait has seen the window, the other one may still hold older ios.
+*/
+static void __sbdd_raid_0_reshape_sync(struct sbdd_raid_0_watermark* mark)
+{
+    atomic_t*   _active = NULL;
+    __u32       _flip = 0;
+
+    for(_flip = 0; _flip < 2; ++_flip)
+    {
+        _active = &mark->active[mark->gen & 1];
+        smp_store_release(&mark->gen, mark->gen + 1);
+        smp_mb();
+
+        wait_var_event(_active, !atomic_read(_active));
+    }
+}
+
+static void __sbdd_raid_0_reshape_endio(struct bio* bio)
+{
+    struct sbdd_raid_0_reshape* _reshape = bio->bi_private;
+
+    if(bio->bi_status)
+        cmpxchg(&_reshape->io_error, 0, blk_status_to_errno(bio->bi_status));
+
+    bio_put(bio);
+
+    if(atomic_dec_and_test(&_reshape->pending))
+        complete(&_reshape->io_done);
+}
+
+/* Sends a byte range of the copy buffer to a member, the bios are counted in pending */
+static void __sbdd_raid_0_reshape_io(struct sbdd_raid_0_reshape* reshape, struct block_device* bdev, sector_t sector,
+                                     size_t offset, size_t len, unsigned int opf)
+{
+    struct bio*     _bio = NULL;
+    unsigned short  _nr_vecs = 0;
+    unsigned int    _page_len = 0;
+
+    while(len)
+    {
+        _nr_vecs = min_t(size_t, DIV_ROUND_UP(offset_in_page(offset) + len, PAGE_SIZE), BIO_MAX_VECS);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+        _bio = bio_alloc(GFP_KERNEL, _nr_vecs);
+        bio_set_dev(_bio, bdev);
+        _bio->bi_opf = opf;
+#else
+        _bio = bio_alloc(bdev, _nr_vecs, opf, GFP_KERNEL);
+#endif
+        _bio->bi_iter.bi_sector = sector;
+        _bio->bi_private = reshape;
+        _bio->bi_end_io = __sbdd_raid_0_reshape_endio;
+
+        while(len)
+        {
+            _page_len = min_t(size_t, len, PAGE_SIZE - offset_in_page(offset));
+            if(bio_add_page(_bio, reshape->pages[offset >> PAGE_SHIFT], _page_len, offset_in_page(offset)) != _page_len)
+                break;
+
+            offset += _page_len;
+            len -= _page_len;
+        }
+
+        sector += bio_sectors(_bio);
+
+        atomic_inc(&reshape->pending);
+        submit_bio(_bio);
+    }
+}
+
+static void __sbdd_raid_0_reshape_begin(struct sbdd_raid_0_reshape* reshape)
+{
+    reinit_completion(&reshape->io_done);
+    atomic_set(&reshape->pending, 1);
+    reshape->io_error = 0;
+}
+
+/* Waits for the copy ios sent since __sbdd_raid_0_reshape_begin */
+static int __sbdd_raid_0_reshape_wait(struct sbdd_raid_0_reshape* reshape)
+{
+    if(!atomic_dec_and_test(&reshape->pending))
+        wait_for_completion_io(&reshape->io_done);
+
+    return reshape->io_error;
+}
+
+static int __sbdd_raid_0_reshape_flush(struct block_device* bdev)
+{
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 12, 0))
+    return blkdev_issue_flush(bdev, GFP_KERNEL, NULL);
+#elif (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 17, 0))
+    return blkdev_issue_flush(bdev, GFP_KERNEL);
+#else
+    return blkdev_issue_flush(bdev);
+#endif
+}
+
+static int __sbdd_raid_0_reshape_sync_io(struct block_device* bdev, sector_t sector, struct page* page, unsigned int opf)
+{
+    struct bio* _bio = NULL;
+    int         _ret = 0;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _bio = bio_alloc(GFP_KERNEL, 1);
+    bio_set_dev(_bio, bdev);
+    _bio->bi_opf = opf;
+#else
+    _bio = bio_alloc(bdev, 1, opf, GFP_KERNEL);
+#endif
+    _bio->bi_iter.bi_sector = sector;
+    bio_add_page(_bio, page, PAGE_SIZE, 0);
+
+    _ret = submit_bio_wait(_bio);
+    bio_put(_bio);
+
+    return _ret;
+}
+
+sector_t sbdd_raid_0_reshape_sb_sector(struct sbdd_raid_0_disk* disk)
+{
+    sector_t _sectors = round_down(bdev_nr_sectors(disk->bdev_raw), SBDD_RAID_0_RESHAPE_SB_SECTORS);
+
+    return _sectors > SBDD_RAID_0_RESHAPE_SB_SECTORS ? _sectors - SBDD_RAID_0_RESHAPE_SB_SECTORS : 0;
+}
+
+/* Records the watermark of the growth, a cleared record is a zero page */
+static int __sbdd_raid_0_reshape_write_sb(struct sbdd_raid_0_reshape* reshape, __u64 done, bool clear)
+{
+    struct sbdd_raid_0_reshape_sb*  _sb = NULL;
+    struct page*                    _page = NULL;
+    int                             _ret = 0;
+
+    _page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if(!_page)
+        return -ENOMEM;
+
+    if(!clear)
+    {
+        _sb = page_address(_page);
+        _sb->magic = cpu_to_le32(SBDD_RAID_0_RESHAPE_MAGIC);
+        _sb->disks_count = cpu_to_le32(reshape->old_map.disks_count);
+        _sb->chunk_sectors = cpu_to_le32(reshape->map.chunk_sectors);
+        _sb->disk_sectors = cpu_to_le64(div_u64(reshape->chunks, reshape->old_map.disks_count) * reshape->map.chunk_sectors);
+        _sb->chunks = cpu_to_le64(reshape->chunks);
+        _sb->done = cpu_to_le64(done);
+        _sb->crc = cpu_to_le32(crc32c(~0, _sb, sizeof(struct sbdd_raid_0_reshape_sb)));
+    }
+
+    _ret = __sbdd_raid_0_reshape_sync_io(reshape->disk->bdev_raw, reshape->sb_sector, _page, REQ_OP_WRITE | REQ_SYNC | REQ_FUA);
+    if(_ret)
+        pr_err("raid_0_reshape:: growth record write to %s error: %d \n", reshape->disk->name, _ret);
+
+    __free_page(_page);
+
+    return _ret;
+}
+
+int sbdd_raid_0_reshape_read_sb(struct sbdd_raid_0_disk* disk, struct sbdd_raid_0_reshape_sb* sb)
+{
+    struct page*    _page = NULL;
+    u32             _crc = 0;
+    int             _ret = 0;
+
+    _page = alloc_page(GFP_KERNEL);
+    if(!_page)
+        return -ENOMEM;
+
+    _ret = __sbdd_raid_0_reshape_sync_io(disk->bdev_raw, sbdd_raid_0_reshape_sb_sector(disk), _page, REQ_OP_READ);
+    if(!_ret)
+    {
+        memcpy(sb, page_address(_page), sizeof(struct sbdd_raid_0_reshape_sb));
+
+        _crc = le32_to_cpu(sb->crc);
+        sb->crc = 0;
+
+        if(le32_to_cpu(sb->magic) != SBDD_RAID_0_RESHAPE_MAGIC || _crc != crc32c(~0, sb, sizeof(struct sbdd_raid_0_reshape_sb)))
+            _ret = -ENOENT;
+    }
+
+    __free_page(_page);
+
+    return _ret;
+}
+
+/* Reads or writes chunks [first, first + count) of a geometry to or from the copy buffer */
+static int __sbdd_raid_0_reshape_copy(struct sbdd_raid_0_reshape* reshape, const struct sbdd_raid_0_map* map,
+                                      __u64 first, __u32 count, unsigned int opf)
+{
+    struct sbdd_raid_0_disk*    _disk = NULL;
+    size_t                      _chunk_bytes = (size_t)map->chunk_sectors << SECTOR_SHIFT;
+    sector_t                    _sector = 0;
+    __u32                       _idx = 0;
+
+    __sbdd_raid_0_reshape_begin(reshape);
+
+    for(_idx = 0; _idx < count; ++_idx)
+    {
+        /* The new geometry has every member, the old one the first of them */
+        _disk = reshape->geo->disks[map->map_sector(map, (first + _idx) * map->chunk_sectors, &_sector)];
+
+        /* The next flush of the array has to cover the moved data */
+        if(op_is_write(opf))
+            set_bit(SBDD_RAID_0_DISK_DIRTY, &_disk->flags);
+
+        __sbdd_raid_0_reshape_io(reshape, _disk->bdev_raw, _sector, _idx * _chunk_bytes, _chunk_bytes, opf);
+    }
+
+    return __sbdd_raid_0_reshape_wait(reshape);
+}
+
+/*
+Moves the window to the new geometry and records the watermark past it
+once the moved chunks are flushed. The old places of the window are not
+written, a failed or cut short move leaves its chunks there.
+*/
+static int __sbdd_raid_0_reshape_move(struct sbdd_raid_0_reshape* reshape, __u64 first, __u32 count)
+{
+    __u32   _idx = 0;
+    int     _ret = 0;
+
+    _ret = __sbdd_raid_0_reshape_copy(reshape, &reshape->old_map, first, count, REQ_OP_READ);
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_copy(reshape, &reshape->map, first, count, REQ_OP_WRITE);
+
+    for(_idx = 0; !_ret && _idx < reshape->geo->disks_count; ++_idx)
+        _ret = __sbdd_raid_0_reshape_flush(reshape->geo->disks[_idx]->bdev_raw);
+
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_write_sb(reshape, first + count, false);
+
+    return _ret;
+}
+
+/*
+Chunks of the growth window from done. The new place of chunk c is the old
+place of chunk c - c / (N + 1), N the old members, or a place on the new
+member. A window is only written over chunks below done then, the first
+row keeps its places.
+*/
+static __u32 __sbdd_raid_0_grow_window(struct sbdd_raid_0_reshape* reshape, __u64 done)
+{
+    __u64 _disks = reshape->old_map.disks_count;
+    __u64 _end = _disks + 1;
+
+    if(done > _disks)
+        _end = div64_u64((done - 1) * (_disks + 1), _disks) + 1;
+
+    return min_t(__u64, min_t(__u64, _end, reshape->chunks) - done, reshape->window_chunks);
+}
+
+/* Copies sectors [first, first + count) of the member being replaced to the new disk */
+static int __sbdd_raid_0_replace_move(struct sbdd_raid_0_reshape* reshape, __u64 first, __u32 count)
+{
+    size_t  _len = (size_t)count << SECTOR_SHIFT;
+    int     _ret = 0;
+
+    __sbdd_raid_0_reshape_begin(reshape);
+    __sbdd_raid_0_reshape_io(reshape, reshape->copying->disks[reshape->slot]->bdev_raw, first, 0, _len, REQ_OP_READ);
+    _ret = __sbdd_raid_0_reshape_wait(reshape);
+    if(_ret)
+        return _ret;
+
+    __sbdd_raid_0_reshape_begin(reshape);
+    __sbdd_raid_0_reshape_io(reshape, reshape->disk->bdev_raw, first, 0, _len, REQ_OP_WRITE);
+
+    return __sbdd_raid_0_reshape_wait(reshape);
+}
+
+/* The member is copied through the whole buffer at once */
+static __u32 __sbdd_raid_0_replace_window(struct sbdd_raid_0_reshape* reshape, __u64 done)
+{
+    return min_t(__u64, (reshape->pages_count << PAGE_SHIFT) >> SECTOR_SHIFT, reshape->sectors - done);
+}
+
+/* Copies units [done, count) window by window, the ios of a window wait for it */
+static int __sbdd_raid_0_reshape_copy_all(struct sbdd_raid_0_reshape* reshape, __u64 count,
+                                          __u32 (*window)(struct sbdd_raid_0_reshape*, __u64),
+                                          int (*move)(struct sbdd_raid_0_reshape*, __u64, __u32))
+{
+    struct sbdd_raid_0_watermark*   _mark = &reshape->mark;
+    __u64                           _done = 0;
+    __u32                           _count = 0;
+    int                             _ret = 0;
+
+    for(_done = _mark->done; _done < count; _done += _count)
+    {
+        /* Stopped by the destroy of the array, it is left like a failed copy */
+        if(kthread_should_stop())
+            return -EINTR;
+
+        _count = window(reshape, _done);
+
+        WRITE_ONCE(_mark->window, _done + _count);
+        __sbdd_raid_0_reshape_sync(_mark);
+
+        _ret = move(reshape, _done, _count);
+        if(_ret)
+        {
+            /* ios go on by the watermark, the copy is just not finished */
+            WRITE_ONCE(_mark->window, _done);
+            wake_up_var(&_mark->done);
+            return _ret;
+        }
+
+        smp_store_release(&_mark->done, _done + _count);
+        wake_up_var(&_mark->done);
+    }
+
+    return 0;
+}
+
+/* The array gets the new geometry and capacity, bios are mapped by the zones again */
+static void __sbdd_raid_0_reshape_finish(struct sbdd_raid_0_reshape* reshape)
+{
+    struct sbdd_raid_0* _raid_0 = reshape->raid_0;
+    struct sbdd*        _dev = _raid_0->ctx;
+    sector_t            _capacity = 0;
+    unsigned int        _io_min = 0;
+    unsigned int        _io_opt = 0;
+
+    /* Bios of the reshape are mapped by its own copies of the maps, the old geometry is not in use */
+    sbdd_raid_0_switch_geo(_raid_0, reshape->geo);
+    WRITE_ONCE(reshape->from, NULL);
+
+    _capacity = sbdd_raid_0_get_capacity(_raid_0);
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 10, 0))
+    set_capacity(_dev->gd, _capacity);
+#else
+    set_capacity_and_notify(_dev->gd, _capacity);
+#endif
+
+    sbdd_raid_0_get_io_hints(_raid_0, &_io_min, &_io_opt);
+    blk_queue_io_opt(_dev->gd->queue, _io_opt);
+
+    pr_info("raid_0_reshape:: done, disks: %u, capacity: %llu \n", reshape->geo->disks_count, (__u64)_capacity);
+}
+
+static int __sbdd_raid_0_reshape_grow(struct sbdd_raid_0_reshape* reshape)
+{
+    struct sbdd_raid_0_geo* _from = reshape->from;
+    int                     _ret = 0;
+
+    /* ios mapped by the old geometry know nothing of the watermark, they are let out first. A resumed one is killed at create */
+    if(!percpu_ref_is_dying(&_from->users))
+        percpu_ref_kill(&_from->users);
+    wait_var_event(&_from->users, percpu_ref_is_zero(&_from->users));
+
+    pr_info("raid_0_reshape:: moving chunks %llu-%llu to %u disks, up to %u chunks at once \n",
+            reshape->mark.done, reshape->chunks, reshape->map.disks_count, reshape->window_chunks);
+
+    _ret = __sbdd_raid_0_reshape_copy_all(reshape, reshape->chunks, __sbdd_raid_0_grow_window, __sbdd_raid_0_reshape_move);
+    if(_ret)
+    {
+        pr_err("raid_0_reshape:: stopped at chunk %llu of %llu, error: %d, it goes on when the array is created again \n",
+               reshape->mark.done, reshape->chunks, _ret);
+        return _ret;
+    }
+
+    /* The array is loaded as a plain one of all the members from here, a record left behind only ends the growth again */
+    __sbdd_raid_0_reshape_write_sb(reshape, 0, true);
+
+    __sbdd_raid_0_reshape_finish(reshape);
+
+    return 0;
+}
+
+static int __sbdd_raid_0_reshape_replace(struct sbdd_raid_0_reshape* reshape)
+{
+    struct sbdd_raid_0*         _raid_0 = reshape->raid_0;
+    struct sbdd_raid_0_disk*    _member = reshape->copying->disks[reshape->slot];
+    int                         _ret = 0;
+
+    /* Writes mapped by the old geometry do not reach the new disk, they are let out before the copy */
+    sbdd_raid_0_switch_geo(_raid_0, reshape->copying);
+
+    pr_info("raid_0_reshape:: copying member %u %s to %s, %llu sectors \n",
+            reshape->slot, _member->name, reshape->disk->name, reshape->sectors);
+
+    _ret = __sbdd_raid_0_reshape_copy_all(reshape, reshape->sectors, __sbdd_raid_0_replace_window, __sbdd_raid_0_replace_move);
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_flush(reshape->disk->bdev_raw);
+    if(_ret)
+    {
+        pr_err("raid_0_reshape:: copy of member %u stopped at sector %llu of %llu, error: %d \n",
+               reshape->slot, reshape->mark.done, reshape->sectors, _ret);
+
+        /*
+        Writes across the watermark would wait for the window for good, the
+        window is dropped so they all pass. The member keeps its slot in the
+        geometry of the new disk and the new disk is closed once the writes
+        still sent to it are done.
+        */
+        WRITE_ONCE(reshape->mark.window, 0);
+        wake_up_var(&reshape->mark.done);
+
+        reshape->geo->disks[reshape->slot] = _member;
+        sbdd_raid_0_switch_geo(_raid_0, reshape->geo);
+        reshape->copying = NULL;
+
+        sbdd_stats_rename_disk(&((struct sbdd*)_raid_0->ctx)->stats, reshape->slot, _member->name);
+
+        sbdd_raid_0_destroy_disk(reshape->disk);
+        reshape->disk = NULL;
+
+        return _ret;
+    }
+
+    /* Writes sent to both since the flush are covered by the next flush of the new disk */
+    set_bit(SBDD_RAID_0_DISK_DIRTY, &reshape->disk->flags);
+
+    sbdd_raid_0_switch_geo(_raid_0, reshape->geo);
+
+    pr_info("raid_0_reshape:: member %u %s replaced by %s \n", reshape->slot, _member->name, reshape->disk->name);
+
+    sbdd_raid_0_destroy_disk(_member);
+
+    return 0;
+}
+
+static int __sbdd_raid_0_reshape_thread(void* data)
+{
+    struct sbdd_raid_0_reshape* _reshape = data;
+    int                         _ret = 0;
+
+    if(_reshape->replace)
+        _ret = __sbdd_raid_0_reshape_replace(_reshape);
+    else
+        _ret = __sbdd_raid_0_reshape_grow(_reshape);
+
+    WRITE_ONCE(_reshape->error, _ret);
+    WRITE_ONCE(_reshape->running, false);
+
+    while(true)
+    {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if(kthread_should_stop())
+            break;
+
+        schedule();
+    }
+
+    __set_current_state(TASK_RUNNING);
+
+    return 0;
+}
+
+static void __sbdd_raid_0_reshape_free_pages(struct sbdd_raid_0_reshape* reshape)
+{
+    __u32 _idx = 0;
+
+    for(_idx = 0; reshape->pages && _idx < reshape->pages_count; ++_idx)
+    {
+        if(reshape->pages[_idx])
+            __free_page(reshape->pages[_idx]);
+    }
+
+    kfree(reshape->pages);
+    reshape->pages = NULL;
+}
+
+/* Lets the last reshape go and gets the copy buffer of the chunk size */
+static int __sbdd_raid_0_reshape_prepare(struct sbdd_raid_0_reshape* reshape, struct sbdd_raid_0* raid_0)
+{
+    size_t  _chunk_bytes = (size_t)sbdd_raid_0_geo(raid_0)->map.chunk_sectors << SECTOR_SHIFT;
+    __u32   _idx = 0;
+
+    /* Bios that found the old geometry of the last reshape killed may still be mapping by it */
+    synchronize_rcu();
+    wait_var_event(&reshape->entered, !atomic_read(&reshape->entered));
+    wait_var_event(&reshape->mark.active[0], !atomic_read(&reshape->mark.active[0]));
+    wait_var_event(&reshape->mark.active[1], !atomic_read(&reshape->mark.active[1]));
+
+    if(reshape->thread)
+        kthread_stop(reshape->thread);
+    reshape->thread = NULL;
+
+    /* The chunk size never changes, the buffer of the first reshape is kept */
+    if(!reshape->pages)
+    {
+        reshape->pages_count = DIV_ROUND_UP(max_t(size_t, SBDD_RAID_0_RESHAPE_BUFFER, _chunk_bytes), PAGE_SIZE);
+        reshape->pages = kcalloc(reshape->pages_count, sizeof(struct page*), GFP_KERNEL);
+        if(!reshape->pages)
+            return -ENOMEM;
+
+        for(_idx = 0; _idx < reshape->pages_count; ++_idx)
+        {
+            reshape->pages[_idx] = alloc_page(GFP_KERNEL);
+            if(!reshape->pages[_idx])
+            {
+                __sbdd_raid_0_reshape_free_pages(reshape);
+                return -ENOMEM;
+            }
+        }
+    }
+
+    reshape->raid_0 = raid_0;
+    reshape->from = NULL;
+    reshape->geo = NULL;
+    reshape->copying = NULL;
+    reshape->disk = NULL;
+    reshape->replace = false;
+    reshape->mark.done = 0;
+    reshape->mark.window = 0;
+    reshape->error = 0;
+    init_completion(&reshape->io_done);
+
+    return 0;
+}
+
+static int __sbdd_raid_0_reshape_create_thread(struct sbdd_raid_0_reshape* reshape)
+{
+    reshape->thread = kthread_create(__sbdd_raid_0_reshape_thread, reshape, "sbdd_reshape");
+    if(IS_ERR(reshape->thread))
+    {
+        pr_err("raid_0_reshape:: can't create reshape thread \n");
+        reshape->thread = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int sbdd_raid_0_reshape_start(struct sbdd_raid_0_reshape* reshape, struct sbdd_raid_0* raid_0,
+                              struct sbdd_raid_0_geo* geo, __u64 chunks, __u64 done)
+{
+    int _ret = 0;
+
+    _ret = __sbdd_raid_0_reshape_prepare(reshape, raid_0);
+    if(_ret)
+        return _ret;
+
+    reshape->geo = geo;
+    reshape->map = geo->map;
+    reshape->old_map = sbdd_raid_0_geo(raid_0)->map;
+    reshape->chunks = chunks;
+    reshape->window_chunks = div_u64((__u64)reshape->pages_count << PAGE_SHIFT, (size_t)geo->map.chunk_sectors << SECTOR_SHIFT);
+    reshape->disk = geo->disks[geo->disks_count - 1];
+    reshape->sb_sector = sbdd_raid_0_reshape_sb_sector(reshape->disk);
+    reshape->mark.done = done;
+    reshape->mark.window = done;
+
+    /* Nothing is moved before the growth is on the new member */
+    _ret = __sbdd_raid_0_reshape_write_sb(reshape, done, false);
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_create_thread(reshape);
+    if(_ret)
+    {
+        reshape->geo = NULL;
+        reshape->disk = NULL;
+        return _ret;
+    }
+
+    /* Looked at by the bios only once the thread kills the geometry */
+    WRITE_ONCE(reshape->from, sbdd_raid_0_geo(raid_0));
+
+    return 0;
+}
+
+int sbdd_raid_0_replace_start(struct sbdd_raid_0_reshape* reshape, struct sbdd_raid_0* raid_0, __u32 slot,
+                              struct sbdd_raid_0_disk* disk, struct sbdd_raid_0_geo* copying, struct sbdd_raid_0_geo* geo)
+{
+    int _ret = 0;
+
+    _ret = __sbdd_raid_0_reshape_prepare(reshape, raid_0);
+    if(!_ret)
+        _ret = __sbdd_raid_0_reshape_create_thread(reshape);
+    if(_ret)
+        return _ret;
+
+    reshape->replace = true;
+    reshape->slot = slot;
+    reshape->disk = disk;
+    reshape->sectors = disk->capacity;
+    reshape->copying = copying;
+    reshape->geo = geo;
+
+    return 0;
+}
+
+void sbdd_raid_0_reshape_run(struct sbdd_raid_0_reshape* reshape)
+{
+    WRITE_ONCE(reshape->running, true);
+    wake_up_process(reshape->thread);
+}
+
+void sbdd_raid_0_reshape_destroy(struct sbdd_raid_0_reshape* reshape)
+{
+    if(reshape->thread)
+    {
+        if(sbdd_raid_0_reshape_running(reshape))
+            pr_info("raid_0_reshape:: stopping the %s \n", reshape->replace ? "member copy, the member stays in the array" :
+                    "growth, it goes on when the array is created again");
+
+        kthread_stop(reshape->thread);
+    }
+    reshape->thread = NULL;
+
+    __sbdd_raid_0_reshape_free_pages(reshape);
+}
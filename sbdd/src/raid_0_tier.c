@@ -0,0 +1,543 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/bitmap.h>
+#include <linux/log2.h>
+#include <linux/crc32c.h>
+#include <sbdd.h>
+#include <raid_0_tier.h>
+
+#define SBDD_RAID_0_TIER_MAGIC          0x54444253 /* "SBDT" */
+#define SBDD_RAID_0_TIER_VERSION        1
+#define SBDD_RAID_0_TIER_PAGE_SECTORS   (PAGE_SIZE >> SECTOR_SHIFT)
+#define SBDD_RAID_0_TIER_TABLE_ENTRIES  (PAGE_SIZE / sizeof(__le32))
+/* Extents are copied in pieces of this many pages */
+#define SBDD_RAID_0_TIER_COPY_PAGES     64
+/* A slow extent is promoted once it has this many recent accesses */
+#define SBDD_RAID_0_TIER_MIN_HITS       8
+
+/* First block of the first member, the remap table follows it */
+struct sbdd_raid_0_tier_sb {
+    __le32 magic;
+    __le32 version;
+    __le32 crc;
+    __le32 extent_sectors;
+    __le32 count;
+    __le32 phys_count;
+};
+
+/* Binary search of the member a physical extent is on */
+static __u32 __sbdd_raid_0_tier_disk(struct sbdd_raid_0_tier* tier, __u32 phys)
+{
+    __u32 _lo = 0;
+    __u32 _hi = tier->geo->disks_count - 1;
+    __u32 _mid = 0;
+
+    while(_lo < _hi)
+    {
+        _mid = (_lo + _hi + 1) >> 1;
+
+        if(phys >= tier->disks[_mid].first)
+            _lo = _mid;
+        else
+            _hi = _mid - 1;
+    }
+
+    return _lo;
+}
+
+/* Member and member sector of an offset in a physical extent */
+static __u32 __sbdd_raid_0_tier_map(struct sbdd_raid_0_tier* tier, __u32 phys, sector_t offset, sector_t* mapped_sector)
+{
+    __u32 _disk = __sbdd_raid_0_tier_disk(tier, phys);
+
+    *mapped_sector = tier->disks[_disk].start + ((sector_t)(phys - tier->disks[_disk].first) << tier->extent_shift) + offset;
+
+    return _disk;
+}
+
+__u32 sbdd_raid_0_tier_get(struct sbdd_raid_0_tier* tier, sector_t sector, sector_t* mapped_sector)
+{
+    struct sbdd_raid_0_extent*  _extent = sbdd_raid_0_tier_extent(tier, sector);
+    __u32                       _hits = 0;
+
+    while(true)
+    {
+        atomic_inc(&_extent->inflight);
+        /* Pairs with the barrier of the migration between the flag and the inflight check */
+        smp_mb__after_atomic();
+
+        if(likely(!test_bit(SBDD_RAID_0_EXTENT_MIGRATING, &_extent->flags)))
+            break;
+
+        sbdd_raid_0_tier_put(_extent);
+        wait_on_bit(&_extent->flags, SBDD_RAID_0_EXTENT_MIGRATING, TASK_UNINTERRUPTIBLE);
+    }
+
+    /* Racy on purpose, a lost access now and then does not change the ranking */
+    _hits = READ_ONCE(_extent->hits);
+    if(_hits < U32_MAX)
+        WRITE_ONCE(_extent->hits, _hits + 1);
+
+    return __sbdd_raid_0_tier_map(tier, READ_ONCE(_extent->phys), sector & ((1 << tier->extent_shift) - 1), mapped_sector);
+}
+
+static int __sbdd_raid_0_tier_io(struct block_device* bdev, sector_t sector, struct page** pages, __u32 count, unsigned int opf)
+{
+    struct bio* _bio = NULL;
+    __u32       _idx = 0;
+    int         _ret = 0;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _bio = bio_alloc(GFP_KERNEL, count);
+    bio_set_dev(_bio, bdev);
+    _bio->bi_opf = opf;
+#else
+    _bio = bio_alloc(bdev, count, opf, GFP_KERNEL);
+#endif
+    _bio->bi_iter.bi_sector = sector;
+
+    for(_idx = 0; _idx < count; ++_idx)
+        bio_add_page(_bio, pages[_idx], PAGE_SIZE, 0);
+
+    _ret = submit_bio_wait(_bio);
+    bio_put(_bio);
+
+    return _ret;
+}
+
+static int __sbdd_raid_0_tier_flush(struct block_device* bdev)
+{
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 12, 0))
+    return blkdev_issue_flush(bdev, GFP_KERNEL, NULL);
+#elif (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 17, 0))
+    return blkdev_issue_flush(bdev, GFP_KERNEL);
+#else
+    return blkdev_issue_flush(bdev);
+#endif
+}
+
+/* Writes a block of the remap table as it is in memory */
+static int __sbdd_raid_0_tier_write_table(struct sbdd_raid_0_tier* tier, __u32 block, unsigned int opf)
+{
+    __le32* _table = page_address(tier->table_page);
+    __u32   _first = block * SBDD_RAID_0_TIER_TABLE_ENTRIES;
+    __u32   _idx = 0;
+
+    memset(_table, 0, PAGE_SIZE);
+
+    for(_idx = 0; _idx < SBDD_RAID_0_TIER_TABLE_ENTRIES && _first + _idx < tier->count; ++_idx)
+        _table[_idx] = cpu_to_le32(READ_ONCE(tier->extents[_first + _idx].phys));
+
+    return __sbdd_raid_0_tier_io(tier->geo->disks[0]->bdev_raw, (sector_t)(block + 1) * SBDD_RAID_0_TIER_PAGE_SECTORS,
+                                 &tier->table_page, 1, REQ_OP_WRITE | opf);
+}
+
+/* Identity remap, the last physical extent is the spare */
+static int __sbdd_raid_0_tier_format(struct sbdd_raid_0_tier* tier)
+{
+    struct sbdd_raid_0_tier_sb* _sb = NULL;
+    __u32                       _idx = 0;
+    int                         _ret = 0;
+
+    pr_info("raid_0_tier:: no remap table, formatting \n");
+
+    for(_idx = 0; _idx < tier->count; ++_idx)
+        tier->extents[_idx].phys = _idx;
+    tier->spare = tier->count;
+
+    for(_idx = 0; _idx < DIV_ROUND_UP(tier->count, SBDD_RAID_0_TIER_TABLE_ENTRIES); ++_idx)
+    {
+        _ret = __sbdd_raid_0_tier_write_table(tier, _idx, 0);
+        if(_ret)
+            return _ret;
+    }
+
+    /* The superblock goes last, a torn format is formatted again */
+    _sb = page_address(tier->table_page);
+    memset(_sb, 0, PAGE_SIZE);
+    _sb->magic = cpu_to_le32(SBDD_RAID_0_TIER_MAGIC);
+    _sb->version = cpu_to_le32(SBDD_RAID_0_TIER_VERSION);
+    _sb->extent_sectors = cpu_to_le32(1 << tier->extent_shift);
+    _sb->count = cpu_to_le32(tier->count);
+    _sb->phys_count = cpu_to_le32(tier->phys_count);
+    _sb->crc = cpu_to_le32(crc32c(~0, _sb, sizeof(struct sbdd_raid_0_tier_sb)));
+
+    return __sbdd_raid_0_tier_io(tier->geo->disks[0]->bdev_raw, 0, &tier->table_page, 1,
+                                 REQ_OP_WRITE | REQ_PREFLUSH | REQ_FUA);
+}
+
+/* Every physical extent is used once, the one left is the spare */
+static int __sbdd_raid_0_tier_load_table(struct sbdd_raid_0_tier* tier)
+{
+    unsigned long*  _used = NULL;
+    __le32*         _table = page_address(tier->table_page);
+    __u32           _phys = 0;
+    __u32           _idx = 0;
+    int             _ret = 0;
+
+    _used = bitmap_zalloc(tier->phys_count, GFP_KERNEL);
+    if(!_used)
+        return -ENOMEM;
+
+    for(_idx = 0; _idx < tier->count; ++_idx)
+    {
+        if(_idx % SBDD_RAID_0_TIER_TABLE_ENTRIES == 0)
+        {
+            _ret = __sbdd_raid_0_tier_io(tier->geo->disks[0]->bdev_raw,
+                                         (sector_t)(_idx / SBDD_RAID_0_TIER_TABLE_ENTRIES + 1) * SBDD_RAID_0_TIER_PAGE_SECTORS,
+                                         &tier->table_page, 1, REQ_OP_READ);
+            if(_ret)
+                goto out;
+        }
+
+        _phys = le32_to_cpu(_table[_idx % SBDD_RAID_0_TIER_TABLE_ENTRIES]);
+        if(_phys >= tier->phys_count || test_and_set_bit(_phys, _used))
+        {
+            pr_err("raid_0_tier:: remap table is corrupted at extent %u \n", _idx);
+            _ret = -EINVAL;
+            goto out;
+        }
+
+        tier->extents[_idx].phys = _phys;
+    }
+
+    tier->spare = find_first_zero_bit(_used, tier->phys_count);
+
+out:
+    bitmap_free(_used);
+
+    return _ret;
+}
+
+static int __sbdd_raid_0_tier_load(struct sbdd_raid_0_tier* tier)
+{
+    struct sbdd_raid_0_tier_sb* _sb = page_address(tier->table_page);
+    __u32                       _crc = 0;
+    int                         _ret = 0;
+
+    _ret = __sbdd_raid_0_tier_io(tier->geo->disks[0]->bdev_raw, 0, &tier->table_page, 1, REQ_OP_READ);
+    if(_ret)
+        return _ret;
+
+    /* Only a blank disk is formatted, anything else may be a table that got damaged */
+    if(!memchr_inv(_sb, 0, PAGE_SIZE))
+        return __sbdd_raid_0_tier_format(tier);
+
+    _crc = le32_to_cpu(_sb->crc);
+    _sb->crc = 0;
+
+    if(le32_to_cpu(_sb->magic) != SBDD_RAID_0_TIER_MAGIC || _crc != crc32c(~0, _sb, sizeof(struct sbdd_raid_0_tier_sb)))
+    {
+        pr_err("raid_0_tier:: the start of the first disk is not a remap table or it is corrupted \n");
+        return -EUCLEAN;
+    }
+
+    if(le32_to_cpu(_sb->version) != SBDD_RAID_0_TIER_VERSION || le32_to_cpu(_sb->extent_sectors) != (1 << tier->extent_shift) ||
+        le32_to_cpu(_sb->count) != tier->count || le32_to_cpu(_sb->phys_count) != tier->phys_count)
+    {
+        pr_err("raid_0_tier:: remap table of another geometry: extent: %u, extents: %u \n",
+               le32_to_cpu(_sb->extent_sectors), le32_to_cpu(_sb->count));
+        return -EINVAL;
+    }
+
+    return __sbdd_raid_0_tier_load_table(tier);
+}
+
+static int __sbdd_raid_0_tier_copy(struct sbdd_raid_0_tier* tier, __u32 src, __u32 dst)
+{
+    struct sbdd_raid_0_geo* _geo = tier->geo;
+    sector_t                _src_sector = 0;
+    sector_t                _dst_sector = 0;
+    sector_t                _done = 0;
+    __u32                   _src_disk = __sbdd_raid_0_tier_map(tier, src, 0, &_src_sector);
+    __u32                   _dst_disk = __sbdd_raid_0_tier_map(tier, dst, 0, &_dst_sector);
+    __u32                   _count = 0;
+    int                     _ret = 0;
+
+    for(_done = 0; _done < (1 << tier->extent_shift); _done += _count * SBDD_RAID_0_TIER_PAGE_SECTORS)
+    {
+        _count = min_t(__u32, SBDD_RAID_0_TIER_COPY_PAGES, ((1 << tier->extent_shift) - _done) / SBDD_RAID_0_TIER_PAGE_SECTORS);
+
+        _ret = __sbdd_raid_0_tier_io(_geo->disks[_src_disk]->bdev_raw, _src_sector + _done, tier->pages, _count, REQ_OP_READ);
+        if(_ret)
+            return _ret;
+
+        _ret = __sbdd_raid_0_tier_io(_geo->disks[_dst_disk]->bdev_raw, _dst_sector + _done, tier->pages, _count, REQ_OP_WRITE);
+        if(_ret)
+            return _ret;
+    }
+
+    /* The copy is stable before the table points at it */
+    return __sbdd_raid_0_tier_flush(_geo->disks[_dst_disk]->bdev_raw);
+}
+
+/*
+Moves a logical extent to the spare. Its ios are held meanwhile. The old
+place is not written before the table entry is stable, so a crash leaves
+either the old or the new mapping with the data in place.
+*/
+static int __sbdd_raid_0_tier_migrate(struct sbdd_raid_0_tier* tier, __u32 idx)
+{
+    struct sbdd_raid_0_extent*  _extent = &tier->extents[idx];
+    __u32                       _src = _extent->phys;
+    __u32                       _dst = tier->spare;
+    int                         _ret = 0;
+
+    set_bit(SBDD_RAID_0_EXTENT_MIGRATING, &_extent->flags);
+    smp_mb__after_atomic();
+    wait_var_event(&_extent->inflight, !atomic_read(&_extent->inflight));
+
+    _ret = __sbdd_raid_0_tier_copy(tier, _src, _dst);
+    if(!_ret)
+    {
+        /* Only this entry changes, a torn table block has it either old or new */
+        WRITE_ONCE(_extent->phys, _dst);
+
+        _ret = __sbdd_raid_0_tier_write_table(tier, idx / SBDD_RAID_0_TIER_TABLE_ENTRIES, REQ_SYNC | REQ_FUA);
+        if(_ret)
+            WRITE_ONCE(_extent->phys, _src);
+        else
+            tier->spare = _src;
+    }
+
+    clear_bit_unlock(SBDD_RAID_0_EXTENT_MIGRATING, &_extent->flags);
+    smp_mb__after_atomic();
+    wake_up_bit(&_extent->flags, SBDD_RAID_0_EXTENT_MIGRATING);
+
+    if(_ret)
+        pr_err("raid_0_tier:: migration of extent %u error: %d \n", idx, _ret);
+
+    return _ret;
+}
+
+/* Hottest extent on the slow members and coldest one on the fast members, U32_MAX if none */
+static void __sbdd_raid_0_tier_scan(struct sbdd_raid_0_tier* tier, __u32* hot, __u32* cold)
+{
+    __u32 _idx = 0;
+    __u32 _hits = 0;
+    __u32 _hot_hits = 0;
+    __u32 _cold_hits = U32_MAX;
+
+    *hot = U32_MAX;
+    *cold = U32_MAX;
+
+    for(_idx = 0; _idx < tier->count; ++_idx)
+    {
+        _hits = READ_ONCE(tier->extents[_idx].hits);
+
+        if(tier->extents[_idx].phys >= tier->fast_extents)
+        {
+            if(*hot == U32_MAX || _hits > _hot_hits)
+            {
+                *hot = _idx;
+                _hot_hits = _hits;
+            }
+        }
+        else if(_hits < _cold_hits)
+        {
+            *cold = _idx;
+            _cold_hits = _hits;
+        }
+    }
+}
+
+/*
+Promotes the hottest slow extents, up to the budget of a pass. With no spare
+on the fast members the coldest fast extent is demoted first, only if the
+hot one is accessed twice as often, so extents do not bounce between tiers.
+*/
+static void __sbdd_raid_0_tier_pass(struct sbdd_raid_0_tier* tier)
+{
+    __u32 _moves = 0;
+    __u32 _hot = 0;
+    __u32 _cold = 0;
+    __u32 _idx = 0;
+
+    while(_moves < tier->budget && !kthread_should_stop())
+    {
+        __sbdd_raid_0_tier_scan(tier, &_hot, &_cold);
+
+        if(_hot == U32_MAX || READ_ONCE(tier->extents[_hot].hits) < SBDD_RAID_0_TIER_MIN_HITS)
+            break;
+
+        if(tier->spare >= tier->fast_extents)
+        {
+            if(_cold == U32_MAX || READ_ONCE(tier->extents[_hot].hits) <= 2 * READ_ONCE(tier->extents[_cold].hits))
+                break;
+
+            if(__sbdd_raid_0_tier_migrate(tier, _cold))
+                break;
+
+            ++tier->demoted;
+            ++_moves;
+        }
+
+        if(__sbdd_raid_0_tier_migrate(tier, _hot))
+            break;
+
+        ++tier->promoted;
+        ++_moves;
+    }
+
+    /* Aging, old accesses count half every pass */
+    for(_idx = 0; _idx < tier->count; ++_idx)
+        WRITE_ONCE(tier->extents[_idx].hits, READ_ONCE(tier->extents[_idx].hits) >> 1);
+}
+
+static int __sbdd_raid_0_tier_migrator(void* data)
+{
+    struct sbdd_raid_0_tier* _tier = data;
+
+    while(!kthread_should_stop())
+    {
+        schedule_timeout_interruptible(HZ);
+
+        if(kthread_should_stop())
+            break;
+
+        __sbdd_raid_0_tier_pass(_tier);
+    }
+
+    return 0;
+}
+
+/* Physical extents of every member, the table is in front of the first member extents */
+static int __sbdd_raid_0_tier_layout(struct sbdd_raid_0_tier* tier)
+{
+    struct sbdd_raid_0_geo* _geo = tier->geo;
+    sector_t                _extent_sectors = 1 << tier->extent_shift;
+    sector_t                _capacity = 0;
+    __u64                   _upper = 0;
+    __u64                   _phys = 0;
+    __u32                   _idx = 0;
+
+    for(_idx = 0; _idx < _geo->disks_count; ++_idx)
+        _upper += _geo->disks[_idx]->capacity >> tier->extent_shift;
+
+    for(_idx = 0; _idx < _geo->disks_count; ++_idx)
+    {
+        _capacity = _geo->disks[_idx]->capacity;
+
+        tier->disks[_idx].first = _phys;
+        tier->disks[_idx].start = 0;
+        if(_idx == 0)
+            tier->disks[_idx].start = round_up(SBDD_RAID_0_TIER_PAGE_SECTORS * (1 + DIV_ROUND_UP(_upper, SBDD_RAID_0_TIER_TABLE_ENTRIES)),
+                                               _extent_sectors);
+
+        tier->disks[_idx].count = _capacity > tier->disks[_idx].start ?
+                                  (_capacity - tier->disks[_idx].start) >> tier->extent_shift : 0;
+        _phys += tier->disks[_idx].count;
+
+        if(_idx + 1 == tier->raid_0->config.tier_disks)
+            tier->fast_extents = _phys;
+    }
+
+    if(_phys >= U32_MAX || !tier->fast_extents || _phys == tier->fast_extents)
+    {
+        pr_err("raid_0_tier:: both tiers need space, fast extents: %u, all: %llu \n", tier->fast_extents, _phys);
+        return -EINVAL;
+    }
+
+    tier->phys_count = _phys;
+    tier->count = _phys - 1;
+
+    return 0;
+}
+
+int sbdd_raid_0_tier_create(struct sbdd_raid_0_tier* tier, struct sbdd_raid_0* raid_0, struct sbdd_raid_0_geo* geo)
+{
+    __u32   _extent_sectors = raid_0->config.extent_size << 1;
+    __u32   _idx = 0;
+    int     _ret = 0;
+
+    tier->raid_0 = raid_0;
+    tier->geo = geo;
+
+    if(raid_0->config.tier_disks >= geo->disks_count)
+    {
+        pr_err("raid_0_tier:: %d fast disks leave no slow ones \n", raid_0->config.tier_disks);
+        return -EINVAL;
+    }
+
+    if(!is_power_of_2(_extent_sectors) || _extent_sectors < SBDD_RAID_0_TIER_PAGE_SECTORS)
+    {
+        pr_err("raid_0_tier:: extent must be a power of two of at least a page \n");
+        return -EINVAL;
+    }
+
+    tier->extent_shift = ilog2(_extent_sectors);
+    tier->budget = max_t(__u32, ((__u64)raid_0->config.tier_rate << (20 - SECTOR_SHIFT)) >> tier->extent_shift, 1);
+
+    tier->disks = kcalloc(geo->disks_count, sizeof(struct sbdd_raid_0_tier_disk), GFP_KERNEL);
+    if(!tier->disks)
+        return -ENOMEM;
+
+    _ret = __sbdd_raid_0_tier_layout(tier);
+    if(_ret)
+        return _ret;
+
+    tier->extents = vzalloc(array_size(tier->count, sizeof(struct sbdd_raid_0_extent)));
+    tier->pages = kcalloc(SBDD_RAID_0_TIER_COPY_PAGES, sizeof(struct page*), GFP_KERNEL);
+    tier->table_page = alloc_page(GFP_KERNEL);
+    if(!tier->extents || !tier->pages || !tier->table_page)
+        return -ENOMEM;
+
+    for(_idx = 0; _idx < SBDD_RAID_0_TIER_COPY_PAGES; ++_idx)
+    {
+        tier->pages[_idx] = alloc_page(GFP_KERNEL);
+        if(!tier->pages[_idx])
+            return -ENOMEM;
+    }
+
+    _ret = __sbdd_raid_0_tier_load(tier);
+    if(_ret)
+        return _ret;
+
+    tier->migrator = kthread_run(__sbdd_raid_0_tier_migrator, tier, "sbdd_tier");
+    if(IS_ERR(tier->migrator))
+    {
+        pr_err("raid_0_tier:: can't start migration thread \n");
+        tier->migrator = NULL;
+        return -ENOMEM;
+    }
+
+    pr_info("raid_0_tier:: extents: %u, fast: %u, extent sectors: %u, extents per pass: %u \n",
+            tier->count, tier->fast_extents, _extent_sectors, tier->budget);
+
+    return 0;
+}
+
+void sbdd_raid_0_tier_destroy(struct sbdd_raid_0_tier* tier)
+{
+    __u32 _idx = 0;
+
+    if(tier->migrator)
+        kthread_stop(tier->migrator);
+    tier->migrator = NULL;
+
+    if(tier->extents)
+        pr_info("raid_0_tier:: promoted: %llu, demoted: %llu \n", tier->promoted, tier->demoted);
+
+    for(_idx = 0; tier->pages && _idx < SBDD_RAID_0_TIER_COPY_PAGES; ++_idx)
+    {
+        if(tier->pages[_idx])
+            __free_page(tier->pages[_idx]);
+    }
+
+    kfree(tier->pages);
+    tier->pages = NULL;
+
+    if(tier->table_page)
+        __free_page(tier->table_page);
+    tier->table_page = NULL;
+
+    vfree(tier->extents);
+    tier->extents = NULL;
+
+    kfree(tier->disks);
+    tier->disks = NULL;
+}
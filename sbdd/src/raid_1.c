@@ -0,0 +1,729 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/string.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/wait_bit.h>
+#include <trace/events/block.h>
+#include <sbdd.h>
+#include <raid_1.h>
+#include <sbdd_trace.h>
+
+#define SBDD_RAID_1_NO_DISK             U32_MAX
+/* Read completions per cpu between hedge delay updates */
+#define SBDD_RAID_1_HEDGE_WINDOW        1024
+/* Windows with fewer reads keep the previous hedge delay */
+#define SBDD_RAID_1_HEDGE_MIN_SAMPLES   256
+
+struct sbdd_raid_1_hedge;
+
+/* Front pad of every bio allocated from the raid bio_set */
+struct sbdd_raid_1_io {
+    struct sbdd_raid_1*         raid_1;
+    struct sbdd_raid_1_hedge*   hedge;
+    __u64       start_ns;
+    sector_t    sector;
+    __u32       sectors;
+    __u32       disk;
+    /* mirrors a read was sent to */
+    __u32       tried;
+    /* data of the bio, its iter is advanced by the layers below */
+    struct bvec_iter iter;
+    struct bio  bio;
+};
+
+/*
+Hedged read. The primary and the hedge read into pages of their own, the
+first one to succeed copies its data to the parent and completes it. The
+other one may still be in flight then, so it must not touch parent pages.
+*/
+struct sbdd_raid_1_hedge {
+    struct sbdd_raid_1*     raid_1;
+    struct bio*             parent;
+    struct hrtimer          timer;
+    struct work_struct      work;
+    /* primary, armed timer or queued work, hedge */
+    atomic_t                refs;
+    /* primary and hedge completions still to come */
+    atomic_t                pending;
+    /* parent is completed */
+    atomic_t                done;
+    blk_status_t            status;
+    sector_t                sector;
+    __u32                   sectors;
+    __u32                   primary;
+    unsigned int            opf;
+    unsigned short          ioprio;
+};
+
+static struct sbdd_raid_1_disk* __sbdd_raid_1_create_disk(const char* name)
+{
+    struct sbdd_raid_1_disk* _disk = NULL;
+
+	_disk = kzalloc(sizeof(struct sbdd_raid_1_disk), GFP_KERNEL);
+	if (!_disk)
+    {
+        pr_err("raid_1:: cannot alloc block device '%s' \n", name);
+		return NULL;
+	}
+
+    scnprintf(_disk->name, DISK_NAME_LEN, name);
+
+    _disk->bdev_raw = blkdev_get_by_path(name, SBDD_RAID_1_FMODE,  NULL);
+    if(IS_ERR(_disk->bdev_raw))
+    {
+	    pr_err("raid_1:: cannot open block device '%s' \n", name);
+        kfree(_disk);
+	    return NULL;
+    }
+
+    _disk->capacity = bdev_nr_sectors(_disk->bdev_raw);
+    _disk->max_sectors = queue_max_hw_sectors(bdev_get_queue(_disk->bdev_raw));
+    atomic_set(&_disk->inflight, 0);
+
+    pr_info("raid_1:: allocate disk name: %s, capacity: %llu, max_sectors: %u \n", _disk->name, _disk->capacity, _disk->max_sectors);
+
+    return _disk;
+}
+
+static int __sbdd_raid_1_destroy_disk(struct sbdd_raid_1_disk* disk)
+{
+    if(disk)
+    {
+        blkdev_put(disk->bdev_raw, SBDD_RAID_1_FMODE);
+        kfree(disk);
+
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+/* Picks the mirror to read from, mirrors in the exclude mask are skipped */
+static __u32 __sbdd_raid_1_select_disk(struct sbdd_raid_1* raid_1, sector_t sector, __u32 exclude)
+{
+    struct sbdd_raid_1_disk*    _disk = NULL;
+    __u32                       _best = SBDD_RAID_1_NO_DISK;
+    __u64                       _best_key[2] = {};
+    __u64                       _key[2] = {};
+    __u64                       _distance = 0;
+    sector_t                    _head = 0;
+    __u32                       _idx = 0;
+
+    for(_idx = 0; _idx < raid_1->config.disks_count; ++_idx)
+    {
+        if(exclude & BIT(_idx))
+            continue;
+
+        _disk = raid_1->disks[_idx];
+        _head = READ_ONCE(_disk->head);
+        _distance = _head > sector ? _head - sector : sector - _head;
+
+        /* The other criterion breaks ties */
+        if(raid_1->config.read_balance == SBDD_RAID_1_READ_NEAREST)
+        {
+            _key[0] = _distance;
+            _key[1] = atomic_read(&_disk->inflight);
+        }
+        else
+        {
+            _key[0] = atomic_read(&_disk->inflight);
+            _key[1] = _distance;
+        }
+
+        if(_best == SBDD_RAID_1_NO_DISK || _key[0] < _best_key[0] ||
+            (_key[0] == _best_key[0] && _key[1] < _best_key[1]))
+        {
+            _best = _idx;
+            _best_key[0] = _key[0];
+            _best_key[1] = _key[1];
+        }
+    }
+
+    return _best;
+}
+
+/* Hedge delay is the configured percentile of the last window of read latencies */
+static void __sbdd_raid_1_update_hedge(struct sbdd_raid_1* raid_1)
+{
+    u64             _hist[SBDD_STATS_HIST_BUCKETS] = {};
+    u64             _total = 0;
+    u64             _sum = 0;
+    u64             _target = 0;
+    unsigned long   _flags = 0;
+    int             _cpu = 0;
+    __u32           _idx = 0;
+
+    if(!spin_trylock_irqsave(&raid_1->lat_lock, _flags))
+        return;
+
+    for_each_possible_cpu(_cpu)
+    {
+        for(_idx = 0; _idx < SBDD_STATS_HIST_BUCKETS; ++_idx)
+            _hist[_idx] += per_cpu_ptr(raid_1->lat, _cpu)->hist[_idx];
+    }
+
+    for(_idx = 0; _idx < SBDD_STATS_HIST_BUCKETS; ++_idx)
+        _total += _hist[_idx] - raid_1->lat_prev[_idx];
+
+    if(_total >= SBDD_RAID_1_HEDGE_MIN_SAMPLES)
+    {
+        _target = div_u64(_total * raid_1->config.hedge_pct + 99, 100);
+
+        for(_idx = 0; _idx < SBDD_STATS_HIST_BUCKETS - 1; ++_idx)
+        {
+            _sum += _hist[_idx] - raid_1->lat_prev[_idx];
+            if(_sum >= _target)
+                break;
+        }
+
+        /* Upper bound of the bucket the percentile falls into */
+        WRITE_ONCE(raid_1->hedge_ns, (1ull << _idx) << SBDD_STATS_HIST_SHIFT);
+
+        memcpy(raid_1->lat_prev, _hist, sizeof(_hist));
+    }
+
+    spin_unlock_irqrestore(&raid_1->lat_lock, _flags);
+}
+
+static void __sbdd_raid_1_account_read(struct sbdd_raid_1* raid_1, u64 ns)
+{
+    this_cpu_inc(raid_1->lat->hist[sbdd_stats_bucket(ns)]);
+
+    if(!(this_cpu_inc_return(raid_1->lat->count) & (SBDD_RAID_1_HEDGE_WINDOW - 1)))
+        __sbdd_raid_1_update_hedge(raid_1);
+}
+
+static void __sbdd_raid_1_hedge_put(struct sbdd_raid_1_hedge* hedge)
+{
+    struct sbdd_raid_1* _raid_1 = hedge->raid_1;
+
+    if(!atomic_dec_and_test(&hedge->refs))
+        return;
+
+    kfree(hedge);
+
+    if(atomic_dec_and_test(&_raid_1->hedges))
+        wake_up_var(&_raid_1->hedges);
+}
+
+/* Parent fails only when no read is left that could still succeed */
+static void __sbdd_raid_1_hedge_dec(struct sbdd_raid_1_hedge* hedge, blk_status_t status)
+{
+    if(status)
+        WRITE_ONCE(hedge->status, status);
+
+    if(atomic_dec_and_test(&hedge->pending) && !atomic_xchg(&hedge->done, 1))
+    {
+        hedge->parent->bi_status = READ_ONCE(hedge->status) ? : BLK_STS_IOERR;
+        bio_endio(hedge->parent);
+    }
+}
+
+static void __sbdd_raid_1_hedge_endio(struct sbdd_raid_1_hedge* hedge, struct bio* bio, bool is_primary)
+{
+    struct sbdd_raid_1_io*  _io = container_of(bio, struct sbdd_raid_1_io, bio);
+    struct bvec_iter        _iter = hedge->parent->bi_iter;
+    blk_status_t            _status = bio->bi_status;
+
+    if(!_status && !atomic_xchg(&hedge->done, 1))
+    {
+        bio_copy_data_iter(hedge->parent, &_iter, bio, &_io->iter);
+        bio_endio(hedge->parent);
+
+        /* Made it in time, no hedge is needed */
+        if(hrtimer_try_to_cancel(&hedge->timer) == 1)
+        {
+            __sbdd_raid_1_hedge_dec(hedge, BLK_STS_OK);
+            __sbdd_raid_1_hedge_put(hedge);
+        }
+    }
+    else if(_status && is_primary && hrtimer_try_to_cancel(&hedge->timer) == 1)
+    {
+        /* Failed primary is retried on another mirror right away, the timer reference goes to the work */
+        queue_work(system_highpri_wq, &hedge->work);
+    }
+
+    __sbdd_raid_1_hedge_dec(hedge, _status);
+
+    bio_free_pages(bio);
+    bio_put(bio);
+
+    __sbdd_raid_1_hedge_put(hedge);
+}
+
+static void __sbdd_raid_1_endio(struct bio* bio)
+{
+    struct sbdd_raid_1_io*  _io = container_of(bio, struct sbdd_raid_1_io, bio);
+    struct sbdd_raid_1*     _raid_1 = _io->raid_1;
+    struct bio*             _parent = bio->bi_private;
+    __u64                   _latency = 0;
+    unsigned long           _flags = 0;
+
+    atomic_dec(&_raid_1->disks[_io->disk]->inflight);
+
+    if(unlikely(bio->bi_status))
+        sbdd_stats_disk_error(&((struct sbdd*)_raid_1->ctx)->stats, _io->disk, sbdd_stats_dir(bio));
+
+    if(_io->start_ns)
+    {
+        _latency = ktime_get_ns() - _io->start_ns;
+
+        if(sbdd_io_is_tracked())
+        {
+            trace_sbdd_complete(bio, _io->sector, _io->sectors, _io->disk, _latency);
+
+            sbdd_stats_disk_complete(&((struct sbdd*)_raid_1->ctx)->stats, _io->disk,
+                                     sbdd_stats_dir(bio), _latency);
+        }
+
+        if(!bio->bi_status && bio_data_dir(bio) == READ && _raid_1->config.hedge_pct)
+            __sbdd_raid_1_account_read(_raid_1, _latency);
+    }
+
+    if(_io->hedge)
+    {
+        __sbdd_raid_1_hedge_endio(_io->hedge, bio, _io->disk == _io->hedge->primary);
+        return;
+    }
+
+    /* A failed read goes on with the next mirror, bios can't be allocated and submitted from here */
+    if(bio->bi_status && bio_data_dir(bio) == READ && bio_has_data(bio) &&
+        hweight32(_io->tried) < _raid_1->config.disks_count)
+    {
+        spin_lock_irqsave(&_raid_1->retry_lock, _flags);
+        bio_list_add(&_raid_1->retry, bio);
+        spin_unlock_irqrestore(&_raid_1->retry_lock, _flags);
+
+        queue_work(system_highpri_wq, &_raid_1->retry_work);
+        return;
+    }
+
+    if(bio->bi_status && !_parent->bi_status)
+        _parent->bi_status = bio->bi_status;
+
+    bio_put(bio);
+    bio_endio(_parent);
+}
+
+static void __sbdd_raid_1_submit(struct sbdd_raid_1* raid_1, struct bio* bio, struct sbdd_raid_1_hedge* hedge, __u32 disk)
+{
+    struct sbdd*                _dev = raid_1->ctx;
+    struct sbdd_raid_1_io*      _io = container_of(bio, struct sbdd_raid_1_io, bio);
+    struct sbdd_raid_1_disk*    _disk = raid_1->disks[disk];
+    sector_t                    _sector = bio->bi_iter.bi_sector;
+
+    _io->raid_1 = raid_1;
+    _io->hedge = hedge;
+    _io->sector = _sector;
+    _io->sectors = bio_sectors(bio);
+    _io->disk = disk;
+    _io->tried |= BIT(disk);
+    _io->iter = bio->bi_iter;
+    _io->start_ns = 0;
+
+    /* Read latencies are what the hedge delay is derived from */
+    if(sbdd_io_is_tracked() || (raid_1->config.hedge_pct && bio_data_dir(bio) == READ))
+        _io->start_ns = ktime_get_ns();
+
+    atomic_inc(&_disk->inflight);
+    WRITE_ONCE(_disk->head, bio_end_sector(bio));
+
+    bio_set_dev(bio, _disk->bdev_raw);
+
+    trace_sbdd_remap(bio, _sector, disk);
+
+    sbdd_stats_disk_submit(&_dev->stats, disk, sbdd_stats_dir(bio), bio_sectors(bio));
+    sbdd_heatmap_record(&_dev->heatmap, bio, _sector);
+
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	trace_block_bio_remap(bio, disk_devt(_dev->gd), _sector);
+#else
+    trace_block_bio_remap(bdev_get_queue(bio->bi_bdev), bio, bio->bi_bdev->bd_dev, _sector);
+#endif
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(bio);
+#else
+	submit_bio_noacct(bio);
+#endif
+}
+
+/* Clone sharing the parent pages, the parent completes with the last of its clones */
+static struct bio* __sbdd_raid_1_clone(struct sbdd_raid_1* raid_1, struct bio* bio, __u32 disk)
+{
+    struct bio* _clone = NULL;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _clone = bio_clone_fast(bio, GFP_NOIO, &raid_1->bio_set);
+#else
+    _clone = bio_alloc_clone(raid_1->disks[disk]->bdev_raw, bio, GFP_NOIO, &raid_1->bio_set);
+#endif
+
+    _clone->bi_private = bio;
+    _clone->bi_end_io = __sbdd_raid_1_endio;
+    bio_inc_remaining(bio);
+
+    container_of(_clone, struct sbdd_raid_1_io, bio)->tried = 0;
+
+    return _clone;
+}
+
+/* Failed reads are sent again to a mirror they were not read from, the parent fails when none is left */
+static void __sbdd_raid_1_retry_work(struct work_struct* work)
+{
+    struct sbdd_raid_1*     _raid_1 = container_of(work, struct sbdd_raid_1, retry_work);
+    struct bio_list         _retry;
+    struct bio*             _bio = NULL;
+    struct bio*             _parent = NULL;
+    struct bio*             _clone = NULL;
+    __u32                   _tried = 0;
+    __u32                   _disk = 0;
+
+    spin_lock_irq(&_raid_1->retry_lock);
+    bio_list_init(&_retry);
+    bio_list_merge(&_retry, &_raid_1->retry);
+    bio_list_init(&_raid_1->retry);
+    spin_unlock_irq(&_raid_1->retry_lock);
+
+    while((_bio = bio_list_pop(&_retry)))
+    {
+        _parent = _bio->bi_private;
+        _tried = container_of(_bio, struct sbdd_raid_1_io, bio)->tried;
+
+        _disk = __sbdd_raid_1_select_disk(_raid_1, _parent->bi_iter.bi_sector, _tried);
+        if(_disk == SBDD_RAID_1_NO_DISK)
+        {
+            if(!_parent->bi_status)
+                _parent->bi_status = _bio->bi_status;
+        }
+        else
+        {
+            /* The parent was never submitted, its iter still covers all of the data */
+            _clone = __sbdd_raid_1_clone(_raid_1, _parent, _disk);
+            container_of(_clone, struct sbdd_raid_1_io, bio)->tried = _tried;
+
+            __sbdd_raid_1_submit(_raid_1, _clone, NULL, _disk);
+        }
+
+        bio_put(_bio);
+        bio_endio(_parent);
+    }
+}
+
+/* Read into pages of its own, NULL if they can't be had without waiting on reclaim */
+static struct bio* __sbdd_raid_1_alloc_bounce(struct sbdd_raid_1* raid_1, struct sbdd_raid_1_hedge* hedge, __u32 disk)
+{
+    struct bio*     _bio = NULL;
+    struct page*    _page = NULL;
+    __u32           _left = hedge->sectors << SECTOR_SHIFT;
+    __u32           _len = 0;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _bio = bio_alloc_bioset(GFP_NOIO, DIV_ROUND_UP(_left, PAGE_SIZE), &raid_1->bio_set);
+#else
+    _bio = bio_alloc_bioset(raid_1->disks[disk]->bdev_raw, DIV_ROUND_UP(_left, PAGE_SIZE), hedge->opf, GFP_NOIO, &raid_1->bio_set);
+#endif
+
+    _bio->bi_opf = hedge->opf;
+    _bio->bi_ioprio = hedge->ioprio;
+    _bio->bi_iter.bi_sector = hedge->sector;
+    _bio->bi_private = NULL;
+    _bio->bi_end_io = __sbdd_raid_1_endio;
+
+    container_of(_bio, struct sbdd_raid_1_io, bio)->tried = 0;
+
+    while(_left)
+    {
+        _page = alloc_page(GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+        if(!_page)
+        {
+            bio_free_pages(_bio);
+            bio_put(_bio);
+            return NULL;
+        }
+
+        _len = min_t(__u32, _left, PAGE_SIZE);
+        bio_add_page(_bio, _page, _len, 0);
+        _left -= _len;
+    }
+
+    return _bio;
+}
+
+static enum hrtimer_restart __sbdd_raid_1_hedge_timer(struct hrtimer* timer)
+{
+    struct sbdd_raid_1_hedge* _hedge = container_of(timer, struct sbdd_raid_1_hedge, timer);
+
+    /* Bios can't be allocated and submitted from the timer */
+    queue_work(system_highpri_wq, &_hedge->work);
+
+    return HRTIMER_NORESTART;
+}
+
+static void __sbdd_raid_1_hedge_work(struct work_struct* work)
+{
+    struct sbdd_raid_1_hedge*   _hedge = container_of(work, struct sbdd_raid_1_hedge, work);
+    struct sbdd_raid_1*         _raid_1 = _hedge->raid_1;
+    struct bio*                 _clone = NULL;
+    __u32                       _disk = SBDD_RAID_1_NO_DISK;
+
+    /* The parent may be gone once done, only the hedge copy of it is used */
+    if(!atomic_read(&_hedge->done))
+    {
+        _disk = __sbdd_raid_1_select_disk(_raid_1, _hedge->sector, BIT(_hedge->primary));
+        if(_disk != SBDD_RAID_1_NO_DISK)
+            _clone = __sbdd_raid_1_alloc_bounce(_raid_1, _hedge, _disk);
+    }
+
+    if(_clone)
+    {
+        atomic_inc(&_hedge->refs);
+
+        trace_sbdd_hedge(_clone, _hedge->primary, _disk);
+
+        __sbdd_raid_1_submit(_raid_1, _clone, _hedge, _disk);
+    }
+    else
+    {
+        /* No second read, its completion won't come */
+        __sbdd_raid_1_hedge_dec(_hedge, BLK_STS_OK);
+    }
+
+    __sbdd_raid_1_hedge_put(_hedge);
+}
+
+static bool __sbdd_raid_1_read_hedged(struct sbdd_raid_1* raid_1, struct bio* bio, __u32 disk, u64 delay_ns)
+{
+    struct sbdd_raid_1_hedge*   _hedge = NULL;
+    struct bio*                 _clone = NULL;
+
+    _hedge = kzalloc(sizeof(struct sbdd_raid_1_hedge), GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN);
+    if(!_hedge)
+        return false;
+
+    _hedge->raid_1 = raid_1;
+    _hedge->parent = bio;
+    _hedge->sector = bio->bi_iter.bi_sector;
+    _hedge->sectors = bio_sectors(bio);
+    _hedge->primary = disk;
+    _hedge->opf = bio->bi_opf;
+    _hedge->ioprio = bio->bi_ioprio;
+    atomic_set(&_hedge->refs, 2);
+    atomic_set(&_hedge->pending, 2);
+    atomic_set(&_hedge->done, 0);
+    INIT_WORK(&_hedge->work, __sbdd_raid_1_hedge_work);
+    hrtimer_init(&_hedge->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    _hedge->timer.function = __sbdd_raid_1_hedge_timer;
+
+    _clone = __sbdd_raid_1_alloc_bounce(raid_1, _hedge, disk);
+    if(!_clone)
+    {
+        kfree(_hedge);
+        return false;
+    }
+
+    bio_clone_blkg_association(_clone, bio);
+
+    atomic_inc(&raid_1->hedges);
+
+    hrtimer_start(&_hedge->timer, ns_to_ktime(delay_ns), HRTIMER_MODE_REL);
+
+    __sbdd_raid_1_submit(raid_1, _clone, _hedge, disk);
+
+    return true;
+}
+
+static void __sbdd_raid_1_read(struct sbdd_raid_1* raid_1, struct bio* bio)
+{
+    struct bio* _clone = NULL;
+    __u32       _disk = __sbdd_raid_1_select_disk(raid_1, bio->bi_iter.bi_sector, 0);
+    u64         _delay = READ_ONCE(raid_1->hedge_ns);
+
+    /* Large reads are not hedged, their copy would cost more than the tail it saves */
+    if(_delay && bio_sectors(bio) <= raid_1->hedge_sectors &&
+        __sbdd_raid_1_read_hedged(raid_1, bio, _disk, _delay))
+    {
+        return;
+    }
+
+    _clone = __sbdd_raid_1_clone(raid_1, bio, _disk);
+    __sbdd_raid_1_submit(raid_1, _clone, NULL, _disk);
+
+    /* Drop the parent own reference, it completes with the clone */
+    bio_endio(bio);
+}
+
+/* Writes, flushes and discards go to every mirror */
+static void __sbdd_raid_1_write(struct sbdd_raid_1* raid_1, struct bio* bio)
+{
+    struct bio* _clone = NULL;
+    __u32       _idx = 0;
+
+    for(_idx = 0; _idx < raid_1->config.disks_count; ++_idx)
+    {
+        _clone = __sbdd_raid_1_clone(raid_1, bio, _idx);
+        __sbdd_raid_1_submit(raid_1, _clone, NULL, _idx);
+    }
+
+    bio_endio(bio);
+}
+
+static blk_qc_t __sbdd_raid_1_process_bio(struct sbdd_raid_1* raid_1, struct bio* bio)
+{
+    struct blk_plug _plug;
+
+    pr_debug("raid_1_process_bio:: bi_sector=%llu, bio_sectors=%u \n", bio->bi_iter.bi_sector, bio_sectors(bio));
+
+    blk_start_plug(&_plug);
+
+    if(bio_data_dir(bio) == READ && bio_has_data(bio))
+        __sbdd_raid_1_read(raid_1, bio);
+    else
+        __sbdd_raid_1_write(raid_1, bio);
+
+    blk_finish_plug(&_plug);
+
+    return BLK_STS_OK;
+}
+
+int sbdd_raid_1_create(struct sbdd_raid_1* raid_1, char* cfg, void* ctx)
+{
+    int     _ret = 0;
+    __u32   _idx = 0;
+
+    /* Clones are allocated in a loop from submit_bio context, rescuer avoids mempool deadlock */
+    _ret = bioset_init(&raid_1->bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_raid_1_io, bio),
+                       BIOSET_NEED_BVECS | BIOSET_NEED_RESCUER);
+	if (_ret)
+    {
+        pr_err("raid_1:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    _ret = sbdd_raid_1_create_config(cfg, &raid_1->config);
+    if(_ret)
+    {
+        pr_err("raid_1:: parsing config error: %d \n", _ret);
+        return _ret;
+    }
+
+    spin_lock_init(&raid_1->lat_lock);
+    atomic_set(&raid_1->hedges, 0);
+
+    spin_lock_init(&raid_1->retry_lock);
+    bio_list_init(&raid_1->retry);
+    INIT_WORK(&raid_1->retry_work, __sbdd_raid_1_retry_work);
+
+    raid_1->lat = alloc_percpu(struct sbdd_raid_1_lat);
+    if(!raid_1->lat)
+        return -ENOMEM;
+
+    raid_1->disks = kcalloc(raid_1->config.disks_count, sizeof(struct sbdd_raid_1_disk*), GFP_KERNEL);
+    if(!raid_1->disks)
+    {
+        pr_err("raid_1:: can't alloc disks with count: %d \n", raid_1->config.disks_count);
+        return -ENOMEM;
+    }
+
+    for(_idx = 0; _idx < raid_1->config.disks_count; ++ _idx)
+    {
+        raid_1->disks[_idx] = __sbdd_raid_1_create_disk(raid_1->config.disks[_idx]);
+        if (!raid_1->disks[_idx])
+        {
+            return -ENOMEM;
+        }
+    }
+
+    raid_1->ctx = ctx;
+    raid_1->hedge_sectors = raid_1->config.hedge_kb << 1;
+
+    pr_info("raid_1:: disks count: %d, read balance: %s, hedge: %d \n", raid_1->config.disks_count,
+            raid_1->config.read_balance == SBDD_RAID_1_READ_NEAREST ? "nearest" : "inflight",
+            raid_1->config.hedge_pct);
+
+    return 0;
+}
+
+void sbdd_raid_1_destroy(struct sbdd_raid_1* raid_1)
+{
+    int                         _ret = 0;
+    __u32                       _disk_idx = 0;
+    struct sbdd_raid_1_disk*    _disk = NULL;
+
+    /* Losers of hedged reads may still be in flight after their parents completed */
+    wait_var_event(&raid_1->hedges, !atomic_read(&raid_1->hedges));
+
+    /* The retry work may still be running after the last parent it completed */
+    flush_work(&raid_1->retry_work);
+
+    for (; raid_1->disks && _disk_idx < raid_1->config.disks_count; ++_disk_idx)
+    {
+		_disk = raid_1->disks[_disk_idx];
+        if(_disk)
+        {
+            _ret = __sbdd_raid_1_destroy_disk(_disk);
+            if(_ret)
+            {
+                pr_err("raid_1:: delete disk '%s' error:%d \n", _disk->name, _ret);
+            }
+        }
+    }
+
+    kfree(raid_1->disks);
+    raid_1->disks = NULL;
+
+    free_percpu(raid_1->lat);
+    raid_1->lat = NULL;
+
+    bioset_exit(&raid_1->bio_set);
+
+    sbdd_raid_1_destroy_config(&raid_1->config);
+}
+
+sector_t sbdd_raid_1_get_capacity(struct sbdd_raid_1* raid_1)
+{
+    __u64   _capacity = 0;
+    __u32   _disk_idx = 0;
+
+    for (; _disk_idx < raid_1->config.disks_count; ++_disk_idx)
+    {
+        if (_disk_idx == 0 || raid_1->disks[_disk_idx]->capacity < _capacity)
+            _capacity = raid_1->disks[_disk_idx]->capacity;
+    }
+
+    return _capacity;
+}
+
+/* Clones are never split, so the smallest member limit applies */
+__u64 sbdd_raid_1_get_max_sectors(struct sbdd_raid_1* raid_1)
+{
+    __u64   _max_sectors = 0;
+    __u32   _disk_idx = 0;
+
+    for (; _disk_idx < raid_1->config.disks_count; ++_disk_idx)
+    {
+        if (_disk_idx == 0 || raid_1->disks[_disk_idx]->max_sectors < _max_sectors)
+            _max_sectors = raid_1->disks[_disk_idx]->max_sectors;
+    }
+
+    return _max_sectors;
+}
+
+blk_qc_t sbdd_raid_1_process_bio(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+    return __sbdd_raid_1_process_bio(&_dev->raid_1, bio);
+}
+
+bool sbdd_raid_1_bio_may_block(struct bio* bio)
+{
+    /* Every bio needs at least one clone from the bio_set mempool */
+    return bio->bi_opf & REQ_NOWAIT;
+}
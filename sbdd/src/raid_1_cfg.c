@@ -0,0 +1,144 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/slab.h>
+#include <linux/genhd.h>
+#include <linux/string.h>
+#include <linux/parser.h>
+#include <raid_1_cfg.h>
+
+#define SBDD_RAID_1_HEDGE_KB_DEFAULT    64
+#define SBDD_RAID_1_HEDGE_KB_MAX        1024
+
+enum {
+	opt_read_balance,
+	opt_hedge,
+	opt_hedge_kb,
+    opt_last_int,
+	opt_disks,
+    opt_last_str,
+	opt_err
+};
+
+static match_table_t __sbdd_raid_1_config_opts_tokens = {
+	{opt_read_balance, "read_balance=%d"},
+	{opt_hedge, "hedge=%d"},
+	{opt_hedge_kb, "hedge_kb=%d"},
+	{opt_disks, "disks=%s"},
+	{opt_err, NULL}
+};
+
+
+int sbdd_raid_1_create_config(char* cfg, sbdd_raid_1_config_t* _cfg)
+{
+    char *_symbol = NULL;
+    char *_disks = NULL;
+
+    substring_t _argstr[MAX_OPT_ARGS];
+
+    pr_info("raid_1_config:: cfg=%s \n", cfg);
+
+    _cfg->hedge_kb = SBDD_RAID_1_HEDGE_KB_DEFAULT;
+
+    while ((_symbol = strsep(&cfg, ";")) != NULL) 
+    {
+        int _token, _intval, _ret = 1;
+
+		if (!*_symbol)
+			continue;
+
+		_token = match_token((char *)_symbol, __sbdd_raid_1_config_opts_tokens, _argstr);
+
+		if (_token < opt_last_int) 
+        {
+			_ret = match_int(&_argstr[0], &_intval);
+			if (_ret < 0) 
+            {
+				pr_err("raid_1_config:: bad option arg (not int) at '%s'\n", _symbol);
+				return -EINVAL;
+			}
+		} 
+
+        switch (_token) 
+        {
+        case opt_read_balance:
+            _cfg->read_balance = _intval;
+            break;
+        case opt_hedge:
+            _cfg->hedge_pct = _intval;
+            break;
+        case opt_hedge_kb:
+            _cfg->hedge_kb = _intval;
+            break;
+        case opt_disks:
+            _cfg->disks_str = kstrndup(_argstr[0].from, _argstr[0].to - _argstr[0].from, GFP_KERNEL);
+            if (!_cfg->disks_str)
+                return -ENOMEM;
+            break;
+        default:
+            pr_err("raid_1_config:: unknown option '%s' \n", _symbol);
+            return -EINVAL;
+        }
+    }
+
+    if(_cfg->read_balance < 0 || _cfg->read_balance >= SBDD_RAID_1_READ_LAST)
+    {
+        pr_err("raid_1_config:: wrong read balance: %d \n", _cfg->read_balance);
+        return -EINVAL;
+    }
+
+    if(_cfg->hedge_pct < 0 || _cfg->hedge_pct > 99)
+    {
+        pr_err("raid_1_config:: wrong hedge percentile: %d \n", _cfg->hedge_pct);
+        return -EINVAL;
+    }
+
+    if(_cfg->hedge_kb <= 0 || _cfg->hedge_kb > SBDD_RAID_1_HEDGE_KB_MAX)
+    {
+        pr_err("raid_1_config:: wrong hedge size: %d, max: %d \n", _cfg->hedge_kb, SBDD_RAID_1_HEDGE_KB_MAX);
+        return -EINVAL;
+    }
+
+    if(!_cfg->disks_str || !*_cfg->disks_str)
+    {
+        pr_err("raid_1_config:: no disks! \n");
+        return -EINVAL;
+    }
+
+    /* Split a copy cursor so disks_str still points to the allocation */
+    _disks = _cfg->disks_str;
+    while ((_symbol = strsep(&_disks, ",")) != NULL)
+    {
+        if(!*_symbol)
+            continue;
+
+        if(_cfg->disks_count == SBDD_RAID_1_MAX_DISKS_COUNT)
+        {
+            pr_err("raid_1_config:: exceeded max disks count: %d \n", SBDD_RAID_1_MAX_DISKS_COUNT);
+            return -EINVAL;
+        }
+
+        pr_info("raid_1_config:: add disk '%s' \n", _symbol);
+
+        _cfg->disks[_cfg->disks_count++] = _symbol;
+    }
+
+    if(_cfg->disks_count < 2)
+    {
+        pr_err("raid_1_config:: mirror needs at least 2 disks, got: %d \n", _cfg->disks_count);
+        return -EINVAL;
+    }
+
+    pr_info("raid_1_config:: disks count: %d, read balance: %d, hedge: %d (<= %d KiB) \n",
+            _cfg->disks_count, _cfg->read_balance, _cfg->hedge_pct, _cfg->hedge_kb);
+
+    return 0;
+}
+
+void sbdd_raid_1_destroy_config(sbdd_raid_1_config_t* cfg)
+{
+    if(cfg->disks_str)
+        kfree(cfg->disks_str);
+
+    cfg->disks_str = NULL;
+    cfg->disks_count = 0;
+}
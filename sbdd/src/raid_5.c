@@ -0,0 +1,1112 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/hash.h>
+#include <linux/highmem.h>
+#include <linux/bitops.h>
+#include <linux/wait_bit.h>
+#include <linux/completion.h>
+#include <linux/raid/xor.h>
+#include <linux/raid/pq.h>
+#include <sbdd.h>
+#include <raid_5.h>
+
+#define SBDD_RAID_5_NO_INDEX    ((sector_t)-1)
+/* Reads of up to this many pages keep the heads they hold on the stack */
+#define SBDD_RAID_5_STACK_PAGES 16
+
+/* Member ios a caller waits for together */
+struct sbdd_raid_5_batch {
+    atomic_t            pending;
+    blk_status_t        status;
+    /* columns whose io failed */
+    unsigned long       failed;
+    struct completion   done;
+};
+
+/* Front pad of every bio allocated from the raid bio_set */
+struct sbdd_raid_5_io {
+    struct sbdd_raid_5*         raid_5;
+    struct sbdd_raid_5_head*    head;
+    struct sbdd_raid_5_batch*   batch;
+    __u32                       col;
+    struct bio                  bio;
+};
+
+/*
+Array sector to its data column and member sector. Columns are mapped to
+members per row with the rotating left-symmetric layout, see col_disk.
+*/
+static void __sbdd_raid_5_map(struct sbdd_raid_5* raid_5, sector_t sector, __u32* col, sector_t* member_sector)
+{
+    __u64 _chunk = 0;
+    __u64 _row = 0;
+    __u32 _offset = 0;
+
+    _chunk = div_u64_rem(sector, raid_5->chunk_sectors, &_offset);
+    _row = div_u64_rem(_chunk, raid_5->data_disks, col);
+
+    *member_sector = _row * raid_5->chunk_sectors + _offset;
+}
+
+/* P of row r is on disk (disks - 1 - r % disks), Q right after it, data follows */
+static __u32 __sbdd_raid_5_col_disk(struct sbdd_raid_5* raid_5, sector_t member_sector, __u32 col)
+{
+    __u32 _disks = raid_5->config.disks_count;
+    __u32 _rotation = 0;
+    __u32 _pd = 0;
+
+    div_u64_rem(div_u64(member_sector, raid_5->chunk_sectors), _disks, &_rotation);
+    _pd = _disks - 1 - _rotation;
+
+    if(col < raid_5->data_disks)
+        return (_pd + raid_5->parity + col) % _disks;
+
+    return (_pd + col - raid_5->data_disks) % _disks;
+}
+
+static __u32 __sbdd_raid_5_sectors_to_boundary(struct sbdd_raid_5* raid_5, sector_t sector)
+{
+    __u32 _offset = 0;
+
+    div_u64_rem(sector, raid_5->chunk_sectors, &_offset);
+
+    return raid_5->chunk_sectors - _offset;
+}
+
+static void __sbdd_raid_5_xor(void* dest, void** srcs, __u32 count)
+{
+    __u32 _step = 0;
+
+    /* xor_blocks takes up to MAX_XOR_BLOCKS sources at once */
+    while(count)
+    {
+        _step = min_t(__u32, count, MAX_XOR_BLOCKS);
+        xor_blocks(_step, PAGE_SIZE, dest, srcs);
+        srcs += _step;
+        count -= _step;
+    }
+}
+
+/* All data columns are uptodate */
+static void __sbdd_raid_5_gen_parity(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head)
+{
+    void*   _ptrs[SBDD_RAID_5_MAX_DISKS_COUNT];
+    __u32   _col = 0;
+
+    for(_col = 0; _col < raid_5->config.disks_count; ++_col)
+        _ptrs[_col] = page_address(head->pages[_col]);
+
+    if(raid_5->parity == 2)
+    {
+        raid6_call.gen_syndrome(raid_5->config.disks_count, PAGE_SIZE, _ptrs);
+        return;
+    }
+
+    memcpy(_ptrs[raid_5->data_disks], _ptrs[0], PAGE_SIZE);
+    __sbdd_raid_5_xor(_ptrs[raid_5->data_disks], &_ptrs[1], raid_5->data_disks - 1);
+}
+
+static void __sbdd_raid_5_batch_init(struct sbdd_raid_5_batch* batch)
+{
+    /* The submitter holds one until everything is sent */
+    atomic_set(&batch->pending, 1);
+    batch->status = BLK_STS_OK;
+    batch->failed = 0;
+    init_completion(&batch->done);
+}
+
+static blk_status_t __sbdd_raid_5_batch_wait(struct sbdd_raid_5_batch* batch)
+{
+    if(!atomic_dec_and_test(&batch->pending))
+        wait_for_completion_io(&batch->done);
+
+    return READ_ONCE(batch->status);
+}
+
+static void __sbdd_raid_5_page_endio(struct bio* bio)
+{
+    struct sbdd_raid_5_io*  _io = container_of(bio, struct sbdd_raid_5_io, bio);
+    struct sbdd_raid_5*     _raid_5 = _io->raid_5;
+
+    if(_io->batch)
+    {
+        if(bio->bi_status)
+        {
+            WRITE_ONCE(_io->batch->status, bio->bi_status);
+            set_bit(_io->col, &_io->batch->failed);
+        }
+
+        if(atomic_dec_and_test(&_io->batch->pending))
+            complete(&_io->batch->done);
+    }
+    else
+    {
+        /* Write-back of a head, nobody waits for this one */
+        if(bio->bi_status)
+            WRITE_ONCE(_raid_5->write_error, bio->bi_status);
+
+        if(atomic_dec_and_test(&_io->head->io))
+            wake_up_var(&_io->head->io);
+
+        if(atomic_dec_and_test(&_raid_5->writing))
+            wake_up_var(&_raid_5->writing);
+    }
+
+    bio_put(bio);
+}
+
+/* Page io of a head column: waited for with batch, a background write-back without it */
+static void __sbdd_raid_5_submit_page(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head, __u32 col,
+                                      unsigned int opf, struct page* page, struct sbdd_raid_5_batch* batch)
+{
+    struct sbdd*            _dev = raid_5->ctx;
+    struct sbdd_raid_5_io*  _io = NULL;
+    struct bio*             _bio = NULL;
+    sector_t                _sector = head->index * SBDD_RAID_5_PAGE_SECTORS;
+    __u32                   _disk = __sbdd_raid_5_col_disk(raid_5, _sector, col);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _bio = bio_alloc_bioset(GFP_NOIO, 1, &raid_5->bio_set);
+    bio_set_dev(_bio, raid_5->disks[_disk]->bdev_raw);
+    _bio->bi_opf = opf;
+#else
+    _bio = bio_alloc_bioset(raid_5->disks[_disk]->bdev_raw, 1, opf, GFP_NOIO, &raid_5->bio_set);
+#endif
+
+    _bio->bi_iter.bi_sector = _sector;
+    _bio->bi_end_io = __sbdd_raid_5_page_endio;
+    bio_add_page(_bio, page, PAGE_SIZE, 0);
+
+    _io = container_of(_bio, struct sbdd_raid_5_io, bio);
+    _io->raid_5 = raid_5;
+    _io->head = head;
+    _io->batch = batch;
+    _io->col = col;
+
+    if(batch)
+    {
+        atomic_inc(&batch->pending);
+    }
+    else
+    {
+        atomic_inc(&head->io);
+        atomic_inc(&raid_5->writing);
+    }
+
+    sbdd_stats_disk_submit(&_dev->stats, _disk, sbdd_stats_dir(_bio), SBDD_RAID_5_PAGE_SECTORS);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+    generic_make_request(_bio);
+#else
+	submit_bio_noacct(_bio);
+#endif
+}
+
+/*
+Rebuilds the data columns in failed, which could not be read, from the other
+columns and the parity as they are on the members. Dirty columns are read
+back into old for it, so their new data stays. Returns all the columns that
+failed, nothing is rebuilt when there are more of them than parity columns.
+*/
+static __u32 __sbdd_raid_5_recover_head(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head, __u32 failed,
+                                        struct page** old)
+{
+    void*                       _ptrs[SBDD_RAID_5_MAX_DISKS_COUNT];
+    void*                       _srcs[SBDD_RAID_5_MAX_DISKS_COUNT];
+    struct sbdd_raid_5_batch    _batch;
+    __u32                       _data = raid_5->data_disks;
+    __u32                       _disks = raid_5->config.disks_count;
+    __u32                       _lost = 0;
+    __u32                       _faila = 0;
+    __u32                       _failb = 0;
+    __u32                       _count = 0;
+    __u32                       _col = 0;
+
+    for(_col = 0; _col < _data; ++_col)
+    {
+        if((head->dirty & BIT(_col)) && !old[_col])
+        {
+            old[_col] = alloc_page(GFP_NOIO);
+            /* Without it the old data can't be had, the stripe is as good as lost */
+            if(!old[_col])
+                return GENMASK(_disks - 1, 0);
+        }
+    }
+
+    __sbdd_raid_5_batch_init(&_batch);
+
+    for(_col = 0; _col < _disks; ++_col)
+    {
+        _ptrs[_col] = page_address(_col < _data && (head->dirty & BIT(_col)) ? old[_col] : head->pages[_col]);
+
+        if(failed & BIT(_col))
+            continue;
+
+        if(_col < _data && (head->dirty & BIT(_col)))
+            __sbdd_raid_5_submit_page(raid_5, head, _col, REQ_OP_READ, old[_col], &_batch);
+        else if(!(head->uptodate & BIT(_col)))
+            __sbdd_raid_5_submit_page(raid_5, head, _col, REQ_OP_READ, head->pages[_col], &_batch);
+    }
+
+    __sbdd_raid_5_batch_wait(&_batch);
+    failed |= _batch.failed;
+
+    _lost = failed & GENMASK(_data - 1, 0);
+    if(!_lost || hweight32(failed) > raid_5->parity)
+        return failed;
+
+    _faila = __ffs(_lost);
+    _lost &= _lost - 1;
+    _failb = _lost ? __ffs(_lost) : _faila;
+
+    if(_failb != _faila)
+    {
+        raid6_2data_recov(_disks, PAGE_SIZE, _faila, _failb, _ptrs);
+    }
+    else if(failed & BIT(_data))
+    {
+        /* raid6 only, P is lost too */
+        raid6_datap_recov(_disks, PAGE_SIZE, _faila, _ptrs);
+    }
+    else
+    {
+        /* The lost column is P xor the other data columns */
+        for(_col = 0; _col < _data; ++_col)
+        {
+            if(_col != _faila)
+                _srcs[_count++] = _ptrs[_col];
+        }
+
+        memcpy(_ptrs[_faila], _ptrs[_data], PAGE_SIZE);
+        __sbdd_raid_5_xor(_ptrs[_faila], _srcs, _count);
+    }
+
+    return failed;
+}
+
+/*
+Sends the dirty columns of a locked head and its parity to the members.
+A head with every data column uptodate is a full stripe and needs no reads.
+Otherwise raid5 picks read-modify-write or reconstruct-write, whichever
+reads less, raid6 always reconstructs. A failed read-modify-write falls back
+to reconstruct-write and the columns it can't read are rebuilt, the data is
+dropped only when more columns failed than there are parities. Only the
+reads are waited for.
+*/
+static void __sbdd_raid_5_write_head(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head, unsigned int opf)
+{
+    struct page*                _old[SBDD_RAID_5_MAX_DISKS_COUNT] = {};
+    void*                       _srcs[2 * SBDD_RAID_5_MAX_DISKS_COUNT];
+    struct sbdd_raid_5_batch    _batch;
+    blk_status_t                _status = BLK_STS_OK;
+    __u32                       _data = raid_5->data_disks;
+    __u32                       _data_mask = GENMASK(_data - 1, 0);
+    __u32                       _missing = _data_mask & ~head->uptodate;
+    __u32                       _failed = 0;
+    __u32                       _count = 0;
+    __u32                       _col = 0;
+    bool                        _rmw = false;
+
+    if(!head->dirty)
+        return;
+
+    if(_missing && raid_5->parity == 1 && hweight32(head->dirty) + 1 < hweight32(_missing))
+    {
+        _rmw = true;
+
+        for(_col = 0; _col < _data && _rmw; ++_col)
+        {
+            if(!(head->dirty & BIT(_col)))
+                continue;
+
+            _old[_col] = alloc_page(GFP_NOIO);
+            _rmw = _old[_col] != NULL;
+        }
+    }
+
+    if(_rmw)
+    {
+        __sbdd_raid_5_batch_init(&_batch);
+
+        for(_col = 0; _col < _data; ++_col)
+        {
+            if(head->dirty & BIT(_col))
+                __sbdd_raid_5_submit_page(raid_5, head, _col, REQ_OP_READ, _old[_col], &_batch);
+        }
+
+        if(!(head->uptodate & BIT(_data)))
+            __sbdd_raid_5_submit_page(raid_5, head, _data, REQ_OP_READ, head->pages[_data], &_batch);
+
+        _status = __sbdd_raid_5_batch_wait(&_batch);
+        _failed = _batch.failed;
+    }
+
+    if(_rmw && !_status)
+    {
+        /* P ^= old ^ new for every dirty column */
+        for(_col = 0; _col < _data; ++_col)
+        {
+            if(!(head->dirty & BIT(_col)))
+                continue;
+
+            _srcs[_count++] = page_address(_old[_col]);
+            _srcs[_count++] = page_address(head->pages[_col]);
+        }
+
+        __sbdd_raid_5_xor(page_address(head->pages[_data]), _srcs, _count);
+    }
+    else
+    {
+        /* Reconstruct-write reads none of the columns a read-modify-write failed on */
+        __sbdd_raid_5_batch_init(&_batch);
+
+        for(_col = 0; _col < _data; ++_col)
+        {
+            if(_missing & BIT(_col))
+                __sbdd_raid_5_submit_page(raid_5, head, _col, REQ_OP_READ, head->pages[_col], &_batch);
+        }
+
+        _status = __sbdd_raid_5_batch_wait(&_batch);
+
+        if(_status)
+        {
+            _failed |= _batch.failed;
+            head->uptodate |= _missing & ~_failed;
+
+            _failed = __sbdd_raid_5_recover_head(raid_5, head, _failed, _old);
+            if(hweight32(_failed) <= raid_5->parity)
+                _status = BLK_STS_OK;
+        }
+
+        if(!_status)
+        {
+            head->uptodate |= _missing;
+            __sbdd_raid_5_gen_parity(raid_5, head);
+        }
+    }
+
+    for(_col = 0; _col < _data; ++_col)
+    {
+        if(_old[_col])
+            __free_page(_old[_col]);
+    }
+
+    if(_status)
+    {
+        /* Parity can't be made consistent, the cached data is dropped and the error reported on flush */
+        pr_err("raid_5:: stripe %llu read error: %d, %u columns failed, write-back dropped \n",
+               (__u64)head->index, blk_status_to_errno(_status), hweight32(_failed));
+        WRITE_ONCE(raid_5->write_error, _status);
+        head->dirty = 0;
+        head->uptodate = 0;
+        return;
+    }
+
+    for(_col = 0; _col < raid_5->config.disks_count; ++_col)
+    {
+        if(_col >= _data || (head->dirty & BIT(_col)))
+            __sbdd_raid_5_submit_page(raid_5, head, _col, REQ_OP_WRITE | opf, head->pages[_col], NULL);
+    }
+
+    head->dirty = 0;
+    head->uptodate |= GENMASK(raid_5->config.disks_count - 1, _data);
+}
+
+static struct sbdd_raid_5_head* __sbdd_raid_5_find_head(struct sbdd_raid_5* raid_5, sector_t index)
+{
+    struct sbdd_raid_5_head* _head = NULL;
+
+    hlist_for_each_entry(_head, &raid_5->cache_hash[hash_64(index, raid_5->cache_hash_bits)], hash)
+    {
+        if(_head->index == index)
+            return _head;
+    }
+
+    return NULL;
+}
+
+/* Under the cache lock */
+static void __sbdd_raid_5_hold_head(struct sbdd_raid_5_head* head)
+{
+    if(head->refs++ == 0)
+        list_del_init(&head->lru);
+}
+
+/* Under the cache lock, a head to be reused goes to the front of the lru */
+static void __sbdd_raid_5_release_head(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head, bool reuse)
+{
+    if(--head->refs)
+        return;
+
+    if(reuse)
+        list_add(&head->lru, &raid_5->cache_lru);
+    else
+        list_add_tail(&head->lru, &raid_5->cache_lru);
+
+    wake_up(&raid_5->cache_wait);
+}
+
+static void __sbdd_raid_5_lock_head(struct sbdd_raid_5_head* head)
+{
+    mutex_lock(&head->lock);
+    wait_var_event(&head->io, !atomic_read(&head->io));
+}
+
+/* Unlocks and releases a head, a full stripe is written out first */
+static void __sbdd_raid_5_put_head(struct sbdd_raid_5* raid_5, struct sbdd_raid_5_head* head, bool write_full)
+{
+    __u32 _data_mask = GENMASK(raid_5->data_disks - 1, 0);
+
+    if(write_full && head->dirty && (head->uptodate & _data_mask) == _data_mask)
+        __sbdd_raid_5_write_head(raid_5, head, 0);
+
+    mutex_unlock(&head->lock);
+
+    mutex_lock(&raid_5->cache_lock);
+    __sbdd_raid_5_release_head(raid_5, head, false);
+    mutex_unlock(&raid_5->cache_lock);
+}
+
+/*
+Held and locked head of index with no member writes in flight. A head is
+reused from the lru front, it is written back and its io drained first,
+so a member never has older data than a head that was dropped from cache.
+*/
+static struct sbdd_raid_5_head* __sbdd_raid_5_get_head(struct sbdd_raid_5* raid_5, sector_t index)
+{
+    struct sbdd_raid_5_head* _head = NULL;
+
+    mutex_lock(&raid_5->cache_lock);
+
+    while(true)
+    {
+        _head = __sbdd_raid_5_find_head(raid_5, index);
+        if(_head)
+        {
+            __sbdd_raid_5_hold_head(_head);
+            break;
+        }
+
+        if(list_empty(&raid_5->cache_lru))
+        {
+            mutex_unlock(&raid_5->cache_lock);
+            wait_event(raid_5->cache_wait, !list_empty_careful(&raid_5->cache_lru));
+            mutex_lock(&raid_5->cache_lock);
+            continue;
+        }
+
+        _head = list_first_entry(&raid_5->cache_lru, struct sbdd_raid_5_head, lru);
+
+        if(!_head->dirty && !atomic_read(&_head->io))
+        {
+            if(_head->index != SBDD_RAID_5_NO_INDEX)
+                hlist_del(&_head->hash);
+
+            _head->index = index;
+            _head->uptodate = 0;
+            hlist_add_head(&_head->hash, &raid_5->cache_hash[hash_64(index, raid_5->cache_hash_bits)]);
+
+            __sbdd_raid_5_hold_head(_head);
+            break;
+        }
+
+        __sbdd_raid_5_hold_head(_head);
+        mutex_unlock(&raid_5->cache_lock);
+
+        __sbdd_raid_5_lock_head(_head);
+        __sbdd_raid_5_write_head(raid_5, _head, 0);
+        wait_var_event(&_head->io, !atomic_read(&_head->io));
+        mutex_unlock(&_head->lock);
+
+        mutex_lock(&raid_5->cache_lock);
+        __sbdd_raid_5_release_head(raid_5, _head, true);
+    }
+
+    mutex_unlock(&raid_5->cache_lock);
+
+    __sbdd_raid_5_lock_head(_head);
+
+    return _head;
+}
+
+/* Writes back every dirty head and flushes the members */
+static blk_status_t __sbdd_raid_5_flush(struct sbdd_raid_5* raid_5)
+{
+    struct sbdd_raid_5_head*    _head = NULL;
+    blk_status_t                _status = BLK_STS_OK;
+    __u32                       _idx = 0;
+    int                         _ret = 0;
+
+    for(_idx = 0; _idx < raid_5->cache_count; ++_idx)
+    {
+        _head = raid_5->heads[_idx];
+
+        mutex_lock(&raid_5->cache_lock);
+        __sbdd_raid_5_hold_head(_head);
+        mutex_unlock(&raid_5->cache_lock);
+
+        __sbdd_raid_5_lock_head(_head);
+        __sbdd_raid_5_write_head(raid_5, _head, 0);
+        __sbdd_raid_5_put_head(raid_5, _head, false);
+    }
+
+    wait_var_event(&raid_5->writing, !atomic_read(&raid_5->writing));
+
+    for(_idx = 0; _idx < raid_5->config.disks_count; ++_idx)
+    {
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 12, 0))
+        _ret = blkdev_issue_flush(raid_5->disks[_idx]->bdev_raw, GFP_NOIO, NULL);
+#elif (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 17, 0))
+        _ret = blkdev_issue_flush(raid_5->disks[_idx]->bdev_raw, GFP_NOIO);
+#else
+        _ret = blkdev_issue_flush(raid_5->disks[_idx]->bdev_raw);
+#endif
+        if(_ret)
+            _status = errno_to_blk_status(_ret);
+    }
+
+    if(READ_ONCE(raid_5->write_error))
+    {
+        _status = READ_ONCE(raid_5->write_error);
+        WRITE_ONCE(raid_5->write_error, BLK_STS_OK);
+    }
+
+    return _status;
+}
+
+/*
+Writes are copied into the stripe cache and complete right away, the
+array has a volatile write cache and flush/FUA write it back. A head is
+sent out as soon as all its data columns are there, so writes covering
+whole rows go out as full stripes without reads.
+*/
+static void __sbdd_raid_5_write(struct sbdd_raid_5* raid_5, struct bio* bio)
+{
+    struct sbdd*                _dev = raid_5->ctx;
+    struct sbdd_raid_5_head*    _head = NULL;
+    struct bio_vec              _bv;
+    struct bvec_iter            _iter;
+    sector_t                    _member_sector = 0;
+    sector_t                    _index = 0;
+    __u64                       _pos = (__u64)bio->bi_iter.bi_sector << SECTOR_SHIFT;
+    __u32                       _col = 0;
+    __u32                       _off = 0;
+    __u32                       _len = 0;
+    char*                       _src = NULL;
+
+    /* Writes land in the stripe cache, they are sampled where they are taken */
+    sbdd_heatmap_record(&_dev->heatmap, bio, bio->bi_iter.bi_sector);
+
+    bio_for_each_segment(_bv, bio, _iter)
+    {
+        while(_bv.bv_len)
+        {
+            __sbdd_raid_5_map(raid_5, _pos >> SECTOR_SHIFT, &_col, &_member_sector);
+            _index = div_u64(_member_sector, SBDD_RAID_5_PAGE_SECTORS);
+            _off = offset_in_page(_pos);
+            _len = min_t(__u32, _bv.bv_len, PAGE_SIZE - _off);
+
+            if(!_head || _head->index != _index)
+            {
+                if(_head)
+                    __sbdd_raid_5_put_head(raid_5, _head, true);
+
+                _head = __sbdd_raid_5_get_head(raid_5, _index);
+            }
+
+            _src = kmap_atomic(_bv.bv_page);
+            memcpy(page_address(_head->pages[_col]) + _off, _src + _bv.bv_offset, _len);
+            kunmap_atomic(_src);
+
+            /* The logical block is a page, the bio covers all of it */
+            _head->dirty |= BIT(_col);
+            _head->uptodate |= BIT(_col);
+
+            _pos += _len;
+            _bv.bv_offset += _len;
+            _bv.bv_len -= _len;
+        }
+    }
+
+    if(_head)
+        __sbdd_raid_5_put_head(raid_5, _head, true);
+}
+
+/*
+Holds the heads of count pages from first that have the data column, NULL
+for the other pages. A held head is not reused, so its data is still there
+for the overlay once the member read is done. Returns how many are held.
+*/
+static __u32 __sbdd_raid_5_hold_cached(struct sbdd_raid_5* raid_5, sector_t first, __u32 count, __u32 col,
+                                       struct sbdd_raid_5_head** heads)
+{
+    struct sbdd_raid_5_head*    _head = NULL;
+    __u32                       _held = 0;
+    __u32                       _idx = 0;
+
+    mutex_lock(&raid_5->cache_lock);
+
+    for(_idx = 0; _idx < count; ++_idx)
+    {
+        _head = __sbdd_raid_5_find_head(raid_5, first + _idx);
+        if(_head && (_head->uptodate & BIT(col)))
+        {
+            __sbdd_raid_5_hold_head(_head);
+            ++_held;
+        }
+        else
+        {
+            _head = NULL;
+        }
+
+        heads[_idx] = _head;
+    }
+
+    mutex_unlock(&raid_5->cache_lock);
+
+    return _held;
+}
+
+static void __sbdd_raid_5_release_cached(struct sbdd_raid_5* raid_5, __u32 count, struct sbdd_raid_5_head** heads)
+{
+    __u32 _idx = 0;
+
+    mutex_lock(&raid_5->cache_lock);
+
+    for(_idx = 0; _idx < count; ++_idx)
+    {
+        if(heads[_idx])
+            __sbdd_raid_5_release_head(raid_5, heads[_idx], false);
+    }
+
+    mutex_unlock(&raid_5->cache_lock);
+}
+
+/* Lays the pages of the held heads over what was read from the member */
+static void __sbdd_raid_5_overlay(struct sbdd_raid_5* raid_5, struct bio* bio, sector_t member_sector, __u32 col,
+                                  struct sbdd_raid_5_head** heads)
+{
+    struct sbdd_raid_5_head*    _head = NULL;
+    struct bio_vec              _bv;
+    struct bvec_iter            _iter;
+    sector_t                    _first = member_sector >> (PAGE_SHIFT - SECTOR_SHIFT);
+    __u64                       _pos = (__u64)member_sector << SECTOR_SHIFT;
+    __u32                       _off = 0;
+    __u32                       _len = 0;
+    char*                       _dst = NULL;
+
+    bio_for_each_segment(_bv, bio, _iter)
+    {
+        while(_bv.bv_len)
+        {
+            _off = offset_in_page(_pos);
+            _len = min_t(__u32, _bv.bv_len, PAGE_SIZE - _off);
+
+            if(_head != heads[(_pos >> PAGE_SHIFT) - _first])
+            {
+                if(_head)
+                    mutex_unlock(&_head->lock);
+
+                _head = heads[(_pos >> PAGE_SHIFT) - _first];
+                if(_head)
+                    mutex_lock(&_head->lock);
+            }
+
+            if(_head)
+            {
+                _dst = kmap_atomic(_bv.bv_page);
+                memcpy(_dst + _bv.bv_offset, page_address(_head->pages[col]) + _off, _len);
+                kunmap_atomic(_dst);
+            }
+
+            _pos += _len;
+            _bv.bv_offset += _len;
+            _bv.bv_len -= _len;
+        }
+    }
+
+    if(_head)
+        mutex_unlock(&_head->lock);
+}
+
+static void __sbdd_raid_5_child_endio(struct bio* bio)
+{
+    struct bio* _parent = bio->bi_private;
+
+    if(bio->bi_status && !_parent->bi_status)
+        _parent->bi_status = bio->bi_status;
+
+    bio_put(bio);
+    bio_endio(_parent);
+}
+
+static void __sbdd_raid_5_chain(struct bio* child, struct bio* parent)
+{
+    child->bi_private = parent;
+    child->bi_end_io = __sbdd_raid_5_child_endio;
+    bio_inc_remaining(parent);
+}
+
+static struct bio* __sbdd_raid_5_clone(struct sbdd_raid_5* raid_5, struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    return bio_clone_fast(bio, GFP_NOIO, &raid_5->bio_set);
+#else
+    return bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &raid_5->bio_set);
+#endif
+}
+
+/*
+Read within one chunk: straight to its member unless the cache has newer
+data. The heads with it are held from before the member read until they
+are laid over it, a write-back can't take them out of the cache meanwhile.
+*/
+static void __sbdd_raid_5_read_piece(struct sbdd_raid_5* raid_5, struct bio* piece)
+{
+    struct sbdd*                _dev = raid_5->ctx;
+    struct sbdd_raid_5_head*    _stack_heads[SBDD_RAID_5_STACK_PAGES];
+    struct sbdd_raid_5_head**   _heads = _stack_heads;
+    struct bio*                 _clone = NULL;
+    sector_t                    _member_sector = 0;
+    sector_t                    _first = 0;
+    blk_status_t                _status = BLK_STS_OK;
+    __u32                       _count = 0;
+    __u32                       _col = 0;
+    __u32                       _disk = 0;
+
+    sbdd_heatmap_record(&_dev->heatmap, piece, piece->bi_iter.bi_sector);
+
+    __sbdd_raid_5_map(raid_5, piece->bi_iter.bi_sector, &_col, &_member_sector);
+    _disk = __sbdd_raid_5_col_disk(raid_5, _member_sector, _col);
+
+    bio_set_dev(piece, raid_5->disks[_disk]->bdev_raw);
+    piece->bi_iter.bi_sector = _member_sector;
+
+    sbdd_stats_disk_submit(&_dev->stats, _disk, SBDD_STATS_READ, bio_sectors(piece));
+
+    _first = div_u64(_member_sector, SBDD_RAID_5_PAGE_SECTORS);
+    _count = div_u64(bio_end_sector(piece) - 1, SBDD_RAID_5_PAGE_SECTORS) - _first + 1;
+
+    if(_count > SBDD_RAID_5_STACK_PAGES)
+    {
+        _heads = kcalloc(_count, sizeof(struct sbdd_raid_5_head*), GFP_NOIO);
+        if(!_heads)
+        {
+            piece->bi_status = BLK_STS_RESOURCE;
+            bio_endio(piece);
+            return;
+        }
+    }
+
+    if(!__sbdd_raid_5_hold_cached(raid_5, _first, _count, _col, _heads))
+    {
+        if(_heads != _stack_heads)
+            kfree(_heads);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 9, 0))
+        generic_make_request(piece);
+#else
+        submit_bio_noacct(piece);
+#endif
+        return;
+    }
+
+    _clone = __sbdd_raid_5_clone(raid_5, piece);
+    _status = submit_bio_wait(_clone);
+    bio_put(_clone);
+
+    if(!_status)
+        __sbdd_raid_5_overlay(raid_5, piece, _member_sector, _col, _heads);
+
+    __sbdd_raid_5_release_cached(raid_5, _count, _heads);
+
+    if(_heads != _stack_heads)
+        kfree(_heads);
+
+    piece->bi_status = _status;
+    bio_endio(piece);
+}
+
+static void __sbdd_raid_5_read(struct sbdd_raid_5* raid_5, struct bio* bio)
+{
+    struct bio* _child = NULL;
+    __u32       _sectors = 0;
+
+    while((_sectors = __sbdd_raid_5_sectors_to_boundary(raid_5, bio->bi_iter.bi_sector)) < bio_sectors(bio))
+    {
+        _child = bio_split(bio, _sectors, GFP_NOIO, &raid_5->bio_set);
+        __sbdd_raid_5_chain(_child, bio);
+
+        sbdd_stats_split(&((struct sbdd*)raid_5->ctx)->stats, SBDD_STATS_READ);
+
+        __sbdd_raid_5_read_piece(raid_5, _child);
+    }
+
+    _child = __sbdd_raid_5_clone(raid_5, bio);
+    __sbdd_raid_5_chain(_child, bio);
+    __sbdd_raid_5_read_piece(raid_5, _child);
+
+    bio_endio(bio);
+}
+
+static blk_qc_t __sbdd_raid_5_process_bio(struct sbdd_raid_5* raid_5, struct bio* bio)
+{
+    blk_status_t _status = BLK_STS_OK;
+
+    pr_debug("raid_5_process_bio:: op=%d, bi_sector=%llu, bio_sectors=%u \n",
+                bio_op(bio), bio->bi_iter.bi_sector, bio_sectors(bio));
+
+    if(bio->bi_opf & REQ_PREFLUSH)
+    {
+        _status = __sbdd_raid_5_flush(raid_5);
+        if(_status || !bio_sectors(bio))
+        {
+            bio->bi_status = _status;
+            bio_endio(bio);
+            return BLK_STS_OK;
+        }
+    }
+
+    switch(bio_op(bio))
+    {
+    case REQ_OP_READ:
+        __sbdd_raid_5_read(raid_5, bio);
+        return BLK_STS_OK;
+    case REQ_OP_WRITE:
+        __sbdd_raid_5_write(raid_5, bio);
+
+        if(bio->bi_opf & REQ_FUA)
+            _status = __sbdd_raid_5_flush(raid_5);
+        break;
+    default:
+        _status = BLK_STS_NOTSUPP;
+        break;
+    }
+
+    bio->bi_status = _status;
+    bio_endio(bio);
+
+    return BLK_STS_OK;
+}
+
+static int __sbdd_raid_5_create_cache(struct sbdd_raid_5* raid_5)
+{
+    struct sbdd_raid_5_head*    _head = NULL;
+    __u32                       _idx = 0;
+    __u32                       _col = 0;
+
+    mutex_init(&raid_5->cache_lock);
+    init_waitqueue_head(&raid_5->cache_wait);
+    INIT_LIST_HEAD(&raid_5->cache_lru);
+
+    raid_5->cache_count = raid_5->config.cache_stripes ? : SBDD_RAID_5_CACHE_DEFAULT;
+    raid_5->cache_hash_bits = ilog2(roundup_pow_of_two(raid_5->cache_count));
+
+    raid_5->cache_hash = kcalloc(1 << raid_5->cache_hash_bits, sizeof(struct hlist_head), GFP_KERNEL);
+    raid_5->heads = kcalloc(raid_5->cache_count, sizeof(struct sbdd_raid_5_head*), GFP_KERNEL);
+    if(!raid_5->cache_hash || !raid_5->heads)
+        return -ENOMEM;
+
+    for(_idx = 0; _idx < raid_5->cache_count; ++_idx)
+    {
+        _head = kzalloc(struct_size(_head, pages, raid_5->config.disks_count), GFP_KERNEL);
+        if(!_head)
+            return -ENOMEM;
+
+        raid_5->heads[_idx] = _head;
+
+        mutex_init(&_head->lock);
+        atomic_set(&_head->io, 0);
+        _head->index = SBDD_RAID_5_NO_INDEX;
+        list_add_tail(&_head->lru, &raid_5->cache_lru);
+
+        for(_col = 0; _col < raid_5->config.disks_count; ++_col)
+        {
+            _head->pages[_col] = alloc_page(GFP_KERNEL);
+            if(!_head->pages[_col])
+                return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void __sbdd_raid_5_destroy_cache(struct sbdd_raid_5* raid_5)
+{
+    struct sbdd_raid_5_head*    _head = NULL;
+    __u32                       _idx = 0;
+    __u32                       _col = 0;
+
+    for(_idx = 0; raid_5->heads && _idx < raid_5->cache_count; ++_idx)
+    {
+        _head = raid_5->heads[_idx];
+        if(!_head)
+            continue;
+
+        for(_col = 0; _col < raid_5->config.disks_count; ++_col)
+        {
+            if(_head->pages[_col])
+                __free_page(_head->pages[_col]);
+        }
+
+        kfree(_head);
+    }
+
+    kfree(raid_5->heads);
+    kfree(raid_5->cache_hash);
+
+    raid_5->heads = NULL;
+    raid_5->cache_hash = NULL;
+    raid_5->cache_count = 0;
+}
+
+int sbdd_raid_5_create(struct sbdd_raid_5* raid_5, char* cfg, void* ctx, __u32 parity)
+{
+    int     _ret = 0;
+    __u32   _idx = 0;
+
+    _ret = bioset_init(&raid_5->bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_raid_5_io, bio),
+                       BIOSET_NEED_BVECS | BIOSET_NEED_RESCUER);
+	if (_ret)
+    {
+        pr_err("raid_5:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    raid_5->config.copies = 1;
+
+    _ret = sbdd_raid_0_create_config(cfg, &raid_5->config);
+    if(_ret)
+    {
+        pr_err("raid_5:: parsing config error: %d \n", _ret);
+        return _ret;
+    }
+
+    if(raid_5->config.weighted)
+    {
+        pr_err("raid_5:: disk weights are not supported \n");
+        return -EINVAL;
+    }
+
+    if(raid_5->config.disks_count < parity + 2)
+    {
+        pr_err("raid_5:: %u parity needs at least %u disks \n", parity, parity + 2);
+        return -EINVAL;
+    }
+
+    if(raid_5->config.disks_count > SBDD_RAID_5_MAX_DISKS_COUNT)
+    {
+        pr_err("raid_5:: exceeded max disks count: %d \n", SBDD_RAID_5_MAX_DISKS_COUNT);
+        return -EINVAL;
+    }
+
+    /* Stripe cache columns are pages */
+    if((raid_5->config.strip_size << 10) % PAGE_SIZE)
+    {
+        pr_err("raid_5:: stripe size must be a multiple of %lu KiB \n", PAGE_SIZE >> 10);
+        return -EINVAL;
+    }
+
+    raid_5->ctx = ctx;
+    raid_5->parity = parity;
+    raid_5->data_disks = raid_5->config.disks_count - parity;
+    raid_5->chunk_sectors = raid_5->config.strip_size << 1;
+    atomic_set(&raid_5->writing, 0);
+
+    raid_5->disks = kcalloc(raid_5->config.disks_count, sizeof(struct sbdd_raid_0_disk*), GFP_KERNEL);
+    if(!raid_5->disks)
+        return -ENOMEM;
+
+    for(_idx = 0; _idx < raid_5->config.disks_count; ++_idx)
+    {
+        raid_5->disks[_idx] = sbdd_raid_0_create_disk(raid_5->config.disks[_idx]);
+        if(!raid_5->disks[_idx])
+            return -ENOMEM;
+    }
+
+    _ret = __sbdd_raid_5_create_cache(raid_5);
+    if(_ret)
+    {
+        pr_err("raid_5:: can't alloc stripe cache of %u stripes \n", raid_5->cache_count);
+        return _ret;
+    }
+
+    pr_info("raid_5:: raid%u, disks count: %d, stripe size: %d, cache stripes: %u, xor: %s \n",
+            parity == 2 ? 6 : 5, raid_5->config.disks_count, raid_5->config.strip_size,
+            raid_5->cache_count, parity == 2 ? raid6_call.name : "xor_blocks");
+
+    return 0;
+}
+
+void sbdd_raid_5_destroy(struct sbdd_raid_5* raid_5)
+{
+    __u32 _idx = 0;
+
+    /* The cache may still hold written data */
+    if(raid_5->heads && raid_5->disks)
+        __sbdd_raid_5_flush(raid_5);
+
+    __sbdd_raid_5_destroy_cache(raid_5);
+
+    for(_idx = 0; raid_5->disks && _idx < raid_5->config.disks_count; ++_idx)
+    {
+        if(raid_5->disks[_idx])
+            sbdd_raid_0_destroy_disk(raid_5->disks[_idx]);
+    }
+
+    kfree(raid_5->disks);
+    raid_5->disks = NULL;
+
+    bioset_exit(&raid_5->bio_set);
+
+    sbdd_raid_0_destroy_config(&raid_5->config);
+}
+
+sector_t sbdd_raid_5_get_capacity(struct sbdd_raid_5* raid_5)
+{
+    __u64   _capacity = 0;
+    __u32   _disk_idx = 0;
+
+    for (; _disk_idx < raid_5->config.disks_count; ++_disk_idx)
+    {
+        if (_disk_idx == 0 || raid_5->disks[_disk_idx]->capacity < _capacity)
+            _capacity = raid_5->disks[_disk_idx]->capacity;
+    }
+
+    /* Whole rows only */
+    return div_u64(_capacity, raid_5->chunk_sectors) * raid_5->chunk_sectors * raid_5->data_disks;
+}
+
+/* A row of data, so a full stripe write can come in one bio */
+__u64 sbdd_raid_5_get_max_sectors(struct sbdd_raid_5* raid_5)
+{
+    return (__u64)raid_5->chunk_sectors * raid_5->data_disks;
+}
+
+/* A full stripe write needs no reads */
+void sbdd_raid_5_get_io_hints(struct sbdd_raid_5* raid_5, unsigned int* io_min, unsigned int* io_opt)
+{
+    *io_min = raid_5->chunk_sectors << SECTOR_SHIFT;
+    *io_opt = *io_min * min_t(__u32, raid_5->data_disks, UINT_MAX / *io_min);
+}
+
+blk_qc_t sbdd_raid_5_process_bio(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+    return __sbdd_raid_5_process_bio(&_dev->raid_5, bio);
+}
+
+bool sbdd_raid_5_bio_may_block(struct bio* bio)
+{
+    /* Stripe cache locks and parity reads sleep, bios are processed by the io workers only */
+    return true;
+}
@@ -0,0 +1,503 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <sbdd.h>
+#include <read_cache.h>
+
+/* Front pad of every bio cloned from the cache bio_set */
+struct sbdd_read_cache_io {
+    struct sbdd_read_cache*         cache;
+    /* data of the parent, the clone iter is advanced by the layers below */
+    struct bvec_iter                iter;
+    /* blocks filled from a missed read, none for writes */
+    u32                             count;
+    u32                             gens[2];
+    struct sbdd_read_cache_block*   blocks[SBDD_READ_CACHE_MAX_BLOCKS];
+    struct bio                      bio;
+};
+
+static u32 __sbdd_read_cache_region(u64 block)
+{
+    return (block / SBDD_READ_CACHE_MAX_BLOCKS) % SBDD_READ_CACHE_GENS;
+}
+
+static void __sbdd_read_cache_put(struct sbdd_read_cache_block* block)
+{
+    if(refcount_dec_and_test(&block->refs))
+    {
+        __free_page(block->page);
+        kfree_rcu(block, rcu);
+    }
+}
+
+/* Lock-free lookup, the block is held until it is put */
+static struct sbdd_read_cache_block* __sbdd_read_cache_get(struct sbdd_read_cache* cache, u64 idx)
+{
+    struct sbdd_read_cache_block* _block = NULL;
+
+    rcu_read_lock();
+
+    _block = xa_load(&cache->index, idx);
+    if(!_block || xa_is_value(_block) || !refcount_inc_not_zero(&_block->refs))
+        _block = NULL;
+
+    rcu_read_unlock();
+
+    return _block;
+}
+
+static struct sbdd_read_cache_block* __sbdd_read_cache_alloc_block(u64 idx)
+{
+    struct sbdd_read_cache_block* _block = NULL;
+
+    /* Never waits for memory, the read goes on without caching */
+    _block = kzalloc(sizeof(struct sbdd_read_cache_block), GFP_NOWAIT | __GFP_NOWARN);
+    if(!_block)
+        return NULL;
+
+    _block->page = alloc_page(GFP_NOWAIT | __GFP_NOWARN);
+    if(!_block->page)
+    {
+        kfree(_block);
+        return NULL;
+    }
+
+    INIT_LIST_HEAD(&_block->list);
+    refcount_set(&_block->refs, 1);
+    _block->block = idx;
+
+    return _block;
+}
+
+/* Off its list, under the index lock. The caller drops or replaces the index entry */
+static void __sbdd_read_cache_unlink(struct sbdd_read_cache* cache, struct sbdd_read_cache_block* block)
+{
+    list_del_init(&block->list);
+
+    if(!test_bit(SBDD_READ_CACHE_AM, &block->flags))
+        --cache->a1in_count;
+    --cache->count;
+}
+
+/* Under the index lock. The oldest ghost is forgotten when the ring is full */
+static void __sbdd_read_cache_ghost(struct sbdd_read_cache* cache, u64 idx)
+{
+    void*   _entry = NULL;
+    u64     _oldest = 0;
+
+    if(cache->ghosts_count == cache->ghosts_max)
+    {
+        _oldest = cache->ghosts[cache->ghosts_head];
+        _entry = xa_load(&cache->index, _oldest);
+        /* The block may be cached again meanwhile */
+        if(xa_is_value(_entry))
+            __xa_erase(&cache->index, _oldest);
+
+        cache->ghosts_head = (cache->ghosts_head + 1) % cache->ghosts_max;
+        --cache->ghosts_count;
+    }
+
+    cache->ghosts[(cache->ghosts_head + cache->ghosts_count) % cache->ghosts_max] = idx;
+    ++cache->ghosts_count;
+
+    if(xa_is_err(__xa_store(&cache->index, idx, xa_mk_value(0), GFP_ATOMIC | __GFP_NOWARN)))
+        __xa_erase(&cache->index, idx);
+}
+
+/*
+Under the index lock. A1in is a fifo, its blocks leave as ghosts. Am is a
+clock: a block hit since the hand passed it goes round once more.
+*/
+static void __sbdd_read_cache_evict(struct sbdd_read_cache* cache)
+{
+    struct sbdd_read_cache_block* _block = NULL;
+
+    while(cache->count > cache->max_count)
+    {
+        if(cache->a1in_count > cache->a1in_max || list_empty(&cache->am))
+        {
+            _block = list_last_entry(&cache->a1in, struct sbdd_read_cache_block, list);
+            __sbdd_read_cache_unlink(cache, _block);
+            __sbdd_read_cache_ghost(cache, _block->block);
+        }
+        else
+        {
+            _block = list_last_entry(&cache->am, struct sbdd_read_cache_block, list);
+            if(test_and_clear_bit(SBDD_READ_CACHE_REFERENCED, &_block->flags))
+            {
+                list_move(&_block->list, &cache->am);
+                continue;
+            }
+
+            __sbdd_read_cache_unlink(cache, _block);
+            __xa_erase(&cache->index, _block->block);
+        }
+
+        __sbdd_read_cache_put(_block);
+    }
+}
+
+/* Under the index lock. A block read again while it is a ghost goes to Am */
+static void __sbdd_read_cache_insert(struct sbdd_read_cache* cache, struct sbdd_read_cache_block* block)
+{
+    void* _entry = xa_load(&cache->index, block->block);
+
+    /* A racing read has cached it already */
+    if(_entry && !xa_is_value(_entry))
+    {
+        __sbdd_read_cache_put(block);
+        return;
+    }
+
+    if(xa_is_err(__xa_store(&cache->index, block->block, block, GFP_ATOMIC | __GFP_NOWARN)))
+    {
+        __sbdd_read_cache_put(block);
+        return;
+    }
+
+    if(_entry)
+    {
+        set_bit(SBDD_READ_CACHE_AM, &block->flags);
+        list_add(&block->list, &cache->am);
+    }
+    else
+    {
+        list_add(&block->list, &cache->a1in);
+        ++cache->a1in_count;
+    }
+
+    ++cache->count;
+
+    __sbdd_read_cache_evict(cache);
+}
+
+/* Drops the cached blocks of a written range, a read of it in flight is not cached */
+static void __sbdd_read_cache_invalidate(struct sbdd_read_cache* cache, u64 first, u64 last)
+{
+    struct sbdd_read_cache_block*   _block = NULL;
+    unsigned long                   _flags = 0;
+    unsigned long                   _idx = 0;
+    u64                             _region = 0;
+
+    xa_lock_irqsave(&cache->index, _flags);
+
+    if(last - first >= SBDD_READ_CACHE_GENS * SBDD_READ_CACHE_MAX_BLOCKS)
+    {
+        for(_region = 0; _region < SBDD_READ_CACHE_GENS; ++_region)
+            atomic_inc(&cache->gens[_region]);
+    }
+    else
+    {
+        for(_region = first / SBDD_READ_CACHE_MAX_BLOCKS; _region <= last / SBDD_READ_CACHE_MAX_BLOCKS; ++_region)
+            atomic_inc(&cache->gens[_region % SBDD_READ_CACHE_GENS]);
+    }
+
+    xa_for_each_range(&cache->index, _idx, _block, first, last)
+    {
+        if(xa_is_value(_block))
+            continue;
+
+        __sbdd_read_cache_unlink(cache, _block);
+        __xa_erase(&cache->index, _idx);
+        __sbdd_read_cache_put(_block);
+    }
+
+    xa_unlock_irqrestore(&cache->index, _flags);
+}
+
+/* Copies between the data of a bio and the pages of its blocks */
+static void __sbdd_read_cache_copy(struct bio* bio, struct bvec_iter iter, struct sbdd_read_cache_block** blocks, bool to_bio)
+{
+    struct bio_vec  _bv;
+    struct bvec_iter _iter;
+    size_t          _done = 0;
+    size_t          _len = 0;
+    size_t          _chunk = 0;
+    size_t          _off = 0;
+    char*           _ptr = NULL;
+    char*           _page = NULL;
+
+    __bio_for_each_segment(_bv, bio, _iter, iter)
+    {
+        _ptr = kmap_atomic(_bv.bv_page);
+
+        for(_len = 0; _len < _bv.bv_len; _len += _chunk, _done += _chunk)
+        {
+            _off = _done & ~PAGE_MASK;
+            _chunk = min_t(size_t, _bv.bv_len - _len, PAGE_SIZE - _off);
+            _page = page_address(blocks[_done >> PAGE_SHIFT]->page) + _off;
+
+            if(to_bio)
+                memcpy(_ptr + _bv.bv_offset + _len, _page, _chunk);
+            else
+                memcpy(_page, _ptr + _bv.bv_offset + _len, _chunk);
+        }
+
+        kunmap_atomic(_ptr);
+    }
+}
+
+static struct bio* __sbdd_read_cache_clone(struct sbdd_read_cache* cache, struct bio* bio, bio_end_io_t end_io)
+{
+    struct sbdd_read_cache_io*  _io = NULL;
+    struct bio*                 _clone = NULL;
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 18, 0))
+    _clone = bio_clone_fast(bio, GFP_NOIO, &cache->bio_set);
+#else
+    _clone = bio_alloc_clone(bio->bi_bdev, bio, GFP_NOIO, &cache->bio_set);
+#endif
+
+    _io = container_of(_clone, struct sbdd_read_cache_io, bio);
+    _io->cache = cache;
+    _io->iter = bio->bi_iter;
+    _io->count = 0;
+
+    _clone->bi_private = bio;
+    _clone->bi_end_io = end_io;
+
+    return _clone;
+}
+
+static void __sbdd_read_cache_fill_endio(struct bio* bio)
+{
+    struct sbdd_read_cache_io*  _io = container_of(bio, struct sbdd_read_cache_io, bio);
+    struct sbdd_read_cache*     _cache = _io->cache;
+    struct bio*                 _parent = bio->bi_private;
+    unsigned long               _flags = 0;
+    u64                         _first = _io->iter.bi_sector >> SBDD_READ_CACHE_BLOCK_SHIFT;
+    u32                         _idx = 0;
+    bool                        _valid = !bio->bi_status;
+
+    if(_valid)
+        __sbdd_read_cache_copy(bio, _io->iter, _io->blocks, false);
+
+    xa_lock_irqsave(&_cache->index, _flags);
+
+    /* A write to the range since the read was sent may have been read half old */
+    _valid = _valid && atomic_read(&_cache->gens[__sbdd_read_cache_region(_first)]) == _io->gens[0] &&
+             atomic_read(&_cache->gens[__sbdd_read_cache_region(_first + _io->count - 1)]) == _io->gens[1];
+
+    for(_idx = 0; _idx < _io->count; ++_idx)
+    {
+        if(_valid)
+            __sbdd_read_cache_insert(_cache, _io->blocks[_idx]);
+        else
+            __sbdd_read_cache_put(_io->blocks[_idx]);
+    }
+
+    xa_unlock_irqrestore(&_cache->index, _flags);
+
+    _parent->bi_status = bio->bi_status;
+    bio_put(bio);
+    bio_endio(_parent);
+}
+
+static void __sbdd_read_cache_write_endio(struct bio* bio)
+{
+    struct sbdd_read_cache_io*  _io = container_of(bio, struct sbdd_read_cache_io, bio);
+    struct bio*                 _parent = bio->bi_private;
+
+    /* Reads sent while the write was in flight may have cached old data */
+    __sbdd_read_cache_invalidate(_io->cache, _io->iter.bi_sector >> SBDD_READ_CACHE_BLOCK_SHIFT,
+                                 (bvec_iter_end_sector(_io->iter) - 1) >> SBDD_READ_CACHE_BLOCK_SHIFT);
+
+    _parent->bi_status = bio->bi_status;
+    bio_put(bio);
+    bio_endio(_parent);
+}
+
+/* All blocks hit: the bio is served from memory and completes here */
+static bool __sbdd_read_cache_hit(struct sbdd_read_cache* cache, struct bio* bio, u64 first, u32 count)
+{
+    struct sbdd_read_cache_block*   _blocks[SBDD_READ_CACHE_MAX_BLOCKS];
+    struct sbdd*                    _dev = cache->ctx;
+    u32                             _idx = 0;
+    u32                             _got = 0;
+
+    for(_got = 0; _got < count; ++_got)
+    {
+        _blocks[_got] = __sbdd_read_cache_get(cache, first + _got);
+        if(!_blocks[_got])
+            break;
+    }
+
+    if(_got == count)
+    {
+        __sbdd_read_cache_copy(bio, bio->bi_iter, _blocks, true);
+        sbdd_stats_read_cache(&_dev->stats, true, count);
+    }
+
+    for(_idx = 0; _idx < _got; ++_idx)
+    {
+        if(_got == count)
+            set_bit(SBDD_READ_CACHE_REFERENCED, &_blocks[_idx]->flags);
+        __sbdd_read_cache_put(_blocks[_idx]);
+    }
+
+    if(_got != count)
+        return false;
+
+    bio_endio(bio);
+
+    return true;
+}
+
+/* Reads the bio past the cache into new blocks, they are cached when it completes */
+static blk_qc_t __sbdd_read_cache_miss(struct sbdd_read_cache* cache, struct bio* bio, u64 first, u32 count)
+{
+    struct sbdd_read_cache_io*  _io = NULL;
+    struct sbdd*                _dev = cache->ctx;
+    struct bio*                 _clone = NULL;
+    u32                         _idx = 0;
+
+    sbdd_stats_read_cache(&_dev->stats, false, count);
+
+    _clone = __sbdd_read_cache_clone(cache, bio, __sbdd_read_cache_fill_endio);
+    _io = container_of(_clone, struct sbdd_read_cache_io, bio);
+
+    /* Taken before the read is sent, a write after it changes them */
+    _io->gens[0] = atomic_read(&cache->gens[__sbdd_read_cache_region(first)]);
+    _io->gens[1] = atomic_read(&cache->gens[__sbdd_read_cache_region(first + count - 1)]);
+
+    for(_io->count = 0; _io->count < count; ++_io->count)
+    {
+        _io->blocks[_io->count] = __sbdd_read_cache_alloc_block(first + _io->count);
+        if(!_io->blocks[_io->count])
+            break;
+    }
+
+    if(_io->count != count)
+    {
+        for(_idx = 0; _idx < _io->count; ++_idx)
+            __sbdd_read_cache_put(_io->blocks[_idx]);
+        _io->count = 0;
+
+        /* Nothing to cache, the parent goes on as is */
+        bio_put(_clone);
+        return cache->process_bio(bio);
+    }
+
+    return cache->process_bio(_clone);
+}
+
+static blk_qc_t __sbdd_read_cache_process_bio(struct sbdd_read_cache* cache, struct bio* bio)
+{
+    struct sbdd*    _dev = cache->ctx;
+    u64             _first = bio->bi_iter.bi_sector >> SBDD_READ_CACHE_BLOCK_SHIFT;
+    u32             _count = bio_sectors(bio) >> SBDD_READ_CACHE_BLOCK_SHIFT;
+
+    if(!bio_sectors(bio))
+        return cache->process_bio(bio);
+
+    if(bio_op(bio) != REQ_OP_READ)
+    {
+        /* Writes, discards and write zeroes drop the cached blocks they touch before and after */
+        __sbdd_read_cache_invalidate(cache, _first, (bio_end_sector(bio) - 1) >> SBDD_READ_CACHE_BLOCK_SHIFT);
+
+        return cache->process_bio(__sbdd_read_cache_clone(cache, bio, __sbdd_read_cache_write_endio));
+    }
+
+    /* Cached blocks are whole pages, large reads are scans */
+    if(!IS_ALIGNED(bio->bi_iter.bi_sector | bio_sectors(bio), 1 << SBDD_READ_CACHE_BLOCK_SHIFT) ||
+        _count > SBDD_READ_CACHE_MAX_BLOCKS)
+    {
+        sbdd_stats_read_cache(&_dev->stats, false, DIV_ROUND_UP(bio_sectors(bio), 1 << SBDD_READ_CACHE_BLOCK_SHIFT));
+        return cache->process_bio(bio);
+    }
+
+    if(__sbdd_read_cache_hit(cache, bio, _first, _count))
+        return BLK_STS_OK;
+
+    return __sbdd_read_cache_miss(cache, bio, _first, _count);
+}
+
+int sbdd_read_cache_create(struct sbdd_read_cache* cache, unsigned int size_mb, process_bio_t process_bio,
+                           bio_may_block_t bio_may_block, void* ctx)
+{
+    int _ret = 0;
+    u32 _idx = 0;
+
+    cache->ctx = ctx;
+    cache->process_bio = process_bio;
+    cache->bio_may_block = bio_may_block;
+
+    xa_init_flags(&cache->index, XA_FLAGS_LOCK_IRQ);
+    INIT_LIST_HEAD(&cache->a1in);
+    INIT_LIST_HEAD(&cache->am);
+
+    for(_idx = 0; _idx < SBDD_READ_CACHE_GENS; ++_idx)
+        atomic_set(&cache->gens[_idx], 0);
+
+    /* The 2Q paper sizes: A1in is a quarter of the blocks, A1out remembers half of them */
+    cache->max_count = (u64)size_mb << (20 - PAGE_SHIFT);
+    cache->a1in_max = max_t(u64, cache->max_count / 4, 1);
+    cache->ghosts_max = max_t(u64, cache->max_count / 2, 1);
+
+    cache->ghosts = kvcalloc(cache->ghosts_max, sizeof(u64), GFP_KERNEL);
+    if(!cache->ghosts)
+    {
+        cache->max_count = 0;
+        return -ENOMEM;
+    }
+
+    _ret = bioset_init(&cache->bio_set, BIO_POOL_SIZE, offsetof(struct sbdd_read_cache_io, bio), BIOSET_NEED_BVECS);
+    if(_ret)
+    {
+        pr_err("read_cache:: bioset_init error: %d \n", _ret);
+        return _ret;
+    }
+
+    pr_info("read_cache:: size: %u MiB, blocks: %llu \n", size_mb, cache->max_count);
+
+    return 0;
+}
+
+void sbdd_read_cache_destroy(struct sbdd_read_cache* cache)
+{
+    struct sbdd_read_cache_block*   _block = NULL;
+    unsigned long                   _idx = 0;
+
+    if(!cache->ghosts)
+        return;
+
+    xa_for_each(&cache->index, _idx, _block)
+    {
+        if(!xa_is_value(_block))
+            __sbdd_read_cache_put(_block);
+    }
+
+    xa_destroy(&cache->index);
+
+    kvfree(cache->ghosts);
+    cache->ghosts = NULL;
+    cache->max_count = 0;
+
+    bioset_exit(&cache->bio_set);
+}
+
+blk_qc_t sbdd_read_cache_process_bio(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+    return __sbdd_read_cache_process_bio(&_dev->read_cache, bio);
+}
+
+bool sbdd_read_cache_bio_may_block(struct bio* bio)
+{
+#if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
+	struct sbdd* _dev = bio->bi_bdev->bd_disk->private_data;
+#else
+	struct sbdd* _dev = bio->bi_disk->private_data;
+#endif
+
+    /* Hits and misses never wait for memory, the layer below decides */
+    return _dev->read_cache.bio_may_block(bio);
+}
@@ -15,74 +15,510 @@
 #include <linux/module.h>
 #include <linux/vmalloc.h>
 #include <linux/moduleparam.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/capability.h>
+#include <linux/uaccess.h>
+#include <linux/miscdevice.h>
 
 #include <disk.h>
 #include <io.h>
+#include <raid_0_reshape.h>
 
-static struct sbdd      __sbdd;
 static int              __sbdd_major = 0;
-static unsigned long    __sbdd_raid_type = 0;
+/* sbddN arrays by N, ids being created are reserved with NULL */
+static DEFINE_IDR(__sbdd_arrays);
+static DEFINE_MUTEX(__sbdd_arrays_lock);
+static unsigned int     __sbdd_raid_type = 0;
 static char*			__sbdd_raid_config = NULL;
+static int				__sbdd_io_workers = SBDD_IO_WORKERS_PER_CPU;
+static int				__sbdd_io_dispatch = SBDD_IO_DISPATCH_DEFERRED;
+static unsigned int		__sbdd_heatmap_region_mb = 0;
+static unsigned int		__sbdd_heatmap_sample = SBDD_HEATMAP_SAMPLE_DEFAULT;
+static unsigned int		__sbdd_read_cache_mb = 0;
+#ifdef BLK_MQ_MODE
+static unsigned int		__sbdd_hw_queues = 0;
+static unsigned int		__sbdd_hw_queue_depth = SBDD_HW_QUEUE_DEPTH_DEFAULT;
+#endif
+
+static bool __sbdd_raid_is_striped(struct sbdd* dev)
+{
+	return dev->params.raid_type == SBDD_RAID_TYPE_0 || dev->params.raid_type == SBDD_RAID_TYPE_10;
+}
+
+static bool __sbdd_raid_is_parity(struct sbdd* dev)
+{
+	return dev->params.raid_type == SBDD_RAID_TYPE_5 || dev->params.raid_type == SBDD_RAID_TYPE_6;
+}
+
+static __u32 __sbdd_raid_disks_count(struct sbdd* dev)
+{
+	if(dev->params.raid_type == SBDD_RAID_TYPE_1)
+		return dev->raid_1.config.disks_count;
+
+	if(__sbdd_raid_is_parity(dev))
+		return dev->raid_5.config.disks_count;
+
+	return sbdd_raid_0_members_geo(&dev->raid_0)->disks_count;
+}
+
+static const char* __sbdd_raid_disk_name(struct sbdd* dev, __u32 idx)
+{
+	if(dev->params.raid_type == SBDD_RAID_TYPE_1)
+		return dev->raid_1.disks[idx]->name;
+
+	if(__sbdd_raid_is_parity(dev))
+		return dev->raid_5.disks[idx]->name;
+
+	return sbdd_raid_0_members_geo(&dev->raid_0)->disks[idx]->name;
+}
+
+static struct block_device* __sbdd_raid_disk_bdev(struct sbdd* dev, __u32 idx)
+{
+	if(dev->params.raid_type == SBDD_RAID_TYPE_1)
+		return dev->raid_1.disks[idx]->bdev_raw;
+
+	if(__sbdd_raid_is_parity(dev))
+		return dev->raid_5.disks[idx]->bdev_raw;
+
+	return sbdd_raid_0_members_geo(&dev->raid_0)->disks[idx]->bdev_raw;
+}
+
+/* Chunk and full stripe in bytes, 0 for mirrors */
+static void __sbdd_raid_io_hints(struct sbdd* dev, unsigned int* io_min, unsigned int* io_opt)
+{
+	*io_min = 0;
+	*io_opt = 0;
+
+	if(__sbdd_raid_is_striped(dev))
+		sbdd_raid_0_get_io_hints(&dev->raid_0, io_min, io_opt);
+	else if(__sbdd_raid_is_parity(dev))
+		sbdd_raid_5_get_io_hints(&dev->raid_5, io_min, io_opt);
+}
+
+/*
+Queue limits are stacked from every member the way dm and md do it, so
+the array never gets bios a member would have to split again.
+*/
+static void __sbdd_stack_limits(struct sbdd* dev, struct request_queue* q, __u64 raid_sectors)
+{
+	unsigned int _io_min = 0;
+	unsigned int _io_opt = 0;
+	bool _discard = true;
+	bool _write_cache = false;
+	__u32 idx = 0;
+	struct block_device* bdev = NULL;
+
+	blk_set_stacking_limits(&q->limits);
+
+	for(idx = 0; idx < __sbdd_raid_disks_count(dev); ++idx)
+	{
+		bdev = __sbdd_raid_disk_bdev(dev, idx);
+
+		/* Stacking keeps the discard limit of any member that has one */
+		if(!bdev_get_queue(bdev)->limits.max_discard_sectors)
+			_discard = false;
+
+		if(test_bit(QUEUE_FLAG_WC, &bdev_get_queue(bdev)->queue_flags))
+			_write_cache = true;
+
+		if(blk_stack_limits(&q->limits, &bdev_get_queue(bdev)->limits, get_start_sect(bdev)) < 0)
+			pr_warn("%s: member %s is misaligned\n", dev->gd->disk_name, __sbdd_raid_disk_name(dev, idx));
+	}
+
+	if(__sbdd_raid_is_parity(dev))
+	{
+		/* Members get single page ios, a whole row of data is one array bio */
+		blk_queue_max_hw_sectors(q, raid_sectors);
+		/* The stripe cache works on whole pages and holds written data until a flush */
+		blk_queue_logical_block_size(q, max_t(unsigned int, queue_logical_block_size(q), PAGE_SIZE));
+		blk_queue_physical_block_size(q, max_t(unsigned int, queue_physical_block_size(q), PAGE_SIZE));
+		blk_queue_max_discard_sectors(q, 0);
+		blk_queue_max_write_zeroes_sectors(q, 0);
+		blk_queue_write_cache(q, true, true);
+	}
+	else if(sbdd_cache_is_enabled(&dev->cache))
+	{
+		/* Cache blocks are pages, discards and write zeroes go past the cache to the target */
+		blk_queue_logical_block_size(q, max_t(unsigned int, queue_logical_block_size(q), PAGE_SIZE));
+		blk_queue_physical_block_size(q, max_t(unsigned int, queue_physical_block_size(q), PAGE_SIZE));
+		blk_queue_write_cache(q, true, true);
+
+		if(!_discard)
+			blk_queue_max_discard_sectors(q, 0);
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 19, 0))
+		else
+			blk_queue_flag_set(QUEUE_FLAG_DISCARD, q);
+#endif
+	}
+	else
+	{
+		/*
+		Without the flag the block layer drops flushes before they reach sbdd.
+		FUA is passed down as is, a member without it emulates it with a flush.
+		*/
+		blk_queue_write_cache(q, _write_cache, _write_cache);
+
+		if(_discard)
+		{
+			/* raid0 sends a discard range to every member once, whatever its size */
+			if(dev->params.raid_type == SBDD_RAID_TYPE_0)
+				blk_queue_max_discard_sectors(q, UINT_MAX >> SECTOR_SHIFT);
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 19, 0))
+			blk_queue_flag_set(QUEUE_FLAG_DISCARD, q);
+#endif
+		}
+		else
+		{
+			blk_queue_max_discard_sectors(q, 0);
+		}
+
+		if(dev->params.raid_type == SBDD_RAID_TYPE_0 && q->limits.max_write_zeroes_sectors)
+			blk_queue_max_write_zeroes_sectors(q, UINT_MAX >> SECTOR_SHIFT);
+	}
 
-static int __sbdd_create_raid(__u32* raid_capacity, __u64* max_raid_sectors)
+	/* Cache log record crcs are computed over the caller pages, they must not change before they are written */
+	if(sbdd_cache_is_enabled(&dev->cache))
+	{
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 10, 0))
+		q->backing_dev_info->capabilities |= BDI_CAP_STABLE_WRITES;
+#else
+		blk_queue_flag_set(QUEUE_FLAG_STABLE_WRITES, q);
+#endif
+	}
+
+	__sbdd_raid_io_hints(dev, &_io_min, &_io_opt);
+	if(_io_min)
+	{
+		blk_queue_io_min(q, max_t(unsigned int, _io_min, queue_physical_block_size(q)));
+		blk_queue_io_opt(q, _io_opt);
+	}
+
+	pr_info("%s: queue limits: max_sectors: %u, logical block: %u, io_min: %u, io_opt: %u, segments: %u, discard: %u\n",
+			dev->gd->disk_name, queue_max_hw_sectors(q), queue_logical_block_size(q), queue_io_min(q), queue_io_opt(q), queue_max_segments(q),
+			q->limits.max_discard_sectors);
+}
+
+/* Readahead covers at least a full stripe, so a sequential reader keeps every member busy */
+static void __sbdd_set_readahead(struct sbdd* dev)
+{
+	unsigned long _pages = DIV_ROUND_UP(queue_io_opt(dev->gd->queue), PAGE_SIZE);
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 15, 0))
+	struct backing_dev_info* _bdi = dev->gd->queue->backing_dev_info;
+#else
+	struct backing_dev_info* _bdi = dev->gd->bdi;
+#endif
+
+	if(_pages > _bdi->ra_pages)
+		_bdi->ra_pages = _pages;
+}
+
+static int __sbdd_create_raid(struct sbdd* dev, sector_t* raid_capacity, __u64* max_raid_sectors)
 {
 	int ret = 0;
 
+	char* _cache_path = NULL;
 	process_bio_t _process_bio = NULL;
+	bio_may_block_t _bio_may_block = NULL;
+
+	/* The cache option is not one of the target, it is taken out before the target parses the rest */
+	ret = sbdd_cache_parse_config(dev->params.raid_config, &_cache_path);
+	if(ret)
+		return ret;
+
+	if(__sbdd_raid_is_striped(dev))
+	{
+		if(dev->params.raid_type == SBDD_RAID_TYPE_10)
+			ret = sbdd_raid_10_create(&dev->raid_0, dev->params.raid_config, dev);
+		else
+			ret = sbdd_raid_0_create(&dev->raid_0, dev->params.raid_config, dev);
+		if(ret)
+		{
+			pr_err("creating raid_%u error=%d\n", dev->params.raid_type, ret);
+			return ret;
+		}
+
+		_process_bio = sbdd_raid_0_process_bio;
+		_bio_may_block = sbdd_raid_0_bio_may_block;
 
-	/* Check if raid type is supported*/
-	if(__sbdd_raid_type > 1)
+		*raid_capacity		= sbdd_raid_0_get_capacity(&dev->raid_0);
+		*max_raid_sectors	= sbdd_raid_0_get_max_sectors(&dev->raid_0);
+	}
+	else if(dev->params.raid_type == SBDD_RAID_TYPE_1)
 	{
-		pr_err("wrong raid type: %lu\n", __sbdd_raid_type);
+		ret = sbdd_raid_1_create(&dev->raid_1, dev->params.raid_config, dev);
+		if(ret)
+		{
+			pr_err("creating raid_1 error=%d\n", ret);
+			return ret;
+		}
+
+		_process_bio = sbdd_raid_1_process_bio;
+		_bio_may_block = sbdd_raid_1_bio_may_block;
+
+		*raid_capacity		= sbdd_raid_1_get_capacity(&dev->raid_1);
+		*max_raid_sectors	= sbdd_raid_1_get_max_sectors(&dev->raid_1);
+	}
+	else if(__sbdd_raid_is_parity(dev))
+	{
+		ret = sbdd_raid_5_create(&dev->raid_5, dev->params.raid_config, dev,
+								 dev->params.raid_type == SBDD_RAID_TYPE_6 ? 2 : 1);
+		if(ret)
+		{
+			pr_err("creating raid_%u error=%d\n", dev->params.raid_type, ret);
+			return ret;
+		}
+
+		_process_bio = sbdd_raid_5_process_bio;
+		_bio_may_block = sbdd_raid_5_bio_may_block;
+
+		*raid_capacity		= sbdd_raid_5_get_capacity(&dev->raid_5);
+		*max_raid_sectors	= sbdd_raid_5_get_max_sectors(&dev->raid_5);
+	}
+	else
+	{
+		/* Check if raid type is supported*/
+		pr_err("wrong raid type: %u\n", dev->params.raid_type);
+		kfree(_cache_path);
 		return -ENAVAIL;
 	}
 
-	if(__sbdd_raid_type == 0)
+	if(_cache_path)
 	{
-		ret = sbdd_raid_0_create(&__sbdd.raid_0, __sbdd_raid_config, &__sbdd);
+		/* The cache device log is laid out for the capacity, it changes at the end of a growth */
+		if(__sbdd_raid_is_striped(dev) && dev->raid_0.reshape && dev->raid_0.reshape->from)
+		{
+			pr_err("a raid0 being grown can't have a cache\n");
+			kfree(_cache_path);
+			return -EOPNOTSUPP;
+		}
+
+		ret = sbdd_cache_create(&dev->cache, _cache_path, _process_bio, *raid_capacity, dev);
 		if(ret)
 		{
-			pr_err("creating raid_0 error=%d\n", ret);
+			pr_err("creating cache error=%d\n", ret);
 			return ret;
 		}
 
-		_process_bio = sbdd_raid_0_process_bio;
+		/* Every bio goes through the cache, it sends to the target what it does not hold */
+		_process_bio = sbdd_cache_process_bio;
+		_bio_may_block = sbdd_cache_bio_may_block;
 	}
 
-	*raid_capacity		= sbdd_raid_0_get_capacity(&__sbdd.raid_0);
-	*max_raid_sectors	= sbdd_raid_0_get_max_sectors(&__sbdd.raid_0);
+	if(dev->params.read_cache_mb)
+	{
+		ret = sbdd_read_cache_create(&dev->read_cache, dev->params.read_cache_mb, _process_bio, _bio_may_block, dev);
+		if(ret)
+		{
+			pr_err("creating read cache error=%d\n", ret);
+			return ret;
+		}
+
+		/* The ram cache is the first layer, a hit never gets further */
+		_process_bio = sbdd_read_cache_process_bio;
+		_bio_may_block = sbdd_read_cache_bio_may_block;
+	}
+
+	/* A raid0 may get members up to its limit */
+	ret = sbdd_stats_create(&dev->stats, __sbdd_raid_disks_count(dev),
+							dev->params.raid_type == SBDD_RAID_TYPE_0 ? SDBB_RAID_0_MAX_DISKS_COUNT : 0);
+	if(ret)
+	{
+		pr_err("creating stats error=%d\n", ret);
+		return ret;
+	}
+
+	ret = sbdd_heatmap_create(&dev->heatmap, *raid_capacity, dev->params.heatmap_region_mb, dev->params.heatmap_sample);
+	if(ret)
+	{
+		pr_err("creating heatmap error=%d\n", ret);
+		return ret;
+	}
 
 	/* Create raid io */
-	ret = sbdd_io_create(&__sbdd.io, _process_bio, &__sbdd);
+	ret = sbdd_io_create(&dev->io, _process_bio, _bio_may_block, dev, dev->params.io_workers, dev->params.io_dispatch);
 	if(ret)
 	{
 		pr_err("creating io error=%d\n", ret);
 		return ret;
 	}
 
-	ret = sbdd_io_start(&__sbdd.io);
+	ret = sbdd_io_start(&dev->io);
 	if(ret)
 	{
 		pr_err("starting io error=%d\n", ret);
 		return ret;
 	}
 
-	pr_info("created raid type: %lu, capacity: %u, sectors: %llu \n", __sbdd_raid_type, *raid_capacity, *max_raid_sectors);
+	pr_info("created sbdd%d raid type: %u, capacity: %llu, sectors: %llu \n", dev->id, dev->params.raid_type, (__u64)*raid_capacity, *max_raid_sectors);
 
 	return 0;
 }
 
-static void __sbdd_destroy_raid(void)
+static void __sbdd_destroy_raid(struct sbdd* dev)
 {
 	/* Blocking call to io */
-	sbdd_io_stop(&__sbdd.io);
+	sbdd_io_stop(&dev->io);
+
+	sbdd_io_destroy(&dev->io);
+
+	sbdd_read_cache_destroy(&dev->read_cache);
 
-	sbdd_io_destroy(&__sbdd.io);
+	/* Destaging goes to the target, it is stopped first */
+	sbdd_cache_destroy(&dev->cache);
 
-	if(__sbdd_raid_type == 0)
+	if(__sbdd_raid_is_striped(dev))
+	{
+		sbdd_raid_0_destroy(&dev->raid_0);
+	}
+	else if(dev->params.raid_type == SBDD_RAID_TYPE_1)
 	{
-		sbdd_raid_0_destroy(&__sbdd.raid_0);
+		sbdd_raid_1_destroy(&dev->raid_1);
 	}
+	else if(__sbdd_raid_is_parity(dev))
+	{
+		sbdd_raid_5_destroy(&dev->raid_5);
+	}
+
+	sbdd_stats_destroy(&dev->stats);
+	sbdd_heatmap_destroy(&dev->heatmap);
+}
+
+static int __sbdd_register_stats(struct sbdd* dev)
+{
+	int ret = 0;
+	__u32 idx = 0;
+	const char** names = NULL;
+
+	names = kcalloc(__sbdd_raid_disks_count(dev), sizeof(char*), GFP_KERNEL);
+	if(!names)
+		return -ENOMEM;
+
+	for(idx = 0; idx < __sbdd_raid_disks_count(dev); ++idx)
+		names[idx] = __sbdd_raid_disk_name(dev, idx);
+
+	ret = sbdd_stats_register(&dev->stats, dev->gd, names);
+
+	kfree(names);
+
+	return ret;
+}
+
+/* Path of a new raid0 member, the array is restriped onto it in the background */
+static ssize_t __sbdd_add_member_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len)
+{
+	int ret = 0;
+	char* _buf = NULL;
+	char* _path = NULL;
+	struct sbdd* _sbdd = dev_to_disk(dev)->private_data;
+
+	/* The cache device log is laid out for the capacity it was created with */
+	if(sbdd_cache_is_enabled(&_sbdd->cache))
+		return -EOPNOTSUPP;
+
+	_buf = kstrndup(buf, len, GFP_KERNEL);
+	if(!_buf)
+		return -ENOMEM;
+
+	_path = strim(_buf);
+
+	/* The member gets ios once the growth starts, its counters have to be there */
+	ret = sbdd_stats_reserve_disk(&_sbdd->stats);
+	if(!ret)
+		ret = sbdd_raid_0_add_disk(&_sbdd->raid_0, _path);
+	if(!ret && sbdd_stats_add_disk(&_sbdd->stats, _path))
+		pr_warn("member %s has no stats\n", _path);
+
+	kfree(_buf);
+
+	return ret ? ret : len;
+}
+
+/* "IDX PATH": member IDX is copied to the disk at PATH, which takes its place at the end */
+static ssize_t __sbdd_replace_member_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len)
+{
+	int ret = 0;
+	unsigned int slot = 0;
+	char* _buf = NULL;
+	char* _slot = NULL;
+	char* _path = NULL;
+	struct sbdd* _sbdd = dev_to_disk(dev)->private_data;
+
+	_buf = kstrndup(buf, len, GFP_KERNEL);
+	if(!_buf)
+		return -ENOMEM;
+
+	_path = strim(_buf);
+	_slot = strsep(&_path, " ");
+
+	ret = _path ? kstrtouint(_slot, 10, &slot) : -EINVAL;
+	if(!ret)
+	{
+		_path = strim(_path);
+		ret = sbdd_raid_0_replace_disk(&_sbdd->raid_0, slot, _path);
+	}
+
+	if(!ret && sbdd_stats_rename_disk(&_sbdd->stats, slot, _path))
+		pr_warn("member %u has no stats\n", slot);
+
+	kfree(_buf);
+
+	return ret ? ret : len;
+}
+
+static ssize_t __sbdd_reshape_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+	struct sbdd* _sbdd = dev_to_disk(dev)->private_data;
+	struct sbdd_raid_0_reshape* _reshape = _sbdd->raid_0.reshape;
+
+	if(!_reshape)
+		return sysfs_emit(buf, "idle\n");
+
+	return sysfs_emit(buf, "%s%s %llu/%llu\n",
+					  _reshape->replace ? "replace " : "",
+					  READ_ONCE(_reshape->running) ? "running" : READ_ONCE(_reshape->error) ? "failed" : "done",
+					  READ_ONCE(_reshape->mark.done), _reshape->replace ? _reshape->sectors : _reshape->chunks);
+}
+
+static struct device_attribute __sbdd_attr_add_member = __ATTR(add_member, 0200, NULL, __sbdd_add_member_store);
+static struct device_attribute __sbdd_attr_replace_member = __ATTR(replace_member, 0200, NULL, __sbdd_replace_member_store);
+static struct device_attribute __sbdd_attr_reshape = __ATTR(reshape, 0444, __sbdd_reshape_show, NULL);
+
+static void __sbdd_unregister_reshape(struct sbdd* dev)
+{
+	if(!dev->reshape_attrs)
+		return;
+
+	/* Waits for a store in progress, no member is added or replaced after it */
+	device_remove_file(disk_to_dev(dev->gd), &__sbdd_attr_add_member);
+	device_remove_file(disk_to_dev(dev->gd), &__sbdd_attr_replace_member);
+	device_remove_file(disk_to_dev(dev->gd), &__sbdd_attr_reshape);
+
+	dev->reshape_attrs = false;
+}
+
+/* raid0 growth and member replacement knobs under /sys/block/sbddN/ */
+static int __sbdd_register_reshape(struct sbdd* dev)
+{
+	int ret = 0;
+
+	if(!__sbdd_raid_is_striped(dev) || dev->raid_0.tier)
+		return 0;
+
+	dev->reshape_attrs = true;
+
+	ret = device_create_file(disk_to_dev(dev->gd), &__sbdd_attr_reshape);
+	if(!ret)
+		ret = device_create_file(disk_to_dev(dev->gd), &__sbdd_attr_replace_member);
+	if(!ret && dev->raid_0.reshapable)
+		ret = device_create_file(disk_to_dev(dev->gd), &__sbdd_attr_add_member);
+
+	/* Files that were not created are skipped */
+	if(ret)
+		__sbdd_unregister_reshape(dev);
+
+	return ret;
 }
 
 #ifdef BLK_MQ_MODE
@@ -100,12 +536,49 @@ static struct blk_mq_ops const __sbdd_blk_mq_ops = {
 };
 #endif
 
+/* An array is destroyed only while it is not open, see __sbdd_destroy_array */
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(6, 5, 0))
+static int __sbdd_open(struct block_device* bdev, fmode_t mode)
+{
+	struct sbdd* _dev = bdev->bd_disk->private_data;
+#else
+static int __sbdd_open(struct gendisk* gd, blk_mode_t mode)
+{
+	struct sbdd* _dev = gd->private_data;
+#endif
+
+	atomic_inc(&_dev->openers);
+	/* Pairs with the barrier of destroy, either the open or the destroy fails */
+	smp_mb__after_atomic();
+
+	if(READ_ONCE(_dev->dying))
+	{
+		atomic_dec(&_dev->openers);
+		return -ENXIO;
+	}
+
+	return 0;
+}
+
+#if (BUILT_KERNEL_VERSION < KERNEL_VERSION(6, 5, 0))
+static void __sbdd_release(struct gendisk* gd, fmode_t mode)
+#else
+static void __sbdd_release(struct gendisk* gd)
+#endif
+{
+	struct sbdd* _dev = gd->private_data;
+
+	atomic_dec(&_dev->openers);
+}
+
 /*
 There are no read or write operations. These operations are performed by
 the request() function associated with the request queue of the disk.
 */
 static struct block_device_operations const __sbdd_bdev_ops = {
 	.owner = THIS_MODULE,
+	.open = __sbdd_open,
+	.release = __sbdd_release,
 #ifndef BLK_MQ_MODE
 #if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 8, 0))
 	.submit_bio = sbdd_io_submit_bio,
@@ -113,27 +586,14 @@ static struct block_device_operations const __sbdd_bdev_ops = {
 #endif
 };
 
-static int sbdd_create(void)
+static int sbdd_create(struct sbdd* dev)
 {
 	int ret = 0;
-	__u32 _raid_capacity = 0;
+	sector_t _raid_capacity = 0;
 	__u64 _raid_sectors = 0;
 
-	/*
-	This call is somewhat redundant, but used anyways by tradition.
-	The number is to be displayed in /proc/devices (0 for auto).
-	*/
-	pr_info("registering blkdev\n");
-	__sbdd_major = register_blkdev(0, SBDD_NAME);
-	if (__sbdd_major < 0) {
-		pr_err("call register_blkdev() failed with %d\n", __sbdd_major);
-		return -EBUSY;
-	}
-
-	memset(&__sbdd, 0, sizeof(struct sbdd));
-
 	/* Create raid */
-	ret = __sbdd_create_raid(&_raid_capacity, &_raid_sectors);
+	ret = __sbdd_create_raid(dev, &_raid_capacity, &_raid_sectors);
 	if(ret)
 	{
 		pr_err("creating raid_error=%d\n", ret);
@@ -143,65 +603,329 @@ static int sbdd_create(void)
 	pr_info("allocating disk\n");
 
 #ifdef BLK_MQ_MODE
-	ret = sbdd_alloc_disk(&__sbdd, &__sbdd_blk_mq_ops);
+	ret = sbdd_alloc_disk(dev, &__sbdd_blk_mq_ops, dev->params.hw_queues, dev->params.hw_queue_depth);
 #else
-	ret = sbdd_alloc_disk(&__sbdd, NULL);
+	ret = sbdd_alloc_disk(dev, NULL, 0, 0);
 #endif
 	if (ret) {
 		pr_warn("disk allocation failed\n");
 		return ret;
 	}
 
+	/* Represents name in /proc/partitions and /sys/block */
+	scnprintf(dev->gd->disk_name, DISK_NAME_LEN, SBDD_NAME "%d", dev->id);
+
 	/* Configure queue */
-	__sbdd.gd->queue->queuedata = &__sbdd;
-	blk_queue_max_hw_sectors(__sbdd.gd->queue, _raid_sectors);
+	dev->gd->queue->queuedata = dev;
+	__sbdd_stack_limits(dev, dev->gd->queue, _raid_sectors);
 #if (BUILT_KERNEL_VERSION < KERNEL_VERSION(5, 14, 0))
-	blk_queue_make_request(__sbdd.gd->queue, sbdd_io_make_request);
+	blk_queue_make_request(dev->gd->queue, sbdd_io_make_request);
 #endif
 
-	/* Configure gendisk */
-	__sbdd.gd->private_data = &__sbdd;
-	__sbdd.gd->major = __sbdd_major;
-	__sbdd.gd->first_minor = 0;
-	__sbdd.gd->minors = 1;
-	__sbdd.gd->fops = &__sbdd_bdev_ops;
-	/* Represents name in /proc/partitions and /sys/block */
-	scnprintf(__sbdd.gd->disk_name, DISK_NAME_LEN, SBDD_NAME);
-	set_capacity(__sbdd.gd, _raid_capacity);
+	/* Configure gendisk, every array has one minor of the module major */
+	dev->gd->private_data = dev;
+	dev->gd->major = __sbdd_major;
+	dev->gd->first_minor = dev->id;
+	dev->gd->minors = 1;
+	dev->gd->fops = &__sbdd_bdev_ops;
+	set_capacity(dev->gd, _raid_capacity);
 	
 	/*
 	Allocating gd does not make it available, add_disk() required.
 	After this call, gd methods can be called at any time. Should not be
 	called before the driver is fully initialized and ready to process reqs.
 	*/
-	pr_info("adding disk\n");
+	pr_info("adding disk %s\n", dev->gd->disk_name);
 #if (BUILT_KERNEL_VERSION > KERNEL_VERSION(5, 14, 0))
-	ret = add_disk(__sbdd.gd);
+	ret = add_disk(dev->gd);
 	if(ret)
 	{
 		pr_err("adding disk error=%d\n", ret);
 		return ret;
 	}
 #else
-	add_disk(__sbdd.gd);
+	add_disk(dev->gd);
 #endif
 
+	/* add_disk sets the default readahead */
+	__sbdd_set_readahead(dev);
+
+	/* Destaging writes to the disk */
+	ret = sbdd_cache_start(&dev->cache);
+	if(ret)
+	{
+		pr_err("starting cache error=%d\n", ret);
+		return ret;
+	}
+
+	/* Stats are exported under /sys/block/sbddN/sbdd/ */
+	ret = __sbdd_register_stats(dev);
+	if(ret)
+	{
+		pr_err("registering stats error=%d\n", ret);
+		return ret;
+	}
+
+	/* A raid0 can grow or have a member replaced through /sys/block/sbddN/ */
+	ret = __sbdd_register_reshape(dev);
+	if(ret)
+	{
+		pr_err("registering reshape error=%d\n", ret);
+		return ret;
+	}
+
+	/* A growth found on the members goes on once the array is up */
+	if(__sbdd_raid_is_striped(dev))
+		sbdd_raid_0_resume(&dev->raid_0);
+
+	/* Heatmap is exported under /sys/kernel/debug/sbdd/sbddN/ */
+	ret = sbdd_heatmap_register(&dev->heatmap, dev->gd->disk_name);
+	if(ret)
+	{
+		pr_err("registering heatmap error=%d\n", ret);
+		return ret;
+	}
+
 	return 0;
 }
 
-static void sbdd_delete(void)
+static void sbdd_delete(struct sbdd* dev)
 {
-	__sbdd_destroy_raid();
+	__sbdd_unregister_reshape(dev);
+	sbdd_heatmap_unregister(&dev->heatmap);
+	sbdd_stats_unregister(&dev->stats);
+
+	__sbdd_destroy_raid(dev);
+
+	sbdd_free_disk(dev);
+}
+
+static void __sbdd_release_id(int id)
+{
+	mutex_lock(&__sbdd_arrays_lock);
+	idr_remove(&__sbdd_arrays, id);
+	mutex_unlock(&__sbdd_arrays_lock);
+}
+
+/*
+Creates sbddN with the lowest free N. The arrays share nothing but the major
+and the id table, that is locked only while an array is created or destroyed.
+*/
+static int __sbdd_create_array(const struct sbdd_ctl_create* params, int* id)
+{
+	int ret = 0;
+	struct sbdd* _dev = NULL;
 
-	sbdd_free_disk(&__sbdd);
+	_dev = kzalloc(sizeof(struct sbdd), GFP_KERNEL);
+	if(!_dev)
+		return -ENOMEM;
+
+	_dev->params = *params;
+	_dev->params.raid_config[SBDD_CTL_CONFIG_LEN - 1] = '\0';
+	atomic_set(&_dev->openers, 0);
+
+	/* The id is reserved with no array, it is not found before the array is created */
+	mutex_lock(&__sbdd_arrays_lock);
+	ret = idr_alloc(&__sbdd_arrays, NULL, 0, 1 << MINORBITS, GFP_KERNEL);
+	mutex_unlock(&__sbdd_arrays_lock);
+	if(ret < 0)
+	{
+		kfree(_dev);
+		return ret;
+	}
+
+	_dev->id = ret;
+
+	ret = sbdd_create(_dev);
+	if(ret)
+	{
+		pr_warn("creating sbdd%d failed\n", _dev->id);
+		sbdd_delete(_dev);
+		__sbdd_release_id(_dev->id);
+		kfree(_dev);
+		return ret;
+	}
+
+	mutex_lock(&__sbdd_arrays_lock);
+	idr_replace(&__sbdd_arrays, _dev, _dev->id);
+	mutex_unlock(&__sbdd_arrays_lock);
+
+	*id = _dev->id;
+
+	return 0;
+}
+
+static int __sbdd_destroy_array(int id)
+{
+	struct sbdd* _dev = NULL;
+
+	mutex_lock(&__sbdd_arrays_lock);
+
+	_dev = idr_find(&__sbdd_arrays, id);
+	if(!_dev)
+	{
+		mutex_unlock(&__sbdd_arrays_lock);
+		return -ENOENT;
+	}
 
-	memset(&__sbdd, 0, sizeof(struct sbdd));
+	WRITE_ONCE(_dev->dying, true);
+	/* Pairs with the barrier of open */
+	smp_mb();
+
+	if(atomic_read(&_dev->openers))
+	{
+		WRITE_ONCE(_dev->dying, false);
+		mutex_unlock(&__sbdd_arrays_lock);
+		return -EBUSY;
+	}
+
+	/* The id stays reserved until the disk with its name and minor is gone */
+	idr_replace(&__sbdd_arrays, NULL, id);
+	mutex_unlock(&__sbdd_arrays_lock);
+
+	pr_info("destroying sbdd%d\n", id);
+
+	sbdd_delete(_dev);
+	kfree(_dev);
+
+	__sbdd_release_id(id);
+
+	return 0;
+}
+
+/* The array of the module parameters is sbdd0, there is none without raid_config */
+static int __sbdd_create_param_array(void)
+{
+	int ret = 0;
+	int _id = 0;
+	struct sbdd_ctl_create* _params = NULL;
+
+	if(!__sbdd_raid_config)
+		return 0;
+
+	_params = kzalloc(sizeof(struct sbdd_ctl_create), GFP_KERNEL);
+	if(!_params)
+		return -ENOMEM;
+
+	_params->raid_type = __sbdd_raid_type;
+	_params->io_workers = __sbdd_io_workers;
+	_params->io_dispatch = __sbdd_io_dispatch;
+	_params->heatmap_region_mb = __sbdd_heatmap_region_mb;
+	_params->heatmap_sample = __sbdd_heatmap_sample;
+	_params->read_cache_mb = __sbdd_read_cache_mb;
+#ifdef BLK_MQ_MODE
+	_params->hw_queues = __sbdd_hw_queues;
+	_params->hw_queue_depth = __sbdd_hw_queue_depth;
+#endif
+
+	if(strscpy(_params->raid_config, __sbdd_raid_config, SBDD_CTL_CONFIG_LEN) < 0)
+	{
+		pr_err("raid_config is longer than %d\n", SBDD_CTL_CONFIG_LEN - 1);
+		ret = -E2BIG;
+	}
+	else
+	{
+		ret = __sbdd_create_array(_params, &_id);
+	}
+
+	kfree(_params);
+
+	return ret;
+}
+
+static void __sbdd_destroy_arrays(void)
+{
+	int _id = 0;
+	struct sbdd* _dev = NULL;
+
+	/* No ioctl is in progress, the control device holds the module */
+	idr_for_each_entry(&__sbdd_arrays, _dev, _id)
+	{
+		sbdd_delete(_dev);
+		kfree(_dev);
+	}
+
+	idr_destroy(&__sbdd_arrays);
+}
+
+static long __sbdd_ctl_ioctl(struct file* file, unsigned int cmd, unsigned long arg)
+{
+	int ret = 0;
+	int _id = 0;
+	struct sbdd_ctl_create* _params = NULL;
+	struct sbdd_ctl_create __user* _uparams = (struct sbdd_ctl_create __user*)arg;
+
+	if(!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	switch(cmd)
+	{
+	case SBDD_CTL_CREATE:
+		_params = memdup_user(_uparams, sizeof(struct sbdd_ctl_create));
+		if(IS_ERR(_params))
+			return PTR_ERR(_params);
+
+		/* 0 is the default here, the module parameters keep their own meaning of it */
+		if(!_params->heatmap_sample)
+			_params->heatmap_sample = SBDD_HEATMAP_SAMPLE_DEFAULT;
+		if(!_params->hw_queue_depth)
+			_params->hw_queue_depth = SBDD_HW_QUEUE_DEPTH_DEFAULT;
+
+		ret = __sbdd_create_array(_params, &_id);
+		if(!ret && put_user(_id, &_uparams->id))
+		{
+			/* The caller can't know the array it would have to destroy */
+			if(__sbdd_destroy_array(_id))
+				pr_warn("sbdd%d is left created, its id was not returned\n", _id);
+
+			ret = -EFAULT;
+		}
+
+		kfree(_params);
+		return ret;
+
+	case SBDD_CTL_DESTROY:
+		if(arg >= (1 << MINORBITS))
+			return -ENOENT;
+
+		return __sbdd_destroy_array(arg);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+static struct file_operations const __sbdd_ctl_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = __sbdd_ctl_ioctl,
+#if (BUILT_KERNEL_VERSION >= KERNEL_VERSION(5, 5, 0))
+	/* The create struct has the same layout for 32-bit callers */
+	.compat_ioctl = compat_ptr_ioctl,
+#endif
+	.llseek = noop_llseek,
+};
+
+/* /dev/sbdd-control */
+static struct miscdevice __sbdd_ctl = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = SBDD_CTL_NAME,
+	.fops = &__sbdd_ctl_fops,
+};
+
+static void sbdd_cleanup(void)
+{
+	misc_deregister(&__sbdd_ctl);
+
+	__sbdd_destroy_arrays();
 
 	if (__sbdd_major > 0) {
 		pr_info("unregistering blkdev\n");
 		unregister_blkdev(__sbdd_major, SBDD_NAME);
 		__sbdd_major = 0;
 	}
+
+	sbdd_heatmap_exit();
+	sbdd_io_exit();
 }
 
 /*
@@ -214,10 +938,43 @@ static int __init sbdd_init(void)
 	int ret = 0;
 
 	pr_info("###starting initialization...\n");
-	ret = sbdd_create();
+
+	ret = sbdd_io_init();
+	if (ret) {
+		pr_warn("io initialization failed\n");
+		return ret;
+	}
+
+	sbdd_heatmap_init();
+
+	/*
+	This call is somewhat redundant, but used anyways by tradition.
+	The number is to be displayed in /proc/devices (0 for auto).
+	*/
+	pr_info("registering blkdev\n");
+	__sbdd_major = register_blkdev(0, SBDD_NAME);
+	if (__sbdd_major < 0) {
+		pr_err("call register_blkdev() failed with %d\n", __sbdd_major);
+		__sbdd_major = 0;
+		sbdd_heatmap_exit();
+		sbdd_io_exit();
+		return -EBUSY;
+	}
+
+	ret = misc_register(&__sbdd_ctl);
+	if (ret) {
+		pr_err("registering control device error=%d\n", ret);
+		unregister_blkdev(__sbdd_major, SBDD_NAME);
+		__sbdd_major = 0;
+		sbdd_heatmap_exit();
+		sbdd_io_exit();
+		return ret;
+	}
+
+	ret = __sbdd_create_param_array();
 	if (ret) {
 		pr_warn("initialization failed\n");
-		sbdd_delete();
+		sbdd_cleanup();
 	} else {
 		pr_info("initialization complete\n");
 	}
@@ -233,7 +990,7 @@ directly into the kernel). There is also __exitdata note.
 static void __exit sbdd_exit(void)
 {
 	pr_info("exiting...\n");
-	sbdd_delete();
+	sbdd_cleanup();
 	pr_info("exiting complete\n");
 }
 
@@ -243,10 +1000,27 @@ module_init(sbdd_init);
 /* Called on module unloading. Unloading module is not allowed without it. */
 module_exit(sbdd_exit);
 
-/* Set raid type */
-module_param_named(raid_type, __sbdd_raid_type, ulong, S_IRUGO);
-/* Set raid type */
+/* Parameters of sbdd0, created on load when raid_config is set, other arrays are created with /dev/sbdd-control */
+/* Set raid type: 0 - raid0, 1 - raid1, 5 - raid5, 6 - raid6, 10 - raid10 */
+module_param_named(raid_type, __sbdd_raid_type, uint, S_IRUGO);
+/* Set raid config */
 module_param_named(raid_config, __sbdd_raid_config, charp, S_IRUGO);
+/* Set io workers layout: 0 - worker per cpu, 1 - worker per numa node */
+module_param_named(io_workers, __sbdd_io_workers, int, S_IRUGO);
+/* Set io dispatch: 0 - deferred to io workers, 1 - inline in submit_bio context */
+module_param_named(io_dispatch, __sbdd_io_dispatch, int, S_IRUGO);
+/* Set heatmap region size in MiB, 0 - heatmap disabled */
+module_param_named(heatmap_region_mb, __sbdd_heatmap_region_mb, uint, S_IRUGO);
+/* Set heatmap sampling: one of heatmap_sample bios is recorded */
+module_param_named(heatmap_sample, __sbdd_heatmap_sample, uint, S_IRUGO);
+/* Set ram read cache size in MiB, 0 - read cache disabled */
+module_param_named(read_cache_mb, __sbdd_read_cache_mb, uint, S_IRUGO);
+#ifdef BLK_MQ_MODE
+/* Set number of hardware queues, 0 - one per online cpu */
+module_param_named(hw_queues, __sbdd_hw_queues, uint, S_IRUGO);
+/* Set depth of each hardware queue */
+module_param_named(hw_queue_depth, __sbdd_hw_queue_depth, uint, S_IRUGO);
+#endif
 
 /* Note for the kernel: a free license module. A warning will be outputted without it. */
 MODULE_LICENSE("GPL");
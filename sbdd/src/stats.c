@@ -0,0 +1,486 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kernel_version.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+#include <io.h>
+#include <stats.h>
+
+struct sbdd_stats_attr {
+    struct attribute attr;
+    ssize_t (*show)(struct sbdd_stats* stats, char* buf);
+    ssize_t (*store)(struct sbdd_stats* stats, const char* buf, size_t len);
+};
+
+struct sbdd_stats_disk_attr {
+    struct attribute attr;
+    ssize_t (*show)(struct sbdd_stats_disk_kobj* disk, char* buf);
+};
+
+static const char* const __sbdd_stats_dir_names[SBDD_STATS_DIRS] = { "read", "write" };
+
+/* Stats structs are plain u64 arrays, sums them over all cpus */
+static void __sbdd_stats_sum(void __percpu* pcpu, size_t offset, size_t size, u64* sum)
+{
+    int     _cpu = 0;
+    size_t  _idx = 0;
+    u64*    _src = NULL;
+
+    memset(sum, 0, size);
+
+    for_each_possible_cpu(_cpu)
+    {
+        _src = (u64*)((char*)per_cpu_ptr(pcpu, _cpu) + offset);
+
+        for(_idx = 0; _idx < size / sizeof(u64); ++_idx)
+            sum[_idx] += _src[_idx];
+    }
+}
+
+static ssize_t __sbdd_stats_show_hist(const u64* hist, char* buf)
+{
+    ssize_t _len = 0;
+    u32     _idx = 0;
+
+    for(_idx = 0; _idx < SBDD_STATS_HIST_BUCKETS - 1; ++_idx)
+        _len += sysfs_emit_at(buf, _len, "%u %llu\n", 1u << _idx, hist[_idx]);
+
+    _len += sysfs_emit_at(buf, _len, "inf %llu\n", hist[_idx]);
+
+    return _len;
+}
+
+static ssize_t __sbdd_stats_stat_show(struct sbdd_stats* stats, char* buf)
+{
+    struct sbdd_stats_array _sum;
+    ssize_t                 _len = 0;
+    int                     _dir = 0;
+
+    __sbdd_stats_sum(stats->array, 0, sizeof(_sum), (u64*)&_sum);
+
+    for(_dir = 0; _dir < SBDD_STATS_DIRS; ++_dir)
+    {
+        _len += sysfs_emit_at(buf, _len, "%s_bios %llu\n", __sbdd_stats_dir_names[_dir], _sum.bios[_dir]);
+        _len += sysfs_emit_at(buf, _len, "%s_sectors %llu\n", __sbdd_stats_dir_names[_dir], _sum.sectors[_dir]);
+        _len += sysfs_emit_at(buf, _len, "%s_splits %llu\n", __sbdd_stats_dir_names[_dir], _sum.splits[_dir]);
+        _len += sysfs_emit_at(buf, _len, "%s_errors %llu\n", __sbdd_stats_dir_names[_dir], _sum.errors[_dir]);
+    }
+
+    _len += sysfs_emit_at(buf, _len, "read_cache_hits %llu\n", _sum.read_cache_hits);
+    _len += sysfs_emit_at(buf, _len, "read_cache_misses %llu\n", _sum.read_cache_misses);
+
+    return _len;
+}
+
+static ssize_t __sbdd_stats_queue_hist_show(struct sbdd_stats* stats, char* buf)
+{
+    struct sbdd_stats_array _sum;
+
+    __sbdd_stats_sum(stats->array, 0, sizeof(_sum), (u64*)&_sum);
+
+    return __sbdd_stats_show_hist(_sum.queue_hist, buf);
+}
+
+static ssize_t __sbdd_stats_tracking_show(struct sbdd_stats* stats, char* buf)
+{
+    return sysfs_emit(buf, "%d\n", READ_ONCE(stats->tracking));
+}
+
+static ssize_t __sbdd_stats_tracking_store(struct sbdd_stats* stats, const char* buf, size_t len)
+{
+    bool _tracking = false;
+    int  _ret = kstrtobool(buf, &_tracking);
+
+    if(_ret)
+        return _ret;
+
+    /* Only a real transition takes or drops the static key reference */
+    if(xchg(&stats->tracking, (int)_tracking) != (int)_tracking)
+    {
+        if(_tracking)
+            sbdd_io_track_get();
+        else
+            sbdd_io_track_put();
+    }
+
+    return len;
+}
+
+static ssize_t __sbdd_stats_reset_store(struct sbdd_stats* stats, const char* buf, size_t len)
+{
+    sbdd_stats_reset(stats);
+
+    return len;
+}
+
+static struct sbdd_stats_attr __sbdd_stats_attr_stat = __ATTR(stat, 0444, __sbdd_stats_stat_show, NULL);
+static struct sbdd_stats_attr __sbdd_stats_attr_queue_hist = __ATTR(queue_hist, 0444, __sbdd_stats_queue_hist_show, NULL);
+static struct sbdd_stats_attr __sbdd_stats_attr_tracking = __ATTR(tracking, 0644, __sbdd_stats_tracking_show, __sbdd_stats_tracking_store);
+static struct sbdd_stats_attr __sbdd_stats_attr_reset = __ATTR(reset, 0200, NULL, __sbdd_stats_reset_store);
+
+static struct attribute* __sbdd_stats_attrs[] = {
+    &__sbdd_stats_attr_stat.attr,
+    &__sbdd_stats_attr_queue_hist.attr,
+    &__sbdd_stats_attr_tracking.attr,
+    &__sbdd_stats_attr_reset.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(__sbdd_stats);
+
+static ssize_t __sbdd_stats_attr_show(struct kobject* kobj, struct attribute* attr, char* buf)
+{
+    struct sbdd_stats_attr* _attr = container_of(attr, struct sbdd_stats_attr, attr);
+
+    if(!_attr->show)
+        return -EIO;
+
+    return _attr->show(container_of(kobj, struct sbdd_stats_kobj, kobj)->stats, buf);
+}
+
+static ssize_t __sbdd_stats_attr_store(struct kobject* kobj, struct attribute* attr, const char* buf, size_t len)
+{
+    struct sbdd_stats_attr* _attr = container_of(attr, struct sbdd_stats_attr, attr);
+
+    if(!_attr->store)
+        return -EIO;
+
+    return _attr->store(container_of(kobj, struct sbdd_stats_kobj, kobj)->stats, buf, len);
+}
+
+static const struct sysfs_ops __sbdd_stats_sysfs_ops = {
+    .show   = __sbdd_stats_attr_show,
+    .store  = __sbdd_stats_attr_store,
+};
+
+static void __sbdd_stats_kobj_release(struct kobject* kobj)
+{
+    kfree(container_of(kobj, struct sbdd_stats_kobj, kobj));
+}
+
+static struct kobj_type __sbdd_stats_ktype = {
+    .release        = __sbdd_stats_kobj_release,
+    .sysfs_ops      = &__sbdd_stats_sysfs_ops,
+    .default_groups = __sbdd_stats_groups,
+};
+
+static ssize_t __sbdd_stats_disk_name_show(struct sbdd_stats_disk_kobj* disk, char* buf)
+{
+    return sysfs_emit(buf, "%s\n", disk->name);
+}
+
+static ssize_t __sbdd_stats_disk_stat_show(struct sbdd_stats_disk_kobj* disk, char* buf)
+{
+    struct sbdd_stats_disk  _sum;
+    ssize_t                 _len = 0;
+    int                     _dir = 0;
+
+    __sbdd_stats_sum(disk->stats->disks[disk->idx], 0, sizeof(_sum), (u64*)&_sum);
+
+    for(_dir = 0; _dir < SBDD_STATS_DIRS; ++_dir)
+    {
+        _len += sysfs_emit_at(buf, _len, "%s_bios %llu\n", __sbdd_stats_dir_names[_dir], _sum.bios[_dir]);
+        _len += sysfs_emit_at(buf, _len, "%s_sectors %llu\n", __sbdd_stats_dir_names[_dir], _sum.sectors[_dir]);
+        _len += sysfs_emit_at(buf, _len, "%s_errors %llu\n", __sbdd_stats_dir_names[_dir], _sum.errors[_dir]);
+    }
+
+    return _len;
+}
+
+static ssize_t __sbdd_stats_disk_hist_show(struct sbdd_stats_disk_kobj* disk, int dir, char* buf)
+{
+    struct sbdd_stats_disk _sum;
+
+    __sbdd_stats_sum(disk->stats->disks[disk->idx], 0, sizeof(_sum), (u64*)&_sum);
+
+    return __sbdd_stats_show_hist(_sum.service_hist[dir], buf);
+}
+
+static ssize_t __sbdd_stats_disk_read_hist_show(struct sbdd_stats_disk_kobj* disk, char* buf)
+{
+    return __sbdd_stats_disk_hist_show(disk, SBDD_STATS_READ, buf);
+}
+
+static ssize_t __sbdd_stats_disk_write_hist_show(struct sbdd_stats_disk_kobj* disk, char* buf)
+{
+    return __sbdd_stats_disk_hist_show(disk, SBDD_STATS_WRITE, buf);
+}
+
+#define SBDD_STATS_DISK_ATTR(_name, _show) \
+    struct sbdd_stats_disk_attr __sbdd_stats_disk_attr_##_name = { .attr = { .name = #_name, .mode = 0444 }, .show = _show }
+
+static SBDD_STATS_DISK_ATTR(name, __sbdd_stats_disk_name_show);
+static SBDD_STATS_DISK_ATTR(stat, __sbdd_stats_disk_stat_show);
+static SBDD_STATS_DISK_ATTR(read_service_hist, __sbdd_stats_disk_read_hist_show);
+static SBDD_STATS_DISK_ATTR(write_service_hist, __sbdd_stats_disk_write_hist_show);
+
+static struct attribute* __sbdd_stats_disk_attrs[] = {
+    &__sbdd_stats_disk_attr_name.attr,
+    &__sbdd_stats_disk_attr_stat.attr,
+    &__sbdd_stats_disk_attr_read_service_hist.attr,
+    &__sbdd_stats_disk_attr_write_service_hist.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(__sbdd_stats_disk);
+
+static ssize_t __sbdd_stats_disk_attr_show(struct kobject* kobj, struct attribute* attr, char* buf)
+{
+    struct sbdd_stats_disk_attr* _attr = container_of(attr, struct sbdd_stats_disk_attr, attr);
+
+    return _attr->show(container_of(kobj, struct sbdd_stats_disk_kobj, kobj), buf);
+}
+
+static const struct sysfs_ops __sbdd_stats_disk_sysfs_ops = {
+    .show   = __sbdd_stats_disk_attr_show,
+};
+
+static void __sbdd_stats_disk_kobj_release(struct kobject* kobj)
+{
+    kfree(container_of(kobj, struct sbdd_stats_disk_kobj, kobj));
+}
+
+static struct kobj_type __sbdd_stats_disk_ktype = {
+    .release        = __sbdd_stats_disk_kobj_release,
+    .sysfs_ops      = &__sbdd_stats_disk_sysfs_ops,
+    .default_groups = __sbdd_stats_disk_groups,
+};
+
+/* A percpu allocation is limited, so a large array can't have its members in one */
+int sbdd_stats_create(struct sbdd_stats* stats, u32 disks_count, u32 disks_max)
+{
+    u32 _idx = 0;
+
+    stats->array = alloc_percpu(struct sbdd_stats_array);
+    if(!stats->array)
+    {
+        pr_err("stats:: can't alloc array stats \n");
+        return -ENOMEM;
+    }
+
+    disks_max = max(disks_count, disks_max);
+
+    stats->disks = kvcalloc(disks_max, sizeof(struct sbdd_stats_disk __percpu*), GFP_KERNEL);
+    if(!stats->disks)
+        goto fail;
+
+    stats->disks_max = disks_max;
+
+    for(_idx = 0; _idx < disks_count; ++_idx)
+    {
+        stats->disks[_idx] = alloc_percpu(struct sbdd_stats_disk);
+        if(!stats->disks[_idx])
+            goto fail;
+    }
+
+    stats->disks_count = disks_count;
+
+    return 0;
+
+fail:
+    pr_err("stats:: can't alloc stats for %u disks \n", disks_count);
+    sbdd_stats_destroy(stats);
+
+    return -ENOMEM;
+}
+
+int sbdd_stats_reserve_disk(struct sbdd_stats* stats)
+{
+    struct sbdd_stats_disk __percpu* _disk = NULL;
+
+    if(stats->disks_count >= stats->disks_max)
+        return -EINVAL;
+
+    if(READ_ONCE(stats->disks[stats->disks_count]))
+        return 0;
+
+    _disk = alloc_percpu(struct sbdd_stats_disk);
+    if(!_disk)
+        return -ENOMEM;
+
+    /* Kept for the next add if the member does not make it */
+    if(cmpxchg(&stats->disks[stats->disks_count], NULL, _disk))
+        free_percpu(_disk);
+
+    return 0;
+}
+
+void sbdd_stats_destroy(struct sbdd_stats* stats)
+{
+    u32 _idx = 0;
+
+    for(_idx = 0; stats->disks && _idx < stats->disks_max; ++_idx)
+        free_percpu(stats->disks[_idx]);
+
+    kvfree(stats->disks);
+    free_percpu(stats->array);
+
+    stats->disks = NULL;
+    stats->array = NULL;
+    stats->disks_count = 0;
+    stats->disks_max = 0;
+}
+
+/*
+The dirs are taken out of sysfs before their last put, no show runs after
+it. The kobjects are freed by their release, whenever the last reference goes.
+*/
+static void __sbdd_stats_remove_kobjs(struct sbdd_stats* stats)
+{
+    u32 _idx = 0;
+
+    for(_idx = 0; stats->disk_kobjs && _idx < stats->disks_max; ++_idx)
+    {
+        if(stats->disk_kobjs[_idx])
+        {
+            kobject_del(&stats->disk_kobjs[_idx]->kobj);
+            kobject_put(&stats->disk_kobjs[_idx]->kobj);
+        }
+    }
+
+    if(stats->kobj)
+    {
+        kobject_del(&stats->kobj->kobj);
+        kobject_put(&stats->kobj->kobj);
+    }
+
+    kvfree(stats->disk_kobjs);
+    stats->disk_kobjs = NULL;
+    stats->kobj = NULL;
+}
+
+int sbdd_stats_register(struct sbdd_stats* stats, struct gendisk* gd, const char* const* disk_names)
+{
+    struct sbdd_stats_kobj*         _kobj = NULL;
+    struct sbdd_stats_disk_kobj*    _disk = NULL;
+    int                             _ret = 0;
+    u32                             _idx = 0;
+
+    stats->disk_kobjs = kvcalloc(stats->disks_max, sizeof(struct sbdd_stats_disk_kobj*), GFP_KERNEL);
+    _kobj = kzalloc(sizeof(struct sbdd_stats_kobj), GFP_KERNEL);
+    if(!stats->disk_kobjs || !_kobj)
+    {
+        kfree(_kobj);
+        kvfree(stats->disk_kobjs);
+        stats->disk_kobjs = NULL;
+        return -ENOMEM;
+    }
+
+    _kobj->stats = stats;
+
+    _ret = kobject_init_and_add(&_kobj->kobj, &__sbdd_stats_ktype, &disk_to_dev(gd)->kobj, "%s", "sbdd");
+    if(_ret)
+    {
+        pr_err("stats:: can't add sysfs dir: %d \n", _ret);
+        /* A failed kobject_init_and_add() needs its put as well */
+        kobject_put(&_kobj->kobj);
+        kvfree(stats->disk_kobjs);
+        stats->disk_kobjs = NULL;
+        return _ret;
+    }
+
+    stats->kobj = _kobj;
+
+    for(_idx = 0; _idx < stats->disks_count; ++_idx)
+    {
+        _disk = kzalloc(sizeof(struct sbdd_stats_disk_kobj), GFP_KERNEL);
+        if(!_disk)
+        {
+            _ret = -ENOMEM;
+            goto fail;
+        }
+
+        _disk->stats = stats;
+        _disk->idx = _idx;
+        strscpy(_disk->name, disk_names[_idx], DISK_NAME_LEN);
+
+        _ret = kobject_init_and_add(&_disk->kobj, &__sbdd_stats_disk_ktype, &_kobj->kobj, "disk%u", _idx);
+        if(_ret)
+        {
+            pr_err("stats:: can't add sysfs dir for disk %u: %d \n", _idx, _ret);
+            kobject_put(&_disk->kobj);
+            goto fail;
+        }
+
+        stats->disk_kobjs[_idx] = _disk;
+    }
+
+    stats->registered = true;
+
+    return 0;
+
+fail:
+    __sbdd_stats_remove_kobjs(stats);
+
+    return _ret;
+}
+
+void sbdd_stats_unregister(struct sbdd_stats* stats)
+{
+    if(!stats->registered)
+        return;
+
+    if(xchg(&stats->tracking, 0))
+        sbdd_io_track_put();
+
+    __sbdd_stats_remove_kobjs(stats);
+
+    stats->registered = false;
+}
+
+int sbdd_stats_add_disk(struct sbdd_stats* stats, const char* disk_name)
+{
+    struct sbdd_stats_disk_kobj*    _disk = NULL;
+    int                             _ret = 0;
+
+    if(!stats->registered || stats->disks_count >= stats->disks_max || !stats->disks[stats->disks_count])
+        return -EINVAL;
+
+    _disk = kzalloc(sizeof(struct sbdd_stats_disk_kobj), GFP_KERNEL);
+    if(!_disk)
+        return -ENOMEM;
+
+    _disk->stats = stats;
+    _disk->idx = stats->disks_count;
+    strscpy(_disk->name, disk_name, DISK_NAME_LEN);
+
+    _ret = kobject_init_and_add(&_disk->kobj, &__sbdd_stats_disk_ktype, &stats->kobj->kobj, "disk%u", _disk->idx);
+    if(_ret)
+    {
+        pr_err("stats:: can't add sysfs dir for disk %u: %d \n", _disk->idx, _ret);
+        kobject_put(&_disk->kobj);
+        return _ret;
+    }
+
+    stats->disk_kobjs[stats->disks_count] = _disk;
+    ++stats->disks_count;
+
+    return 0;
+}
+
+int sbdd_stats_rename_disk(struct sbdd_stats* stats, u32 idx, const char* disk_name)
+{
+    if(!stats->registered || idx >= stats->disks_count)
+        return -EINVAL;
+
+    strscpy(stats->disk_kobjs[idx]->name, disk_name, DISK_NAME_LEN);
+
+    return 0;
+}
+
+void sbdd_stats_reset(struct sbdd_stats* stats)
+{
+    int _cpu = 0;
+    u32 _idx = 0;
+
+    for_each_possible_cpu(_cpu)
+    {
+        memset(per_cpu_ptr(stats->array, _cpu), 0, sizeof(struct sbdd_stats_array));
+
+        for(_idx = 0; _idx < stats->disks_max; ++_idx)
+        {
+            if(stats->disks[_idx])
+                memset(per_cpu_ptr(stats->disks[_idx], _cpu), 0, sizeof(struct sbdd_stats_disk));
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef _SBDD_STATS_H_
+#define _SBDD_STATS_H_
+
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/blkdev.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/kobject.h>
+
+/* log2 buckets of ~1us units: bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us */
+#define SBDD_STATS_HIST_BUCKETS 24
+#define SBDD_STATS_HIST_SHIFT   10
+
+#define SBDD_STATS_READ         0
+#define SBDD_STATS_WRITE        1
+#define SBDD_STATS_DIRS         2
+
+struct sbdd_stats_array {
+	u64 bios[SBDD_STATS_DIRS];
+	u64 sectors[SBDD_STATS_DIRS];
+	u64 splits[SBDD_STATS_DIRS];
+	u64 errors[SBDD_STATS_DIRS];
+	/* blocks read from the ram read cache and read past it */
+	u64 read_cache_hits;
+	u64 read_cache_misses;
+	/* time spent in the io worker queue */
+	u64 queue_hist[SBDD_STATS_HIST_BUCKETS];
+};
+
+struct sbdd_stats_disk {
+	u64 bios[SBDD_STATS_DIRS];
+	u64 sectors[SBDD_STATS_DIRS];
+	u64 errors[SBDD_STATS_DIRS];
+	/* member service time */
+	u64 service_hist[SBDD_STATS_DIRS][SBDD_STATS_HIST_BUCKETS];
+};
+
+struct sbdd_stats;
+
+/* sysfs dirs are allocated on their own, a kobject may outlive the array it shows */
+struct sbdd_stats_kobj {
+	struct kobject              kobj;
+	struct sbdd_stats*          stats;
+};
+
+struct sbdd_stats_disk_kobj {
+	struct kobject              kobj;
+	struct sbdd_stats*          stats;
+	u32                         idx;
+	char                        name[DISK_NAME_LEN];
+};
+
+struct sbdd_stats {
+	struct sbdd_stats_array __percpu*   array;
+	/* disks_max slots, counters of a member are a percpu block of their own */
+	struct sbdd_stats_disk __percpu**   disks;
+	u32                                 disks_count;
+	u32                                 disks_max;
+	/* member completions and latencies are collected */
+	int                                 tracking;
+	bool                                registered;
+	struct sbdd_stats_kobj*             kobj;
+	struct sbdd_stats_disk_kobj**       disk_kobjs;
+};
+
+/* Members may be added up to disks_max */
+int sbdd_stats_create(struct sbdd_stats* stats, u32 disks_count, u32 disks_max);
+void sbdd_stats_destroy(struct sbdd_stats* stats);
+
+/* Exports the stats under /sys/block/<disk>/sbdd/ */
+int sbdd_stats_register(struct sbdd_stats* stats, struct gendisk* gd, const char* const* disk_names);
+void sbdd_stats_unregister(struct sbdd_stats* stats);
+/* Counters of the member to be added next, before its ios may come */
+int sbdd_stats_reserve_disk(struct sbdd_stats* stats);
+/* Exports a member added to the array */
+int sbdd_stats_add_disk(struct sbdd_stats* stats, const char* disk_name);
+/* A member got a new disk, its counters go on */
+int sbdd_stats_rename_disk(struct sbdd_stats* stats, u32 idx, const char* disk_name);
+
+void sbdd_stats_reset(struct sbdd_stats* stats);
+
+static inline int sbdd_stats_dir(struct bio* bio)
+{
+	return op_is_write(bio_op(bio)) ? SBDD_STATS_WRITE : SBDD_STATS_READ;
+}
+
+static inline u32 sbdd_stats_bucket(u64 ns)
+{
+	return min_t(u32, fls64(ns >> SBDD_STATS_HIST_SHIFT), SBDD_STATS_HIST_BUCKETS - 1);
+}
+
+static inline void sbdd_stats_account(struct sbdd_stats* stats, int dir, u32 sectors)
+{
+	this_cpu_inc(stats->array->bios[dir]);
+	this_cpu_add(stats->array->sectors[dir], sectors);
+}
+
+static inline void sbdd_stats_split(struct sbdd_stats* stats, int dir)
+{
+	this_cpu_inc(stats->array->splits[dir]);
+}
+
+static inline void sbdd_stats_read_cache(struct sbdd_stats* stats, bool hit, u32 blocks)
+{
+	if (hit)
+		this_cpu_add(stats->array->read_cache_hits, blocks);
+	else
+		this_cpu_add(stats->array->read_cache_misses, blocks);
+}
+
+static inline void sbdd_stats_queue_wait(struct sbdd_stats* stats, u64 ns)
+{
+	this_cpu_inc(stats->array->queue_hist[sbdd_stats_bucket(ns)]);
+}
+
+static inline void sbdd_stats_disk_submit(struct sbdd_stats* stats, u32 disk, int dir, u32 sectors)
+{
+	this_cpu_inc(stats->disks[disk]->bios[dir]);
+	this_cpu_add(stats->disks[disk]->sectors[dir], sectors);
+}
+
+/* Errors are counted whether completions are tracked or not */
+static inline void sbdd_stats_disk_error(struct sbdd_stats* stats, u32 disk, int dir)
+{
+	this_cpu_inc(stats->disks[disk]->errors[dir]);
+	this_cpu_inc(stats->array->errors[dir]);
+}
+
+static inline void sbdd_stats_disk_complete(struct sbdd_stats* stats, u32 disk, int dir, u64 ns)
+{
+	this_cpu_inc(stats->disks[disk]->service_hist[dir][sbdd_stats_bucket(ns)]);
+}
+
+#endif